@@ -46,10 +46,45 @@
 #include <thread>
 #include <vector>
 
+#include <zlib.h>
+
 using namespace android;
 
 std::atomic_bool Replayer::sReplayingManually(false);
 
+// Traces written with debug.sf.interceptor_compress are a sequence of gzip
+// members, one per chunk written by SurfaceInterceptor
+static bool isCompressed(const std::string& input) {
+    return input.size() >= 2 && static_cast<uint8_t>(input[0]) == 0x1f &&
+            static_cast<uint8_t>(input[1]) == 0x8b;
+}
+
+static bool decompress(const std::string& input, std::string* output) {
+    z_stream stream {};
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+        return false;
+    }
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = input.size();
+    char buffer[64 * 1024];
+    int result = Z_OK;
+    while (result == Z_OK || result == Z_STREAM_END) {
+        if (result == Z_STREAM_END) {
+            if (stream.avail_in == 0) {
+                break;
+            }
+            // Move on to the next member
+            inflateReset(&stream);
+        }
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        result = inflate(&stream, Z_NO_FLUSH);
+        output->append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
 Replayer::Replayer(const std::string& filename, bool replayManually, int numThreads, bool wait,
         nsecs_t stopHere)
       : mTrace(),
@@ -67,6 +102,15 @@ Replayer::Replayer(const std::string& filename, bool replayManually, int numThre
         abort();
     }
 
+    if (isCompressed(input)) {
+        std::string decompressed;
+        if (!decompress(input, &decompressed)) {
+            std::cerr << "Trace could not be decompressed." << std::endl;
+            abort();
+        }
+        input.swap(decompressed);
+    }
+
     mLoaded = mTrace.ParseFromString(input);
     if (!mLoaded) {
         std::cerr << "Trace did not load." << std::endl;
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBINPUT_INPUT_MESSAGE_RING_H
+#define _LIBINPUT_INPUT_MESSAGE_RING_H
+
+#include <input/InputTransport.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+
+namespace android {
+
+/*
+ * A single producer, single consumer ring of input messages in shared memory.
+ *
+ * An InputPublisher can move its events to a ring to avoid copying each of them
+ * through the input channel's socket.  The publisher creates the ring and sends
+ * its fd to the consumer over the channel, which then only carries doorbells:
+ * the consumer marks the ring as waiting before it goes idle, and the publisher
+ * sends a doorbell message after pushing to a waiting ring so that the channel's
+ * fd becomes readable.  A consumer that keeps up drains the ring without any
+ * system call.
+ *
+ * Each side keeps its own copy of its index and only reads the other side's
+ * index from the shared memory, checking it for consistency, so that a broken
+ * peer cannot make it access memory outside of the ring.
+ */
+class InputMessageRing : public RefBase {
+protected:
+    virtual ~InputMessageRing();
+
+public:
+    enum {
+        MAX_CAPACITY = 256,
+    };
+
+    /* Creates a ring of at least capacity messages in new shared memory.
+     *
+     * Returns NULL if the shared memory could not be created.
+     */
+    static sp<InputMessageRing> create(const String8& name, uint32_t capacity);
+
+    /* Maps a ring created by the peer with the given capacity, taking ownership of fd.
+     *
+     * Returns NULL if fd does not refer to a ring of that capacity.
+     */
+    static sp<InputMessageRing> map(int fd, uint32_t capacity);
+
+    inline int getFd() const { return mFd; }
+    inline uint32_t getCapacity() const { return mCapacity; }
+
+    /* Publisher side.
+     *
+     * Pushes a message to the ring.
+     *
+     * Returns OK on success.
+     * Returns WOULD_BLOCK if the ring is full.
+     */
+    status_t sendMessage(const InputMessage* msg);
+
+    /* Publisher side.
+     *
+     * Returns true if the consumer was waiting for messages, in which case the
+     * caller must wake it up.  Only the first call after the consumer started
+     * waiting returns true.
+     */
+    bool takeWaitingConsumer();
+
+    /* Consumer side.
+     *
+     * Pops up to count messages from the ring, in order.  The number of messages
+     * popped is returned in *outReceived.
+     *
+     * Returns OK if at least one message was popped.
+     * Returns WOULD_BLOCK if the ring is empty.
+     * Returns BAD_VALUE if the ring holds an invalid message or is inconsistent;
+     * the messages popped before it are still returned.
+     */
+    status_t receiveMessages(InputMessage* msgs, size_t count, size_t* outReceived);
+
+    /* Consumer side.
+     *
+     * Marks the consumer as waiting, so that the publisher wakes it up when it
+     * pushes the next message.
+     *
+     * Returns false if messages were pushed in the meantime, in which case the
+     * consumer should pop them instead of waiting.
+     */
+    bool prepareToWait();
+
+    /* Consumer side.
+     *
+     * Returns true if there are no messages to pop.
+     */
+    bool isEmpty() const;
+
+private:
+    struct Header;
+
+    InputMessageRing(int fd, void* data, size_t size, uint32_t capacity);
+
+    static size_t getSize(uint32_t capacity);
+
+    const int mFd;
+    void* const mData;
+    const size_t mSize;
+    const uint32_t mCapacity;
+
+    Header* const mHeader;
+    InputMessage* const mSlots;
+
+    // The index of the next message to push, only used by the publisher.
+    uint64_t mWriteIndex;
+
+    // The index of the next message to pop, only used by the consumer.
+    uint64_t mReadIndex;
+};
+
+} // namespace android
+
+#endif // _LIBINPUT_INPUT_MESSAGE_RING_H
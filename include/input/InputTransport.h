@@ -37,6 +37,8 @@
 
 namespace android {
 
+class InputMessageRing;
+
 /*
  * Intermediate representation used to send input events and related signals.
  *
@@ -48,6 +50,9 @@ struct InputMessage {
         TYPE_KEY = 1,
         TYPE_MOTION = 2,
         TYPE_FINISHED = 3,
+        // Transport messages, handled by InputConsumer itself.
+        TYPE_RING_SETUP = 4,
+        TYPE_DOORBELL = 5,
     };
 
     struct Header {
@@ -123,6 +128,17 @@ struct InputMessage {
                 return sizeof(Finished);
             }
         } finished;
+
+        // Sent with the fd of an InputMessageRing attached.  fd is only meaningful
+        // in the receiving process, where it is set when the message is received.
+        struct Ring {
+            uint32_t capacity;
+            int32_t fd;
+
+            inline size_t size() const {
+                return sizeof(Ring);
+            }
+        } ring;
     } __attribute__((aligned(8))) body;
 
     bool isValid(size_t actualSize) const;
@@ -179,6 +195,42 @@ public:
      */
     status_t receiveMessage(InputMessage* msg);
 
+    /* Sends count messages to the other endpoint, in order, using as few system
+     * calls as possible.
+     *
+     * Each message is sent atomically, as by sendMessage.  The number of messages
+     * that were sent is returned in *outSent; the others were not sent at all.
+     *
+     * Returns OK if all the messages were sent.
+     * Returns WOULD_BLOCK if the channel became full before all the messages were sent.
+     * Returns DEAD_OBJECT if the channel's peer has been closed.
+     * Other errors probably indicate that the channel is broken.
+     */
+    status_t sendMessages(const InputMessage* msgs, size_t count, size_t* outSent);
+
+    /* Sends a message to the other endpoint along with a duplicate of fd.
+     *
+     * Only TYPE_RING_SETUP messages carry an fd, receiveMessages stores it in the
+     * message's body.
+     *
+     * Returns the same errors as sendMessage.
+     */
+    status_t sendMessageWithFd(const InputMessage* msg, int fd);
+
+    /* Receives up to count messages sent by the other endpoint, in order, with a
+     * single system call.
+     *
+     * The number of messages received is returned in *outReceived.
+     *
+     * Returns OK if at least one message was received.
+     * Returns WOULD_BLOCK if there is no message present.
+     * Returns DEAD_OBJECT if the channel's peer has been closed.
+     * Returns BAD_VALUE if an invalid message was received; the messages received
+     * before it are still returned.
+     * Other errors probably indicate that the channel is broken.
+     */
+    status_t receiveMessages(InputMessage* msgs, size_t count, size_t* outReceived);
+
     /* Returns a new object that has a duplicate of this channel's fd. */
     sp<InputChannel> dup() const;
 
@@ -264,8 +316,54 @@ public:
      */
     status_t receiveFinishedSignal(uint32_t* outSeq, bool* outHandled);
 
+    /* Starts queuing the events that are published instead of sending them right
+     * away, so that they can be sent together by endBatch().
+     *
+     * While a batch is open the publish methods still validate their arguments and
+     * return BAD_VALUE, but otherwise return OK once the event is queued.
+     */
+    void beginBatch();
+
+    /* Sends the events queued since beginBatch(), in order, and stops queuing.
+     *
+     * The number of events that were published is returned in *outPublished.
+     * The others were not sent and are dropped from the batch, so they need to
+     * be published again later.
+     *
+     * Returns OK if all the events were published.
+     * Otherwise returns the same errors as publishKeyEvent and publishMotionEvent.
+     */
+    status_t endBatch(size_t* outPublished);
+
+    /* Moves the events published from now on to a ring of at least capacity
+     * messages in memory shared with the consumer, instead of the channel's socket.
+     * The ring is sent to the consumer over the channel, which is then only used to
+     * wake the consumer up when it is waiting for events.
+     *
+     * Returns OK on success.
+     * Returns INVALID_OPERATION if the events already go through a ring.
+     * Returns NO_MEMORY if the ring could not be created.
+     * Otherwise returns the same errors as publishKeyEvent.
+     */
+    status_t enableMessageRing(uint32_t capacity);
+
+    /* Returns true if the events go through a message ring. */
+    inline bool isMessageRingEnabled() const { return mRing != NULL; }
+
 private:
     sp<InputChannel> mChannel;
+
+    // The ring the events go through, or NULL if they go through the channel.
+    sp<InputMessageRing> mRing;
+
+    // True between beginBatch() and endBatch().
+    bool mBatching;
+
+    // The messages queued since beginBatch().
+    Vector<InputMessage> mBatch;
+
+    status_t publishMessage(const InputMessage& msg);
+    status_t wakeConsumer();
 };
 
 /*
@@ -363,6 +461,22 @@ private:
     // call to consume and that still needs to be handled.
     bool mMsgDeferred;
 
+    // Messages read from the input channel in one go that have not been handled yet.
+    // mReceivedMessages[mReceivedIndex] to mReceivedMessages[mReceivedCount - 1]
+    // are still pending.
+    Vector<InputMessage> mReceivedMessages;
+    size_t mReceivedIndex;
+    size_t mReceivedCount;
+
+    // The error that stopped a read after some messages.  It is returned once those
+    // messages have been handled, and from then on, since the messages that came
+    // after it are lost.
+    status_t mReceiveError;
+
+    // The ring the publisher moved its events to, or NULL if they come through the
+    // channel.
+    sp<InputMessageRing> mRing;
+
     // Batched motion events per device and source.
     struct Batch {
         Vector<InputMessage> samples;
@@ -483,6 +597,10 @@ private:
     ssize_t findBatch(int32_t deviceId, int32_t source) const;
     ssize_t findTouchState(int32_t deviceId, int32_t source) const;
 
+    status_t receiveNextMessage(InputMessage* msg);
+    status_t receiveMessages();
+    status_t handleRingSetup(const InputMessage& msg);
+    status_t deferReceiveError(status_t result);
     status_t sendUnchainedFinishedSignal(uint32_t seq, bool handled);
 
     static void rewriteMessage(TouchState& state, InputMessage& msg);
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UI_PRIVATE_REGION_SIMD_H
+#define ANDROID_UI_PRIVATE_REGION_SIMD_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <limits>
+
+#include <ui/Rect.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define REGION_SIMD_NEON
+#define REGION_SIMD
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define REGION_SIMD_SSE
+#define REGION_SIMD
+#endif
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * Span kernels used by Region's boolean operations.
+ *
+ * A Rect is four consecutive int32_t (left, top, right, bottom), so one rect
+ * fits exactly in a 128-bit vector register. Each kernel has a NEON and an
+ * SSE4.1 implementation and a scalar fallback producing identical results.
+ */
+namespace region_simd {
+
+static_assert(sizeof(Rect) == 4 * sizeof(int32_t), "Rect must be 4 packed int32_t");
+
+#if defined(REGION_SIMD_NEON)
+
+typedef int32x4_t vec_t;
+
+static inline vec_t load(const Rect& r) { return vld1q_s32(&r.left); }
+static inline void store(Rect& r, vec_t v) { vst1q_s32(&r.left, v); }
+static inline vec_t make(int32_t a, int32_t b, int32_t c, int32_t d) {
+    const int32_t v[4] = { a, b, c, d };
+    return vld1q_s32(v);
+}
+static inline vec_t add(vec_t a, vec_t b) { return vaddq_s32(a, b); }
+static inline vec_t min(vec_t a, vec_t b) { return vminq_s32(a, b); }
+static inline vec_t max(vec_t a, vec_t b) { return vmaxq_s32(a, b); }
+// true when lane 0 (left) and lane 2 (right) of a and b are equal
+static inline bool sameHorizontalEdges(vec_t a, vec_t b) {
+    const uint32x4_t eq = vceqq_s32(a, b);
+    return (vgetq_lane_u32(eq, 0) & vgetq_lane_u32(eq, 2)) != 0;
+}
+
+#elif defined(REGION_SIMD_SSE)
+
+typedef __m128i vec_t;
+
+static inline vec_t load(const Rect& r) {
+    vec_t v;
+    memcpy(&v, &r.left, sizeof(v));
+    return v;
+}
+static inline void store(Rect& r, vec_t v) { memcpy(&r.left, &v, sizeof(v)); }
+static inline vec_t make(int32_t a, int32_t b, int32_t c, int32_t d) {
+    return _mm_setr_epi32(a, b, c, d);
+}
+static inline vec_t add(vec_t a, vec_t b) { return _mm_add_epi32(a, b); }
+static inline vec_t min(vec_t a, vec_t b) { return _mm_min_epi32(a, b); }
+static inline vec_t max(vec_t a, vec_t b) { return _mm_max_epi32(a, b); }
+static inline bool sameHorizontalEdges(vec_t a, vec_t b) {
+    const int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b)));
+    return (mask & 0x5) == 0x5;
+}
+
+#endif
+
+/*
+ * Returns true if the rects in a[] and b[] have the same left and right
+ * edges, pairwise. Used to coalesce a span with the one right above it.
+ */
+static inline bool spansHaveSameEdges(const Rect* a, const Rect* b, size_t count) {
+#ifdef REGION_SIMD
+    for (size_t i = 0; i < count; i++) {
+        if (!sameHorizontalEdges(load(a[i]), load(b[i]))) {
+            return false;
+        }
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        if ((a[i].left != b[i].left) || (a[i].right != b[i].right)) {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+/*
+ * Offsets count rects in place by (dx, dy).
+ */
+static inline void offsetRects(Rect* rects, size_t count, int32_t dx, int32_t dy) {
+#ifdef REGION_SIMD
+    const vec_t offset = make(dx, dy, dx, dy);
+    for (size_t i = 0; i < count; i++) {
+        store(rects[i], add(load(rects[i]), offset));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        rects[i].offsetBy(dx, dy);
+    }
+#endif
+}
+
+/*
+ * Intersects each of the count rects in src with clip and hands the
+ * non-empty results, in order, to the rasterizer.
+ */
+template<typename RASTERIZER>
+static inline void clipRects(const Rect* src, size_t count, const Rect& clip,
+        RASTERIZER& rasterizer) {
+#ifdef REGION_SIMD
+    const vec_t lo = make(clip.left, clip.top,
+            std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::min());
+    const vec_t hi = make(std::numeric_limits<int32_t>::max(),
+            std::numeric_limits<int32_t>::max(), clip.right, clip.bottom);
+    Rect clipped;
+    for (size_t i = 0; i < count; i++) {
+        store(clipped, min(max(load(src[i]), lo), hi));
+        if (clipped.left < clipped.right && clipped.top < clipped.bottom) {
+            rasterizer(clipped);
+        }
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        Rect clipped;
+        if (src[i].intersect(clip, &clipped)) {
+            rasterizer(clipped);
+        }
+    }
+#endif
+}
+
+}; // namespace region_simd
+
+// ----------------------------------------------------------------------------
+};
+
+#endif /* ANDROID_UI_PRIVATE_REGION_SIMD_H */
@@ -79,7 +79,7 @@ void BufferQueue::ProxyConsumerListener::addAndGetFrameTimestamps(
 
 void BufferQueue::createBufferQueue(sp<IGraphicBufferProducer>* outProducer,
         sp<IGraphicBufferConsumer>* outConsumer,
-        bool consumerIsSurfaceFlinger) {
+        bool consumerIsSurfaceFlinger, bool consumerReleasesLockFree) {
     LOG_ALWAYS_FATAL_IF(outProducer == NULL,
             "BufferQueue: outProducer must not be NULL");
     LOG_ALWAYS_FATAL_IF(outConsumer == NULL,
@@ -93,9 +93,10 @@ void BufferQueue::createBufferQueue(sp<IGraphicBufferProducer>* outProducer,
     LOG_ALWAYS_FATAL_IF(producer == NULL,
             "BufferQueue: failed to create BufferQueueProducer");
 
-    sp<IGraphicBufferConsumer> consumer(new BufferQueueConsumer(core));
+    sp<BufferQueueConsumer> consumer(new BufferQueueConsumer(core));
     LOG_ALWAYS_FATAL_IF(consumer == NULL,
             "BufferQueue: failed to create BufferQueueConsumer");
+    consumer->setLockFreeReleaseEnabled(consumerReleasesLockFree);
 
     *outProducer = producer;
     *outConsumer = consumer;
@@ -44,7 +44,8 @@ namespace android {
 BufferQueueConsumer::BufferQueueConsumer(const sp<BufferQueueCore>& core) :
     mCore(core),
     mSlots(core->mSlots),
-    mConsumerName() {}
+    mConsumerName(),
+    mLockFreeRelease(false) {}
 
 BufferQueueConsumer::~BufferQueueConsumer() {}
 
@@ -56,6 +57,7 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
     sp<IProducerListener> listener;
     {
         Mutex::Autolock lock(mCore->mMutex);
+        mCore->applyPendingReleasesLocked();
 
         // Check that the consumer doesn't currently have the maximum number of
         // buffers acquired. We allow the max buffer count to be exceeded by one
@@ -258,6 +260,17 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
 
         mCore->mQueue.erase(front);
 
+        if (mLockFreeRelease) {
+            LockFreeSlot& lockFree(mLockFreeSlots[slot]);
+            if (!outBuffer->mIsStale && !mSlots[slot].mBufferState.isShared()) {
+                lockFree.frameNumber = outBuffer->mFrameNumber;
+                lockFree.epoch = mCore->mSlotEpoch.load();
+                mLockFreeListener = mCore->mConnectedProducerListener;
+            } else {
+                lockFree.frameNumber = 0;
+            }
+        }
+
         // We might have freed a slot while dropping old buffers, or the producer
         // may be blocked waiting for the number of buffers in the queue to
         // decrease.
@@ -284,6 +297,7 @@ status_t BufferQueueConsumer::detachBuffer(int slot) {
     ATRACE_BUFFER_INDEX(slot);
     BQ_LOGV("detachBuffer: slot %d", slot);
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyPendingReleasesLocked();
 
     if (mCore->mIsAbandoned) {
         BQ_LOGE("detachBuffer: BufferQueue has been abandoned");
@@ -328,6 +342,7 @@ status_t BufferQueueConsumer::attachBuffer(int* outSlot,
     }
 
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyPendingReleasesLocked();
 
     if (mCore->mSharedBufferMode) {
         BQ_LOGE("attachBuffer: cannot attach a buffer in shared buffer mode");
@@ -417,46 +432,24 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
         return BAD_VALUE;
     }
 
+    status_t lockFreeResult;
+    if (mLockFreeRelease && releaseLockFree(slot, frameNumber, releaseFence,
+            eglDisplay, eglFence, &lockFreeResult)) {
+        return lockFreeResult;
+    }
+
     sp<IProducerListener> listener;
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
+        mCore->applyPendingReleasesLocked();
 
-        // If the frame number has changed because the buffer has been reallocated,
-        // we can ignore this releaseBuffer for the old buffer.
-        // Ignore this for the shared buffer where the frame number can easily
-        // get out of sync due to the buffer being queued and acquired at the
-        // same time.
-        if (frameNumber != mSlots[slot].mFrameNumber &&
-                !mSlots[slot].mBufferState.isShared()) {
-            return STALE_BUFFER_SLOT;
-        }
-
-        if (!mSlots[slot].mBufferState.isAcquired()) {
-            BQ_LOGE("releaseBuffer: attempted to release buffer slot %d "
-                    "but its state was %s", slot,
-                    mSlots[slot].mBufferState.string());
-            return BAD_VALUE;
-        }
-
-        mSlots[slot].mEglDisplay = eglDisplay;
-        mSlots[slot].mEglFence = eglFence;
-        mSlots[slot].mFence = releaseFence;
-        mSlots[slot].mBufferState.release();
-
-        // After leaving shared buffer mode, the shared buffer will
-        // still be around. Mark it as no longer shared if this
-        // operation causes it to be free.
-        if (!mCore->mSharedBufferMode && mSlots[slot].mBufferState.isFree()) {
-            mSlots[slot].mBufferState.mShared = false;
-        }
-        // Don't put the shared buffer on the free list.
-        if (!mSlots[slot].mBufferState.isShared()) {
-            mCore->mActiveBuffers.erase(slot);
-            mCore->mFreeBuffers.push_back(slot);
+        status_t result = mCore->releaseBufferLocked(slot, frameNumber,
+                releaseFence, eglDisplay, eglFence);
+        if (result != NO_ERROR) {
+            return result;
         }
 
         listener = mCore->mConnectedProducerListener;
-        BQ_LOGV("releaseBuffer: releasing slot %d", slot);
 
         mCore->mDequeueCondition.broadcast();
         VALIDATE_CONSISTENCY();
@@ -470,6 +463,55 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
     return NO_ERROR;
 }
 
+bool BufferQueueConsumer::releaseLockFree(int slot, uint64_t frameNumber,
+        const sp<Fence>& releaseFence, EGLDisplay eglDisplay,
+        EGLSyncKHR eglFence, status_t* outResult) {
+    LockFreeSlot& lockFree(mLockFreeSlots[slot]);
+    const uint32_t epoch = lockFree.epoch;
+    const bool canReleaseLockFree = lockFree.frameNumber != 0 &&
+            lockFree.frameNumber == frameNumber &&
+            epoch == mCore->mSlotEpoch.load();
+    lockFree.frameNumber = 0;
+    if (!canReleaseLockFree || !mCore->postPendingRelease(slot, frameNumber,
+            releaseFence, eglDisplay, eglFence)) {
+        return false;
+    }
+
+    BQ_LOGV("releaseBuffer: releasing slot %d without locking", slot);
+    *outResult = NO_ERROR;
+
+    // If an acquired slot was cleared while the release was being posted,
+    // the release may have come after the slot was cleared, and then it is
+    // dropped. Apply it under the lock to find out, so that the stale slot
+    // is reported like by a locked release. A producer may also be waiting
+    // for this buffer, it has to be woken up with the lock held.
+    sp<IProducerListener> listener(mLockFreeListener);
+    if (mCore->mSlotEpoch.load() != epoch || mCore->mReleaseWaiters.load() > 0) {
+        Mutex::Autolock lock(mCore->mMutex);
+        mCore->applyPendingReleasesLocked();
+        if (mCore->takeStaleReleaseLocked(slot)) {
+            *outResult = STALE_BUFFER_SLOT;
+            return true;
+        }
+        listener = mCore->mConnectedProducerListener;
+    }
+
+    if (listener != NULL) {
+        listener->onBufferReleased();
+    }
+    return true;
+}
+
+void BufferQueueConsumer::setLockFreeReleaseEnabled(bool enabled) {
+    mLockFreeRelease = enabled;
+    if (!enabled) {
+        for (LockFreeSlot& lockFree : mLockFreeSlots) {
+            lockFree.frameNumber = 0;
+        }
+        mLockFreeListener.clear();
+    }
+}
+
 status_t BufferQueueConsumer::connect(
         const sp<IConsumerListener>& consumerListener, bool controlledByApp) {
     ATRACE_CALL();
@@ -501,6 +543,7 @@ status_t BufferQueueConsumer::disconnect() {
     BQ_LOGV("disconnect");
 
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyPendingReleasesLocked();
 
     if (mCore->mConsumerListener == NULL) {
         BQ_LOGE("disconnect: no consumer is connected");
@@ -525,6 +568,7 @@ status_t BufferQueueConsumer::getReleasedBuffers(uint64_t *outSlotMask) {
     }
 
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyPendingReleasesLocked();
 
     if (mCore->mIsAbandoned) {
         BQ_LOGE("getReleasedBuffers: BufferQueue has been abandoned");
@@ -581,6 +625,7 @@ status_t BufferQueueConsumer::setMaxBufferCount(int bufferCount) {
     }
 
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyPendingReleasesLocked();
 
     if (mCore->mConnectedApi != BufferQueueCore::NO_CONNECTED_API) {
         BQ_LOGE("setMaxBufferCount: producer is already connected");
@@ -621,6 +666,7 @@ status_t BufferQueueConsumer::setMaxAcquiredBufferCount(
     sp<IConsumerListener> listener;
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
+        mCore->applyPendingReleasesLocked();
         mCore->waitWhileAllocatingLocked();
 
         if (mCore->mIsAbandoned) {
@@ -743,6 +789,7 @@ status_t BufferQueueConsumer::getOccupancyHistory(bool forceFlush,
 
 status_t BufferQueueConsumer::discardFreeBuffers() {
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyPendingReleasesLocked();
     mCore->discardFreeBuffersLocked();
     return NO_ERROR;
 }
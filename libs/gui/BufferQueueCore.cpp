@@ -34,6 +34,7 @@
 #include <gui/BufferItem.h>
 #include <gui/BufferQueueCore.h>
 #include <gui/IConsumerListener.h>
+#include <gui/IGraphicBufferConsumer.h>
 #include <gui/IProducerListener.h>
 #include <gui/ISurfaceComposer.h>
 #include <private/gui/ComposerService.h>
@@ -95,7 +96,12 @@ BufferQueueCore::BufferQueueCore() :
     mSharedBufferCache(Rect::INVALID_RECT, 0, NATIVE_WINDOW_SCALING_MODE_FREEZE,
             HAL_DATASPACE_UNKNOWN),
     mLastQueuedSlot(INVALID_BUFFER_SLOT),
-    mUniqueId(getUniqueId())
+    mUniqueId(getUniqueId()),
+    mPendingReleaseHead(0),
+    mPendingReleaseTail(0),
+    mReleaseWaiters(0),
+    mSlotEpoch(0),
+    mStaleReleases(0)
 {
     int numStartingBuffers = getMaxBufferCountLocked();
     for (int s = 0; s < numStartingBuffers; s++) {
@@ -204,6 +210,25 @@ int BufferQueueCore::getMaxBufferCountLocked() const {
 void BufferQueueCore::clearBufferSlotLocked(int slot) {
     BQ_LOGV("clearBufferSlotLocked: slot %d", slot);
 
+    if (mSlots[slot].mBufferState.isAcquired()) {
+        ++mSlotEpoch;
+
+        // A release of this buffer posted before the epoch changed came
+        // first, so the consumer was told it succeeded. The clear frees the
+        // slot in its place. Releases posted later aren't seen here, and the
+        // consumer checks the epoch again after posting to catch them, see
+        // BufferQueueConsumer::releaseLockFree.
+        const uint32_t tail = mPendingReleaseTail.load(std::memory_order_seq_cst);
+        for (uint32_t i = mPendingReleaseHead.load(std::memory_order_relaxed);
+                i != tail; ++i) {
+            PendingRelease& release(
+                    mPendingReleases[i % BufferQueueDefs::NUM_BUFFER_SLOTS]);
+            if (release.slot == slot) {
+                release.slot = INVALID_BUFFER_SLOT;
+            }
+        }
+    }
+
     mSlots[slot].mGraphicBuffer.clear();
     mSlots[slot].mBufferState.reset();
     mSlots[slot].mRequestBufferCalled = false;
@@ -256,6 +281,8 @@ void BufferQueueCore::freeAllBuffersLocked() {
 }
 
 void BufferQueueCore::discardFreeBuffersLocked() {
+    applyPendingReleasesLocked();
+
     for (int s : mFreeBuffers) {
         mFreeSlots.insert(s);
         clearBufferSlotLocked(s);
@@ -266,6 +293,9 @@ void BufferQueueCore::discardFreeBuffersLocked() {
 }
 
 bool BufferQueueCore::adjustAvailableSlotsLocked(int delta) {
+    // Released buffers can be freed to make up for the delta
+    applyPendingReleasesLocked();
+
     if (delta >= 0) {
         // If we're going to fail, do so before modifying anything
         if (delta > static_cast<int>(mUnusedSlots.size())) {
@@ -313,6 +343,124 @@ void BufferQueueCore::waitWhileAllocatingLocked() const {
     }
 }
 
+status_t BufferQueueCore::releaseBufferLocked(int slot, uint64_t frameNumber,
+        const sp<Fence>& releaseFence, EGLDisplay eglDisplay,
+        EGLSyncKHR eglFence) {
+    // If the frame number has changed because the buffer has been reallocated,
+    // we can ignore this releaseBuffer for the old buffer.
+    // Ignore this for the shared buffer where the frame number can easily
+    // get out of sync due to the buffer being queued and acquired at the
+    // same time.
+    if (frameNumber != mSlots[slot].mFrameNumber &&
+            !mSlots[slot].mBufferState.isShared()) {
+        return IGraphicBufferConsumer::STALE_BUFFER_SLOT;
+    }
+
+    if (!mSlots[slot].mBufferState.isAcquired()) {
+        BQ_LOGE("releaseBuffer: attempted to release buffer slot %d "
+                "but its state was %s", slot,
+                mSlots[slot].mBufferState.string());
+        return BAD_VALUE;
+    }
+
+    mSlots[slot].mEglDisplay = eglDisplay;
+    mSlots[slot].mEglFence = eglFence;
+    mSlots[slot].mFence = releaseFence;
+    mSlots[slot].mBufferState.release();
+
+    // After leaving shared buffer mode, the shared buffer will
+    // still be around. Mark it as no longer shared if this
+    // operation causes it to be free.
+    if (!mSharedBufferMode && mSlots[slot].mBufferState.isFree()) {
+        mSlots[slot].mBufferState.mShared = false;
+    }
+    // Don't put the shared buffer on the free list.
+    if (!mSlots[slot].mBufferState.isShared()) {
+        mActiveBuffers.erase(slot);
+        mFreeBuffers.push_back(slot);
+    }
+
+    BQ_LOGV("releaseBuffer: releasing slot %d", slot);
+    return NO_ERROR;
+}
+
+bool BufferQueueCore::postPendingRelease(int slot, uint64_t frameNumber,
+        const sp<Fence>& releaseFence, EGLDisplay eglDisplay,
+        EGLSyncKHR eglFence) {
+    static_assert((BufferQueueDefs::NUM_BUFFER_SLOTS &
+            (BufferQueueDefs::NUM_BUFFER_SLOTS - 1)) == 0,
+            "NUM_BUFFER_SLOTS must be a power of two");
+
+    const uint32_t tail = mPendingReleaseTail.load(std::memory_order_relaxed);
+    const uint32_t head = mPendingReleaseHead.load(std::memory_order_acquire);
+    if (tail - head >= BufferQueueDefs::NUM_BUFFER_SLOTS) {
+        return false;
+    }
+
+    PendingRelease& release(
+            mPendingReleases[tail % BufferQueueDefs::NUM_BUFFER_SLOTS]);
+    release.slot = slot;
+    release.frameNumber = frameNumber;
+    release.fence = releaseFence;
+    release.eglDisplay = eglDisplay;
+    release.eglFence = eglFence;
+
+    // This store must be ordered before the caller reads mReleaseWaiters, see
+    // BufferQueueProducer::waitForFreeSlotThenRelock
+    mPendingReleaseTail.store(tail + 1, std::memory_order_seq_cst);
+    return true;
+}
+
+void BufferQueueCore::applyPendingReleasesLocked() {
+    uint32_t head = mPendingReleaseHead.load(std::memory_order_relaxed);
+    const uint32_t tail = mPendingReleaseTail.load(std::memory_order_acquire);
+    if (head == tail) {
+        return;
+    }
+
+    ATRACE_CALL();
+    for (; head != tail; ++head) {
+        PendingRelease& release(
+                mPendingReleases[head % BufferQueueDefs::NUM_BUFFER_SLOTS]);
+        // Releases superseded by clearing their slot have no slot anymore
+        status_t result = IGraphicBufferConsumer::STALE_BUFFER_SLOT;
+        if (release.slot != INVALID_BUFFER_SLOT) {
+            result = releaseBufferLocked(release.slot, release.frameNumber,
+                    release.fence, release.eglDisplay, release.eglFence);
+            if (result != NO_ERROR) {
+                // The slot was cleared before the release was posted. The
+                // consumer noticed the new epoch and collects this with
+                // takeStaleReleaseLocked.
+                BQ_LOGV("applyPendingReleasesLocked: stale release of slot %d "
+                        "(%d)", release.slot, result);
+                mStaleReleases |= 1ULL << release.slot;
+            }
+        }
+        if (result != NO_ERROR) {
+            if (release.eglFence != EGL_NO_SYNC_KHR) {
+                eglDestroySyncKHR(release.eglDisplay, release.eglFence);
+            }
+        }
+        release.fence.clear();
+    }
+    mPendingReleaseHead.store(head, std::memory_order_release);
+
+    mDequeueCondition.broadcast();
+    VALIDATE_CONSISTENCY();
+}
+
+bool BufferQueueCore::takeStaleReleaseLocked(int slot) {
+    const uint64_t mask = 1ULL << slot;
+    const bool stale = (mStaleReleases & mask) != 0;
+    mStaleReleases &= ~mask;
+    return stale;
+}
+
+bool BufferQueueCore::hasPendingReleases() const {
+    return mPendingReleaseHead.load(std::memory_order_relaxed) !=
+            mPendingReleaseTail.load(std::memory_order_seq_cst);
+}
+
 #if DEBUG_ONLY_CODE
 void BufferQueueCore::validateConsistencyLocked() const {
     static const useconds_t PAUSE_TIME = 0;
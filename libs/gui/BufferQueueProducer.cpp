@@ -101,6 +101,7 @@ status_t BufferQueueProducer::setMaxDequeuedBufferCount(
     sp<IConsumerListener> listener;
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
+        mCore->applyPendingReleasesLocked();
         mCore->waitWhileAllocatingLocked();
 
         if (mCore->mIsAbandoned) {
@@ -180,6 +181,7 @@ status_t BufferQueueProducer::setAsyncMode(bool async) {
     sp<IConsumerListener> listener;
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
+        mCore->applyPendingReleasesLocked();
         mCore->waitWhileAllocatingLocked();
 
         if (mCore->mIsAbandoned) {
@@ -256,6 +258,8 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(FreeSlotCaller caller,
             return NO_INIT;
         }
 
+        mCore->applyPendingReleasesLocked();
+
         int dequeuedCount = 0;
         int acquiredCount = 0;
         for (int s : mCore->mActiveBuffers) {
@@ -332,14 +336,23 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(FreeSlotCaller caller,
                     (acquiredCount <= mCore->mMaxAcquiredBufferCount)) {
                 return WOULD_BLOCK;
             }
-            if (mDequeueTimeout >= 0) {
-                status_t result = mCore->mDequeueCondition.waitRelative(
-                        mCore->mMutex, mDequeueTimeout);
-                if (result == TIMED_OUT) {
-                    return result;
+
+            // A consumer releasing a buffer without the lock only wakes us up
+            // if it sees mReleaseWaiters set, so check for releases posted
+            // before that one last time before waiting.
+            ++mCore->mReleaseWaiters;
+            status_t result = NO_ERROR;
+            if (!mCore->hasPendingReleases()) {
+                if (mDequeueTimeout >= 0) {
+                    result = mCore->mDequeueCondition.waitRelative(
+                            mCore->mMutex, mDequeueTimeout);
+                } else {
+                    mCore->mDequeueCondition.wait(mCore->mMutex);
                 }
-            } else {
-                mCore->mDequeueCondition.wait(mCore->mMutex);
+            }
+            --mCore->mReleaseWaiters;
+            if (result == TIMED_OUT) {
+                return result;
             }
         }
     } // while (tryAgain)
@@ -635,6 +648,7 @@ status_t BufferQueueProducer::detachNextBuffer(sp<GraphicBuffer>* outBuffer,
     sp<IConsumerListener> listener;
     {
         Mutex::Autolock lock(mCore->mMutex);
+        mCore->applyPendingReleasesLocked();
 
         if (mCore->mIsAbandoned) {
             BQ_LOGE("detachNextBuffer: BufferQueue has been abandoned");
@@ -1226,6 +1240,7 @@ status_t BufferQueueProducer::disconnect(int api, DisconnectMode mode) {
     sp<IConsumerListener> listener;
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
+        mCore->applyPendingReleasesLocked();
 
         if (mode == DisconnectMode::AllLocal) {
             if (IPCThreadState::self()->getCallingPid() != mCore->mConnectedPid) {
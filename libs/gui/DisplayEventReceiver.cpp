@@ -25,6 +25,7 @@
 #include <private/gui/ComposerService.h>
 
 #include <private/gui/BitTube.h>
+#include <private/gui/VsyncTimeline.h>
 
 // ---------------------------------------------------------------------------
 
@@ -78,6 +79,41 @@ status_t DisplayEventReceiver::requestNextVsync() {
     return NO_INIT;
 }
 
+status_t DisplayEventReceiver::setVsyncPhase(uint32_t phase) {
+    if (mEventConnection != NULL) {
+        return mEventConnection->setVsyncPhase(phase);
+    }
+    return NO_INIT;
+}
+
+status_t DisplayEventReceiver::getNextVsync(nsecs_t time, nsecs_t* outTimestamp,
+        uint32_t* outCount, nsecs_t* outPeriod) {
+    if (mVsyncTimeline == NULL) {
+        if (mEventConnection == NULL)
+            return NO_INIT;
+
+        auto timeline = std::make_unique<gui::VsyncTimeline>();
+        status_t err = mEventConnection->getVsyncTimeline(timeline.get());
+        if (err == NO_ERROR) {
+            err = timeline->initCheck();
+        }
+        if (err != NO_ERROR) {
+            return err;
+        }
+        mVsyncTimeline = std::move(timeline);
+    }
+
+    gui::VsyncTimeline::Snapshot snapshot;
+    if (!mVsyncTimeline->read(&snapshot)) {
+        return NOT_ENOUGH_DATA;
+    }
+    *outTimestamp = snapshot.computeNextVsync(time, outCount);
+    if (outPeriod != NULL) {
+        *outPeriod = snapshot.period;
+    }
+    return NO_ERROR;
+}
+
 
 ssize_t DisplayEventReceiver::getEvents(DisplayEventReceiver::Event* events,
         size_t count) {
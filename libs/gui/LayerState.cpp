@@ -81,6 +81,58 @@ status_t layer_state_t::read(const Parcel& input)
     return NO_ERROR;
 }
 
+void layer_state_t::merge(const layer_state_t& other) {
+    if (other.what & ePositionChanged) {
+        x = other.x;
+        y = other.y;
+    }
+    if (other.what & eLayerChanged) {
+        z = other.z;
+        what &= ~eRelativeLayerChanged;
+        relativeLayerHandle = nullptr;
+    }
+    if (other.what & eRelativeLayerChanged) {
+        z = other.z;
+        what &= ~eLayerChanged;
+        relativeLayerHandle = other.relativeLayerHandle;
+    }
+    if (other.what & eSizeChanged) {
+        w = other.w;
+        h = other.h;
+    }
+    if (other.what & eAlphaChanged) {
+        alpha = other.alpha;
+    }
+    if (other.what & eMatrixChanged) {
+        matrix = other.matrix;
+    }
+    if (other.what & eTransparentRegionChanged) {
+        transparentRegion = other.transparentRegion;
+    }
+    if (other.what & eFlagsChanged) {
+        if (what & eFlagsChanged) {
+            flags = (flags & ~other.mask) | (other.flags & other.mask);
+            mask |= other.mask;
+        } else {
+            flags = other.flags;
+            mask = other.mask;
+        }
+    }
+    if (other.what & eLayerStackChanged) {
+        layerStack = other.layerStack;
+    }
+    if (other.what & eCropChanged) {
+        crop = other.crop;
+    }
+    if (other.what & eFinalCropChanged) {
+        finalCrop = other.finalCrop;
+    }
+    if (other.what & eOverrideScalingModeChanged) {
+        overrideScalingMode = other.overrideScalingMode;
+    }
+    what |= other.what;
+}
+
 status_t ComposerState::write(Parcel& output) const {
     output.writeStrongBinder(IInterface::asBinder(client));
     return state.write(output);
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <private/gui/VsyncTimeline.h>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cutils/ashmem.h>
+#include <log/log.h>
+
+#include <binder/Parcel.h>
+
+namespace android {
+namespace gui {
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "VsyncTimeline atomics must be lock-free to be shared between processes");
+
+nsecs_t VsyncTimeline::Snapshot::computeNextVsync(nsecs_t time, uint32_t* outCount) const {
+    uint32_t vsyncs = 0;
+    if (period > 0 && time >= timestamp) {
+        vsyncs = static_cast<uint32_t>((time - timestamp) / period + 1);
+    }
+    if (outCount != nullptr) {
+        *outCount = count + vsyncs;
+    }
+    return timestamp + vsyncs * period;
+}
+
+VsyncTimeline::VsyncTimeline(CreateType) {
+    mFd.reset(ashmem_create_region("VsyncTimeline", sizeof(Data)));
+    if (mFd < 0) {
+        ALOGE("VsyncTimeline: can't create shared memory region");
+        mFd.reset();
+        return;
+    }
+    if (map(PROT_READ | PROT_WRITE) != NO_ERROR) {
+        mFd.reset();
+        return;
+    }
+    // Mappings made from now on, i.e. by the clients, can only be read-only
+    if (ashmem_set_prot_region(mFd, PROT_READ) < 0) {
+        ALOGE("VsyncTimeline: can't make shared memory region read-only (%s)", strerror(errno));
+        munmap(mData, sizeof(Data));
+        mData = nullptr;
+        mFd.reset();
+    }
+}
+
+VsyncTimeline::~VsyncTimeline() {
+    if (mData != nullptr) {
+        munmap(mData, sizeof(Data));
+    }
+}
+
+status_t VsyncTimeline::map(int prot) {
+    void* data = mmap(nullptr, sizeof(Data), prot, MAP_SHARED, mFd, 0);
+    if (data == MAP_FAILED) {
+        int error = errno;
+        ALOGE("VsyncTimeline: can't map shared memory region (%s)", strerror(error));
+        return -error;
+    }
+    mData = static_cast<Data*>(data);
+    return NO_ERROR;
+}
+
+status_t VsyncTimeline::initCheck() const {
+    return mData != nullptr ? NO_ERROR : NO_INIT;
+}
+
+void VsyncTimeline::publish(uint32_t count, nsecs_t timestamp, nsecs_t period) {
+    if (mData == nullptr) {
+        return;
+    }
+    const uint32_t sequence = mData->sequence.load(std::memory_order_relaxed);
+    mData->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mData->count.store(count, std::memory_order_relaxed);
+    mData->timestamp.store(timestamp, std::memory_order_relaxed);
+    mData->period.store(period, std::memory_order_relaxed);
+    mData->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool VsyncTimeline::read(Snapshot* outSnapshot) const {
+    if (mData == nullptr) {
+        return false;
+    }
+    uint32_t sequence;
+    do {
+        sequence = mData->sequence.load(std::memory_order_acquire);
+        outSnapshot->count = mData->count.load(std::memory_order_relaxed);
+        outSnapshot->timestamp = mData->timestamp.load(std::memory_order_relaxed);
+        outSnapshot->period = mData->period.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) || sequence != mData->sequence.load(std::memory_order_relaxed));
+    return sequence != 0;
+}
+
+status_t VsyncTimeline::share(VsyncTimeline* other) const {
+    if (mFd < 0) {
+        return NO_INIT;
+    }
+    other->mFd.reset(dup(mFd));
+    return other->mFd < 0 ? -errno : NO_ERROR;
+}
+
+status_t VsyncTimeline::writeToParcel(Parcel* parcel) const {
+    if (mFd < 0) return -EINVAL;
+    return parcel->writeDupFileDescriptor(mFd);
+}
+
+status_t VsyncTimeline::readFromParcel(const Parcel* parcel) {
+    if (mData != nullptr) {
+        munmap(mData, sizeof(Data));
+        mData = nullptr;
+    }
+    mFd.reset(dup(parcel->readFileDescriptor()));
+    if (mFd < 0) {
+        mFd.reset();
+        int error = errno;
+        ALOGE("VsyncTimeline::readFromParcel: can't dup file descriptor (%s)", strerror(error));
+        return -error;
+    }
+    if (ashmem_get_size_region(mFd) < static_cast<int>(sizeof(Data))) {
+        ALOGE("VsyncTimeline::readFromParcel: shared memory region is too small");
+        mFd.reset();
+        return BAD_VALUE;
+    }
+    return map(PROT_READ);
+}
+
+} // namespace gui
+} // namespace android
@@ -75,9 +75,14 @@ public:
     // BufferQueue manages a pool of gralloc memory slots to be used by
     // producers and consumers. allocator is used to allocate all the
     // needed gralloc buffers.
+    // consumerReleasesLockFree enables the lock-free release path of the
+    // consumer, which is only safe for an in-process consumer that never
+    // calls acquireBuffer and releaseBuffer concurrently, see
+    // BufferQueueConsumer::setLockFreeReleaseEnabled.
     static void createBufferQueue(sp<IGraphicBufferProducer>* outProducer,
             sp<IGraphicBufferConsumer>* outConsumer,
-            bool consumerIsSurfaceFlinger = false);
+            bool consumerIsSurfaceFlinger = false,
+            bool consumerReleasesLockFree = false);
 
     BufferQueue() = delete; // Create through createBufferQueue
 };
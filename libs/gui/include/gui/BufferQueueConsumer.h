@@ -27,6 +27,7 @@
 namespace android {
 
 class BufferQueueCore;
+class IProducerListener;
 
 class BufferQueueConsumer : public BnGraphicBufferConsumer {
 
@@ -152,6 +153,14 @@ public:
     // dump our state in a String
     status_t dumpState(const String8& prefix, String8* outResult) const override;
 
+    // setLockFreeReleaseEnabled lets releaseBuffer hand buffers back to the
+    // producer without locking the BufferQueue. Such buffers are put back on
+    // the free lists the next time the BufferQueue is locked, e.g. by the
+    // producer's next dequeueBuffer. This is only valid if the caller
+    // serializes its calls to acquireBuffer and releaseBuffer, which is the
+    // case when a single thread consumes the buffers.
+    void setLockFreeReleaseEnabled(bool enabled);
+
     // Functions required for backwards compatibility.
     // These will be modified/renamed in IGraphicBufferConsumer and will be
     // removed from this class at that time. See b/13306289.
@@ -181,6 +190,31 @@ private:
     // It's updated during setConsumerName.
     String8 mConsumerName;
 
+    // releaseLockFree tries to release the buffer without locking
+    // mCore->mMutex. If it returns true, the buffer was released and
+    // outResult is what releaseBuffer returns, otherwise the buffer has to
+    // be released under mCore->mMutex.
+    bool releaseLockFree(int slot, uint64_t frameNumber,
+            const sp<Fence>& releaseFence, EGLDisplay eglDisplay,
+            EGLSyncKHR eglFence, status_t* outResult);
+
+    // The fields below are only accessed by acquireBuffer and releaseBuffer,
+    // which the consumer serializes when mLockFreeRelease is set.
+    bool mLockFreeRelease;
+
+    // Frame number and mCore->mSlotEpoch of the buffers acquired since
+    // mLockFreeRelease was set. A frame number of 0 means the buffer has to
+    // be released under mCore->mMutex.
+    struct LockFreeSlot {
+        uint64_t frameNumber = 0;
+        uint32_t epoch = 0;
+    };
+    LockFreeSlot mLockFreeSlots[BufferQueueDefs::NUM_BUFFER_SLOTS];
+
+    // The producer listener at the time of the last acquireBuffer. It can
+    // only change along with mCore->mSlotEpoch.
+    sp<IProducerListener> mLockFreeListener;
+
 }; // class BufferQueueConsumer
 
 } // namespace android
@@ -31,6 +31,7 @@
 #include <utils/Trace.h>
 #include <utils/Vector.h>
 
+#include <atomic>
 #include <list>
 #include <set>
 
@@ -135,6 +136,36 @@ private:
     // waitWhileAllocatingLocked blocks until mIsAllocating is false.
     void waitWhileAllocatingLocked() const;
 
+    // releaseBufferLocked hands an acquired buffer back to the free lists.
+    // It returns STALE_BUFFER_SLOT if the slot was reallocated since the
+    // buffer was acquired, and BAD_VALUE if the slot isn't acquired.
+    status_t releaseBufferLocked(int slot, uint64_t frameNumber,
+            const sp<Fence>& releaseFence, EGLDisplay eglDisplay,
+            EGLSyncKHR eglFence);
+
+    // postPendingRelease is used by BufferQueueConsumer to release a buffer
+    // without locking mMutex. The release is applied by the next call to
+    // applyPendingReleasesLocked. Returns false if the release can't be
+    // queued, in which case the caller must release the buffer under mMutex.
+    bool postPendingRelease(int slot, uint64_t frameNumber,
+            const sp<Fence>& releaseFence, EGLDisplay eglDisplay,
+            EGLSyncKHR eglFence);
+
+    // applyPendingReleasesLocked applies the releases posted since it was
+    // last called. It must be called after locking mMutex by any code that
+    // looks at acquired slots or at the free lists.
+    void applyPendingReleasesLocked();
+
+    // takeStaleReleaseLocked returns true, once, if a release of slot posted
+    // by postPendingRelease was dropped by applyPendingReleasesLocked because
+    // the slot had been cleared. The consumer reports it as
+    // STALE_BUFFER_SLOT, like a locked release would have.
+    bool takeStaleReleaseLocked(int slot);
+
+    // hasPendingReleases returns true if releases were posted since the last
+    // call to applyPendingReleasesLocked.
+    bool hasPendingReleases() const;
+
 #if DEBUG_ONLY_CODE
     // validateConsistencyLocked ensures that the free lists are in sync with
     // the information stored in mSlots
@@ -336,6 +367,38 @@ private:
 
     const uint64_t mUniqueId;
 
+    // A buffer release posted by postPendingRelease
+    struct PendingRelease {
+        int slot = INVALID_BUFFER_SLOT;
+        uint64_t frameNumber = 0;
+        sp<Fence> fence;
+        EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+        EGLSyncKHR eglFence = EGL_NO_SYNC_KHR;
+    };
+
+    // mPendingReleases is a single-producer single-consumer ring of releases
+    // waiting to be applied. The consumer writes at mPendingReleaseTail
+    // without holding mMutex, and applyPendingReleasesLocked reads at
+    // mPendingReleaseHead with mMutex held. Since a slot can only be pending
+    // once, the ring never needs more than one entry per slot.
+    PendingRelease mPendingReleases[BufferQueueDefs::NUM_BUFFER_SLOTS];
+    std::atomic<uint32_t> mPendingReleaseHead;
+    std::atomic<uint32_t> mPendingReleaseTail;
+
+    // mReleaseWaiters counts the producers about to wait on mDequeueCondition
+    // for a buffer to be released. A consumer posting a release without
+    // holding mMutex locks it to wake them up only when this isn't zero.
+    std::atomic<int32_t> mReleaseWaiters;
+
+    // mSlotEpoch is incremented whenever an acquired slot is cleared. The
+    // consumer only releases a buffer without locking mMutex if it hasn't
+    // changed since the buffer was acquired.
+    std::atomic<uint32_t> mSlotEpoch;
+
+    // mStaleReleases has a bit set for each slot whose pending release was
+    // dropped, until takeStaleReleaseLocked is called for it.
+    uint64_t mStaleReleases;
+
 }; // class BufferQueueCore
 
 } // namespace android
@@ -37,6 +37,7 @@ class IDisplayEventConnection;
 
 namespace gui {
 class BitTube;
+class VsyncTimeline;
 } // namespace gui
 
 static inline constexpr uint32_t fourcc(char c1, char c2, char c3, char c4) {
@@ -135,9 +136,32 @@ public:
      */
     status_t requestNextVsync();
 
+    /*
+     * setVsyncPhase() picks which Event::VSync a rate > 1 returns: the
+     * ones whose count modulo the rate is phase. A client that wants 10Hz
+     * out of 60Hz can use setVsyncRate(6) and any phase from 0 to 5.
+     */
+    status_t setVsyncPhase(uint32_t phase);
+
+    /*
+     * getNextVsync() returns the first Event::VSync after time in
+     * outTimestamp, its count in outCount and the vsync period in outPeriod,
+     * extrapolated from the vsync timeline SurfaceFlinger publishes in shared
+     * memory. It only reads memory, except for the first call which maps the
+     * timeline, so a client that only needs vsync timing can compute its
+     * deadlines without waiting for events.
+     * The timeline is only updated while some client receives vsync events;
+     * the further time is from the last one, the larger the error.
+     * Returns NOT_ENOUGH_DATA if no vsync event was published yet.
+     * The first call must not race with other calls.
+     */
+    status_t getNextVsync(nsecs_t time, nsecs_t* outTimestamp,
+            uint32_t* outCount = nullptr, nsecs_t* outPeriod = nullptr);
+
 private:
     sp<IDisplayEventConnection> mEventConnection;
     std::unique_ptr<gui::BitTube> mDataChannel;
+    std::unique_ptr<gui::VsyncTimeline> mVsyncTimeline;
 };
 
 // ----------------------------------------------------------------------------
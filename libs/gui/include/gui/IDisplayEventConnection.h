@@ -27,6 +27,7 @@ namespace android {
 
 namespace gui {
 class BitTube;
+class VsyncTimeline;
 } // namespace gui
 
 class IDisplayEventConnection : public IInterface {
@@ -51,6 +52,19 @@ public:
      * requestNextVsync() schedules the next vsync event. It has no effect if the vsync rate is > 0.
      */
     virtual void requestNextVsync() = 0; // Asynchronous
+
+    /*
+     * setVsyncPhase() picks which of the vsync events a rate > 1 returns: the ones whose count
+     * modulo the rate is phase (modulo the rate). It defaults to 0. Spreading connections with the
+     * same rate over different phases keeps their work from landing on the same frame.
+     */
+    virtual status_t setVsyncPhase(uint32_t phase) = 0;
+
+    /*
+     * getVsyncTimeline() returns a read-only mapping of the shared memory where the vsync events
+     * of this connection's source are published, see gui::VsyncTimeline.
+     */
+    virtual status_t getVsyncTimeline(gui::VsyncTimeline* outTimeline) = 0;
 };
 
 class BnDisplayEventConnection : public SafeBnInterface<IDisplayEventConnection> {
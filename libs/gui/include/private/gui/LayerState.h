@@ -77,6 +77,11 @@ struct layer_state_t {
     status_t    write(Parcel& output) const;
     status_t    read(const Parcel& input);
 
+    // Applies the changes of other on top of this state, as if other had
+    // been set right after it. Both states must be for the same surface and
+    // neither may defer, reparent or detach.
+    void        merge(const layer_state_t& other);
+
             struct matrix22_t {
                 float   dsdx{0};
                 float   dtdx{0};
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+#include <binder/Parcelable.h>
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace android {
+
+class Parcel;
+
+namespace gui {
+
+/*
+ * VsyncTimeline is a page of shared memory where the EventThread publishes its last vsync event
+ * and the vsync period. The EventThread maps it read-write and hands out read-only mappings, so
+ * that clients can compute their next frame deadlines without waiting for a vsync event on their
+ * BitTube.
+ *
+ * Updates are published with a sequence lock: the writer makes the sequence number odd, writes
+ * the values and makes it even again, and readers retry when the sequence number was odd or
+ * changed while they were reading. A single writer is assumed.
+ */
+class VsyncTimeline : public Parcelable {
+public:
+    struct Snapshot {
+        // count and timestamp of the last vsync event
+        uint32_t count;
+        nsecs_t timestamp;
+        // vsync period, 0 if it isn't known
+        nsecs_t period;
+
+        // Returns the first vsync after time, extrapolated from the last vsync event, and its
+        // count in outCount if not null. Returns timestamp if the period isn't known.
+        nsecs_t computeNextVsync(nsecs_t time, uint32_t* outCount = nullptr) const;
+    };
+
+    // creates an unmapped VsyncTimeline (to unparcel into)
+    VsyncTimeline() = default;
+
+    // creates and maps a new, writable VsyncTimeline
+    struct CreateType {};
+    static constexpr CreateType Create{};
+    explicit VsyncTimeline(CreateType);
+
+    ~VsyncTimeline() override;
+
+    VsyncTimeline(const VsyncTimeline&) = delete;
+    VsyncTimeline& operator=(const VsyncTimeline&) = delete;
+
+    // check state after construction or unparceling
+    status_t initCheck() const;
+
+    // publish a vsync event. Only valid on a VsyncTimeline created with Create.
+    void publish(uint32_t count, nsecs_t timestamp, nsecs_t period);
+
+    // Reads the last published vsync event. Returns false if nothing was published yet or the
+    // timeline isn't mapped.
+    bool read(Snapshot* outSnapshot) const;
+
+    // gives other a read-only handle on this timeline, to be parceled
+    status_t share(VsyncTimeline* other) const;
+
+    // implement the Parcelable protocol. Only parcels the file descriptor; readFromParcel maps it
+    // read-only.
+    status_t writeToParcel(Parcel* parcel) const override;
+    status_t readFromParcel(const Parcel* parcel) override;
+
+private:
+    // The layout of the shared page. The values are atomics so that reading them while they are
+    // written is well defined; the sequence number tells whether they are consistent.
+    struct Data {
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> count;
+        std::atomic<int64_t> timestamp;
+        std::atomic<int64_t> period;
+    };
+
+    status_t map(int prot);
+
+    base::unique_fd mFd;
+    Data* mData = nullptr;
+};
+
+} // namespace gui
+} // namespace android
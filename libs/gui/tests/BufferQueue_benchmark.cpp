@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <gui/BufferItem.h>
+#include <gui/BufferQueue.h>
+#include <gui/BufferQueueConsumer.h>
+#include <gui/IConsumerListener.h>
+#include <gui/IProducerListener.h>
+
+#include <ui/GraphicBuffer.h>
+
+#include <system/window.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace android;
+
+namespace {
+
+struct DummyConsumer : public BnConsumerListener {
+    void onFrameAvailable(const BufferItem& /* item */) override {}
+    void onBuffersReleased() override {}
+    void onSidebandStreamChanged() override {}
+};
+
+struct BufferQueueFixture {
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+
+    // Connects both ends and lets the producer dequeue up to two buffers
+    explicit BufferQueueFixture(bool lockFreeRelease) {
+        BufferQueue::createBufferQueue(&producer, &consumer);
+        consumer->consumerConnect(new DummyConsumer, false);
+        static_cast<BufferQueueConsumer*>(consumer.get())->
+                setLockFreeReleaseEnabled(lockFreeRelease);
+        IGraphicBufferProducer::QueueBufferOutput output;
+        producer->connect(new DummyProducerListener, NATIVE_WINDOW_API_CPU,
+                false, &output);
+        producer->setMaxDequeuedBufferCount(2);
+    }
+
+    status_t dequeueAndQueue() {
+        static const IGraphicBufferProducer::QueueBufferInput input(0, false,
+                HAL_DATASPACE_UNKNOWN, Rect(0, 0, 1, 1),
+                NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+        int slot;
+        sp<Fence> fence;
+        status_t result = producer->dequeueBuffer(&slot, &fence, 1, 1, 0,
+                GRALLOC_USAGE_SW_READ_OFTEN, nullptr, nullptr);
+        if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            sp<GraphicBuffer> buffer;
+            producer->requestBuffer(slot, &buffer);
+        } else if (result != NO_ERROR) {
+            return result;
+        }
+        IGraphicBufferProducer::QueueBufferOutput output;
+        return producer->queueBuffer(slot, input, &output);
+    }
+
+    status_t acquireAndRelease() {
+        BufferItem item;
+        status_t result = consumer->acquireBuffer(&item, 0);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        return consumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+                EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE);
+    }
+};
+
+} // namespace
+
+// One dequeue -> queue -> acquire -> release round trip on a single thread.
+// The argument enables the lock-free release path.
+static void BM_BufferQueueRoundTrip(benchmark::State& state) {
+    BufferQueueFixture bq(state.range(0) != 0);
+    while (state.KeepRunning()) {
+        bq.dequeueAndQueue();
+        bq.acquireAndRelease();
+    }
+}
+BENCHMARK(BM_BufferQueueRoundTrip)->Arg(0)->Arg(1);
+
+// The same round trip with the producer and the consumer on their own
+// threads, as with an app rendering into a SurfaceFlinger layer. The time
+// reported is the producer's, including waits for a free buffer.
+static void BM_BufferQueueRoundTripThreaded(benchmark::State& state) {
+    BufferQueueFixture bq(state.range(0) != 0);
+    std::atomic<bool> done(false);
+    std::thread consumerThread([&bq, &done]() {
+        while (!done) {
+            if (bq.acquireAndRelease() != NO_ERROR) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    while (state.KeepRunning()) {
+        bq.dequeueAndQueue();
+    }
+    done = true;
+    consumerThread.join();
+}
+BENCHMARK(BM_BufferQueueRoundTripThreaded)->Arg(0)->Arg(1)->UseRealTime();
+
+BENCHMARK_MAIN();
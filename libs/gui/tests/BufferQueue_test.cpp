@@ -21,6 +21,7 @@
 
 #include <gui/BufferItem.h>
 #include <gui/BufferQueue.h>
+#include <gui/BufferQueueConsumer.h>
 #include <gui/IProducerListener.h>
 
 #include <ui/GraphicBuffer.h>
@@ -36,6 +37,7 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <thread>
 
 using namespace std::chrono_literals;
@@ -1192,4 +1194,76 @@ TEST_F(BufferQueueTest, TestProducerConnectDisconnect) {
     ASSERT_EQ(NO_INIT, mProducer->disconnect(NATIVE_WINDOW_API_CPU));
 }
 
+
+TEST_F(BufferQueueTest, TestLockFreeRelease) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    static_cast<BufferQueueConsumer*>(mConsumer.get())->setLockFreeReleaseEnabled(true);
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    IGraphicBufferProducer::QueueBufferInput input(0, false,
+            HAL_DATASPACE_UNKNOWN, Rect(0, 0, 1, 1),
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+    int slot;
+    sp<Fence> fence;
+    sp<GraphicBuffer> buffer;
+    ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+            mProducer->dequeueBuffer(&slot, &fence, 1, 1, 0,
+            GRALLOC_USAGE_SW_READ_OFTEN, nullptr, nullptr));
+    ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+    ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+
+    // A stale frame number must still be reported to the consumer
+    BufferItem item;
+    ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+    ASSERT_EQ(IGraphicBufferConsumer::STALE_BUFFER_SLOT,
+            mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber + 1,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+    ASSERT_EQ(OK, mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+
+    // The producer blocks until the consumer releases its buffer, which it
+    // does without locking the BufferQueue. Failures are only checked once
+    // the consumer thread is joined.
+    std::atomic<bool> producerDone(false);
+    std::thread consumerThread([this, &producerDone]() {
+        for (int i = 0; i < 100; i++) {
+            BufferItem item;
+            while (mConsumer->acquireBuffer(&item, 0) != OK) {
+                if (producerDone) {
+                    return;
+                }
+                std::this_thread::sleep_for(1ms);
+            }
+            std::this_thread::sleep_for(100us);
+            EXPECT_EQ(OK, mConsumer->releaseBuffer(item.mSlot,
+                    item.mFrameNumber, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR,
+                    Fence::NO_FENCE));
+        }
+    });
+    status_t result = OK;
+    for (int i = 0; i < 100 && result == OK; i++) {
+        result = mProducer->dequeueBuffer(&slot, &fence, 1, 1, 0,
+                GRALLOC_USAGE_SW_READ_OFTEN, nullptr, nullptr);
+        // slot 0 may still be acquired, so the producer can get a new slot
+        if (result == IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            result = mProducer->requestBuffer(slot, &buffer);
+        }
+        if (result == OK) {
+            result = mProducer->queueBuffer(slot, input, &output);
+        }
+    }
+    producerDone = true;
+    consumerThread.join();
+    ASSERT_EQ(OK, result);
+
+    // All the buffers were released, so dequeueing doesn't have to wait
+    ASSERT_EQ(OK, mProducer->setDequeueTimeout(0));
+    ASSERT_EQ(OK, mProducer->dequeueBuffer(&slot, &fence, 1, 1, 0,
+            GRALLOC_USAGE_SW_READ_OFTEN, nullptr, nullptr));
+}
+
 } // namespace android
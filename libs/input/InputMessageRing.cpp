@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "InputMessageRing"
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+#include <cutils/ashmem.h>
+#include <log/log.h>
+
+#include <input/InputMessageRing.h>
+
+namespace android {
+
+// Size of a cache line, the publisher's and the consumer's fields of the shared
+// header are kept on separate lines.
+static const size_t CACHE_LINE_SIZE = 64;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+        "the ring's shared indices must be lock-free to work across processes");
+
+// The part of the shared memory in front of the messages.
+struct InputMessageRing::Header {
+    // Written by the publisher.
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> writeIndex;
+
+    // Written by the consumer.
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> readIndex;
+
+    // Set by the consumer before it goes idle, cleared by the publisher when it
+    // wakes the consumer up.
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> consumerWaiting;
+};
+
+InputMessageRing::InputMessageRing(int fd, void* data, size_t size, uint32_t capacity) :
+        mFd(fd), mData(data), mSize(size), mCapacity(capacity),
+        mHeader(static_cast<Header*>(data)),
+        mSlots(reinterpret_cast<InputMessage*>(static_cast<uint8_t*>(data) + sizeof(Header))),
+        mWriteIndex(0), mReadIndex(0) {
+}
+
+InputMessageRing::~InputMessageRing() {
+    munmap(mData, mSize);
+    ::close(mFd);
+}
+
+size_t InputMessageRing::getSize(uint32_t capacity) {
+    static_assert(sizeof(Header) % CACHE_LINE_SIZE == 0,
+            "the messages must start on a cache line");
+    return sizeof(Header) + sizeof(InputMessage) * capacity;
+}
+
+sp<InputMessageRing> InputMessageRing::create(const String8& name, uint32_t capacity) {
+    // A power of two capacity lets indices be mapped to slots with a mask.
+    uint32_t roundedCapacity = 1;
+    while (roundedCapacity < capacity && roundedCapacity < MAX_CAPACITY) {
+        roundedCapacity <<= 1;
+    }
+
+    size_t size = getSize(roundedCapacity);
+    String8 regionName("input message ring: ");
+    regionName.append(name);
+    int fd = ashmem_create_region(regionName.string(), size);
+    if (fd < 0) {
+        ALOGE("Could not create input message ring '%s'.  errno=%d", name.string(), errno);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        ALOGE("Could not map input message ring '%s'.  errno=%d", name.string(), errno);
+        ::close(fd);
+        return NULL;
+    }
+
+    // ashmem regions start zeroed, which is an empty ring without a waiting consumer.
+    // Mark the consumer as waiting so that the first message rings the doorbell.
+    InputMessageRing* ring = new InputMessageRing(fd, data, size, roundedCapacity);
+    new (ring->mHeader) Header();
+    ring->mHeader->writeIndex.store(0, std::memory_order_relaxed);
+    ring->mHeader->readIndex.store(0, std::memory_order_relaxed);
+    ring->mHeader->consumerWaiting.store(1, std::memory_order_release);
+    return ring;
+}
+
+sp<InputMessageRing> InputMessageRing::map(int fd, uint32_t capacity) {
+    if (fd < 0) {
+        return NULL;
+    }
+    if (capacity == 0 || capacity > MAX_CAPACITY || (capacity & (capacity - 1))) {
+        ALOGE("Invalid input message ring capacity %u.", capacity);
+        ::close(fd);
+        return NULL;
+    }
+
+    size_t size = getSize(capacity);
+    int regionSize = ashmem_get_size_region(fd);
+    if (regionSize < 0 || size_t(regionSize) < size) {
+        ALOGE("Input message ring is too small: %d bytes for %u messages.",
+                regionSize, capacity);
+        ::close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        ALOGE("Could not map input message ring.  errno=%d", errno);
+        ::close(fd);
+        return NULL;
+    }
+
+    // The publisher may already have pushed messages, they are read from the start.
+    return new InputMessageRing(fd, data, size, capacity);
+}
+
+status_t InputMessageRing::sendMessage(const InputMessage* msg) {
+    uint64_t readIndex = mHeader->readIndex.load(std::memory_order_acquire);
+    if (readIndex > mWriteIndex || mWriteIndex - readIndex >= mCapacity) {
+        return WOULD_BLOCK;
+    }
+
+    memcpy(&mSlots[mWriteIndex & (mCapacity - 1)], msg, msg->size());
+    mWriteIndex += 1;
+    mHeader->writeIndex.store(mWriteIndex, std::memory_order_seq_cst);
+    return OK;
+}
+
+bool InputMessageRing::takeWaitingConsumer() {
+    // Ordered after the store of writeIndex in sendMessage, so that either this sees
+    // the consumer waiting, or the consumer sees the message in prepareToWait.
+    return mHeader->consumerWaiting.exchange(0, std::memory_order_seq_cst) != 0;
+}
+
+status_t InputMessageRing::receiveMessages(InputMessage* msgs, size_t count,
+        size_t* outReceived) {
+    *outReceived = 0;
+
+    uint64_t writeIndex = mHeader->writeIndex.load(std::memory_order_acquire);
+    if (writeIndex < mReadIndex || writeIndex - mReadIndex > mCapacity) {
+        ALOGE("Input message ring is inconsistent: read index %" PRIu64
+                ", write index %" PRIu64 ".", mReadIndex, writeIndex);
+        return BAD_VALUE;
+    }
+    if (writeIndex == mReadIndex) {
+        return WOULD_BLOCK;
+    }
+
+    status_t result = OK;
+    while (*outReceived < count && mReadIndex < writeIndex) {
+        // Validate the copy, the slot itself could still be changed by the peer.
+        InputMessage& msg = msgs[*outReceived];
+        memcpy(&msg, &mSlots[mReadIndex & (mCapacity - 1)], sizeof(InputMessage));
+        mReadIndex += 1;
+        if ((msg.header.type != InputMessage::TYPE_KEY
+                && msg.header.type != InputMessage::TYPE_MOTION)
+                || !msg.isValid(msg.size())) {
+            ALOGE("Input message ring holds an invalid message of type %u.",
+                    msg.header.type);
+            result = BAD_VALUE;
+            break;
+        }
+        *outReceived += 1;
+    }
+    mHeader->readIndex.store(mReadIndex, std::memory_order_release);
+    return result;
+}
+
+bool InputMessageRing::prepareToWait() {
+    mHeader->consumerWaiting.store(1, std::memory_order_seq_cst);
+    return isEmpty();
+}
+
+bool InputMessageRing::isEmpty() const {
+    return mHeader->writeIndex.load(std::memory_order_seq_cst) == mReadIndex;
+}
+
+} // namespace android
@@ -30,10 +30,22 @@
 #include <cutils/properties.h>
 #include <log/log.h>
 
+#include <input/InputMessageRing.h>
 #include <input/InputTransport.h>
 
 namespace android {
 
+// Maximum number of messages moved by one sendmmsg() or recvmmsg() call.
+static const size_t MAX_MESSAGES_PER_CALL = 16;
+
+// Number of messages the consumer reads from the channel at a time.  High rate
+// devices deliver several samples per frame, which can then be drained with one
+// system call.
+static const size_t CONSUMER_RECEIVE_BATCH_SIZE = 8;
+
+// Space for the control message carrying the fd of a TYPE_RING_SETUP message.
+static const size_t FD_CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+
 // Socket buffer size.  The default is typically about 128KB, which is much larger than
 // we really need.  So we make it smaller.  It just needs to be big enough to hold
 // a few dozen large multi-finger motion events in the case where an application gets
@@ -67,6 +79,34 @@ inline static float lerp(float a, float b, float alpha) {
     return a + alpha * (b - a);
 }
 
+static void closeFds(const int* fds, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] >= 0) {
+            ::close(fds[i]);
+        }
+    }
+}
+
+static status_t statusForSendError(int error) {
+    if (error == EAGAIN || error == EWOULDBLOCK) {
+        return WOULD_BLOCK;
+    }
+    if (error == EPIPE || error == ENOTCONN || error == ECONNREFUSED || error == ECONNRESET) {
+        return DEAD_OBJECT;
+    }
+    return -error;
+}
+
+static status_t statusForReceiveError(int error) {
+    if (error == EAGAIN || error == EWOULDBLOCK) {
+        return WOULD_BLOCK;
+    }
+    if (error == EPIPE || error == ENOTCONN || error == ECONNREFUSED) {
+        return DEAD_OBJECT;
+    }
+    return -error;
+}
+
 // --- InputMessage ---
 
 bool InputMessage::isValid(size_t actualSize) const {
@@ -78,6 +118,8 @@ bool InputMessage::isValid(size_t actualSize) const {
             return body.motion.pointerCount > 0
                     && body.motion.pointerCount <= MAX_POINTERS;
         case TYPE_FINISHED:
+        case TYPE_RING_SETUP:
+        case TYPE_DOORBELL:
             return true;
         }
     }
@@ -92,6 +134,8 @@ size_t InputMessage::size() const {
         return sizeof(Header) + body.motion.size();
     case TYPE_FINISHED:
         return sizeof(Header) + body.finished.size();
+    case TYPE_RING_SETUP:
+        return sizeof(Header) + body.ring.size();
     }
     return sizeof(Header);
 }
@@ -161,13 +205,7 @@ status_t InputChannel::sendMessage(const InputMessage* msg) {
         ALOGD("channel '%s' ~ error sending message of type %d, errno=%d", mName.string(),
                 msg->header.type, error);
 #endif
-        if (error == EAGAIN || error == EWOULDBLOCK) {
-            return WOULD_BLOCK;
-        }
-        if (error == EPIPE || error == ENOTCONN || error == ECONNREFUSED || error == ECONNRESET) {
-            return DEAD_OBJECT;
-        }
-        return -error;
+        return statusForSendError(error);
     }
 
     if (size_t(nWrite) != msgLength) {
@@ -195,13 +233,7 @@ status_t InputChannel::receiveMessage(InputMessage* msg) {
 #if DEBUG_CHANNEL_MESSAGES
         ALOGD("channel '%s' ~ receive message failed, errno=%d", mName.string(), errno);
 #endif
-        if (error == EAGAIN || error == EWOULDBLOCK) {
-            return WOULD_BLOCK;
-        }
-        if (error == EPIPE || error == ENOTCONN || error == ECONNREFUSED) {
-            return DEAD_OBJECT;
-        }
-        return -error;
+        return statusForReceiveError(error);
     }
 
     if (nRead == 0) { // check for EOF
@@ -218,12 +250,182 @@ status_t InputChannel::receiveMessage(InputMessage* msg) {
         return BAD_VALUE;
     }
 
+    if (msg->header.type == InputMessage::TYPE_RING_SETUP) {
+        // recv() does not receive fds.
+        msg->body.ring.fd = -1;
+    }
+
 #if DEBUG_CHANNEL_MESSAGES
     ALOGD("channel '%s' ~ received message of type %d", mName.string(), msg->header.type);
 #endif
     return OK;
 }
 
+status_t InputChannel::sendMessages(const InputMessage* msgs, size_t count, size_t* outSent) {
+    *outSent = 0;
+    while (*outSent < count) {
+        struct iovec iovs[MAX_MESSAGES_PER_CALL];
+        struct mmsghdr headers[MAX_MESSAGES_PER_CALL];
+        size_t batchSize = min(count - *outSent, MAX_MESSAGES_PER_CALL);
+        for (size_t i = 0; i < batchSize; i++) {
+            const InputMessage* msg = &msgs[*outSent + i];
+            iovs[i].iov_base = const_cast<InputMessage*>(msg);
+            iovs[i].iov_len = msg->size();
+            memset(&headers[i], 0, sizeof(headers[i]));
+            headers[i].msg_hdr.msg_iov = &iovs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int nSent;
+        do {
+            nSent = ::sendmmsg(mFd, headers, batchSize, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } while (nSent == -1 && errno == EINTR);
+
+        if (nSent < 0) {
+            int error = errno;
+#if DEBUG_CHANNEL_MESSAGES
+            ALOGD("channel '%s' ~ error sending %zu messages, errno=%d", mName.string(),
+                    batchSize, error);
+#endif
+            return statusForSendError(error);
+        }
+
+        for (size_t i = 0; i < size_t(nSent); i++) {
+            if (headers[i].msg_len != iovs[i].iov_len) {
+#if DEBUG_CHANNEL_MESSAGES
+                ALOGD("channel '%s' ~ error sending message type %d, send was incomplete",
+                        mName.string(), msgs[*outSent].header.type);
+#endif
+                return DEAD_OBJECT;
+            }
+            *outSent += 1;
+        }
+
+#if DEBUG_CHANNEL_MESSAGES
+        ALOGD("channel '%s' ~ sent %d messages", mName.string(), nSent);
+#endif
+    }
+    return OK;
+}
+
+status_t InputChannel::receiveMessages(InputMessage* msgs, size_t count, size_t* outReceived) {
+    *outReceived = 0;
+
+    struct iovec iovs[MAX_MESSAGES_PER_CALL];
+    struct mmsghdr headers[MAX_MESSAGES_PER_CALL];
+    uint64_t controls[MAX_MESSAGES_PER_CALL][(FD_CONTROL_SIZE + 7) / 8];
+    size_t batchSize = min(count, MAX_MESSAGES_PER_CALL);
+    for (size_t i = 0; i < batchSize; i++) {
+        iovs[i].iov_base = &msgs[i];
+        iovs[i].iov_len = sizeof(InputMessage);
+        memset(&headers[i], 0, sizeof(headers[i]));
+        headers[i].msg_hdr.msg_iov = &iovs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+        headers[i].msg_hdr.msg_control = controls[i];
+        headers[i].msg_hdr.msg_controllen = FD_CONTROL_SIZE;
+    }
+
+    int nRead;
+    do {
+        nRead = ::recvmmsg(mFd, headers, batchSize, MSG_DONTWAIT | MSG_CMSG_CLOEXEC, NULL);
+    } while (nRead == -1 && errno == EINTR);
+
+    if (nRead < 0) {
+        int error = errno;
+#if DEBUG_CHANNEL_MESSAGES
+        ALOGD("channel '%s' ~ receive messages failed, errno=%d", mName.string(), errno);
+#endif
+        return statusForReceiveError(error);
+    }
+
+    // Take the fds out of the control messages first so that none of them leaks.
+    int fds[MAX_MESSAGES_PER_CALL];
+    for (size_t i = 0; i < size_t(nRead); i++) {
+        fds[i] = -1;
+        struct msghdr& hdr = headers[i].msg_hdr;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+                    && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+                memcpy(&fds[i], CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+    }
+
+    for (size_t i = 0; i < size_t(nRead); i++) {
+        if (headers[i].msg_len == 0) {
+            // The peer was closed after the messages before this one were sent,
+            // report it on the next call if any message was received.
+#if DEBUG_CHANNEL_MESSAGES
+            ALOGD("channel '%s' ~ receive messages stopped because peer was closed",
+                    mName.string());
+#endif
+            closeFds(fds + i, size_t(nRead) - i);
+            return *outReceived ? OK : DEAD_OBJECT;
+        }
+        if (!msgs[i].isValid(headers[i].msg_len)) {
+#if DEBUG_CHANNEL_MESSAGES
+            ALOGD("channel '%s' ~ received invalid message", mName.string());
+#endif
+            closeFds(fds + i, size_t(nRead) - i);
+            return BAD_VALUE;
+        }
+        if (msgs[i].header.type == InputMessage::TYPE_RING_SETUP) {
+            msgs[i].body.ring.fd = fds[i];
+        } else {
+            closeFds(fds + i, 1);
+        }
+        *outReceived += 1;
+    }
+
+    if (nRead == 0) { // check for EOF
+        return DEAD_OBJECT;
+    }
+
+#if DEBUG_CHANNEL_MESSAGES
+    ALOGD("channel '%s' ~ received %zu messages", mName.string(), *outReceived);
+#endif
+    return OK;
+}
+
+status_t InputChannel::sendMessageWithFd(const InputMessage* msg, int fd) {
+    struct iovec iov;
+    iov.iov_base = const_cast<InputMessage*>(msg);
+    iov.iov_len = msg->size();
+
+    uint64_t control[(FD_CONTROL_SIZE + 7) / 8];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = FD_CONTROL_SIZE;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t nWrite;
+    do {
+        nWrite = ::sendmsg(mFd, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (nWrite == -1 && errno == EINTR);
+
+    if (nWrite < 0) {
+        int error = errno;
+#if DEBUG_CHANNEL_MESSAGES
+        ALOGD("channel '%s' ~ error sending message of type %d with fd, errno=%d",
+                mName.string(), msg->header.type, error);
+#endif
+        return statusForSendError(error);
+    }
+
+    if (size_t(nWrite) != iov.iov_len) {
+        return DEAD_OBJECT;
+    }
+    return OK;
+}
+
 sp<InputChannel> InputChannel::dup() const {
     int fd = ::dup(getFd());
     return fd >= 0 ? new InputChannel(getName(), fd) : NULL;
@@ -233,7 +435,7 @@ sp<InputChannel> InputChannel::dup() const {
 // --- InputPublisher ---
 
 InputPublisher::InputPublisher(const sp<InputChannel>& channel) :
-        mChannel(channel) {
+        mChannel(channel), mBatching(false) {
 }
 
 InputPublisher::~InputPublisher() {
@@ -278,7 +480,7 @@ status_t InputPublisher::publishKeyEvent(
     msg.body.key.repeatCount = repeatCount;
     msg.body.key.downTime = downTime;
     msg.body.key.eventTime = eventTime;
-    return mChannel->sendMessage(&msg);
+    return publishMessage(msg);
 }
 
 status_t InputPublisher::publishMotionEvent(
@@ -346,9 +548,104 @@ status_t InputPublisher::publishMotionEvent(
         msg.body.motion.pointers[i].properties.copyFrom(pointerProperties[i]);
         msg.body.motion.pointers[i].coords.copyFrom(pointerCoords[i]);
     }
+    return publishMessage(msg);
+}
+
+status_t InputPublisher::publishMessage(const InputMessage& msg) {
+    if (mBatching) {
+        mBatch.push(msg);
+        return OK;
+    }
+    if (mRing != NULL) {
+        status_t result = mRing->sendMessage(&msg);
+        if (result) {
+            return result;
+        }
+        return wakeConsumer();
+    }
     return mChannel->sendMessage(&msg);
 }
 
+status_t InputPublisher::wakeConsumer() {
+    if (!mRing->takeWaitingConsumer()) {
+        return OK;
+    }
+
+    InputMessage msg;
+    msg.header.type = InputMessage::TYPE_DOORBELL;
+    status_t result = mChannel->sendMessage(&msg);
+    if (result == WOULD_BLOCK) {
+        // The consumer has unread doorbells, which already make its fd readable.
+        return OK;
+    }
+    return result;
+}
+
+status_t InputPublisher::enableMessageRing(uint32_t capacity) {
+    if (mRing != NULL) {
+        return INVALID_OPERATION;
+    }
+
+    sp<InputMessageRing> ring = InputMessageRing::create(mChannel->getName(), capacity);
+    if (ring == NULL) {
+        return NO_MEMORY;
+    }
+
+    InputMessage msg;
+    msg.header.type = InputMessage::TYPE_RING_SETUP;
+    msg.body.ring.capacity = ring->getCapacity();
+    msg.body.ring.fd = -1;
+    status_t result = mChannel->sendMessageWithFd(&msg, ring->getFd());
+    if (result) {
+        return result;
+    }
+
+#if DEBUG_TRANSPORT_ACTIONS
+    ALOGD("channel '%s' publisher ~ enabled message ring of %u messages",
+            mChannel->getName().string(), ring->getCapacity());
+#endif
+    mRing = ring;
+    return OK;
+}
+
+void InputPublisher::beginBatch() {
+#if DEBUG_TRANSPORT_ACTIONS
+    ALOGD("channel '%s' publisher ~ beginBatch", mChannel->getName().string());
+#endif
+    mBatching = true;
+}
+
+status_t InputPublisher::endBatch(size_t* outPublished) {
+    mBatching = false;
+    status_t result = OK;
+    *outPublished = 0;
+    if (!mBatch.isEmpty()) {
+        if (mRing != NULL) {
+            while (*outPublished < mBatch.size()) {
+                result = mRing->sendMessage(&mBatch.itemAt(*outPublished));
+                if (result) {
+                    break;
+                }
+                *outPublished += 1;
+            }
+            if (*outPublished) {
+                status_t wakeResult = wakeConsumer();
+                if (!result) {
+                    result = wakeResult;
+                }
+            }
+        } else {
+            result = mChannel->sendMessages(mBatch.array(), mBatch.size(), outPublished);
+        }
+        mBatch.clear();
+    }
+#if DEBUG_TRANSPORT_ACTIONS
+    ALOGD("channel '%s' publisher ~ endBatch: published %zu events, result=%d",
+            mChannel->getName().string(), *outPublished, result);
+#endif
+    return result;
+}
+
 status_t InputPublisher::receiveFinishedSignal(uint32_t* outSeq, bool* outHandled) {
 #if DEBUG_TRANSPORT_ACTIONS
     ALOGD("channel '%s' publisher ~ receiveFinishedSignal",
@@ -376,7 +673,8 @@ status_t InputPublisher::receiveFinishedSignal(uint32_t* outSeq, bool* outHandle
 
 InputConsumer::InputConsumer(const sp<InputChannel>& channel) :
         mResampleTouch(isTouchResamplingEnabled()),
-        mChannel(channel), mMsgDeferred(false) {
+        mChannel(channel), mMsgDeferred(false), mReceivedIndex(0), mReceivedCount(0),
+        mReceiveError(OK) {
 }
 
 InputConsumer::~InputConsumer() {
@@ -418,7 +716,7 @@ status_t InputConsumer::consume(InputEventFactoryInterface* factory,
             mMsgDeferred = false;
         } else {
             // Receive a fresh message.
-            status_t result = mChannel->receiveMessage(&mMsg);
+            status_t result = receiveNextMessage(&mMsg);
             if (result) {
                 // Consume the next batched event unless batches are being held for later.
                 if (consumeBatches || result != WOULD_BLOCK) {
@@ -538,7 +836,7 @@ status_t InputConsumer::consume(InputEventFactoryInterface* factory,
             mMsgDeferred = false;
         } else {
             // Receive a fresh message.
-            status_t result = mChannel->receiveMessage(&mMsg);
+            status_t result = receiveNextMessage(&mMsg);
             if (result == 0) {
                 if ((mMsg.body.motion.action & AMOTION_EVENT_ACTION_MASK) == AMOTION_EVENT_ACTION_MOVE){
                     mTouchMoveCounter++;
@@ -1057,6 +1355,102 @@ status_t InputConsumer::sendFinishedSignal(uint32_t seq, bool handled) {
     return sendUnchainedFinishedSignal(seq, handled);
 }
 
+status_t InputConsumer::receiveNextMessage(InputMessage* msg) {
+    while (mReceivedIndex == mReceivedCount) {
+        status_t result = receiveMessages();
+        if (result) {
+            return result;
+        }
+    }
+    *msg = mReceivedMessages.itemAt(mReceivedIndex++);
+    return OK;
+}
+
+status_t InputConsumer::receiveMessages() {
+    if (mReceiveError) {
+        return mReceiveError;
+    }
+    if (mReceivedMessages.isEmpty()) {
+        mReceivedMessages.insertAt(0, CONSUMER_RECEIVE_BATCH_SIZE);
+    }
+    InputMessage* msgs = mReceivedMessages.editArray();
+    size_t capacity = mReceivedMessages.size();
+    mReceivedIndex = 0;
+    mReceivedCount = 0;
+
+    // Once the publisher has set up a ring, the events only go through it.
+    if (mRing != NULL) {
+        status_t result = mRing->receiveMessages(msgs, capacity, &mReceivedCount);
+        if (result != WOULD_BLOCK) {
+            return deferReceiveError(result);
+        }
+    }
+
+    size_t count;
+    status_t result = mChannel->receiveMessages(msgs, capacity, &count);
+    if (result && !count) {
+        if (result == WOULD_BLOCK && mRing != NULL && !mRing->prepareToWait()) {
+            // Events were pushed to the ring while going idle, the caller tries again.
+            return OK;
+        }
+        return result;
+    }
+
+    // Keep the events and handle the transport messages here: events received
+    // before the ring setup come first, and the publisher only uses the ring after it.
+    for (size_t i = 0; i < count; i++) {
+        const InputMessage& msg = msgs[i];
+        if (msg.header.type == InputMessage::TYPE_DOORBELL) {
+            continue;
+        }
+        if (msg.header.type == InputMessage::TYPE_RING_SETUP) {
+            status_t setupResult = handleRingSetup(msg);
+            if (setupResult) {
+                result = setupResult;
+                break;
+            }
+            continue;
+        }
+        if (mReceivedCount != i) {
+            msgs[mReceivedCount] = msg;
+        }
+        mReceivedCount += 1;
+    }
+    return deferReceiveError(result);
+}
+
+status_t InputConsumer::deferReceiveError(status_t result) {
+    // If the read stopped at an error after some messages, hand those out first.
+    if (result && mReceivedCount) {
+        mReceiveError = result;
+        return OK;
+    }
+    return result;
+}
+
+status_t InputConsumer::handleRingSetup(const InputMessage& msg) {
+    if (mRing != NULL) {
+        ALOGE("channel '%s' consumer ~ Received a second message ring",
+                mChannel->getName().string());
+        if (msg.body.ring.fd >= 0) {
+            ::close(msg.body.ring.fd);
+        }
+        return UNKNOWN_ERROR;
+    }
+
+    mRing = InputMessageRing::map(msg.body.ring.fd, msg.body.ring.capacity);
+    if (mRing == NULL) {
+        ALOGE("channel '%s' consumer ~ Could not map the message ring",
+                mChannel->getName().string());
+        return UNKNOWN_ERROR;
+    }
+#if DEBUG_TRANSPORT_ACTIONS
+    ALOGD("channel '%s' consumer ~ using message ring of %u messages",
+            mChannel->getName().string(), mRing->getCapacity());
+#endif
+    return OK;
+}
+
 status_t InputConsumer::sendUnchainedFinishedSignal(uint32_t seq, bool handled) {
     InputMessage msg;
     msg.header.type = InputMessage::TYPE_FINISHED;
@@ -1066,7 +1460,9 @@ status_t InputConsumer::sendUnchainedFinishedSignal(uint32_t seq, bool handled)
 }
 
 bool InputConsumer::hasDeferredEvent() const {
-    return mMsgDeferred;
+    // Messages already read from the channel won't make its fd readable again.
+    return mMsgDeferred || mReceivedIndex < mReceivedCount
+            || (mRing != NULL && !mRing->isEmpty());
 }
 
 bool InputConsumer::hasPendingBatch() const {
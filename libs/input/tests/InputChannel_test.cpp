@@ -155,5 +155,58 @@ TEST_F(InputChannelTest, SendSignal_WhenPeerClosed_ReturnsAnError) {
             << "sendMessage should have returned DEAD_OBJECT";
 }
 
+TEST_F(InputChannelTest, SendMessages_ReceiveMessages_TransferMessagesInOrder) {
+    sp<InputChannel> serverChannel, clientChannel;
+
+    status_t result = InputChannel::openInputChannelPair(String8("channel name"),
+            serverChannel, clientChannel);
+
+    ASSERT_EQ(OK, result)
+            << "should have successfully opened a channel pair";
+
+    // More messages than are moved by a single system call.
+    const size_t messageCount = 24;
+    InputMessage serverMsgs[messageCount];
+    memset(serverMsgs, 0, sizeof(serverMsgs));
+    for (size_t i = 0; i < messageCount; i++) {
+        serverMsgs[i].header.type = InputMessage::TYPE_KEY;
+        serverMsgs[i].body.key.seq = i + 1;
+    }
+
+    size_t sent;
+    EXPECT_EQ(OK, serverChannel->sendMessages(serverMsgs, messageCount, &sent))
+            << "sendMessages should have sent all the messages";
+    EXPECT_EQ(messageCount, sent);
+
+    InputMessage clientMsgs[8];
+    size_t total = 0;
+    while (total < messageCount) {
+        size_t received;
+        ASSERT_EQ(OK, clientChannel->receiveMessages(clientMsgs, 8, &received))
+                << "receiveMessages should have received messages";
+        ASSERT_GT(received, 0U);
+        for (size_t i = 0; i < received; i++) {
+            EXPECT_EQ(uint32_t(InputMessage::TYPE_KEY), clientMsgs[i].header.type);
+            EXPECT_EQ(total + i + 1, clientMsgs[i].body.key.seq)
+                    << "receiveMessages should return the messages in order";
+        }
+        total += received;
+    }
+    EXPECT_EQ(messageCount, total);
+
+    size_t received;
+    EXPECT_EQ(WOULD_BLOCK, clientChannel->receiveMessages(clientMsgs, 8, &received))
+            << "receiveMessages should have returned WOULD_BLOCK";
+    EXPECT_EQ(0U, received);
+
+    serverChannel.clear(); // close server channel
+
+    EXPECT_EQ(DEAD_OBJECT, clientChannel->receiveMessages(clientMsgs, 8, &received))
+            << "receiveMessages should have returned DEAD_OBJECT";
+    EXPECT_EQ(DEAD_OBJECT, clientChannel->sendMessages(clientMsgs, 1, &sent))
+            << "sendMessages should have returned DEAD_OBJECT";
+    EXPECT_EQ(0U, sent);
+}
+
 
 } // namespace android
@@ -16,7 +16,9 @@
 
 #include "TestHelpers.h"
 
+#include <poll.h>
 #include <unistd.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <time.h>
 
@@ -60,8 +62,79 @@ protected:
 
     void PublishAndConsumeKeyEvent();
     void PublishAndConsumeMotionEvent();
+    void PublishMoveSamples(size_t firstSample, size_t sampleCount,
+            status_t* outStatus, size_t* outPublished);
+    void ConsumeMoveSamples(size_t* ioConsumedCount);
 };
 
+// Publishes samples firstSample to sampleCount - 1 of a move in one batch, the way the
+// dispatcher publishes a move with history: the historical samples have sequence numbers
+// that are not waited on, and the last sample is the event itself, with seq 1.
+// Sample i has event time i + 1.
+void InputPublisherAndConsumerTest::PublishMoveSamples(size_t firstSample, size_t sampleCount,
+        status_t* outStatus, size_t* outPublished) {
+    PointerProperties pointerProperties;
+    pointerProperties.clear();
+    pointerProperties.id = 0;
+    pointerProperties.toolType = AMOTION_EVENT_TOOL_TYPE_FINGER;
+    PointerCoords pointerCoords;
+    pointerCoords.clear();
+
+    mPublisher->beginBatch();
+    for (size_t i = firstSample; i < sampleCount; i++) {
+        uint32_t seq = i + 1 == sampleCount ? 1 : 100 + i;
+        pointerCoords.setAxisValue(AMOTION_EVENT_AXIS_X, 10 * i);
+        status_t status = mPublisher->publishMotionEvent(seq, 1, AINPUT_SOURCE_TOUCHSCREEN, 0,
+                AMOTION_EVENT_ACTION_MOVE, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, i + 1,
+                1, &pointerProperties, &pointerCoords);
+        ASSERT_EQ(OK, status)
+                << "publisher publishMotionEvent should return OK";
+    }
+    *outStatus = mPublisher->endBatch(outPublished);
+}
+
+// Consumes the samples that were published as one batched move, checks that they are the
+// ones that follow the samples already consumed, and finishes them.
+void InputPublisherAndConsumerTest::ConsumeMoveSamples(size_t* ioConsumedCount) {
+    uint32_t consumeSeq;
+    InputEvent* event;
+    int32_t displayId;
+    status_t status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1,
+            &consumeSeq, &event, &displayId);
+    ASSERT_EQ(OK, status)
+            << "consumer consume should return OK";
+    ASSERT_TRUE(event != NULL)
+            << "consumer should have returned non-NULL event";
+    ASSERT_EQ(AINPUT_EVENT_TYPE_MOTION, event->getType())
+            << "consumer should have returned a motion event";
+
+    MotionEvent* motionEvent = static_cast<MotionEvent*>(event);
+    size_t historySize = motionEvent->getHistorySize();
+    for (size_t h = 0; h <= historySize; h++) {
+        nsecs_t eventTime = h < historySize
+                ? motionEvent->getHistoricalEventTime(h) : motionEvent->getEventTime();
+        EXPECT_EQ(nsecs_t(*ioConsumedCount + 1), eventTime)
+                << "consumer should receive each sample once, in order";
+        EXPECT_EQ(10.0f * *ioConsumedCount, h < historySize
+                ? motionEvent->getHistoricalX(0, h) : motionEvent->getX(0));
+        *ioConsumedCount += 1;
+    }
+
+    status = mConsumer->sendFinishedSignal(consumeSeq, true);
+    ASSERT_EQ(OK, status)
+            << "consumer sendFinishedSignal should return OK";
+    uint32_t finishedSeq;
+    bool handled;
+    for (size_t i = 0; i <= historySize; i++) {
+        status = mPublisher->receiveFinishedSignal(&finishedSeq, &handled);
+        ASSERT_EQ(OK, status)
+                << "publisher receiveFinishedSignal should return OK";
+    }
+    status = mPublisher->receiveFinishedSignal(&finishedSeq, &handled);
+    ASSERT_EQ(WOULD_BLOCK, status)
+            << "consumer should finish each sample once";
+}
+
 TEST_F(InputPublisherAndConsumerTest, GetChannel_ReturnsTheChannel) {
     EXPECT_EQ(serverChannel.get(), mPublisher->getChannel().get());
     EXPECT_EQ(clientChannel.get(), mConsumer->getChannel().get());
@@ -290,4 +363,198 @@ TEST_F(InputPublisherAndConsumerTest, PublishMultipleEvents_EndToEnd) {
     ASSERT_NO_FATAL_FAILURE(PublishAndConsumeKeyEvent());
 }
 
+TEST_F(InputPublisherAndConsumerTest, PublishBatch_SendsEventsOnEndBatch) {
+    status_t status;
+    const size_t eventCount = 12;
+
+    mPublisher->beginBatch();
+    for (size_t i = 0; i < eventCount; i++) {
+        status = mPublisher->publishKeyEvent(i + 1, 1, AINPUT_SOURCE_KEYBOARD,
+                AKEY_EVENT_ACTION_DOWN, 0, AKEYCODE_A + i, 0, 0, 0, 0, 0);
+        ASSERT_EQ(OK, status)
+                << "publisher publishKeyEvent should return OK";
+    }
+
+    uint32_t consumeSeq;
+    InputEvent* event;
+    int32_t displayId;
+    status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1, &consumeSeq, &event,
+            &displayId);
+    ASSERT_EQ(WOULD_BLOCK, status)
+            << "consumer consume should return WOULD_BLOCK before the batch is sent";
+
+    size_t published;
+    status = mPublisher->endBatch(&published);
+    ASSERT_EQ(OK, status)
+            << "publisher endBatch should return OK";
+    ASSERT_EQ(eventCount, published)
+            << "publisher endBatch should have published all the events";
+
+    for (size_t i = 0; i < eventCount; i++) {
+        status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1, &consumeSeq,
+                &event, &displayId);
+        ASSERT_EQ(OK, status)
+                << "consumer consume should return OK";
+        ASSERT_TRUE(event != NULL)
+                << "consumer should have returned non-NULL event";
+        ASSERT_EQ(AINPUT_EVENT_TYPE_KEY, event->getType())
+                << "consumer should have returned a key event";
+        EXPECT_EQ(i + 1, consumeSeq)
+                << "consumer should return the events in order";
+        EXPECT_EQ(int32_t(AKEYCODE_A + i), static_cast<KeyEvent*>(event)->getKeyCode());
+    }
+
+    EXPECT_FALSE(mConsumer->hasDeferredEvent())
+            << "consumer should have handed out all the events it received";
+    status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1, &consumeSeq, &event,
+            &displayId);
+    ASSERT_EQ(WOULD_BLOCK, status)
+            << "consumer consume should return WOULD_BLOCK once all events are consumed";
+
+    status = mPublisher->endBatch(&published);
+    ASSERT_EQ(OK, status)
+            << "publisher endBatch should return OK when there is nothing to send";
+    ASSERT_EQ(0U, published);
+}
+
+TEST_F(InputPublisherAndConsumerTest, PublishBatch_WhenRingFillsDuringHistory_SendsEachSampleOnce) {
+    const size_t sampleCount = 6;
+    status_t status;
+    size_t published;
+    size_t consumedCount = 0;
+
+    status = mPublisher->enableMessageRing(4);
+    ASSERT_EQ(OK, status)
+            << "publisher enableMessageRing should return OK";
+
+    // The ring fills up after the first four historical samples.
+    ASSERT_NO_FATAL_FAILURE(PublishMoveSamples(0, sampleCount, &status, &published));
+    ASSERT_EQ(WOULD_BLOCK, status)
+            << "publisher endBatch should return WOULD_BLOCK when the ring is full";
+    ASSERT_EQ(4U, published)
+            << "publisher endBatch should have published the samples that fit in the ring";
+    ASSERT_NO_FATAL_FAILURE(ConsumeMoveSamples(&consumedCount));
+    ASSERT_EQ(4U, consumedCount);
+
+    // Finishing the historical samples makes room for the rest of the move.
+    ASSERT_NO_FATAL_FAILURE(PublishMoveSamples(published, sampleCount, &status, &published));
+    ASSERT_EQ(OK, status)
+            << "publisher endBatch should return OK once the ring has room";
+    ASSERT_EQ(2U, published);
+    ASSERT_NO_FATAL_FAILURE(ConsumeMoveSamples(&consumedCount));
+    ASSERT_EQ(sampleCount, consumedCount);
+}
+
+TEST_F(InputPublisherAndConsumerTest, Consume_WhenInvalidMessageFollowsEvent_ReportsError) {
+    status_t status;
+    status = mPublisher->publishKeyEvent(1, 1, AINPUT_SOURCE_KEYBOARD,
+            AKEY_EVENT_ACTION_DOWN, 0, AKEYCODE_A, 0, 0, 0, 0, 0);
+    ASSERT_EQ(OK, status)
+            << "publisher publishKeyEvent should return OK";
+
+    // A motion event without pointers is rejected by the consumer.
+    InputMessage invalidMsg;
+    memset(&invalidMsg, 0, sizeof(invalidMsg));
+    invalidMsg.header.type = InputMessage::TYPE_MOTION;
+    invalidMsg.body.motion.seq = 2;
+    invalidMsg.body.motion.pointerCount = 0;
+    ASSERT_EQ(OK, serverChannel->sendMessage(&invalidMsg));
+
+    uint32_t consumeSeq;
+    InputEvent* event;
+    int32_t displayId;
+    status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1, &consumeSeq, &event,
+            &displayId);
+    ASSERT_EQ(OK, status)
+            << "consumer consume should return the event read before the invalid message";
+    EXPECT_EQ(1U, consumeSeq);
+
+    status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1, &consumeSeq, &event,
+            &displayId);
+    ASSERT_EQ(BAD_VALUE, status)
+            << "consumer consume should report the invalid message afterwards";
+    status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1, &consumeSeq, &event,
+            &displayId);
+    ASSERT_EQ(BAD_VALUE, status)
+            << "consumer consume should keep reporting the invalid message";
+}
+
+TEST_F(InputPublisherAndConsumerTest, EnableMessageRing_EventsGoThroughTheRing) {
+    status_t status;
+    uint32_t consumeSeq;
+    InputEvent* event;
+    int32_t displayId;
+
+    // An event published before the ring is set up still comes first.
+    status = mPublisher->publishKeyEvent(1, 1, AINPUT_SOURCE_KEYBOARD,
+            AKEY_EVENT_ACTION_DOWN, 0, AKEYCODE_A, 0, 0, 0, 0, 0);
+    ASSERT_EQ(OK, status)
+            << "publisher publishKeyEvent should return OK";
+
+    status = mPublisher->enableMessageRing(4);
+    ASSERT_EQ(OK, status)
+            << "publisher enableMessageRing should return OK";
+    ASSERT_TRUE(mPublisher->isMessageRingEnabled());
+    status = mPublisher->enableMessageRing(4);
+    ASSERT_EQ(INVALID_OPERATION, status)
+            << "publisher enableMessageRing should return INVALID_OPERATION the second time";
+
+    for (size_t i = 1; i < 5; i++) {
+        status = mPublisher->publishKeyEvent(i + 1, 1, AINPUT_SOURCE_KEYBOARD,
+                AKEY_EVENT_ACTION_DOWN, 0, AKEYCODE_A + i, 0, 0, 0, 0, 0);
+        ASSERT_EQ(OK, status)
+                << "publisher publishKeyEvent should return OK";
+    }
+    status = mPublisher->publishKeyEvent(6, 1, AINPUT_SOURCE_KEYBOARD,
+            AKEY_EVENT_ACTION_DOWN, 0, AKEYCODE_A, 0, 0, 0, 0, 0);
+    ASSERT_EQ(WOULD_BLOCK, status)
+            << "publisher publishKeyEvent should return WOULD_BLOCK when the ring is full";
+
+    for (size_t i = 0; i < 5; i++) {
+        status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1, &consumeSeq,
+                &event, &displayId);
+        ASSERT_EQ(OK, status)
+                << "consumer consume should return OK";
+        ASSERT_TRUE(event != NULL)
+                << "consumer should have returned non-NULL event";
+        ASSERT_EQ(AINPUT_EVENT_TYPE_KEY, event->getType())
+                << "consumer should have returned a key event";
+        EXPECT_EQ(i + 1, consumeSeq)
+                << "consumer should return the events in order";
+        EXPECT_EQ(int32_t(AKEYCODE_A + i), static_cast<KeyEvent*>(event)->getKeyCode());
+
+        status = mConsumer->sendFinishedSignal(consumeSeq, true);
+        ASSERT_EQ(OK, status)
+                << "consumer sendFinishedSignal should return OK";
+        uint32_t finishedSeq;
+        bool handled;
+        status = mPublisher->receiveFinishedSignal(&finishedSeq, &handled);
+        ASSERT_EQ(OK, status)
+                << "publisher receiveFinishedSignal should return OK";
+        ASSERT_EQ(consumeSeq, finishedSeq)
+                << "publisher receiveFinishedSignal should have returned the original sequence number";
+    }
+
+    status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1, &consumeSeq, &event,
+            &displayId);
+    ASSERT_EQ(WOULD_BLOCK, status)
+            << "consumer consume should return WOULD_BLOCK once all events are consumed";
+
+    // The consumer is waiting again, so the next event must make its fd readable.
+    status = mPublisher->publishKeyEvent(7, 1, AINPUT_SOURCE_KEYBOARD,
+            AKEY_EVENT_ACTION_UP, 0, AKEYCODE_A, 0, 0, 0, 0, 0);
+    ASSERT_EQ(OK, status)
+            << "publisher publishKeyEvent should return OK once the ring has room";
+    struct pollfd pfd;
+    pfd.fd = clientChannel->getFd();
+    pfd.events = POLLIN;
+    ASSERT_EQ(1, poll(&pfd, 1, 0))
+            << "publisher should have woken up the waiting consumer";
+    status = mConsumer->consume(&mEventFactory, true /*consumeBatches*/, -1, &consumeSeq, &event,
+            &displayId);
+    ASSERT_EQ(OK, status)
+            << "consumer consume should return OK";
+    EXPECT_EQ(7U, consumeSeq);
+}
+
 } // namespace android
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <input/Input.h>
+#include <input/InputMessageRing.h>
+#include <input/InputTransport.h>
+
+using namespace android;
+
+// Publishes bursts of state.range(0) touch moves, as the dispatcher does for a
+// window that fell behind, and consumes them the way an application does on
+// its next frame: as one batch, then finishing every event of the batch.
+static void publishAndConsumeBursts(benchmark::State& state, bool useMessageRing) {
+    sp<InputChannel> serverChannel, clientChannel;
+    InputChannel::openInputChannelPair(String8("benchmark"), serverChannel, clientChannel);
+    InputPublisher publisher(serverChannel);
+    InputConsumer consumer(clientChannel);
+    PreallocatedInputEventFactory eventFactory;
+    if (useMessageRing && publisher.enableMessageRing(InputMessageRing::MAX_CAPACITY)) {
+        state.SkipWithError("Could not enable the message ring");
+        return;
+    }
+
+    PointerProperties pointerProperties;
+    pointerProperties.clear();
+    PointerCoords pointerCoords;
+    pointerCoords.clear();
+
+    const size_t burstSize = size_t(state.range(0));
+    uint32_t seq = 0;
+    nsecs_t eventTime = 0;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < burstSize; i++) {
+            eventTime += 1000000;
+            pointerCoords.setAxisValue(AMOTION_EVENT_AXIS_X, float(i));
+            pointerCoords.setAxisValue(AMOTION_EVENT_AXIS_Y, float(i));
+            publisher.publishMotionEvent(++seq, 1, AINPUT_SOURCE_TOUCHSCREEN, 0,
+                    AMOTION_EVENT_ACTION_MOVE, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, eventTime,
+                    1, &pointerProperties, &pointerCoords);
+        }
+
+        uint32_t consumeSeq;
+        InputEvent* event;
+        int32_t displayId;
+        while (consumer.consume(&eventFactory, true /*consumeBatches*/, -1, &consumeSeq,
+                &event, &displayId) == OK) {
+            consumer.sendFinishedSignal(consumeSeq, true);
+        }
+
+        uint32_t finishedSeq;
+        bool handled;
+        while (publisher.receiveFinishedSignal(&finishedSeq, &handled) == OK) {
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(burstSize));
+}
+
+static void BM_SocketTransport(benchmark::State& state) {
+    publishAndConsumeBursts(state, false);
+}
+BENCHMARK(BM_SocketTransport)->Arg(1)->Arg(8)->Arg(32);
+
+static void BM_RingTransport(benchmark::State& state) {
+    publishAndConsumeBursts(state, true);
+}
+BENCHMARK(BM_RingTransport)->Arg(1)->Arg(8)->Arg(32);
+
+BENCHMARK_MAIN();
@@ -19,6 +19,9 @@
 #include <inttypes.h>
 #include <limits.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <utils/Log.h>
 #include <utils/String8.h>
 #include <utils/CallStack.h>
@@ -28,6 +31,7 @@
 #include <ui/Point.h>
 
 #include <private/ui/RegionHelper.h>
+#include <private/ui/RegionSimd.h>
 
 // ----------------------------------------------------------------------------
 #define VALIDATE_REGIONS        (false)
@@ -57,6 +61,81 @@ const Region Region::INVALID_REGION(Rect::INVALID_RECT);
 
 // ----------------------------------------------------------------------------
 
+Region::Storage::Storage(const Storage& rhs)
+    : mSize(rhs.mSize), mHeap(rhs.mHeap)
+{
+    if (isInline()) {
+        std::copy(rhs.mInline, rhs.mInline + mSize, mInline);
+    }
+}
+
+Region::Storage& Region::Storage::operator = (const Storage& rhs)
+{
+    if (this != &rhs) {
+        mSize = rhs.mSize;
+        mHeap = rhs.mHeap;
+        if (isInline()) {
+            std::copy(rhs.mInline, rhs.mInline + mSize, mInline);
+        }
+    }
+    return *this;
+}
+
+void Region::Storage::clear()
+{
+    mSize = 0;
+    mHeap.clear();
+}
+
+void Region::Storage::spill(size_t extra)
+{
+    mHeap.clear();
+    mHeap.setCapacity(mSize + extra);
+    mHeap.appendArray(mInline, mSize);
+}
+
+void Region::Storage::add(const Rect& rect)
+{
+    if (mSize < INLINE_CAPACITY) {
+        mInline[mSize] = rect;
+    } else {
+        if (isInline()) {
+            spill(1);
+        }
+        mHeap.add(rect);
+    }
+    mSize++;
+}
+
+void Region::Storage::appendArray(const Rect* rects, size_t count)
+{
+    if (mSize + count <= INLINE_CAPACITY) {
+        std::copy(rects, rects + count, mInline + mSize);
+    } else {
+        if (isInline()) {
+            spill(count);
+        }
+        mHeap.appendArray(rects, count);
+    }
+    mSize += count;
+}
+
+void Region::Storage::insertAt(const Rect& rect, size_t index)
+{
+    if (mSize < INLINE_CAPACITY) {
+        std::copy_backward(mInline + index, mInline + mSize, mInline + mSize + 1);
+        mInline[index] = rect;
+    } else {
+        if (isInline()) {
+            spill(1);
+        }
+        mHeap.insertAt(rect, index, 1);
+    }
+    mSize++;
+}
+
+// ----------------------------------------------------------------------------
+
 Region::Region() {
     mStorage.add(Rect(0,0));
 }
@@ -91,8 +170,9 @@ Region::~Region()
  * final, correctly ordered region buffer. Each rectangle will be compared with the span directly
  * above it, and subdivided to resolve any remaining T-junctions.
  */
+template<typename RECTS>
 static void reverseRectsResolvingJunctions(const Rect* begin, const Rect* end,
-        Vector<Rect>& dst, int spanDirection) {
+        RECTS& dst, int spanDirection) {
     dst.clear();
 
     const Rect* current = end - 1;
@@ -268,16 +348,39 @@ void Region::set(uint32_t w, uint32_t h)
 }
 
 bool Region::isTriviallyEqual(const Region& region) const {
+    if (mStorage.isInline() && region.mStorage.isInline()) {
+        // inline rects are never shared, but they are cheap to compare
+        return hasSameRects(region);
+    }
     return begin() == region.begin();
 }
 
+bool Region::hasSameRects(const Region& other) const {
+    if (begin() == other.begin()) {
+        return true;
+    }
+    size_t thisRectCount = 0;
+    size_t otherRectCount = 0;
+    Rect const* thisRects = getArray(&thisRectCount);
+    Rect const* otherRects = other.getArray(&otherRectCount);
+    if (thisRectCount != otherRectCount) {
+        return false;
+    }
+    for (size_t i = 0; i < thisRectCount; i++) {
+        if (thisRects[i] != otherRects[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 // ----------------------------------------------------------------------------
 
 void Region::addRectUnchecked(int l, int t, int r, int b)
 {
     Rect rect(l,t,r,b);
     size_t where = mStorage.size() - 1;
-    mStorage.insertAt(rect, where, 1);
+    mStorage.insertAt(rect, where);
 }
 
 // ----------------------------------------------------------------------------
@@ -413,15 +516,56 @@ const Region Region::operation(const Region& rhs, int dx, int dy, uint32_t op) c
 
 // ----------------------------------------------------------------------------
 
+// The span being rasterized. Short spans are kept inline. Once a span
+// doesn't fit, the rects move to a heap buffer that is kept, with its
+// capacity, for the following spans of the same rasterizer.
+class SpanBuffer
+{
+public:
+    SpanBuffer() : mSize(0), mOnHeap(false) { }
+
+    inline size_t size() const { return mOnHeap ? mHeap.size() : mSize; }
+    inline const Rect* array() const { return mOnHeap ? mHeap.data() : mInline; }
+    inline Rect* editArray() { return mOnHeap ? mHeap.data() : mInline; }
+    inline const Rect& operator [] (size_t index) const { return array()[index]; }
+    inline const Rect& itemAt(size_t index) const { return array()[index]; }
+    inline const Rect& top() const { return array()[size() - 1]; }
+
+    void add(const Rect& rect) {
+        if (!mOnHeap) {
+            if (mSize < INLINE_CAPACITY) {
+                mInline[mSize++] = rect;
+                return;
+            }
+            mHeap.assign(mInline, mInline + mSize);
+            mOnHeap = true;
+        }
+        mHeap.push_back(rect);
+    }
+
+    void clear() {
+        mSize = 0;
+        mHeap.clear();
+    }
+
+private:
+    static constexpr size_t INLINE_CAPACITY = 8;
+
+    size_t mSize;
+    bool mOnHeap;
+    Rect mInline[INLINE_CAPACITY];
+    std::vector<Rect> mHeap;
+};
+
 // This is our region rasterizer, which merges rects and spans together
 // to obtain an optimal region.
 class Region::rasterizer : public region_operator<Rect>::region_rasterizer
 {
     Rect bounds;
-    Vector<Rect>& storage;
+    Storage& storage;
     Rect* head;
     Rect* tail;
-    Vector<Rect> span;
+    SpanBuffer span;
     Rect* cur;
 public:
     explicit rasterizer(Region& reg)
@@ -480,18 +624,10 @@ void Region::rasterizer::flushSpan()
 {
     bool merge = false;
     if (tail-head == ssize_t(span.size())) {
-        Rect const* p = span.editArray();
+        Rect const* p = span.array();
         Rect const* q = head;
         if (p->top == q->bottom) {
-            merge = true;
-            while (q != tail) {
-                if ((p->left != q->left) || (p->right != q->right)) {
-                    merge = false;
-                    break;
-                }
-                p++;
-                q++;
-            }
+            merge = region_simd::spansHaveSameEdges(p, q, span.size());
         }
     }
     if (merge) {
@@ -504,7 +640,7 @@ void Region::rasterizer::flushSpan()
     } else {
         bounds.left = min(span.itemAt(0).left, bounds.left);
         bounds.right = max(span.top().right, bounds.right);
-        storage.appendVector(span);
+        storage.appendArray(span.array(), span.size());
         tail = storage.editArray() + storage.size();
         head = tail - span.size();
     }
@@ -593,6 +729,14 @@ void Region::boolean_operation(uint32_t op, Region& dst,
     validate(dst, "boolean_operation (before): dst");
 #endif
 
+#if !VALIDATE_WITH_CORECG && !VALIDATE_REGIONS
+    if (op == op_and && rhs.isRect()) {
+        // intersecting with a single rect doesn't need the full span walk
+        boolean_operation(op, dst, lhs, rhs.getBounds(), dx, dy);
+        return;
+    }
+#endif
+
     size_t lhs_count;
     Rect const * const lhs_rects = lhs.getArray(&lhs_count);
 
@@ -711,6 +855,17 @@ void Region::boolean_operation(uint32_t op, Region& dst,
     size_t lhs_count;
     Rect const * const lhs_rects = lhs.getArray(&lhs_count);
 
+    if (op == op_and) {
+        // The intersection of each rect with rhs keeps the spans sorted, so
+        // they can be clipped independently and fed straight to the
+        // rasterizer, which coalesces the spans that became identical.
+        Rect clip(rhs);
+        clip.offsetBy(dx, dy);
+        rasterizer r(dst);
+        region_simd::clipRects(lhs_rects, lhs_count, clip, r);
+        return;
+    }
+
     region_operator<Rect>::region lhs_region(lhs_rects, lhs_count);
     region_operator<Rect>::region rhs_region(&rhs, 1, dx, dy);
     region_operator<Rect> operation(op, lhs_region, rhs_region);
@@ -740,13 +895,7 @@ void Region::translate(Region& reg, int dx, int dy)
 #if VALIDATE_REGIONS
         validate(reg, "translate (before)");
 #endif
-        size_t count = reg.mStorage.size();
-        Rect* rects = reg.mStorage.editArray();
-        while (count) {
-            rects->offsetBy(dx, dy);
-            rects++;
-            count--;
-        }
+        region_simd::offsetRects(reg.mStorage.editArray(), reg.mStorage.size(), dx, dy);
 #if VALIDATE_REGIONS
         validate(reg, "translate (after)");
 #endif
@@ -810,7 +959,7 @@ status_t Region::unflatten(void const* buffer, size_t size) {
             return status;
         }
         FlattenableUtils::advance(buffer, size, sizeof(rect));
-        result.mStorage.push_back(rect);
+        result.mStorage.add(rect);
     }
 
 #if VALIDATE_REGIONS
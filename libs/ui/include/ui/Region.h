@@ -113,9 +113,14 @@ public:
     inline  Region&     operator += (const Point& pt);
 
 
-    // returns true if the regions share the same underlying storage
+    // returns true if the regions share the same underlying storage, or are
+    // both small enough to be stored inline and consist of the same rects.
+    // false doesn't mean the rects differ, use hasSameRects() for that
     bool isTriviallyEqual(const Region& region) const;
 
+    // returns true if the regions consist of exactly the same rects
+    bool hasSameRects(const Region& region) const;
+
 
     /* various ways to access the rectangle list */
 
@@ -144,6 +149,48 @@ public:
     void        dump(const char* what, uint32_t flags=0) const;
 
 private:
+    // Sorted array of Rects backing a Region. Regions of up to four rects
+    // (plus their bounds) keep them inline, which avoids a heap allocation
+    // for the overwhelmingly common case; larger regions use a
+    // copy-on-write Vector.
+    //
+    // ABI note: the inline rects make sizeof(Region) larger than the plain
+    // Vector<Rect> it replaces. libui is part of the VNDK, so vendor modules
+    // that embed a Region or inline its methods have to be rebuilt against
+    // this header, and the VNDK ABI reference dump of libui updated.
+    class Storage {
+    public:
+        Storage() : mSize(0) { }
+        Storage(const Storage& rhs);
+        Storage& operator = (const Storage& rhs);
+
+        inline size_t size() const { return mSize; }
+        inline bool isInline() const { return mSize <= INLINE_CAPACITY; }
+
+        inline const Rect* array() const { return isInline() ? mInline : mHeap.array(); }
+        inline Rect* editArray() { return isInline() ? mInline : mHeap.editArray(); }
+        inline const Rect* begin() const { return array(); }
+        inline const Rect* end() const { return array() + mSize; }
+        inline const Rect& operator [] (size_t index) const { return array()[index]; }
+        inline const Rect& itemAt(size_t index) const { return array()[index]; }
+        inline const Rect& top() const { return array()[mSize - 1]; }
+
+        void clear();
+        void add(const Rect& rect);
+        void appendArray(const Rect* rects, size_t count);
+        void insertAt(const Rect& rect, size_t index);
+
+    private:
+        static constexpr size_t INLINE_CAPACITY = 5;
+
+        // moves the inline rects to mHeap, making room for extra more
+        void spill(size_t extra);
+
+        size_t mSize;
+        Rect mInline[INLINE_CAPACITY];
+        Vector<Rect> mHeap;
+    };
+
     class rasterizer;
     friend class rasterizer;
 
@@ -174,7 +221,7 @@ private:
     // with an extra Rect as the last element which is set to the
     // bounds of the region. However, if the region is
     // a simple Rect then mStorage contains only that rect.
-    Vector<Rect> mStorage;
+    Storage mStorage;
 };
 
 
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <benchmark/benchmark.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+using namespace android;
+
+// Builds a staircase of overlapping windows, which yields a region made of
+// several hundred rects once the overlaps are resolved.
+static Region makeComplexRegion(int windows, int offset) {
+    Region region;
+    srandom(static_cast<unsigned>(windows + offset));
+    for (int i = 0; i < windows; i++) {
+        const int left = offset + static_cast<int>(random() % 1400);
+        const int top = offset + static_cast<int>(random() % 2500);
+        region.orSelf(Rect(left, top, left + 16 + static_cast<int>(random() % 200),
+                top + 16 + static_cast<int>(random() % 200)));
+    }
+    return region;
+}
+
+static void BM_RegionOr(benchmark::State& state) {
+    const Region lhs(makeComplexRegion(static_cast<int>(state.range(0)), 0));
+    const Region rhs(makeComplexRegion(static_cast<int>(state.range(0)), 7));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(lhs.merge(rhs));
+    }
+}
+BENCHMARK(BM_RegionOr)->Arg(16)->Arg(64)->Arg(256);
+
+static void BM_RegionAnd(benchmark::State& state) {
+    const Region lhs(makeComplexRegion(static_cast<int>(state.range(0)), 0));
+    const Region rhs(makeComplexRegion(static_cast<int>(state.range(0)), 7));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(lhs.intersect(rhs));
+    }
+}
+BENCHMARK(BM_RegionAnd)->Arg(16)->Arg(64)->Arg(256);
+
+static void BM_RegionSubtract(benchmark::State& state) {
+    const Region lhs(makeComplexRegion(static_cast<int>(state.range(0)), 0));
+    const Region rhs(makeComplexRegion(static_cast<int>(state.range(0)), 7));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(lhs.subtract(rhs));
+    }
+}
+BENCHMARK(BM_RegionSubtract)->Arg(16)->Arg(64)->Arg(256);
+
+static void BM_RegionAndRect(benchmark::State& state) {
+    const Region lhs(makeComplexRegion(static_cast<int>(state.range(0)), 0));
+    const Rect clip(100, 100, 1340, 2460);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(lhs.intersect(clip));
+    }
+}
+BENCHMARK(BM_RegionAndRect)->Arg(16)->Arg(64)->Arg(256);
+
+static void BM_RegionTranslate(benchmark::State& state) {
+    Region region(makeComplexRegion(static_cast<int>(state.range(0)), 0));
+    while (state.KeepRunning()) {
+        region.translateSelf(1, -1);
+        region.translateSelf(-1, 1);
+    }
+}
+BENCHMARK(BM_RegionTranslate)->Arg(16)->Arg(64)->Arg(256);
+
+BENCHMARK_MAIN();
@@ -152,5 +152,86 @@ TEST_F(RegionTest, Random_TJunction) {
     }
 }
 
+TEST_F(RegionTest, HasSameRects) {
+    Region a;
+    a.orSelf(Rect(0, 0, 10, 10));
+    a.orSelf(Rect(5, 5, 20, 20));
+
+    Region b;
+    b.orSelf(Rect(0, 0, 10, 10));
+    b.orSelf(Rect(5, 5, 20, 20));
+    // small regions are stored inline and compared by value
+    EXPECT_TRUE(a.isTriviallyEqual(b));
+    EXPECT_TRUE(a.hasSameRects(b));
+    EXPECT_TRUE(a.hasSameRects(a));
+
+    // heap backed regions built separately don't share their storage
+    Region c, d;
+    for (int i = 0; i < 6; i++) {
+        c.orSelf(Rect(i * 2, 0, i * 2 + 1, 1));
+        d.orSelf(Rect(i * 2, 0, i * 2 + 1, 1));
+    }
+    EXPECT_FALSE(c.isTriviallyEqual(d));
+    EXPECT_TRUE(c.hasSameRects(d));
+
+    b.subtractSelf(Rect(0, 0, 1, 1));
+    EXPECT_FALSE(a.hasSameRects(b));
+    EXPECT_TRUE(Region().hasSameRects(Region()));
+}
+
+TEST_F(RegionTest, IntersectWithRect) {
+    Region r;
+    srandom(54321);
+
+    for (int iter = 0; iter < ITER_MAX; iter++) {
+        r.clear();
+        for (int i = 0; i < X_MAX; i++) {
+            for (int j = 0; j < Y_MAX; j++) {
+                if (random() % 2) {
+                    r.orSelf(Rect(i, j, i + 1, j + 1));
+                }
+            }
+        }
+        const int left = random() % X_MAX;
+        const int top = random() % Y_MAX;
+        const Rect clip(left, top, left + 1 + random() % X_MAX, top + 1 + random() % Y_MAX);
+
+        // A & clip == A - (A - clip), the latter going through the
+        // general span walk
+        const Region expected(r.subtract(r.subtract(clip)));
+        EXPECT_TRUE(r.intersect(clip).hasSameRects(expected));
+        EXPECT_TRUE(r.intersect(Region(clip)).hasSameRects(expected));
+    }
+}
+
+TEST_F(RegionTest, InlineAndHeapStorage) {
+    Region r;
+    // | x x x x x x |
+    for (int i = 0; i < 6; i++) {
+        r.orSelf(Rect(i * 2, 0, i * 2 + 1, 1));
+
+        size_t count = 0;
+        r.getArray(&count);
+        EXPECT_EQ(size_t(i + 1), count);
+        EXPECT_EQ(Rect(0, 0, i * 2 + 1, 1), r.getBounds());
+    }
+
+    // copies of a heap backed region share their storage
+    Region copy(r);
+    EXPECT_TRUE(copy.isTriviallyEqual(r));
+    copy.orSelf(Rect(0, 0, 12, 1));
+    EXPECT_FALSE(copy.isTriviallyEqual(r));
+    EXPECT_TRUE(copy.isRect());
+
+    // and copies of an inline one compare equal by value
+    Region small(Rect(0, 0, 4, 4));
+    Region other(Rect(0, 0, 4, 4));
+    EXPECT_TRUE(small.isTriviallyEqual(other));
+
+    r.subtractSelf(Rect(2, 0, 12, 1));
+    EXPECT_TRUE(r.isRect());
+    EXPECT_EQ(Rect(0, 0, 1, 1), r.getBounds());
+}
+
 }; // namespace android
 
@@ -46,11 +46,14 @@
 #include "InputDispatcher.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <cutils/properties.h>
 #include <log/log.h>
 #include <utils/Trace.h>
 #include <powermanager/PowerManager.h>
@@ -88,6 +91,10 @@ const nsecs_t SLOW_EVENT_PROCESSING_WARNING_TIMEOUT = 2000 * 1000000LL; // 2sec
 // Number of recent events to keep for debugging purposes.
 const size_t RECENT_QUEUE_MAX_SIZE = 10;
 
+// Number of events each connection can have in flight in its shared memory ring, when
+// rings are enabled.  A few frames of touch samples at high sampling rates.
+const uint32_t MESSAGE_RING_CAPACITY = 64;
+
 static inline nsecs_t now() {
     return systemTime(SYSTEM_TIME_MONOTONIC);
 }
@@ -176,6 +183,26 @@ static bool isMainDisplay(int32_t displayId) {
     return displayId == ADISPLAY_ID_DEFAULT || displayId == ADISPLAY_ID_NONE;
 }
 
+// Returns the coords to send to a target, which are either pointerCoords or the copies
+// of them scaled or cleared in outCoords.
+static const PointerCoords* transformPointerCoords(const PointerCoords* pointerCoords,
+        uint32_t pointerCount, float scaleFactor, bool zeroCoords, PointerCoords* outCoords) {
+    if (zeroCoords) {
+        for (uint32_t i = 0; i < pointerCount; i++) {
+            outCoords[i].clear();
+        }
+        return outCoords;
+    }
+    if (scaleFactor != 1.0f) {
+        for (uint32_t i = 0; i < pointerCount; i++) {
+            outCoords[i] = pointerCoords[i];
+            outCoords[i].scale(scaleFactor);
+        }
+        return outCoords;
+    }
+    return pointerCoords;
+}
+
 static void dumpRegion(String8& dump, const Region& region) {
     if (region.isEmpty()) {
         dump.append("<empty>");
@@ -211,6 +238,10 @@ InputDispatcher::InputDispatcher(const sp<InputDispatcherPolicyInterface>& polic
     mKeyRepeatState.lastKeyEntry = NULL;
 
     policy->getDispatcherConfiguration(&mConfig);
+
+    // Events go to applications through shared memory rings instead of the sockets
+    // of their input channels when this is set.
+    mUseMessageRings = property_get_bool("ro.input.message_ring", false);
 }
 
 InputDispatcher::~InputDispatcher() {
@@ -475,27 +506,11 @@ void InputDispatcher::addRecentEventLocked(EventEntry* entry) {
 
 sp<InputWindowHandle> InputDispatcher::findTouchedWindowAtLocked(int32_t displayId,
         int32_t x, int32_t y) {
-    // Traverse windows from front to back to find touched window.
-    size_t numWindows = mWindowHandles.size();
-    for (size_t i = 0; i < numWindows; i++) {
-        sp<InputWindowHandle> windowHandle = mWindowHandles.itemAt(i);
-        const InputWindowInfo* windowInfo = windowHandle->getInfo();
-        if (windowInfo->displayId == displayId) {
-            int32_t flags = windowInfo->layoutParamsFlags;
-
-            if (windowInfo->visible) {
-                if (!(flags & InputWindowInfo::FLAG_NOT_TOUCHABLE)) {
-                    bool isTouchModal = (flags & (InputWindowInfo::FLAG_NOT_FOCUSABLE
-                            | InputWindowInfo::FLAG_NOT_TOUCH_MODAL)) == 0;
-                    if (isTouchModal || windowInfo->touchableRegionContainsPoint(x, y)) {
-                        // Found window.
-                        return windowHandle;
-                    }
-                }
-            }
-        }
+    ssize_t index = mWindowIndex.findTouchedWindow(displayId, x, y);
+    if (index < 0) {
+        return NULL;
     }
-    return NULL;
+    return mWindowIndex.getWindowHandle(index);
 }
 
 void InputDispatcher::dropInboundEventLocked(EventEntry* entry, DropReason dropReason) {
@@ -1205,33 +1220,22 @@ int32_t InputDispatcher::findTouchedWindowTargetsLocked(nsecs_t currentTime,
         int32_t y = int32_t(entry->pointerCoords[pointerIndex].
                 getAxisValue(AMOTION_EVENT_AXIS_Y));
         sp<InputWindowHandle> newTouchedWindowHandle;
-        bool isTouchModal = false;
 
-        // Traverse windows from front to back to find touched window and outside targets.
-        size_t numWindows = mWindowHandles.size();
-        for (size_t i = 0; i < numWindows; i++) {
-            sp<InputWindowHandle> windowHandle = mWindowHandles.itemAt(i);
-            const InputWindowInfo* windowInfo = windowHandle->getInfo();
-            if (windowInfo->displayId != displayId) {
-                continue; // wrong display
-            }
-
-            int32_t flags = windowInfo->layoutParamsFlags;
-            if (windowInfo->visible) {
-                if (! (flags & InputWindowInfo::FLAG_NOT_TOUCHABLE)) {
-                    isTouchModal = (flags & (InputWindowInfo::FLAG_NOT_FOCUSABLE
-                            | InputWindowInfo::FLAG_NOT_TOUCH_MODAL)) == 0;
-                    if (isTouchModal || windowInfo->touchableRegionContainsPoint(x, y)) {
-                        newTouchedWindowHandle = windowHandle;
-                        break; // found touched window, exit window loop
-                    }
-                }
+        // Find the touched window, and the windows in front of it that watch
+        // outside touches.
+        ssize_t touchedIndex = mWindowIndex.findTouchedWindow(displayId, x, y);
+        if (touchedIndex >= 0) {
+            newTouchedWindowHandle = mWindowIndex.getWindowHandle(touchedIndex);
+        }
 
-                if (maskedAction == AMOTION_EVENT_ACTION_DOWN
-                        && (flags & InputWindowInfo::FLAG_WATCH_OUTSIDE_TOUCH)) {
-                    mTempTouchState.addOrUpdateWindow(
-                            windowHandle, InputTarget::FLAG_DISPATCH_AS_OUTSIDE, BitSet32(0));
+        if (maskedAction == AMOTION_EVENT_ACTION_DOWN) {
+            const Vector<size_t>& watchers = mWindowIndex.getOutsideTouchWatchers(displayId);
+            for (size_t i = 0; i < watchers.size(); i++) {
+                if (touchedIndex >= 0 && watchers.itemAt(i) >= size_t(touchedIndex)) {
+                    break;
                 }
+                mTempTouchState.addOrUpdateWindow(mWindowIndex.getWindowHandle(watchers.itemAt(i)),
+                        InputTarget::FLAG_DISPATCH_AS_OUTSIDE, BitSet32(0));
             }
         }
 
@@ -1618,25 +1622,9 @@ bool InputDispatcher::checkInjectionPermission(const sp<InputWindowHandle>& wind
 
 bool InputDispatcher::isWindowObscuredAtPointLocked(
         const sp<InputWindowHandle>& windowHandle, int32_t x, int32_t y) const {
-    int32_t displayId = windowHandle->getInfo()->displayId;
-    size_t numWindows = mWindowHandles.size();
-    for (size_t i = 0; i < numWindows; i++) {
-        sp<InputWindowHandle> otherHandle = mWindowHandles.itemAt(i);
-        if (otherHandle == windowHandle) {
-            break;
-        }
-
-        const InputWindowInfo* otherInfo = otherHandle->getInfo();
-        if (otherInfo->displayId == displayId
-                && otherInfo->visible && !otherInfo->isTrustedOverlay()
-                && otherInfo->frameContainsPoint(x, y)) {
-            return true;
-        }
-    }
-    return false;
+    return mWindowIndex.isObscuredAtPoint(windowHandle, x, y);
 }
 
-
 bool InputDispatcher::isWindowObscuredLocked(const sp<InputWindowHandle>& windowHandle) const {
     int32_t displayId = windowHandle->getInfo()->displayId;
     const InputWindowInfo* windowInfo = windowHandle->getInfo();
@@ -1965,13 +1953,19 @@ void InputDispatcher::startDispatchCycleLocked(nsecs_t currentTime,
             connection->getInputChannelName());
 #endif
 
-    while (connection->status == Connection::STATUS_NORMAL
-            && !connection->outboundQueue.isEmpty()) {
-        DispatchEntry* dispatchEntry = connection->outboundQueue.head;
+    if (connection->status != Connection::STATUS_NORMAL
+            || connection->outboundQueue.isEmpty()) {
+        return;
+    }
+
+    // Queue up the whole outbound queue and send it with as few system calls as possible.
+    status_t status = OK;
+    connection->inputPublisher.beginBatch();
+    for (DispatchEntry* dispatchEntry = connection->outboundQueue.head; dispatchEntry;
+            dispatchEntry = dispatchEntry->next) {
         dispatchEntry->deliveryTime = currentTime;
 
         // Publish the event.
-        status_t status;
         EventEntry* eventEntry = dispatchEntry->eventEntry;
         switch (eventEntry->type) {
         case EventEntry::TYPE_KEY: {
@@ -1991,34 +1985,47 @@ void InputDispatcher::startDispatchCycleLocked(nsecs_t currentTime,
             MotionEntry* motionEntry = static_cast<MotionEntry*>(eventEntry);
 
             PointerCoords scaledCoords[MAX_POINTERS];
-            const PointerCoords* usingCoords = motionEntry->pointerCoords;
 
             // Set the X and Y offset depending on the input source.
             float xOffset, yOffset;
+            float scaleFactor = 1.0f;
+            bool zeroCoords = false;
             if ((motionEntry->source & AINPUT_SOURCE_CLASS_POINTER)
                     && !(dispatchEntry->targetFlags & InputTarget::FLAG_ZERO_COORDS)) {
-                float scaleFactor = dispatchEntry->scaleFactor;
+                scaleFactor = dispatchEntry->scaleFactor;
                 xOffset = dispatchEntry->xOffset * scaleFactor;
                 yOffset = dispatchEntry->yOffset * scaleFactor;
-                if (scaleFactor != 1.0f) {
-                    for (uint32_t i = 0; i < motionEntry->pointerCount; i++) {
-                        scaledCoords[i] = motionEntry->pointerCoords[i];
-                        scaledCoords[i].scale(scaleFactor);
-                    }
-                    usingCoords = scaledCoords;
-                }
             } else {
                 xOffset = 0.0f;
                 yOffset = 0.0f;
 
                 // We don't want the dispatch target to know.
-                if (dispatchEntry->targetFlags & InputTarget::FLAG_ZERO_COORDS) {
-                    for (uint32_t i = 0; i < motionEntry->pointerCount; i++) {
-                        scaledCoords[i].clear();
-                    }
-                    usingCoords = scaledCoords;
+                zeroCoords = dispatchEntry->targetFlags & InputTarget::FLAG_ZERO_COORDS;
+            }
+
+            // Publish the samples coalesced into a move first, as separate messages that
+            // the consumer batches back together.  Only the event itself is waited on.
+            size_t historySize = motionEntry->getHistorySize();
+            for (size_t h = historySize - dispatchEntry->getUnpublishedHistorySize();
+                    h < historySize; h++) {
+                status = connection->inputPublisher.publishMotionEvent(DispatchEntry::nextSeq(),
+                        motionEntry->deviceId, motionEntry->source, motionEntry->displayId,
+                        dispatchEntry->resolvedAction, motionEntry->actionButton,
+                        dispatchEntry->resolvedFlags, motionEntry->edgeFlags,
+                        motionEntry->metaState, motionEntry->buttonState,
+                        xOffset, yOffset, motionEntry->xPrecision, motionEntry->yPrecision,
+                        motionEntry->downTime, motionEntry->historicalEventTimes.itemAt(h),
+                        motionEntry->pointerCount, motionEntry->pointerProperties,
+                        transformPointerCoords(motionEntry->getHistoricalPointerCoords(h),
+                                motionEntry->pointerCount, scaleFactor, zeroCoords,
+                                scaledCoords));
+                if (status) {
+                    break;
                 }
             }
+            if (status) {
+                break;
+            }
 
             // Publish the motion event.
             status = connection->inputPublisher.publishMotionEvent(dispatchEntry->seq,
@@ -2029,48 +2036,80 @@ void InputDispatcher::startDispatchCycleLocked(nsecs_t currentTime,
                     xOffset, yOffset, motionEntry->xPrecision, motionEntry->yPrecision,
                     motionEntry->downTime, motionEntry->eventTime,
                     motionEntry->pointerCount, motionEntry->pointerProperties,
-                    usingCoords);
+                    transformPointerCoords(motionEntry->pointerCoords,
+                            motionEntry->pointerCount, scaleFactor, zeroCoords,
+                            scaledCoords));
             break;
         }
 
         default:
             ALOG_ASSERT(false);
-            return;
+            status = BAD_VALUE;
+            break;
         }
 
-        // Check the result.
         if (status) {
-            if (status == WOULD_BLOCK) {
-                if (connection->waitQueue.isEmpty()) {
-                    ALOGE("channel '%s' ~ Could not publish event because the pipe is full. "
-                            "This is unexpected because the wait queue is empty, so the pipe "
-                            "should be empty and we shouldn't have any problems writing an "
-                            "event to it, status=%d", connection->getInputChannelName(), status);
-                    abortBrokenDispatchCycleLocked(currentTime, connection, true /*notify*/);
-                } else {
-                    // Pipe is full and we are waiting for the app to finish process some events
-                    // before sending more events to it.
-#if DEBUG_DISPATCH_CYCLE
-                    ALOGD("channel '%s' ~ Could not publish event because the pipe is full, "
-                            "waiting for the application to catch up",
-                            connection->getInputChannelName());
-#endif
-                    connection->inputPublisherBlocked = true;
-                }
-            } else {
-                ALOGE("channel '%s' ~ Could not publish event due to an unexpected error, "
-                        "status=%d", connection->getInputChannelName(), status);
-                abortBrokenDispatchCycleLocked(currentTime, connection, true /*notify*/);
-            }
-            return;
+            break;
         }
+    }
 
-        // Re-enqueue the event on the wait queue.
+    // Re-enqueue the events that were published on the wait queue.  An error sending
+    // the batch concerns an earlier event than an error queuing it, so it wins.
+    // A move only counts as published once its last message is.  Historical samples
+    // sent before the batch stopped are remembered so that they are not sent twice.
+    size_t published;
+    status_t sendStatus = connection->inputPublisher.endBatch(&published);
+    if (sendStatus) {
+        status = sendStatus;
+    }
+    bool requeued = false;
+    while (published) {
+        DispatchEntry* dispatchEntry = connection->outboundQueue.head;
+        size_t historySize = dispatchEntry->getUnpublishedHistorySize();
+        if (published <= historySize) {
+            dispatchEntry->publishedHistorySize += published;
+            break;
+        }
+        published -= historySize + 1;
+        dispatchEntry->publishedHistorySize += historySize;
         connection->outboundQueue.dequeue(dispatchEntry);
-        traceOutboundQueueLengthLocked(connection);
         connection->waitQueue.enqueueAtTail(dispatchEntry);
+        requeued = true;
+    }
+    if (requeued) {
+        traceOutboundQueueLengthLocked(connection);
         traceWaitQueueLengthLocked(connection);
     }
+
+    // Check the result.
+    if (status) {
+        if (status == WOULD_BLOCK) {
+            // The historical samples of the next move that are in flight are finished
+            // as well, so they also make room for more events.
+            DispatchEntry* nextEntry = connection->outboundQueue.head;
+            if (connection->waitQueue.isEmpty()
+                    && !(nextEntry && nextEntry->publishedHistorySize)) {
+                ALOGE("channel '%s' ~ Could not publish event because the pipe is full. "
+                        "This is unexpected because the wait queue is empty, so the pipe "
+                        "should be empty and we shouldn't have any problems writing an "
+                        "event to it, status=%d", connection->getInputChannelName(), status);
+                abortBrokenDispatchCycleLocked(currentTime, connection, true /*notify*/);
+            } else {
+                // Pipe is full and we are waiting for the app to finish process some events
+                // before sending more events to it.
+#if DEBUG_DISPATCH_CYCLE
+                ALOGD("channel '%s' ~ Could not publish event because the pipe is full, "
+                        "waiting for the application to catch up",
+                        connection->getInputChannelName());
+#endif
+                connection->inputPublisherBlocked = true;
+            }
+        } else {
+            ALOGE("channel '%s' ~ Could not publish event due to an unexpected error, "
+                    "status=%d", connection->getInputChannelName(), status);
+            abortBrokenDispatchCycleLocked(currentTime, connection, true /*notify*/);
+        }
+    }
 }
 
 void InputDispatcher::finishDispatchCycleLocked(nsecs_t currentTime,
@@ -2080,6 +2119,7 @@ void InputDispatcher::finishDispatchCycleLocked(nsecs_t currentTime,
             connection->getInputChannelName(), seq, toString(handled));
 #endif
 
+    bool publisherBlocked = connection->inputPublisherBlocked;
     connection->inputPublisherBlocked = false;
 
     if (connection->status == Connection::STATUS_BROKEN
@@ -2088,7 +2128,7 @@ void InputDispatcher::finishDispatchCycleLocked(nsecs_t currentTime,
     }
 
     // Notify other system components and prepare to start the next dispatch cycle.
-    onDispatchCycleFinishedLocked(currentTime, connection, seq, handled);
+    onDispatchCycleFinishedLocked(currentTime, connection, seq, handled, publisherBlocked);
 }
 
 void InputDispatcher::abortBrokenDispatchCycleLocked(nsecs_t currentTime,
@@ -2358,6 +2398,20 @@ InputDispatcher::splitMotionEvent(const MotionEntry* originalMotionEntry, BitSet
             originalMotionEntry->displayId,
             splitPointerCount, splitPointerProperties, splitPointerCoords, 0, 0);
 
+    if (action == AMOTION_EVENT_ACTION_MOVE) {
+        size_t historySize = originalMotionEntry->getHistorySize();
+        splitMotionEntry->historicalEventTimes = originalMotionEntry->historicalEventTimes;
+        splitMotionEntry->historicalPointerCoords.setCapacity(historySize * splitPointerCount);
+        for (size_t h = 0; h < historySize; h++) {
+            const PointerCoords* historicalCoords =
+                    originalMotionEntry->getHistoricalPointerCoords(h);
+            for (uint32_t i = 0; i < splitPointerCount; i++) {
+                splitMotionEntry->historicalPointerCoords.push(
+                        historicalCoords[splitPointerIndexMap[i]]);
+            }
+        }
+    }
+
     if (originalMotionEntry->injectionState) {
         splitMotionEntry->injectionState = originalMotionEntry->injectionState;
         splitMotionEntry->injectionState->refCount += 1;
@@ -2521,12 +2575,23 @@ void InputDispatcher::notifyMotion(const NotifyMotionArgs* args) {
         if (shouldSendMotionToInputFilterLocked(args)) {
             mLock.unlock();
 
+            // The filter gets the coalesced samples as the history of the event.
+            size_t historySize = args->getHistorySize();
             MotionEvent event;
             event.initialize(args->deviceId, args->source, args->action, args->actionButton,
                     args->flags, args->edgeFlags, args->metaState, args->buttonState,
                     0, 0, args->xPrecision, args->yPrecision,
-                    args->downTime, args->eventTime,
-                    args->pointerCount, args->pointerProperties, args->pointerCoords);
+                    args->downTime,
+                    historySize ? args->historicalEventTimes.itemAt(0) : args->eventTime,
+                    args->pointerCount, args->pointerProperties,
+                    historySize ? args->historicalPointerCoords.array() : args->pointerCoords);
+            for (size_t i = 1; i < historySize; i++) {
+                event.addSample(args->historicalEventTimes.itemAt(i),
+                        args->historicalPointerCoords.array() + i * args->pointerCount);
+            }
+            if (historySize) {
+                event.addSample(args->eventTime, args->pointerCoords);
+            }
 
             policyFlags |= POLICY_FLAG_FILTERED;
             if (!mPolicy->filterInputEvent(&event, policyFlags)) {
@@ -2544,6 +2609,8 @@ void InputDispatcher::notifyMotion(const NotifyMotionArgs* args) {
                 args->edgeFlags, args->xPrecision, args->yPrecision, args->downTime,
                 args->displayId,
                 args->pointerCount, args->pointerProperties, args->pointerCoords, 0, 0);
+        newEntry->historicalEventTimes = args->historicalEventTimes;
+        newEntry->historicalPointerCoords = args->historicalPointerCoords;
 
         needWake = enqueueInboundEventLocked(newEntry);
         mLock.unlock();
@@ -2839,13 +2906,7 @@ sp<InputWindowHandle> InputDispatcher::getWindowHandleLocked(
 
 bool InputDispatcher::hasWindowHandleLocked(
         const sp<InputWindowHandle>& windowHandle) const {
-    size_t numWindows = mWindowHandles.size();
-    for (size_t i = 0; i < numWindows; i++) {
-        if (mWindowHandles.itemAt(i) == windowHandle) {
-            return true;
-        }
-    }
-    return false;
+    return mWindowIndex.indexOf(windowHandle) >= 0;
 }
 
 void InputDispatcher::setInputWindows(const Vector<sp<InputWindowHandle> >& inputWindowHandles) {
@@ -2874,6 +2935,8 @@ void InputDispatcher::setInputWindows(const Vector<sp<InputWindowHandle> >& inpu
             }
         }
 
+        mWindowIndex.build(mWindowHandles);
+
         if (!foundHoveredWindow) {
             mLastHoverWindowHandle = NULL;
         }
@@ -3282,10 +3345,11 @@ void InputDispatcher::dumpDispatchStateLocked(String8& dump) {
         for (size_t i = 0; i < mConnectionsByFd.size(); i++) {
             const sp<Connection>& connection = mConnectionsByFd.valueAt(i);
             dump.appendFormat(INDENT2 "%zu: channelName='%s', windowName='%s', "
-                    "status=%s, monitor=%s, inputPublisherBlocked=%s\n",
+                    "status=%s, monitor=%s, inputPublisherBlocked=%s, messageRing=%s\n",
                     i, connection->getInputChannelName(), connection->getWindowName(),
                     connection->getStatusLabel(), toString(connection->monitor),
-                    toString(connection->inputPublisherBlocked));
+                    toString(connection->inputPublisherBlocked),
+                    toString(connection->inputPublisher.isMessageRingEnabled()));
 
             if (!connection->outboundQueue.isEmpty()) {
                 dump.appendFormat(INDENT3 "OutboundQueue: length=%u\n",
@@ -3335,6 +3399,16 @@ void InputDispatcher::dumpDispatchStateLocked(String8& dump) {
             mConfig.keyRepeatDelay * 0.000001f);
     dump.appendFormat(INDENT2 "KeyRepeatTimeout: %0.1fms\n",
             mConfig.keyRepeatTimeout * 0.000001f);
+
+    dump.append(INDENT "EntryPools:\n");
+    dump.append(INDENT2);
+    KeyEntry::getPool().dump(dump);
+    dump.append(INDENT2);
+    MotionEntry::getPool().dump(dump);
+    dump.append(INDENT2);
+    DispatchEntry::getPool().dump(dump);
+    dump.append(INDENT2);
+    CommandEntry::getPool().dump(dump);
 }
 
 status_t InputDispatcher::registerInputChannel(const sp<InputChannel>& inputChannel,
@@ -3354,6 +3428,15 @@ status_t InputDispatcher::registerInputChannel(const sp<InputChannel>& inputChan
         }
 
         sp<Connection> connection = new Connection(inputChannel, inputWindowHandle, monitor);
+        if (mUseMessageRings) {
+            status_t result = connection->inputPublisher.enableMessageRing(
+                    MESSAGE_RING_CAPACITY);
+            if (result) {
+                ALOGW("channel '%s' ~ Could not enable the message ring, events will go "
+                        "through the socket, status=%d", inputChannel->getName().string(),
+                        result);
+            }
+        }
 
         int fd = inputChannel->getFd();
         mConnectionsByFd.add(fd, connection);
@@ -3437,13 +3520,15 @@ ssize_t InputDispatcher::getConnectionIndexLocked(const sp<InputChannel>& inputC
 }
 
 void InputDispatcher::onDispatchCycleFinishedLocked(
-        nsecs_t currentTime, const sp<Connection>& connection, uint32_t seq, bool handled) {
+        nsecs_t currentTime, const sp<Connection>& connection, uint32_t seq, bool handled,
+        bool publisherBlocked) {
     CommandEntry* commandEntry = postCommandLocked(
             & InputDispatcher::doDispatchCycleFinishedLockedInterruptible);
     commandEntry->connection = connection;
     commandEntry->eventTime = currentTime;
     commandEntry->seq = seq;
     commandEntry->handled = handled;
+    commandEntry->publisherBlocked = publisherBlocked;
 }
 
 void InputDispatcher::onDispatchCycleBrokenLocked(
@@ -3559,7 +3644,9 @@ void InputDispatcher::doDispatchCycleFinishedLockedInterruptible(
     uint32_t seq = commandEntry->seq;
     bool handled = commandEntry->handled;
 
-    // Handle post-event policy actions.
+    // Handle post-event policy actions.  Historical samples of a move have no entry, and
+    // finishing them only makes room in the channel, so there is nothing more to do
+    // unless publishing was blocked waiting for that room.
     DispatchEntry* dispatchEntry = connection->findWaitQueueEntry(seq);
     if (dispatchEntry) {
         nsecs_t eventDuration = finishTime - dispatchEntry->deliveryTime;
@@ -3598,10 +3685,12 @@ void InputDispatcher::doDispatchCycleFinishedLockedInterruptible(
                 releaseDispatchEntryLocked(dispatchEntry);
             }
         }
-
-        // Start the next dispatch cycle for this connection.
-        startDispatchCycleLocked(now(), connection);
+    } else if (!commandEntry->publisherBlocked) {
+        return;
     }
+
+    // Start the next dispatch cycle for this connection.
+    startDispatchCycleLocked(now(), connection);
 }
 
 bool InputDispatcher::afterKeyEventLockedInterruptible(const sp<Connection>& connection,
@@ -3843,6 +3932,37 @@ void InputDispatcher::monitor() {
 }
 
 
+// --- InputDispatcher entry pools ---
+
+// Pools of the entries allocated for every event.  The number of free blocks each
+// keeps is about what a burst of touch events going to several windows and monitors
+// has in flight.  The pools are never destroyed, so that entries still referenced by
+// a dispatcher can be released while static objects are torn down at exit.
+InputEntryPool& InputDispatcher::KeyEntry::getPool() {
+    static InputEntryPool* const sPool = new InputEntryPool(
+            "KeyEntry", sizeof(KeyEntry), 16);
+    return *sPool;
+}
+
+InputEntryPool& InputDispatcher::MotionEntry::getPool() {
+    static InputEntryPool* const sPool = new InputEntryPool(
+            "MotionEntry", sizeof(MotionEntry), 32);
+    return *sPool;
+}
+
+InputEntryPool& InputDispatcher::DispatchEntry::getPool() {
+    static InputEntryPool* const sPool = new InputEntryPool(
+            "DispatchEntry", sizeof(DispatchEntry), 64);
+    return *sPool;
+}
+
+InputEntryPool& InputDispatcher::CommandEntry::getPool() {
+    static InputEntryPool* const sPool = new InputEntryPool(
+            "CommandEntry", sizeof(CommandEntry), 16);
+    return *sPool;
+}
+
+
 // --- InputDispatcher::InjectionState ---
 
 InputDispatcher::InjectionState::InjectionState(int32_t injectorPid, int32_t injectorUid) :
@@ -3999,7 +4119,7 @@ void InputDispatcher::MotionEntry::appendDescription(String8& msg) const {
         msg.appendFormat("%d: (%.1f, %.1f)", pointerProperties[i].id,
                 pointerCoords[i].getX(), pointerCoords[i].getY());
     }
-    msg.appendFormat("]), policyFlags=0x%08x", policyFlags);
+    msg.appendFormat("], historySize=%zu), policyFlags=0x%08x", getHistorySize(), policyFlags);
 }
 
 
@@ -4012,7 +4132,7 @@ InputDispatcher::DispatchEntry::DispatchEntry(EventEntry* eventEntry,
         seq(nextSeq()),
         eventEntry(eventEntry), targetFlags(targetFlags),
         xOffset(xOffset), yOffset(yOffset), scaleFactor(scaleFactor),
-        deliveryTime(0), resolvedAction(0), resolvedFlags(0) {
+        deliveryTime(0), resolvedAction(0), resolvedFlags(0), publishedHistorySize(0) {
     eventEntry->refCount += 1;
 }
 
@@ -4020,6 +4140,17 @@ InputDispatcher::DispatchEntry::~DispatchEntry() {
     eventEntry->release();
 }
 
+size_t InputDispatcher::DispatchEntry::getUnpublishedHistorySize() const {
+    // The history only makes sense to the target as part of a move, not when the
+    // event was turned into an outside touch, a cancel or a down for it.
+    if (eventEntry->type != EventEntry::TYPE_MOTION
+            || resolvedAction != AMOTION_EVENT_ACTION_MOVE) {
+        return 0;
+    }
+    const MotionEntry* motionEntry = static_cast<const MotionEntry*>(eventEntry);
+    return motionEntry->getHistorySize() - publishedHistorySize;
+}
+
 uint32_t InputDispatcher::DispatchEntry::nextSeq() {
     // Sequence number 0 is reserved and will never be returned.
     uint32_t seq;
@@ -4436,7 +4567,7 @@ InputDispatcher::DispatchEntry* InputDispatcher::Connection::findWaitQueueEntry(
 
 InputDispatcher::CommandEntry::CommandEntry(Command command) :
     command(command), eventTime(0), keyEntry(NULL), userActivityEventType(0),
-    seq(0), handled(false) {
+    seq(0), handled(false), publisherBlocked(false) {
 }
 
 InputDispatcher::CommandEntry::~CommandEntry() {
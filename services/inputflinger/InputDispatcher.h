@@ -34,6 +34,8 @@
 #include <limits.h>
 
 #include "InputWindow.h"
+#include "InputWindowIndex.h"
+#include "InputEntryPool.h"
 #include "InputApplication.h"
 #include "InputListener.h"
 
@@ -501,6 +503,10 @@ private:
         virtual void appendDescription(String8& msg) const;
         void recycle();
 
+        static void* operator new(size_t size) { return getPool().allocate(size); }
+        static void operator delete(void* p, size_t size) { getPool().free(p, size); }
+        static InputEntryPool& getPool();
+
     protected:
         virtual ~KeyEntry();
     };
@@ -523,6 +529,11 @@ private:
         PointerProperties pointerProperties[MAX_POINTERS];
         PointerCoords pointerCoords[MAX_POINTERS];
 
+        // Samples that came before the current one, oldest first, when the reader
+        // coalesced consecutive moves.  There are pointerCount coords per sample.
+        Vector<nsecs_t> historicalEventTimes;
+        Vector<PointerCoords> historicalPointerCoords;
+
         MotionEntry(nsecs_t eventTime,
                 int32_t deviceId, uint32_t source, uint32_t policyFlags,
                 int32_t action, int32_t actionButton, int32_t flags,
@@ -533,6 +544,15 @@ private:
                 float xOffset, float yOffset);
         virtual void appendDescription(String8& msg) const;
 
+        inline size_t getHistorySize() const { return historicalEventTimes.size(); }
+        inline const PointerCoords* getHistoricalPointerCoords(size_t sample) const {
+            return historicalPointerCoords.array() + sample * pointerCount;
+        }
+
+        static void* operator new(size_t size) { return getPool().allocate(size); }
+        static void operator delete(void* p, size_t size) { getPool().free(p, size); }
+        static InputEntryPool& getPool();
+
     protected:
         virtual ~MotionEntry();
     };
@@ -552,10 +572,17 @@ private:
         int32_t resolvedAction;
         int32_t resolvedFlags;
 
+        // Number of historical samples of a move already published, when the
+        // connection filled up part way through them.
+        size_t publishedHistorySize;
+
         DispatchEntry(EventEntry* eventEntry,
                 int32_t targetFlags, float xOffset, float yOffset, float scaleFactor);
         ~DispatchEntry();
 
+        // Returns the number of historical samples to publish before the event itself.
+        size_t getUnpublishedHistorySize() const;
+
         inline bool hasForegroundTarget() const {
             return targetFlags & InputTarget::FLAG_FOREGROUND;
         }
@@ -564,10 +591,16 @@ private:
             return targetFlags & InputTarget::FLAG_SPLIT;
         }
 
-    private:
-        static volatile int32_t sNextSeqAtomic;
+        static void* operator new(size_t size) { return getPool().allocate(size); }
+        static void operator delete(void* p, size_t size) { getPool().free(p, size); }
+        static InputEntryPool& getPool();
 
+        // Also numbers the historical samples of a move, which are published
+        // ahead of it but not waited on.
         static uint32_t nextSeq();
+
+    private:
+        static volatile int32_t sNextSeqAtomic;
     };
 
     // A command entry captures state and behavior for an action to be performed in the
@@ -594,6 +627,10 @@ private:
         explicit CommandEntry(Command command);
         ~CommandEntry();
 
+        static void* operator new(size_t size) { return getPool().allocate(size); }
+        static void operator delete(void* p, size_t size) { getPool().free(p, size); }
+        static InputEntryPool& getPool();
+
         Command command;
 
         // parameters for the command (usage varies by command)
@@ -606,6 +643,7 @@ private:
         int32_t userActivityEventType;
         uint32_t seq;
         bool handled;
+        bool publisherBlocked;
     };
 
     // Generic queue implementation.
@@ -952,8 +990,11 @@ private:
     bool mDispatchEnabled;
     bool mDispatchFrozen;
     bool mInputFilterEnabled;
+    bool mUseMessageRings;
 
     Vector<sp<InputWindowHandle> > mWindowHandles;
+    // Spatial index of mWindowHandles, rebuilt by setInputWindows.
+    InputWindowIndex mWindowIndex;
 
     sp<InputWindowHandle> getWindowHandleLocked(const sp<InputChannel>& inputChannel) const;
     bool hasWindowHandleLocked(const sp<InputWindowHandle>& windowHandle) const;
@@ -1109,7 +1150,8 @@ private:
 
     // Interesting events that we might like to log or tell the framework about.
     void onDispatchCycleFinishedLocked(
-            nsecs_t currentTime, const sp<Connection>& connection, uint32_t seq, bool handled);
+            nsecs_t currentTime, const sp<Connection>& connection, uint32_t seq, bool handled,
+            bool publisherBlocked);
     void onDispatchCycleBrokenLocked(
             nsecs_t currentTime, const sp<Connection>& connection);
     void onANRLocked(
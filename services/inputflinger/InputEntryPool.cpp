@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "InputEntryPool"
+
+#include "InputEntryPool.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include <log/log.h>
+
+namespace android {
+
+InputEntryPool::InputEntryPool(const char* name, size_t blockSize, size_t maxFreeBlocks) :
+        mName(name), mBlockSize(blockSize), mMaxFreeBlocks(maxFreeBlocks),
+        mFreeCount(0), mInUseCount(0), mPeakInUseCount(0),
+        mHitCount(0), mMissCount(0) {
+    LOG_ALWAYS_FATAL_IF(maxFreeBlocks > MAX_FREE_BLOCKS,
+            "%s pool can keep at most %d free blocks.", name, MAX_FREE_BLOCKS);
+    for (size_t i = 0; i < MAX_FREE_BLOCKS; i++) {
+        mFreeBlocks[i].store(NULL, std::memory_order_relaxed);
+    }
+}
+
+InputEntryPool::~InputEntryPool() {
+    for (size_t i = 0; i < mMaxFreeBlocks; i++) {
+        ::free(mFreeBlocks[i].load(std::memory_order_relaxed));
+    }
+}
+
+void* InputEntryPool::allocate(size_t size) {
+    if (size == mBlockSize) {
+        size_t inUse = mInUseCount.fetch_add(1, std::memory_order_relaxed) + 1;
+        size_t peak = mPeakInUseCount.load(std::memory_order_relaxed);
+        while (inUse > peak && !mPeakInUseCount.compare_exchange_weak(peak, inUse,
+                std::memory_order_relaxed)) {
+        }
+
+        if (mFreeCount.load(std::memory_order_relaxed) != 0) {
+            for (size_t i = 0; i < mMaxFreeBlocks; i++) {
+                if (mFreeBlocks[i].load(std::memory_order_relaxed) == NULL) {
+                    continue;
+                }
+                // Acquire the writes made to the block before it was freed.
+                void* block = mFreeBlocks[i].exchange(NULL, std::memory_order_acquire);
+                if (block) {
+                    mFreeCount.fetch_sub(1, std::memory_order_relaxed);
+                    mHitCount.fetch_add(1, std::memory_order_relaxed);
+                    return block;
+                }
+            }
+        }
+        mMissCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void* block = malloc(size);
+    if (!block) {
+        LOG_ALWAYS_FATAL("Out of memory allocating a %zu byte %s.", size, mName);
+    }
+    return block;
+}
+
+void InputEntryPool::free(void* block, size_t size) {
+    if (!block) {
+        return;
+    }
+    if (size == mBlockSize) {
+        mInUseCount.fetch_sub(1, std::memory_order_relaxed);
+        if (mFreeCount.load(std::memory_order_relaxed) < mMaxFreeBlocks) {
+            for (size_t i = 0; i < mMaxFreeBlocks; i++) {
+                void* expected = NULL;
+                if (mFreeBlocks[i].load(std::memory_order_relaxed) == NULL
+                        && mFreeBlocks[i].compare_exchange_strong(expected, block,
+                                std::memory_order_release, std::memory_order_relaxed)) {
+                    mFreeCount.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+        }
+    }
+    ::free(block);
+}
+
+void InputEntryPool::dump(String8& dump) const {
+    uint64_t hits = mHitCount.load(std::memory_order_relaxed);
+    uint64_t misses = mMissCount.load(std::memory_order_relaxed);
+    uint64_t allocations = hits + misses;
+    dump.appendFormat("%s: blockSize=%zu, inUse=%zu, peakInUse=%zu, "
+            "free=%zu/%zu, hits=%" PRIu64 ", misses=%" PRIu64 ", hitRate=%0.1f%%\n",
+            mName, mBlockSize, mInUseCount.load(std::memory_order_relaxed),
+            mPeakInUseCount.load(std::memory_order_relaxed),
+            mFreeCount.load(std::memory_order_relaxed), mMaxFreeBlocks,
+            hits, misses, allocations ? hits * 100.0 / allocations : 0.0);
+}
+
+} // namespace android
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _UI_INPUT_ENTRY_POOL_H
+#define _UI_INPUT_ENTRY_POOL_H
+
+#include <utils/String8.h>
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+/*
+ * A pool of fixed size blocks, used to allocate the entries that the dispatcher
+ * creates and releases for every event so that dispatching does not go through malloc.
+ * Released blocks are kept for reuse, up to maxFreeBlocks of them.
+ *
+ * Entries are allocated and released both by the dispatcher thread and by the threads
+ * that inject events, without a common lock, so the pool is lock-free.  Free blocks are
+ * kept in a fixed array of slots that are taken and filled with single atomic
+ * operations, which unlike a linked free list is not subject to ABA races.
+ */
+class InputEntryPool {
+public:
+    enum {
+        MAX_FREE_BLOCKS = 64,
+    };
+
+    InputEntryPool(const char* name, size_t blockSize, size_t maxFreeBlocks);
+    ~InputEntryPool();
+
+    void* allocate(size_t size);
+    void free(void* block, size_t size);
+
+    // Appends a line with the usage and hit rate of the pool.
+    void dump(String8& dump) const;
+
+private:
+    const char* const mName;
+    const size_t mBlockSize;
+    const size_t mMaxFreeBlocks;
+
+    std::atomic<void*> mFreeBlocks[MAX_FREE_BLOCKS];
+    std::atomic<size_t> mFreeCount;
+    std::atomic<size_t> mInUseCount;
+    std::atomic<size_t> mPeakInUseCount;
+    std::atomic<uint64_t> mHitCount;  // allocations served from a free block
+    std::atomic<uint64_t> mMissCount; // allocations that went to malloc
+};
+
+} // namespace android
+
+#endif // _UI_INPUT_ENTRY_POOL_H
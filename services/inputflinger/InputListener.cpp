@@ -89,7 +89,9 @@ NotifyMotionArgs::NotifyMotionArgs(const NotifyMotionArgs& other) :
         action(other.action), actionButton(other.actionButton), flags(other.flags),
         metaState(other.metaState), buttonState(other.buttonState),
         edgeFlags(other.edgeFlags), displayId(other.displayId), pointerCount(other.pointerCount),
-        xPrecision(other.xPrecision), yPrecision(other.yPrecision), downTime(other.downTime) {
+        xPrecision(other.xPrecision), yPrecision(other.yPrecision), downTime(other.downTime),
+        historicalEventTimes(other.historicalEventTimes),
+        historicalPointerCoords(other.historicalPointerCoords) {
     for (uint32_t i = 0; i < pointerCount; i++) {
         pointerProperties[i].copyFrom(other.pointerProperties[i]);
         pointerCoords[i].copyFrom(other.pointerCoords[i]);
@@ -100,6 +102,45 @@ void NotifyMotionArgs::notify(const sp<InputListenerInterface>& listener) const
     listener->notifyMotion(this);
 }
 
+bool NotifyMotionArgs::canAddSample(const NotifyMotionArgs& other) const {
+    if (action != AMOTION_EVENT_ACTION_MOVE
+            || other.action != AMOTION_EVENT_ACTION_MOVE
+            || deviceId != other.deviceId
+            || source != other.source
+            || policyFlags != other.policyFlags
+            || actionButton != other.actionButton
+            || flags != other.flags
+            || metaState != other.metaState
+            || buttonState != other.buttonState
+            || edgeFlags != other.edgeFlags
+            || displayId != other.displayId
+            || xPrecision != other.xPrecision
+            || yPrecision != other.yPrecision
+            || downTime != other.downTime
+            || pointerCount != other.pointerCount
+            || other.eventTime < eventTime) {
+        return false;
+    }
+    for (uint32_t i = 0; i < pointerCount; i++) {
+        if (pointerProperties[i] != other.pointerProperties[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void NotifyMotionArgs::addSample(const NotifyMotionArgs& other) {
+    historicalEventTimes.push(eventTime);
+    historicalPointerCoords.appendArray(pointerCoords, pointerCount);
+    historicalEventTimes.appendVector(other.historicalEventTimes);
+    historicalPointerCoords.appendVector(other.historicalPointerCoords);
+
+    eventTime = other.eventTime;
+    for (uint32_t i = 0; i < pointerCount; i++) {
+        pointerCoords[i].copyFrom(other.pointerCoords[i]);
+    }
+}
+
 
 // --- NotifySwitchArgs ---
 
@@ -136,8 +177,10 @@ void NotifyDeviceResetArgs::notify(const sp<InputListenerInterface>& listener) c
 
 // --- QueuedInputListener ---
 
-QueuedInputListener::QueuedInputListener(const sp<InputListenerInterface>& innerListener) :
-        mInnerListener(innerListener) {
+QueuedInputListener::QueuedInputListener(const sp<InputListenerInterface>& innerListener,
+        bool coalesceMotionSamples) :
+        mInnerListener(innerListener), mCoalesceMotionSamples(coalesceMotionSamples),
+        mLastMotionArgs(NULL), mMotionSampleCount(0), mCoalescedMotionSampleCount(0) {
 }
 
 QueuedInputListener::~QueuedInputListener() {
@@ -149,23 +192,40 @@ QueuedInputListener::~QueuedInputListener() {
 
 void QueuedInputListener::notifyConfigurationChanged(
         const NotifyConfigurationChangedArgs* args) {
-    mArgsQueue.push(new NotifyConfigurationChangedArgs(*args));
+    queue(new NotifyConfigurationChangedArgs(*args));
 }
 
 void QueuedInputListener::notifyKey(const NotifyKeyArgs* args) {
-    mArgsQueue.push(new NotifyKeyArgs(*args));
+    queue(new NotifyKeyArgs(*args));
 }
 
 void QueuedInputListener::notifyMotion(const NotifyMotionArgs* args) {
-    mArgsQueue.push(new NotifyMotionArgs(*args));
+    size_t sampleCount = args->getHistorySize() + 1;
+    mMotionSampleCount += sampleCount;
+
+    // Only the last queued args can take the sample, so that events are never reordered.
+    if (mCoalesceMotionSamples && mLastMotionArgs && mLastMotionArgs->canAddSample(*args)) {
+        mLastMotionArgs->addSample(*args);
+        mCoalescedMotionSampleCount += sampleCount;
+        return;
+    }
+
+    NotifyMotionArgs* motionArgs = new NotifyMotionArgs(*args);
+    queue(motionArgs);
+    mLastMotionArgs = motionArgs;
 }
 
 void QueuedInputListener::notifySwitch(const NotifySwitchArgs* args) {
-    mArgsQueue.push(new NotifySwitchArgs(*args));
+    queue(new NotifySwitchArgs(*args));
 }
 
 void QueuedInputListener::notifyDeviceReset(const NotifyDeviceResetArgs* args) {
-    mArgsQueue.push(new NotifyDeviceResetArgs(*args));
+    queue(new NotifyDeviceResetArgs(*args));
+}
+
+void QueuedInputListener::queue(NotifyArgs* args) {
+    mArgsQueue.push(args);
+    mLastMotionArgs = NULL;
 }
 
 void QueuedInputListener::flush() {
@@ -176,6 +236,7 @@ void QueuedInputListener::flush() {
         delete args;
     }
     mArgsQueue.clear();
+    mLastMotionArgs = NULL;
 }
 
 
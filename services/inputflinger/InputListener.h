@@ -97,6 +97,11 @@ struct NotifyMotionArgs : public NotifyArgs {
     float yPrecision;
     nsecs_t downTime;
 
+    // Samples that came before the current one, oldest first, when consecutive moves
+    // were coalesced into this event.  There are pointerCount coords per sample.
+    Vector<nsecs_t> historicalEventTimes;
+    Vector<PointerCoords> historicalPointerCoords;
+
     inline NotifyMotionArgs() { }
 
     NotifyMotionArgs(nsecs_t eventTime, int32_t deviceId, uint32_t source, uint32_t policyFlags,
@@ -111,6 +116,14 @@ struct NotifyMotionArgs : public NotifyArgs {
     virtual ~NotifyMotionArgs() { }
 
     virtual void notify(const sp<InputListenerInterface>& listener) const;
+
+    inline size_t getHistorySize() const { return historicalEventTimes.size(); }
+
+    /* Returns true if other can be appended to this event as its next sample. */
+    bool canAddSample(const NotifyMotionArgs& other) const;
+
+    /* Moves the current sample to the history and makes the one of other current. */
+    void addSample(const NotifyMotionArgs& other);
 };
 
 
@@ -172,13 +185,19 @@ public:
 /*
  * An implementation of the listener interface that queues up and defers dispatch
  * of decoded events until flushed.
+ *
+ * When coalesceMotionSamples is true, an ACTION_MOVE is merged into the motion event
+ * queued right before it as a new sample, as long as they only differ by their
+ * coords and time.  Devices reporting faster than the reader runs then produce one
+ * event with history per flush instead of one event per sample.
  */
 class QueuedInputListener : public InputListenerInterface {
 protected:
     virtual ~QueuedInputListener();
 
 public:
-    explicit QueuedInputListener(const sp<InputListenerInterface>& innerListener);
+    explicit QueuedInputListener(const sp<InputListenerInterface>& innerListener,
+            bool coalesceMotionSamples = false);
 
     virtual void notifyConfigurationChanged(const NotifyConfigurationChangedArgs* args);
     virtual void notifyKey(const NotifyKeyArgs* args);
@@ -188,9 +207,28 @@ public:
 
     void flush();
 
+    inline bool isCoalescingMotionSamples() const { return mCoalesceMotionSamples; }
+
+    /* Returns the number of motion samples queued so far, and how many of them were
+     * coalesced into the previous motion event. */
+    inline uint64_t getMotionSampleCount() const { return mMotionSampleCount; }
+    inline uint64_t getCoalescedMotionSampleCount() const {
+        return mCoalescedMotionSampleCount;
+    }
+
 private:
     sp<InputListenerInterface> mInnerListener;
     Vector<NotifyArgs*> mArgsQueue;
+
+    const bool mCoalesceMotionSamples;
+
+    // The last queued args if they are a motion event, NULL otherwise.
+    NotifyMotionArgs* mLastMotionArgs;
+
+    uint64_t mMotionSampleCount;
+    uint64_t mCoalescedMotionSampleCount;
+
+    void queue(NotifyArgs* args);
 };
 
 } // namespace android
@@ -52,6 +52,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <cutils/properties.h>
 #include <log/log.h>
 
 #include <input/Keyboard.h>
@@ -345,7 +346,9 @@ InputReader::InputReader(const sp<EventHubInterface>& eventHub,
         mGlobalMetaState(0), mGeneration(1),
         mDisableVirtualKeysTimeout(LLONG_MIN), mNextTimeout(LLONG_MAX),
         mConfigurationChangesToRefresh(0) {
-    mQueuedListener = new QueuedInputListener(listener);
+    // Consecutive moves read together are sent as one event with history when this is set.
+    mQueuedListener = new QueuedInputListener(listener,
+            property_get_bool("ro.input.coalesce_motion", false));
 
     { // acquire lock
         AutoMutex _l(mLock);
@@ -895,6 +898,14 @@ void InputReader::dump(String8& dump) {
         mDevices.valueAt(i)->dump(dump);
     }
 
+    uint64_t motionSamples = mQueuedListener->getMotionSampleCount();
+    uint64_t coalescedMotionSamples = mQueuedListener->getCoalescedMotionSampleCount();
+    dump.appendFormat(INDENT "MotionCoalescing: enabled=%s, samples=%" PRIu64
+            ", events=%" PRIu64 ", coalesced=%0.1f%%\n",
+            toString(mQueuedListener->isCoalescingMotionSamples()),
+            motionSamples, motionSamples - coalescedMotionSamples,
+            motionSamples ? coalescedMotionSamples * 100.0 / motionSamples : 0.0);
+
     dump.append(INDENT "Configuration:\n");
     dump.append(INDENT2 "ExcludedDeviceNames: [");
     for (size_t i = 0; i < mConfig.excludedDeviceNames.size(); i++) {
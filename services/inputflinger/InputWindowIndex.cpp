@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "InputWindowIndex"
+
+#include "InputWindowIndex.h"
+
+#include <math.h>
+
+#include <ui/Region.h>
+
+namespace android {
+
+// Maximum number of grid cells along each axis.
+static const size_t MAX_GRID_SIZE = 32;
+
+static bool isTouchModal(const InputWindowInfo* windowInfo) {
+    return (windowInfo->layoutParamsFlags & (InputWindowInfo::FLAG_NOT_FOCUSABLE
+            | InputWindowInfo::FLAG_NOT_TOUCH_MODAL)) == 0;
+}
+
+static bool isTouchable(const InputWindowInfo* windowInfo) {
+    return windowInfo->visible
+            && !(windowInfo->layoutParamsFlags & InputWindowInfo::FLAG_NOT_TOUCHABLE);
+}
+
+// --- InputWindowIndex::Grid ---
+
+InputWindowIndex::Grid::Grid() :
+        mCellWidth(1), mCellHeight(1), mColumns(0), mRows(0) {
+}
+
+void InputWindowIndex::Grid::build(const Vector<Rect>& rects, const Vector<size_t>& windows) {
+    mBounds.makeInvalid();
+    mCellStarts.clear();
+    mCellWindows.clear();
+    mColumns = 0;
+    mRows = 0;
+
+    size_t numRects = rects.size();
+    if (numRects == 0) {
+        return;
+    }
+
+    mBounds = rects.itemAt(0);
+    for (size_t i = 1; i < numRects; i++) {
+        const Rect& rect = rects.itemAt(i);
+        if (rect.left < mBounds.left) mBounds.left = rect.left;
+        if (rect.top < mBounds.top) mBounds.top = rect.top;
+        if (rect.right > mBounds.right) mBounds.right = rect.right;
+        if (rect.bottom > mBounds.bottom) mBounds.bottom = rect.bottom;
+    }
+
+    // About one rect per cell if they were spread evenly.
+    size_t gridSize = size_t(ceil(sqrt(double(numRects))));
+    if (gridSize > MAX_GRID_SIZE) {
+        gridSize = MAX_GRID_SIZE;
+    }
+    int32_t width = mBounds.getWidth();
+    int32_t height = mBounds.getHeight();
+    mColumns = gridSize < size_t(width) ? gridSize : size_t(width);
+    mRows = gridSize < size_t(height) ? gridSize : size_t(height);
+    mCellWidth = (width + int32_t(mColumns) - 1) / int32_t(mColumns);
+    mCellHeight = (height + int32_t(mRows) - 1) / int32_t(mRows);
+
+    // Count the windows of each cell, then lay them out contiguously. Rects of
+    // the same window are adjacent, so remembering the last window added to a
+    // cell is enough to add each window to a cell only once.
+    size_t numCells = mColumns * mRows;
+    Vector<size_t> counts;
+    Vector<ssize_t> lastWindows;
+    counts.insertAt(size_t(0), 0, numCells);
+    lastWindows.insertAt(ssize_t(-1), 0, numCells);
+    for (size_t i = 0; i < numRects; i++) {
+        size_t left, top, right, bottom;
+        getCellRange(rects.itemAt(i), &left, &top, &right, &bottom);
+        for (size_t row = top; row <= bottom; row++) {
+            for (size_t column = left; column <= right; column++) {
+                size_t cell = row * mColumns + column;
+                if (lastWindows.itemAt(cell) != ssize_t(windows.itemAt(i))) {
+                    lastWindows.editItemAt(cell) = windows.itemAt(i);
+                    counts.editItemAt(cell) += 1;
+                }
+            }
+        }
+    }
+
+    mCellStarts.setCapacity(numCells + 1);
+    size_t total = 0;
+    for (size_t cell = 0; cell < numCells; cell++) {
+        mCellStarts.add(total);
+        total += counts.itemAt(cell);
+    }
+    mCellStarts.add(total);
+
+    mCellWindows.insertAt(size_t(0), 0, total);
+    for (size_t cell = 0; cell < numCells; cell++) {
+        counts.editItemAt(cell) = 0;
+        lastWindows.editItemAt(cell) = -1;
+    }
+    for (size_t i = 0; i < numRects; i++) {
+        size_t window = windows.itemAt(i);
+        size_t left, top, right, bottom;
+        getCellRange(rects.itemAt(i), &left, &top, &right, &bottom);
+        for (size_t row = top; row <= bottom; row++) {
+            for (size_t column = left; column <= right; column++) {
+                size_t cell = row * mColumns + column;
+                if (lastWindows.itemAt(cell) != ssize_t(window)) {
+                    lastWindows.editItemAt(cell) = window;
+                    size_t& count = counts.editItemAt(cell);
+                    mCellWindows.editItemAt(mCellStarts.itemAt(cell) + count) = window;
+                    count += 1;
+                }
+            }
+        }
+    }
+}
+
+void InputWindowIndex::Grid::getCellRange(const Rect& rect, size_t* outLeft, size_t* outTop,
+        size_t* outRight, size_t* outBottom) const {
+    // rect is within mBounds and isn't empty, so its last column and row are
+    // right - 1 and bottom - 1.
+    *outLeft = size_t((rect.left - mBounds.left) / mCellWidth);
+    *outTop = size_t((rect.top - mBounds.top) / mCellHeight);
+    *outRight = size_t((rect.right - 1 - mBounds.left) / mCellWidth);
+    *outBottom = size_t((rect.bottom - 1 - mBounds.top) / mCellHeight);
+}
+
+const size_t* InputWindowIndex::Grid::getCell(int32_t x, int32_t y, size_t* outCount) const {
+    if (mColumns == 0 || x < mBounds.left || x >= mBounds.right
+            || y < mBounds.top || y >= mBounds.bottom) {
+        *outCount = 0;
+        return NULL;
+    }
+    size_t column = size_t((x - mBounds.left) / mCellWidth);
+    size_t row = size_t((y - mBounds.top) / mCellHeight);
+    size_t cell = row * mColumns + column;
+    size_t start = mCellStarts.itemAt(cell);
+    *outCount = mCellStarts.itemAt(cell + 1) - start;
+    return mCellWindows.array() + start;
+}
+
+// --- InputWindowIndex::DisplayIndex ---
+
+InputWindowIndex::DisplayIndex::DisplayIndex() :
+        firstTouchModalWindow(-1) {
+}
+
+// --- InputWindowIndex ---
+
+InputWindowIndex::InputWindowIndex() {
+}
+
+void InputWindowIndex::clear() {
+    mWindowHandles.clear();
+    mPositions.clear();
+    mDisplays.clear();
+}
+
+void InputWindowIndex::build(const Vector<sp<InputWindowHandle> >& windowHandles) {
+    clear();
+    mWindowHandles = windowHandles;
+
+    struct DisplayRects {
+        Vector<Rect> touchableRects;
+        Vector<size_t> touchableWindows;
+        Vector<Rect> obscuringRects;
+        Vector<size_t> obscuringWindows;
+    };
+    KeyedVector<int32_t, DisplayRects> displayRects;
+
+    size_t numWindows = mWindowHandles.size();
+    for (size_t i = 0; i < numWindows; i++) {
+        const sp<InputWindowHandle>& windowHandle = mWindowHandles.itemAt(i);
+        mPositions.add(windowHandle.get(), i);
+
+        const InputWindowInfo* windowInfo = windowHandle->getInfo();
+        ssize_t displayIndex = mDisplays.indexOfKey(windowInfo->displayId);
+        if (displayIndex < 0) {
+            displayIndex = mDisplays.add(windowInfo->displayId, DisplayIndex());
+            displayRects.add(windowInfo->displayId, DisplayRects());
+        }
+        DisplayIndex& display = mDisplays.editValueAt(displayIndex);
+        DisplayRects& rects = displayRects.editValueFor(windowInfo->displayId);
+
+        if (!windowInfo->visible) {
+            continue;
+        }
+
+        if (windowInfo->layoutParamsFlags & InputWindowInfo::FLAG_WATCH_OUTSIDE_TOUCH) {
+            display.outsideTouchWatchers.add(i);
+        }
+
+        if (!windowInfo->isTrustedOverlay()) {
+            Rect frame(windowInfo->frameLeft, windowInfo->frameTop,
+                    windowInfo->frameRight, windowInfo->frameBottom);
+            if (!frame.isEmpty()) {
+                rects.obscuringRects.add(frame);
+                rects.obscuringWindows.add(i);
+            }
+        }
+
+        // Windows behind a touch modal window can never be touched.
+        if (display.firstTouchModalWindow < 0 && isTouchable(windowInfo)) {
+            if (isTouchModal(windowInfo)) {
+                display.firstTouchModalWindow = i;
+            } else {
+                const Region& region = windowInfo->touchableRegion;
+                for (Region::const_iterator it = region.begin(); it != region.end(); ++it) {
+                    if (!it->isEmpty()) {
+                        rects.touchableRects.add(*it);
+                        rects.touchableWindows.add(i);
+                    }
+                }
+            }
+        }
+    }
+
+    for (size_t d = 0; d < mDisplays.size(); d++) {
+        DisplayIndex& display = mDisplays.editValueAt(d);
+        const DisplayRects& rects = displayRects.valueFor(mDisplays.keyAt(d));
+        display.touchable.build(rects.touchableRects, rects.touchableWindows);
+        display.obscuring.build(rects.obscuringRects, rects.obscuringWindows);
+    }
+}
+
+ssize_t InputWindowIndex::indexOf(const sp<InputWindowHandle>& windowHandle) const {
+    ssize_t index = mPositions.indexOfKey(windowHandle.get());
+    return index >= 0 ? ssize_t(mPositions.valueAt(index)) : -1;
+}
+
+ssize_t InputWindowIndex::findTouchedWindow(int32_t displayId, int32_t x, int32_t y) const {
+    ssize_t displayIndex = mDisplays.indexOfKey(displayId);
+    if (displayIndex < 0) {
+        return -1;
+    }
+    const DisplayIndex& display = mDisplays.valueAt(displayIndex);
+
+    // The grid only holds windows in front of the first touch modal window,
+    // which gets the touch if none of them does.
+    size_t count;
+    const size_t* windows = display.touchable.getCell(x, y, &count);
+    for (size_t i = 0; i < count; i++) {
+        const InputWindowInfo* windowInfo = mWindowHandles.itemAt(windows[i])->getInfo();
+        if (windowInfo->touchableRegionContainsPoint(x, y)) {
+            return windows[i];
+        }
+    }
+    return display.firstTouchModalWindow;
+}
+
+bool InputWindowIndex::isObscuredAtPoint(const sp<InputWindowHandle>& windowHandle,
+        int32_t x, int32_t y) const {
+    ssize_t displayIndex = mDisplays.indexOfKey(windowHandle->getInfo()->displayId);
+    if (displayIndex < 0) {
+        return false;
+    }
+    const DisplayIndex& display = mDisplays.valueAt(displayIndex);
+
+    ssize_t position = indexOf(windowHandle);
+    size_t count;
+    const size_t* windows = display.obscuring.getCell(x, y, &count);
+    for (size_t i = 0; i < count; i++) {
+        if (position >= 0 && windows[i] >= size_t(position)) {
+            break;
+        }
+        const InputWindowInfo* otherInfo = mWindowHandles.itemAt(windows[i])->getInfo();
+        if (otherInfo->frameContainsPoint(x, y)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const Vector<size_t>& InputWindowIndex::getOutsideTouchWatchers(int32_t displayId) const {
+    ssize_t displayIndex = mDisplays.indexOfKey(displayId);
+    return displayIndex >= 0 ? mDisplays.valueAt(displayIndex).outsideTouchWatchers
+            : mNoWindows;
+}
+
+} // namespace android
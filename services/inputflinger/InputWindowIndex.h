@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _UI_INPUT_WINDOW_INDEX_H
+#define _UI_INPUT_WINDOW_INDEX_H
+
+#include <ui/Rect.h>
+#include <utils/KeyedVector.h>
+#include <utils/RefBase.h>
+#include <utils/Vector.h>
+
+#include "InputWindow.h"
+
+namespace android {
+
+/*
+ * Spatial index of the input windows, used by the dispatcher to hit-test
+ * touches without visiting every window.
+ *
+ * The windows of each display are bucketed into a uniform grid covering
+ * their touchable regions, and another covering their frames. A grid cell
+ * lists the windows that overlap it front to back, so a hit test only looks
+ * at the windows of one cell.
+ *
+ * Windows are identified by their position in the list the index was built
+ * from, which is their Z order. The index is built from the window handles
+ * given to InputDispatcher::setInputWindows once their info is up to date,
+ * and must be rebuilt whenever that info changes.
+ */
+class InputWindowIndex {
+public:
+    InputWindowIndex();
+
+    void build(const Vector<sp<InputWindowHandle> >& windowHandles);
+    void clear();
+
+    inline const sp<InputWindowHandle>& getWindowHandle(size_t index) const {
+        return mWindowHandles.itemAt(index);
+    }
+
+    // Returns the position of windowHandle, or -1 if it isn't indexed.
+    ssize_t indexOf(const sp<InputWindowHandle>& windowHandle) const;
+
+    /* Returns the position of the frontmost window of the display that a touch
+     * at (x, y) goes to: a visible, touchable window that is either touch modal
+     * or has the point in its touchable region. Returns -1 if there is none.
+     */
+    ssize_t findTouchedWindow(int32_t displayId, int32_t x, int32_t y) const;
+
+    /* Returns true if a visible window that isn't a trusted overlay, on the
+     * same display as windowHandle and in front of it, has its frame over
+     * (x, y). All the windows of the display are considered if windowHandle
+     * isn't indexed.
+     */
+    bool isObscuredAtPoint(const sp<InputWindowHandle>& windowHandle,
+            int32_t x, int32_t y) const;
+
+    /* Returns the positions, front to back, of the visible windows of the
+     * display that watch outside touches.
+     */
+    const Vector<size_t>& getOutsideTouchWatchers(int32_t displayId) const;
+
+private:
+    /* Buckets rects, each belonging to a window, into a uniform grid over
+     * their bounds. The windows of a cell are stored contiguously, front to
+     * back, each at most once.
+     */
+    class Grid {
+    public:
+        Grid();
+
+        // rects must be sorted by window, front to back.
+        void build(const Vector<Rect>& rects, const Vector<size_t>& windows);
+
+        // Returns the windows of the cell containing (x, y).
+        const size_t* getCell(int32_t x, int32_t y, size_t* outCount) const;
+
+    private:
+        Rect mBounds;
+        int32_t mCellWidth;
+        int32_t mCellHeight;
+        size_t mColumns;
+        size_t mRows;
+        // mCellWindows[mCellStarts[c]] to mCellWindows[mCellStarts[c + 1]]
+        // are the windows of cell c
+        Vector<size_t> mCellStarts;
+        Vector<size_t> mCellWindows;
+
+        void getCellRange(const Rect& rect, size_t* outLeft, size_t* outTop,
+                size_t* outRight, size_t* outBottom) const;
+    };
+
+    struct DisplayIndex {
+        DisplayIndex();
+
+        // position of the frontmost touch modal window, or -1
+        ssize_t firstTouchModalWindow;
+        Vector<size_t> outsideTouchWatchers;
+        // touchable regions of the touchable windows in front of the first
+        // touch modal window
+        Grid touchable;
+        // frames of the windows that can obscure the windows behind them
+        Grid obscuring;
+    };
+
+    Vector<sp<InputWindowHandle> > mWindowHandles;
+    KeyedVector<const InputWindowHandle*, size_t> mPositions;
+    KeyedVector<int32_t, DisplayIndex> mDisplays;
+    const Vector<size_t> mNoWindows;
+};
+
+} // namespace android
+
+#endif // _UI_INPUT_WINDOW_INDEX_H
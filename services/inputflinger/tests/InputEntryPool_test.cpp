@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../InputEntryPool.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <thread>
+
+namespace android {
+
+// An arbitrary block size.
+static const size_t BLOCK_SIZE = 48;
+
+
+// --- InputEntryPoolTest ---
+
+class InputEntryPoolTest : public testing::Test {
+protected:
+    static std::string dumpPool(const InputEntryPool& pool) {
+        String8 dump;
+        pool.dump(dump);
+        return dump.string();
+    }
+
+    static void expectDumpContains(const InputEntryPool& pool, const char* expected) {
+        std::string dump = dumpPool(pool);
+        EXPECT_NE(std::string::npos, dump.find(expected))
+                << "Expected \"" << expected << "\" in: " << dump;
+    }
+};
+
+TEST_F(InputEntryPoolTest, Allocate_AfterFree_ReusesBlock) {
+    InputEntryPool pool("Test", BLOCK_SIZE, 4);
+
+    void* first = pool.allocate(BLOCK_SIZE);
+    ASSERT_TRUE(first != NULL);
+    expectDumpContains(pool, "inUse=1, peakInUse=1, free=0/4, hits=0, misses=1");
+
+    pool.free(first, BLOCK_SIZE);
+    expectDumpContains(pool, "inUse=0, peakInUse=1, free=1/4, hits=0, misses=1");
+
+    void* second = pool.allocate(BLOCK_SIZE);
+    EXPECT_EQ(first, second);
+    expectDumpContains(pool, "inUse=1, peakInUse=1, free=0/4, hits=1, misses=1, "
+            "hitRate=50.0%");
+
+    pool.free(second, BLOCK_SIZE);
+}
+
+TEST_F(InputEntryPoolTest, Free_WhenPoolFull_ReleasesBlock) {
+    InputEntryPool pool("Test", BLOCK_SIZE, 2);
+
+    void* blocks[3];
+    for (size_t i = 0; i < 3; i++) {
+        blocks[i] = pool.allocate(BLOCK_SIZE);
+    }
+    for (size_t i = 0; i < 3; i++) {
+        pool.free(blocks[i], BLOCK_SIZE);
+    }
+    expectDumpContains(pool, "inUse=0, peakInUse=3, free=2/2, hits=0, misses=3");
+
+    for (size_t i = 0; i < 3; i++) {
+        blocks[i] = pool.allocate(BLOCK_SIZE);
+    }
+    expectDumpContains(pool, "inUse=3, peakInUse=3, free=0/2, hits=2, misses=4");
+
+    for (size_t i = 0; i < 3; i++) {
+        pool.free(blocks[i], BLOCK_SIZE);
+    }
+}
+
+TEST_F(InputEntryPoolTest, Allocate_WithOtherSize_BypassesPool) {
+    InputEntryPool pool("Test", BLOCK_SIZE, 4);
+
+    void* block = pool.allocate(BLOCK_SIZE * 2);
+    ASSERT_TRUE(block != NULL);
+    pool.free(block, BLOCK_SIZE * 2);
+
+    expectDumpContains(pool, "inUse=0, peakInUse=0, free=0/4, hits=0, misses=0, "
+            "hitRate=0.0%");
+}
+
+TEST_F(InputEntryPoolTest, AllocateAndFree_FromSeveralThreads_KeepsCountsConsistent) {
+    static const size_t NUM_THREADS = 4;
+    static const size_t NUM_ITERATIONS = 10000;
+    InputEntryPool pool("Test", BLOCK_SIZE, 8);
+
+    std::thread threads[NUM_THREADS];
+    for (size_t t = 0; t < NUM_THREADS; t++) {
+        threads[t] = std::thread([&pool, t]() {
+            for (size_t i = 0; i < NUM_ITERATIONS; i++) {
+                void* block = pool.allocate(BLOCK_SIZE);
+                // Each owner writes the whole block, so handing a block to two
+                // owners at once shows up as corrupted contents.
+                memset(block, int(t), BLOCK_SIZE);
+                for (size_t j = 0; j < BLOCK_SIZE; j++) {
+                    ASSERT_EQ(int(t), static_cast<uint8_t*>(block)[j]);
+                }
+                pool.free(block, BLOCK_SIZE);
+            }
+        });
+    }
+    for (size_t t = 0; t < NUM_THREADS; t++) {
+        threads[t].join();
+    }
+
+    std::string dump = dumpPool(pool);
+    EXPECT_NE(std::string::npos, dump.find("inUse=0,")) << dump;
+    unsigned long long hits = 0, misses = 0;
+    const char* counts = strstr(dump.c_str(), "hits=");
+    ASSERT_TRUE(counts != NULL) << dump;
+    ASSERT_EQ(2, sscanf(counts, "hits=%llu, misses=%llu", &hits, &misses)) << dump;
+    EXPECT_EQ(NUM_THREADS * NUM_ITERATIONS, hits + misses);
+    EXPECT_LE(misses, NUM_THREADS * NUM_ITERATIONS / 2);
+}
+
+} // namespace android
@@ -1350,6 +1350,114 @@ TEST_F(InputReaderTest, LoopOnce_ForwardsRawEventsToMappers) {
 }
 
 
+// --- QueuedInputListenerTest ---
+
+class QueuedInputListenerTest : public testing::Test {
+protected:
+    static const int32_t DEVICE_ID = 1;
+
+    sp<FakeInputListener> mFakeListener;
+    sp<QueuedInputListener> mQueuedListener;
+
+    virtual void SetUp() {
+        mFakeListener = new FakeInputListener();
+        mQueuedListener = new QueuedInputListener(mFakeListener,
+                true /*coalesceMotionSamples*/);
+    }
+
+    virtual void TearDown() {
+        mQueuedListener.clear();
+        mFakeListener.clear();
+    }
+
+    void notifyMotion(nsecs_t eventTime, int32_t action, float x, float y,
+            int32_t deviceId = DEVICE_ID) {
+        PointerProperties pointerProperties;
+        pointerProperties.clear();
+        pointerProperties.toolType = AMOTION_EVENT_TOOL_TYPE_FINGER;
+        PointerCoords pointerCoords;
+        pointerCoords.clear();
+        pointerCoords.setAxisValue(AMOTION_EVENT_AXIS_X, x);
+        pointerCoords.setAxisValue(AMOTION_EVENT_AXIS_Y, y);
+        NotifyMotionArgs args(eventTime, deviceId, AINPUT_SOURCE_TOUCHSCREEN, 0, action, 0, 0,
+                0, 0, 0, ADISPLAY_ID_DEFAULT, 1, &pointerProperties, &pointerCoords,
+                1, 1, ARBITRARY_TIME);
+        mQueuedListener->notifyMotion(&args);
+    }
+};
+
+TEST_F(QueuedInputListenerTest, Flush_CoalescesConsecutiveMoves) {
+    notifyMotion(ARBITRARY_TIME, AMOTION_EVENT_ACTION_DOWN, 0, 0);
+    notifyMotion(ARBITRARY_TIME + 1, AMOTION_EVENT_ACTION_MOVE, 1, 2);
+    notifyMotion(ARBITRARY_TIME + 2, AMOTION_EVENT_ACTION_MOVE, 3, 4);
+    notifyMotion(ARBITRARY_TIME + 3, AMOTION_EVENT_ACTION_MOVE, 5, 6);
+    notifyMotion(ARBITRARY_TIME + 4, AMOTION_EVENT_ACTION_UP, 5, 6);
+    mQueuedListener->flush();
+
+    NotifyMotionArgs args;
+    ASSERT_NO_FATAL_FAILURE(mFakeListener->assertNotifyMotionWasCalled(&args));
+    ASSERT_EQ(AMOTION_EVENT_ACTION_DOWN, args.action);
+    ASSERT_EQ(0U, args.getHistorySize());
+
+    ASSERT_NO_FATAL_FAILURE(mFakeListener->assertNotifyMotionWasCalled(&args));
+    ASSERT_EQ(AMOTION_EVENT_ACTION_MOVE, args.action);
+    ASSERT_EQ(ARBITRARY_TIME + 3, args.eventTime);
+    ASSERT_EQ(5.0f, args.pointerCoords[0].getX());
+    ASSERT_EQ(6.0f, args.pointerCoords[0].getY());
+    ASSERT_EQ(2U, args.getHistorySize());
+    ASSERT_EQ(2U, args.historicalPointerCoords.size());
+    ASSERT_EQ(ARBITRARY_TIME + 1, args.historicalEventTimes[0]);
+    ASSERT_EQ(1.0f, args.historicalPointerCoords[0].getX());
+    ASSERT_EQ(2.0f, args.historicalPointerCoords[0].getY());
+    ASSERT_EQ(ARBITRARY_TIME + 2, args.historicalEventTimes[1]);
+    ASSERT_EQ(3.0f, args.historicalPointerCoords[1].getX());
+    ASSERT_EQ(4.0f, args.historicalPointerCoords[1].getY());
+
+    ASSERT_NO_FATAL_FAILURE(mFakeListener->assertNotifyMotionWasCalled(&args));
+    ASSERT_EQ(AMOTION_EVENT_ACTION_UP, args.action);
+    ASSERT_NO_FATAL_FAILURE(mFakeListener->assertNotifyMotionWasNotCalled());
+
+    ASSERT_EQ(5U, mQueuedListener->getMotionSampleCount());
+    ASSERT_EQ(2U, mQueuedListener->getCoalescedMotionSampleCount());
+}
+
+TEST_F(QueuedInputListenerTest, Flush_DoesNotCoalesceAcrossOtherEventsOrFlushes) {
+    notifyMotion(ARBITRARY_TIME, AMOTION_EVENT_ACTION_MOVE, 0, 0);
+    NotifyKeyArgs keyArgs(ARBITRARY_TIME, DEVICE_ID + 1, AINPUT_SOURCE_KEYBOARD, 0,
+            AKEY_EVENT_ACTION_DOWN, 0, AKEYCODE_A, KEY_A, 0, ARBITRARY_TIME);
+    mQueuedListener->notifyKey(&keyArgs);
+    notifyMotion(ARBITRARY_TIME + 1, AMOTION_EVENT_ACTION_MOVE, 1, 1);
+    notifyMotion(ARBITRARY_TIME + 2, AMOTION_EVENT_ACTION_MOVE, 2, 2, DEVICE_ID + 1);
+    mQueuedListener->flush();
+    notifyMotion(ARBITRARY_TIME + 3, AMOTION_EVENT_ACTION_MOVE, 3, 3, DEVICE_ID + 1);
+    mQueuedListener->flush();
+
+    for (size_t i = 0; i < 4; i++) {
+        NotifyMotionArgs args;
+        ASSERT_NO_FATAL_FAILURE(mFakeListener->assertNotifyMotionWasCalled(&args));
+        ASSERT_EQ(0U, args.getHistorySize());
+        ASSERT_EQ(ARBITRARY_TIME + nsecs_t(i), args.eventTime);
+    }
+    ASSERT_NO_FATAL_FAILURE(mFakeListener->assertNotifyKeyWasCalled());
+    ASSERT_NO_FATAL_FAILURE(mFakeListener->assertNotifyMotionWasNotCalled());
+    ASSERT_EQ(0U, mQueuedListener->getCoalescedMotionSampleCount());
+}
+
+TEST_F(QueuedInputListenerTest, Flush_WhenCoalescingDisabled_SendsEverySample) {
+    mQueuedListener = new QueuedInputListener(mFakeListener);
+    notifyMotion(ARBITRARY_TIME, AMOTION_EVENT_ACTION_MOVE, 0, 0);
+    notifyMotion(ARBITRARY_TIME + 1, AMOTION_EVENT_ACTION_MOVE, 1, 1);
+    mQueuedListener->flush();
+
+    NotifyMotionArgs args;
+    ASSERT_NO_FATAL_FAILURE(mFakeListener->assertNotifyMotionWasCalled(&args));
+    ASSERT_EQ(0U, args.getHistorySize());
+    ASSERT_NO_FATAL_FAILURE(mFakeListener->assertNotifyMotionWasCalled(&args));
+    ASSERT_EQ(0U, args.getHistorySize());
+    ASSERT_EQ(2U, mQueuedListener->getMotionSampleCount());
+    ASSERT_EQ(0U, mQueuedListener->getCoalescedMotionSampleCount());
+}
+
 // --- InputDeviceTest ---
 
 class InputDeviceTest : public testing::Test {
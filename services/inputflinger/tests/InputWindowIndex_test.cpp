@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../InputWindowIndex.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+// An arbitrary display id.
+static const int32_t DISPLAY_ID = 0;
+
+// Another arbitrary display id.
+static const int32_t OTHER_DISPLAY_ID = 1;
+
+
+// --- FakeInputWindowHandle ---
+
+class FakeInputWindowHandle : public InputWindowHandle {
+public:
+    FakeInputWindowHandle(int32_t displayId, int32_t left, int32_t top,
+            int32_t right, int32_t bottom, int32_t flags) :
+            InputWindowHandle(NULL) {
+        mInfo = new InputWindowInfo();
+        mInfo->layoutParamsFlags = flags;
+        mInfo->layoutParamsType = InputWindowInfo::TYPE_APPLICATION;
+        mInfo->frameLeft = left;
+        mInfo->frameTop = top;
+        mInfo->frameRight = right;
+        mInfo->frameBottom = bottom;
+        mInfo->addTouchableRegion(Rect(left, top, right, bottom));
+        mInfo->visible = true;
+        mInfo->displayId = displayId;
+    }
+
+    InputWindowInfo* editInfo() {
+        return mInfo;
+    }
+
+    virtual bool updateInfo() {
+        return true;
+    }
+};
+
+
+// --- InputWindowIndexTest ---
+
+class InputWindowIndexTest : public testing::Test {
+protected:
+    Vector<sp<InputWindowHandle> > mWindowHandles;
+    InputWindowIndex mIndex;
+
+    sp<FakeInputWindowHandle> addWindow(int32_t left, int32_t top, int32_t right, int32_t bottom,
+            int32_t flags = InputWindowInfo::FLAG_NOT_TOUCH_MODAL,
+            int32_t displayId = DISPLAY_ID) {
+        sp<FakeInputWindowHandle> windowHandle = new FakeInputWindowHandle(displayId,
+                left, top, right, bottom, flags);
+        mWindowHandles.add(windowHandle);
+        return windowHandle;
+    }
+
+    // The linear search the dispatcher did before it had an index.
+    ssize_t findTouchedWindowSlow(int32_t displayId, int32_t x, int32_t y) {
+        for (size_t i = 0; i < mWindowHandles.size(); i++) {
+            const InputWindowInfo* windowInfo = mWindowHandles.itemAt(i)->getInfo();
+            int32_t flags = windowInfo->layoutParamsFlags;
+            if (windowInfo->displayId == displayId && windowInfo->visible
+                    && !(flags & InputWindowInfo::FLAG_NOT_TOUCHABLE)) {
+                bool isTouchModal = (flags & (InputWindowInfo::FLAG_NOT_FOCUSABLE
+                        | InputWindowInfo::FLAG_NOT_TOUCH_MODAL)) == 0;
+                if (isTouchModal || windowInfo->touchableRegionContainsPoint(x, y)) {
+                    return i;
+                }
+            }
+        }
+        return -1;
+    }
+
+    bool isObscuredAtPointSlow(size_t index, int32_t x, int32_t y) {
+        int32_t displayId = mWindowHandles.itemAt(index)->getInfo()->displayId;
+        for (size_t i = 0; i < index; i++) {
+            const InputWindowInfo* otherInfo = mWindowHandles.itemAt(i)->getInfo();
+            if (otherInfo->displayId == displayId
+                    && otherInfo->visible && !otherInfo->isTrustedOverlay()
+                    && otherInfo->frameContainsPoint(x, y)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+TEST_F(InputWindowIndexTest, FindTouchedWindow_WhenEmpty_ReturnsNone) {
+    mIndex.build(mWindowHandles);
+
+    ASSERT_EQ(-1, mIndex.findTouchedWindow(DISPLAY_ID, 10, 10));
+    ASSERT_EQ(0U, mIndex.getOutsideTouchWatchers(DISPLAY_ID).size());
+}
+
+TEST_F(InputWindowIndexTest, FindTouchedWindow_ReturnsFrontmostWindowContainingPoint) {
+    addWindow(0, 0, 100, 100);
+    addWindow(50, 50, 200, 200);
+    addWindow(0, 0, 1000, 1000);
+    mIndex.build(mWindowHandles);
+
+    ASSERT_EQ(0, mIndex.findTouchedWindow(DISPLAY_ID, 60, 60));
+    ASSERT_EQ(1, mIndex.findTouchedWindow(DISPLAY_ID, 150, 150));
+    ASSERT_EQ(2, mIndex.findTouchedWindow(DISPLAY_ID, 500, 500));
+    ASSERT_EQ(-1, mIndex.findTouchedWindow(DISPLAY_ID, 1000, 1000));
+    ASSERT_EQ(-1, mIndex.findTouchedWindow(OTHER_DISPLAY_ID, 60, 60));
+}
+
+TEST_F(InputWindowIndexTest, FindTouchedWindow_SkipsInvisibleAndUntouchableWindows) {
+    addWindow(0, 0, 100, 100)->editInfo()->visible = false;
+    addWindow(0, 0, 100, 100, InputWindowInfo::FLAG_NOT_TOUCH_MODAL
+            | InputWindowInfo::FLAG_NOT_TOUCHABLE);
+    addWindow(0, 0, 100, 100);
+    mIndex.build(mWindowHandles);
+
+    ASSERT_EQ(2, mIndex.findTouchedWindow(DISPLAY_ID, 10, 10));
+}
+
+TEST_F(InputWindowIndexTest, FindTouchedWindow_TouchModalWindowTakesTouchesOutside) {
+    addWindow(0, 0, 100, 100);
+    addWindow(200, 200, 300, 300, 0);
+    addWindow(0, 0, 1000, 1000);
+    mIndex.build(mWindowHandles);
+
+    ASSERT_EQ(0, mIndex.findTouchedWindow(DISPLAY_ID, 10, 10));
+    ASSERT_EQ(1, mIndex.findTouchedWindow(DISPLAY_ID, 500, 500));
+    ASSERT_EQ(1, mIndex.findTouchedWindow(DISPLAY_ID, -10, -10));
+}
+
+TEST_F(InputWindowIndexTest, FindTouchedWindow_UsesTouchableRegion) {
+    sp<FakeInputWindowHandle> window = addWindow(0, 0, 100, 100);
+    window->editInfo()->touchableRegion.clear();
+    window->editInfo()->addTouchableRegion(Rect(0, 0, 10, 10));
+    window->editInfo()->addTouchableRegion(Rect(90, 90, 100, 100));
+    addWindow(0, 0, 100, 100);
+    mIndex.build(mWindowHandles);
+
+    ASSERT_EQ(0, mIndex.findTouchedWindow(DISPLAY_ID, 5, 5));
+    ASSERT_EQ(0, mIndex.findTouchedWindow(DISPLAY_ID, 95, 95));
+    ASSERT_EQ(1, mIndex.findTouchedWindow(DISPLAY_ID, 50, 50));
+}
+
+TEST_F(InputWindowIndexTest, IsObscuredAtPoint_OnlyConsidersWindowsInFront) {
+    sp<FakeInputWindowHandle> overlay = addWindow(0, 0, 100, 10);
+    overlay->editInfo()->layoutParamsType = InputWindowInfo::TYPE_STATUS_BAR;
+    sp<FakeInputWindowHandle> front = addWindow(0, 0, 50, 50);
+    sp<FakeInputWindowHandle> back = addWindow(0, 0, 100, 100);
+    addWindow(0, 0, 100, 100, InputWindowInfo::FLAG_NOT_TOUCH_MODAL, OTHER_DISPLAY_ID);
+    mIndex.build(mWindowHandles);
+
+    ASSERT_FALSE(mIndex.isObscuredAtPoint(front, 10, 20));
+    ASSERT_TRUE(mIndex.isObscuredAtPoint(back, 10, 20));
+    ASSERT_FALSE(mIndex.isObscuredAtPoint(back, 10, 5));
+    ASSERT_FALSE(mIndex.isObscuredAtPoint(back, 60, 60));
+}
+
+TEST_F(InputWindowIndexTest, GetOutsideTouchWatchers_ReturnsVisibleWatchersFrontToBack) {
+    const int32_t watchFlags = InputWindowInfo::FLAG_NOT_TOUCH_MODAL
+            | InputWindowInfo::FLAG_WATCH_OUTSIDE_TOUCH;
+    addWindow(0, 0, 10, 10, watchFlags);
+    addWindow(0, 0, 10, 10, watchFlags)->editInfo()->visible = false;
+    addWindow(0, 0, 10, 10);
+    addWindow(0, 0, 10, 10, watchFlags | InputWindowInfo::FLAG_NOT_TOUCHABLE);
+    addWindow(0, 0, 10, 10, watchFlags, OTHER_DISPLAY_ID);
+    mIndex.build(mWindowHandles);
+
+    const Vector<size_t>& watchers = mIndex.getOutsideTouchWatchers(DISPLAY_ID);
+    ASSERT_EQ(2U, watchers.size());
+    ASSERT_EQ(0U, watchers.itemAt(0));
+    ASSERT_EQ(3U, watchers.itemAt(1));
+}
+
+TEST_F(InputWindowIndexTest, IndexOf_ReturnsPositionOfIndexedWindows) {
+    sp<FakeInputWindowHandle> first = addWindow(0, 0, 10, 10);
+    sp<FakeInputWindowHandle> second = addWindow(0, 0, 10, 10);
+    sp<FakeInputWindowHandle> other = new FakeInputWindowHandle(DISPLAY_ID,
+            0, 0, 10, 10, 0);
+    mIndex.build(mWindowHandles);
+
+    ASSERT_EQ(0, mIndex.indexOf(first));
+    ASSERT_EQ(1, mIndex.indexOf(second));
+    ASSERT_EQ(-1, mIndex.indexOf(other));
+
+    mIndex.clear();
+    ASSERT_EQ(-1, mIndex.indexOf(first));
+}
+
+TEST_F(InputWindowIndexTest, ManyOverlappingWindows_MatchLinearSearch) {
+    // A deterministic scatter of windows of various sizes over a 1000x1000
+    // display, with a touch modal window part way down.
+    uint32_t seed = 1;
+    for (size_t i = 0; i < 100; i++) {
+        seed = seed * 1103515245 + 12345;
+        int32_t left = int32_t((seed >> 8) % 900);
+        seed = seed * 1103515245 + 12345;
+        int32_t top = int32_t((seed >> 8) % 900);
+        seed = seed * 1103515245 + 12345;
+        int32_t size = int32_t((seed >> 8) % 200) + 1;
+        int32_t flags = i == 70 ? 0 : InputWindowInfo::FLAG_NOT_TOUCH_MODAL;
+        addWindow(left, top, left + size, top + size, flags);
+    }
+    mIndex.build(mWindowHandles);
+
+    for (int32_t y = -5; y < 1105; y += 7) {
+        for (int32_t x = -5; x < 1105; x += 7) {
+            ASSERT_EQ(findTouchedWindowSlow(DISPLAY_ID, x, y),
+                    mIndex.findTouchedWindow(DISPLAY_ID, x, y))
+                    << "at (" << x << ", " << y << ")";
+            for (size_t i = 0; i < mWindowHandles.size(); i += 9) {
+                ASSERT_EQ(isObscuredAtPointSlow(i, x, y),
+                        mIndex.isObscuredAtPoint(mWindowHandles.itemAt(i), x, y))
+                        << "window " << i << " at (" << x << ", " << y << ")";
+            }
+        }
+    }
+}
+
+} // namespace android
@@ -9,16 +9,22 @@ LOCAL_SRC_FILES := \
     DisplayDevice.cpp \
     DispSync.cpp \
     EventControlThread.cpp \
+    PresentThread.cpp \
+    DisplayWorkerPool.cpp \
     StartPropertySetThread.cpp \
     EventThread.cpp \
     FrameTracker.cpp \
+    LatencyHistogram.cpp \
+    VsyncKalmanFilter.cpp \
     GpuService.cpp \
     Layer.cpp \
     LayerDim.cpp \
     LayerRejecter.cpp \
+    LayerSnapshot.cpp \
     LayerVector.cpp \
     MessageQueue.cpp \
     MonitoredProducer.cpp \
+    ScreenshotImageCache.cpp \
     SurfaceFlingerConsumer.cpp \
     SurfaceInterceptor.cpp \
     Transform.cpp \
@@ -96,6 +102,7 @@ LOCAL_SHARED_LIBRARIES := \
     libsync \
     libprotobuf-cpp-lite \
     libbase \
+    libz \
     android.hardware.power@1.0
 
 LOCAL_EXPORT_SHARED_LIBRARY_HEADERS := \
@@ -20,7 +20,9 @@
 // This is needed for stdint.h to define INT64_MAX in C++
 #define __STDC_LIMIT_MACROS
 
+#include <inttypes.h>
 #include <math.h>
+#include <sched.h>
 
 #include <algorithm>
 
@@ -34,7 +36,6 @@
 #include <ui/FenceTime.h>
 
 #include "DispSync.h"
-#include "SurfaceFlinger.h"
 #include "EventLog/EventLog.h"
 
 using std::max;
@@ -375,10 +376,14 @@ private:
     bool mParity;
 };
 
-DispSync::DispSync(const char* name) :
+DispSync::DispSync(const char* name, Model model) :
         mName(name),
+        mModel(model),
+        mPeriod(0),
         mRefreshSkipCount(0),
-        mThread(new DispSyncThread(name)) {
+        mThread(new DispSyncThread(name)),
+        mPresentTimeOffset(0),
+        mIgnorePresentFences(false) {
 }
 
 DispSync::~DispSync() {}
@@ -421,6 +426,7 @@ void DispSync::reset() {
     mNumResyncSamples = 0;
     mFirstResyncSample = 0;
     mNumResyncSamplesSincePresent = 0;
+    mFilter.reset(mPeriod / (1 + mRefreshSkipCount));
     resetErrorLocked();
 }
 
@@ -428,11 +434,15 @@ bool DispSync::addPresentFence(const std::shared_ptr<FenceTime>& fenceTime) {
     Mutex::Autolock lock(mMutex);
 
     mPresentFences[mPresentSampleOffset] = fenceTime;
+    mPresentFenceFiltered[mPresentSampleOffset] = false;
     mPresentSampleOffset = (mPresentSampleOffset + 1) % NUM_PRESENT_SAMPLES;
     mNumResyncSamplesSincePresent = 0;
 
     updateErrorLocked();
 
+    if (mModel == Model::KALMAN && mFilter.needsReset()) {
+        return true;
+    }
     return !mModelUpdated || mError > kErrorThreshold;
 }
 
@@ -441,6 +451,9 @@ void DispSync::beginResync() {
     ALOGV("[%s] beginResync", mName);
     mModelUpdated = false;
     mNumResyncSamples = 0;
+    if (mFilter.needsReset()) {
+        mFilter.reset(mPeriod / (1 + mRefreshSkipCount));
+    }
 }
 
 bool DispSync::addResyncSample(nsecs_t timestamp) {
@@ -465,6 +478,9 @@ bool DispSync::addResyncSample(nsecs_t timestamp) {
         mFirstResyncSample = (mFirstResyncSample + 1) % MAX_RESYNC_SAMPLES;
     }
 
+    if (mModel == Model::KALMAN) {
+        mFilter.addSample(timestamp, VsyncKalmanFilter::HW_VSYNC);
+    }
     updateModelLocked();
 
     if (mNumResyncSamplesSincePresent++ > MAX_RESYNC_SAMPLES_WITHOUT_PRESENT) {
@@ -483,6 +499,9 @@ bool DispSync::addResyncSample(nsecs_t timestamp) {
     // Check against kErrorThreshold / 2 to add some hysteresis before having to
     // resync again
     bool modelLocked = mModelUpdated && mError < (kErrorThreshold / 2);
+    if (mModel == Model::KALMAN && mFilter.needsReset()) {
+        modelLocked = false;
+    }
     ALOGV("[%s] addResyncSample returning %s", mName,
             modelLocked ? "locked" : "unlocked");
     return !modelLocked;
@@ -491,6 +510,15 @@ bool DispSync::addResyncSample(nsecs_t timestamp) {
 void DispSync::endResync() {
 }
 
+bool DispSync::hasConfidentModel(nsecs_t now) const {
+    Mutex::Autolock lock(mMutex);
+    if (mModel != Model::KALMAN || !mModelUpdated || mFilter.needsReset()) {
+        return false;
+    }
+    nsecs_t error = mFilter.getPredictionError(now);
+    return error >= 0 && error * error < kErrorThreshold / 2;
+}
+
 status_t DispSync::addEventListener(const char* name, nsecs_t phase,
         const sp<Callback>& callback) {
     Mutex::Autolock lock(mMutex);
@@ -514,6 +542,7 @@ void DispSync::setPeriod(nsecs_t period) {
     mPeriod = period;
     mPhase = 0;
     mReferenceTime = 0;
+    mFilter.reset(period);
     mThread->updateModel(mPeriod, mPhase, mReferenceTime);
 }
 
@@ -524,6 +553,11 @@ nsecs_t DispSync::getPeriod() {
 }
 
 void DispSync::updateModelLocked() {
+    if (mModel == Model::KALMAN) {
+        updateKalmanModelLocked();
+        return;
+    }
+
     ALOGV("[%s] updateModelLocked %zu", mName, mNumResyncSamples);
     if (mNumResyncSamples >= MIN_RESYNC_SAMPLES_FOR_UPDATE) {
         ALOGV("[%s] Computing...", mName);
@@ -582,7 +616,55 @@ void DispSync::updateModelLocked() {
     }
 }
 
+void DispSync::updateKalmanModelLocked() {
+    ALOGV("[%s] updateKalmanModelLocked %zu", mName, mFilter.getNumSamples());
+    if (mFilter.getNumSamples() < MIN_RESYNC_SAMPLES_FOR_UPDATE) {
+        return;
+    }
+
+    // The filter models the last vsync event, there is no phase to add
+    mPeriod = mFilter.getPeriod();
+    mPhase = 0;
+    mReferenceTime = mFilter.getReferenceTime();
+
+    if (kTraceDetailedInfo) {
+        ATRACE_INT64("DispSync:Period", mPeriod);
+        ATRACE_INT64("DispSync:PredictionError",
+                mFilter.getPredictionError(mReferenceTime));
+    }
+
+    // Artificially inflate the period if requested.
+    mPeriod += mPeriod * mRefreshSkipCount;
+
+    mThread->updateModel(mPeriod, mPhase, mReferenceTime);
+    mModelUpdated = true;
+}
+
 void DispSync::updateErrorLocked() {
+    if (mModel == Model::KALMAN && mFilter.getNumSamples() > 0) {
+        // Feed the fences that signaled since the last call to the filter,
+        // oldest first
+        bool filtered = false;
+        for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
+            size_t idx = (mPresentSampleOffset + i) % NUM_PRESENT_SAMPLES;
+            if (mPresentFenceFiltered[idx]) {
+                continue;
+            }
+            nsecs_t time = mPresentFences[idx]->getCachedSignalTime();
+            if (time == Fence::SIGNAL_TIME_PENDING) {
+                continue;
+            }
+            mPresentFenceFiltered[idx] = true;
+            if (time != Fence::SIGNAL_TIME_INVALID) {
+                mFilter.addSample(time, VsyncKalmanFilter::PRESENT_FENCE);
+                filtered = true;
+            }
+        }
+        if (filtered) {
+            updateKalmanModelLocked();
+        }
+    }
+
     if (!mModelUpdated) {
         return;
     }
@@ -641,6 +723,7 @@ void DispSync::resetErrorLocked() {
     mZeroErrSamplesCount = 0;
     for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
         mPresentFences[i] = FenceTime::NO_FENCE;
+        mPresentFenceFiltered[i] = true;
     }
 }
 
@@ -651,10 +734,32 @@ nsecs_t DispSync::computeNextRefresh(int periodOffset) const {
     return (((now - phase) / mPeriod) + periodOffset + 1) * mPeriod + phase;
 }
 
+nsecs_t DispSync::computeNextVsync(nsecs_t when) const {
+    Mutex::Autolock lock(mMutex);
+    nsecs_t period = mPeriod / (1 + mRefreshSkipCount);
+    nsecs_t phase = mReferenceTime + mPhase;
+    if (period <= 0) {
+        return when;
+    }
+    if (when < phase) {
+        return phase - ((phase - when) / period) * period;
+    }
+    return phase + ((when - phase) / period + 1) * period;
+}
+
 void DispSync::dump(String8& result) const {
     Mutex::Autolock lock(mMutex);
     result.appendFormat("present fences are %s\n",
             mIgnorePresentFences ? "ignored" : "used");
+    if (mModel == Model::KALMAN) {
+        result.appendFormat("model: kalman (%zu samples, %zu outliers, "
+                "prediction error %" PRId64 " ns%s)\n", mFilter.getNumSamples(),
+                mFilter.getNumRejectedSamples(),
+                mFilter.getPredictionError(systemTime(SYSTEM_TIME_MONOTONIC)),
+                mFilter.needsReset() ? ", needs resync" : "");
+    } else {
+        result.appendFormat("model: average\n");
+    }
     result.appendFormat("mPeriod: %" PRId64 " ns (%.3f fps; skipCount=%d)\n",
             mPeriod, 1000000000.0 / mPeriod, mRefreshSkipCount);
     result.appendFormat("mPhase: %" PRId64 " ns\n", mPhase);
@@ -25,6 +25,8 @@
 
 #include <ui/FenceTime.h>
 
+#include "VsyncKalmanFilter.h"
+
 #include <memory>
 
 namespace android {
@@ -46,17 +48,28 @@ class DispSyncThread;
 // current model accurately represents the hardware event times it will return
 // false to indicate that a resynchronization (via addResyncSample) is not
 // needed.
+//
+// Two models are available. AVERAGE fits the period and phase to the last
+// MAX_RESYNC_SAMPLES hardware vsync events and only uses present fences to
+// validate them. KALMAN tracks the period and phase with a
+// VsyncKalmanFilter, which also learns from present fences, so it keeps up
+// with a drifting display clock without turning hardware vsync events on.
 class DispSync {
 
 public:
 
+    enum class Model {
+        AVERAGE,
+        KALMAN,
+    };
+
     class Callback: public virtual RefBase {
     public:
         virtual ~Callback() {};
         virtual void onDispSyncEvent(nsecs_t when) = 0;
     };
 
-    explicit DispSync(const char* name);
+    explicit DispSync(const char* name, Model model = Model::AVERAGE);
     ~DispSync();
 
     void init(bool hasSyncFramework, int64_t dispSyncPresentTimeOffset);
@@ -90,6 +103,12 @@ public:
     bool addResyncSample(nsecs_t timestamp);
     void endResync();
 
+    // hasConfidentModel returns true if the model is expected to predict
+    // the vsync events following now well enough without a resync, even
+    // though it hasn't seen hardware vsync events for a while. Always false
+    // with the AVERAGE model.
+    bool hasConfidentModel(nsecs_t now) const;
+
     // The setPeriod method sets the vsync event model's period to a specific
     // value.  This should be used to prime the model when a display is first
     // turned on.  It should NOT be used after that.
@@ -122,12 +141,17 @@ public:
     // the refresh after next. etc.
     nsecs_t computeNextRefresh(int periodOffset) const;
 
+    // computeNextVsync computes when the first modeled vsync event after
+    // when happens, ignoring the refresh skip count.
+    nsecs_t computeNextVsync(nsecs_t when) const;
+
     // dump appends human-readable debug info to the result string.
     void dump(String8& result) const;
 
 private:
 
     void updateModelLocked();
+    void updateKalmanModelLocked();
     void updateErrorLocked();
     void resetErrorLocked();
 
@@ -138,6 +162,7 @@ private:
     enum { ACCEPTABLE_ZERO_ERR_SAMPLES_COUNT = 64 };
 
     const char* const mName;
+    const Model mModel;
 
     // mPeriod is the computed period of the modeled vsync events in
     // nanoseconds.
@@ -178,6 +203,11 @@ private:
             mPresentFences[NUM_PRESENT_SAMPLES] {FenceTime::NO_FENCE};
     size_t mPresentSampleOffset;
 
+    // With the KALMAN model, the filter and which of mPresentFences it has
+    // seen already
+    VsyncKalmanFilter mFilter;
+    bool mPresentFenceFiltered[NUM_PRESENT_SAMPLES];
+
     int mRefreshSkipCount;
 
     // mThread is the thread from which all the callbacks are called.
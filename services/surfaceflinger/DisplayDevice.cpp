@@ -73,6 +73,40 @@ inline void eglSetSwapRectangleANDROID (EGLDisplay, EGLSurface, EGLint, EGLint,
 }
 #endif
 
+#ifdef USE_HWC2
+static bool findExtension(const char* exts, const char* name) {
+    if (!exts)
+        return false;
+    size_t len = strlen(name);
+
+    const char* pos = exts;
+    while ((pos = strstr(pos, name)) != NULL) {
+        if (pos[len] == '\0' || pos[len] == ' ')
+            return true;
+        pos += len;
+    }
+
+    return false;
+}
+
+// Converts region to the EGL rectangle list of EGL_KHR_partial_update and
+// EGL_KHR_swap_buffers_with_damage: x, y, width, height, with y counted
+// from the bottom of the surface.
+static std::vector<EGLint> toEglRects(const Region& region, int height) {
+    std::vector<EGLint> rects;
+    size_t count;
+    const Rect* r = region.getArray(&count);
+    rects.reserve(count * 4);
+    for (size_t i = 0; i < count; i++) {
+        rects.push_back(r[i].left);
+        rects.push_back(height - r[i].bottom);
+        rects.push_back(r[i].width());
+        rects.push_back(r[i].height());
+    }
+    return rects;
+}
+#endif
+
 /*
  * Initialize the display to the specified values.
  *
@@ -161,6 +195,16 @@ DisplayDevice::DisplayDevice(
     mSurface = eglSurface;
 #ifndef USE_HWC2
     mFormat = format;
+#else
+    const char* const eglExtensions = eglQueryString(display, EGL_EXTENSIONS);
+    mHasBufferAge = findExtension(eglExtensions, "EGL_EXT_buffer_age");
+    mHasPartialUpdate = findExtension(eglExtensions, "EGL_KHR_partial_update");
+    mHasSwapBuffersWithDamage =
+            findExtension(eglExtensions, "EGL_KHR_swap_buffers_with_damage");
+    mDamageHistorySize = 0;
+    mNeedsFullRepaint = true;
+    mHasRepaintRect = false;
+    mRepaintsEverything = false;
 #endif
     mPageFlipCount = 0;
     mViewport.makeInvalid();
@@ -332,7 +376,39 @@ void DisplayDevice::swapBuffers(HWComposer& hwc) const {
             (hwc.hasGlesComposition(mHwcDisplayId) &&
              (hwc.supportsFramebufferTarget() || mType >= DISPLAY_VIRTUAL))) {
 #endif
+#ifdef USE_HWC2
+        EGLBoolean success;
+        // After a full repaint, the contents may have changed everywhere
+        // (cleared holes, another color mode), not just in mPendingDamage
+        if (mHasSwapBuffersWithDamage && mHasRepaintRect && !mRepaintsEverything) {
+            const std::vector<EGLint> rects(
+                    toEglRects(mPendingDamage.intersect(getBounds()), mDisplayHeight));
+            success = eglSwapBuffersWithDamageKHR(mDisplay, mSurface,
+                    const_cast<EGLint*>(rects.data()), rects.size() / 4);
+        } else {
+            success = eglSwapBuffers(mDisplay, mSurface);
+        }
+
+        if (success && mHasRepaintRect) {
+            for (size_t i = MAX_DAMAGE_HISTORY - 1; i > 0; i--) {
+                mDamageHistory[i] = mDamageHistory[i - 1];
+            }
+            mDamageHistory[0] = mRepaintsEverything ? Region(getBounds()) : mPendingDamage;
+            if (mDamageHistorySize < MAX_DAMAGE_HISTORY) {
+                mDamageHistorySize++;
+            }
+            mNeedsFullRepaint = false;
+        } else {
+            // this frame wasn't drawn by doDisplayComposition, we don't know
+            // what's in the buffer anymore
+            invalidateDamageHistory();
+        }
+        mPendingDamage.clear();
+        mHasRepaintRect = false;
+        mRepaintsEverything = false;
+#else
         EGLBoolean success = eglSwapBuffers(mDisplay, mSurface);
+#endif
         if (!success) {
             EGLint error = eglGetError();
             if (error == EGL_CONTEXT_LOST ||
@@ -370,6 +446,57 @@ uint32_t DisplayDevice::getFlags() const
     return mFlags;
 }
 
+#ifdef USE_HWC2
+Rect DisplayDevice::getRepaintRect(const Region& dirty) const {
+    mPendingDamage.orSelf(dirty);
+
+    // an age of N means the back buffer holds what was drawn N swaps ago,
+    // 0 that its contents are undefined
+    EGLint age = 0;
+    if (mHasBufferAge &&
+            !eglQuerySurface(mDisplay, mSurface, EGL_BUFFER_AGE_EXT, &age)) {
+        age = 0;
+    }
+
+    Rect repaint(getBounds());
+    if (!mNeedsFullRepaint && age > 0 && size_t(age) <= mDamageHistorySize + 1) {
+        Region damage(mPendingDamage);
+        for (EGLint i = 0; i < age - 1; i++) {
+            damage.orSelf(mDamageHistory[i]);
+        }
+        // client composition is scissored, so redraw the bounds
+        repaint.intersect(damage.getBounds(), &repaint);
+    }
+
+    if (mHasPartialUpdate) {
+        // lets tiled GPUs skip loading the rest of the buffer
+        const std::vector<EGLint> rects(toEglRects(Region(repaint), mDisplayHeight));
+        eglSetDamageRegionKHR(mDisplay, mSurface,
+                const_cast<EGLint*>(rects.data()), rects.size() / 4);
+    }
+
+    mHasRepaintRect = true;
+    mRepaintsEverything = repaint == getBounds();
+    return repaint;
+}
+
+void DisplayDevice::addDamage(const Region& dirty) const {
+    mPendingDamage.orSelf(dirty);
+}
+
+void DisplayDevice::invalidateDamageHistory() const {
+    mDamageHistorySize = 0;
+    mNeedsFullRepaint = true;
+}
+
+void DisplayDevice::setCompositionSignature(std::vector<uint64_t>&& signature) const {
+    if (signature != mCompositionSignature) {
+        mCompositionSignature = std::move(signature);
+        invalidateDamageHistory();
+    }
+}
+#endif
+
 EGLBoolean DisplayDevice::makeCurrent(EGLDisplay dpy, EGLContext ctx) const {
     EGLBoolean result = EGL_TRUE;
     EGLSurface sur = eglGetCurrentSurface(EGL_DRAW);
@@ -451,6 +578,9 @@ int DisplayDevice::getActiveConfig()  const {
 // ----------------------------------------------------------------------------
 #ifdef USE_HWC2
 void DisplayDevice::setActiveColorMode(android_color_mode_t mode) {
+    if (mode != mActiveColorMode) {
+        invalidateDamageHistory();
+    }
     mActiveColorMode = mode;
 }
 
@@ -533,6 +663,9 @@ void DisplayDevice::setDisplaySize(const int newWidth, const int newHeight) {
     }
 
     mDisplaySurface->resizeBuffers(newWidth, newHeight);
+#ifdef USE_HWC2
+    invalidateDamageHistory();
+#endif
 
     ANativeWindow* const window = mNativeWindow.get();
     mSurface = eglCreateWindowSurface(mDisplay, mConfig, window, NULL);
@@ -675,6 +808,12 @@ void DisplayDevice::dump(String8& result) const {
                         mFrame.left, mFrame.top, mFrame.right, mFrame.bottom, mScissor.left,
                         mScissor.top, mScissor.right, mScissor.bottom, tr[0][0], tr[1][0], tr[2][0],
                         tr[0][1], tr[1][1], tr[2][1], tr[0][2], tr[1][2], tr[2][2]);
+#ifdef USE_HWC2
+    result.appendFormat("   bufferAge=%d, partialUpdate=%d, swapWithDamage=%d, "
+                        "damageHistory=%zu\n",
+                        mHasBufferAge, mHasPartialUpdate, mHasSwapBuffersWithDamage,
+                        mDamageHistorySize);
+#endif
 
     String8 surfaceDump;
     mDisplaySurface->dumpAsString(surfaceDump);
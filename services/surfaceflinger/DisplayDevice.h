@@ -41,6 +41,7 @@
 
 #ifdef USE_HWC2
 #include <memory>
+#include <vector>
 #endif
 
 struct ANativeWindow;
@@ -163,6 +164,31 @@ public:
     status_t compositionComplete() const;
 #endif
 
+#ifdef USE_HWC2
+    /* ------------------------------------------------------------------------
+     * Partial client composition.
+     *
+     * When the EGL surface reports the age of its back buffer
+     * (EGL_EXT_buffer_age), only what changed since that buffer was last
+     * drawn needs to be redrawn into it. The display remembers what changed
+     * in each of its last MAX_DAMAGE_HISTORY swaps for this purpose.
+     */
+    // Returns the part of the back buffer to redraw for it to be up to date,
+    // given that dirty changed since the last frame, or the whole display if
+    // the back buffer contents are unknown. Must be called before drawing,
+    // with this display's surface current.
+    Rect getRepaintRect(const Region& dirty) const;
+    // Records a change that wasn't drawn into the client target because
+    // HWC composed the whole frame.
+    void addDamage(const Region& dirty) const;
+    // Forgets the damage history, the next frame will be fully redrawn.
+    void invalidateDamageHistory() const;
+    // Records how each visible layer is composed this frame, and invalidates
+    // the damage history if that changed: parts of the back buffers that
+    // didn't change don't hold what this composition would draw there.
+    void setCompositionSignature(std::vector<uint64_t>&& signature) const;
+#endif
+
     // called after h/w composer has completed its set() call
 #ifdef USE_HWC2
     void onSwapBuffersCompleted() const;
@@ -282,6 +308,25 @@ private:
     // Initialized by SurfaceFlinger when the DisplayDevice is created.
     // Fed to RenderEngine during composition.
     bool mDisplayHasWideColor;
+
+    enum { MAX_DAMAGE_HISTORY = 4 };
+    bool mHasBufferAge;
+    bool mHasPartialUpdate;
+    bool mHasSwapBuffersWithDamage;
+    // what changed in the display with each of the last swaps, most recent
+    // first
+    mutable Region mDamageHistory[MAX_DAMAGE_HISTORY];
+    mutable size_t mDamageHistorySize;
+    // what changed since the last swap
+    mutable Region mPendingDamage;
+    // set when the back buffers don't hold what the current composition
+    // would draw, until a fully repainted frame is swapped
+    mutable bool mNeedsFullRepaint;
+    // set by getRepaintRect until the frame is swapped
+    mutable bool mHasRepaintRect;
+    // set by getRepaintRect when the whole display is redrawn
+    mutable bool mRepaintsEverything;
+    mutable std::vector<uint64_t> mCompositionSignature;
 #endif
 
     int translateX;
@@ -230,7 +230,8 @@ Display::Display(android::Hwc2::Composer& composer,
     mCapabilities(capabilities),
     mId(id),
     mIsConnected(false),
-    mType(type)
+    mType(type),
+    mHasStateChanges(true)
 {
     ALOGV("Created display %" PRIu64, id);
     setConnected(true);
@@ -303,9 +304,10 @@ Error Display::createLayer(Layer** outLayer)
     }
 
     auto layer = std::make_unique<Layer>(
-            mComposer, mCapabilities, mId, layerId);
+            mComposer, mCapabilities, *this, layerId);
     *outLayer = layer.get();
     mLayers.emplace(layerId, std::move(layer));
+    mHasStateChanges = true;
     return Error::None;
 }
 
@@ -315,6 +317,7 @@ Error Display::destroyLayer(Layer* layer)
         return Error::BadParameter;
     }
     mLayers.erase(layer->getId());
+    mHasStateChanges = true;
     return Error::None;
 }
 
@@ -540,6 +543,7 @@ Error Display::setActiveConfig(const std::shared_ptr<const Config>& config)
         return Error::BadConfig;
     }
     auto intError = mComposer.setActiveConfig(mId, config->getId());
+    mHasStateChanges = true;
     return static_cast<Error>(intError);
 }
 
@@ -558,6 +562,7 @@ Error Display::setColorMode(android_color_mode_t mode)
 {
     auto intError = mComposer.setColorMode(
             mId, static_cast<Hwc2::ColorMode>(mode));
+    mHasStateChanges = true;
     return static_cast<Error>(intError);
 }
 
@@ -566,6 +571,7 @@ Error Display::setColorTransform(const android::mat4& matrix,
 {
     auto intError = mComposer.setColorTransform(mId,
             matrix.asArray(), static_cast<Hwc2::ColorTransform>(hint));
+    mHasStateChanges = true;
     return static_cast<Error>(intError);
 }
 
@@ -576,6 +582,7 @@ Error Display::setOutputBuffer(const sp<GraphicBuffer>& buffer,
     auto handle = buffer->getNativeBuffer()->handle;
     auto intError = mComposer.setOutputBuffer(mId, handle, fenceFd);
     close(fenceFd);
+    mHasStateChanges = true;
     return static_cast<Error>(intError);
 }
 
@@ -583,6 +590,7 @@ Error Display::setPowerMode(PowerMode mode)
 {
     auto intMode = static_cast<Hwc2::IComposerClient::PowerMode>(mode);
     auto intError = mComposer.setPowerMode(mId, intMode);
+    mHasStateChanges = true;
     return static_cast<Error>(intError);
 }
 
@@ -602,6 +610,7 @@ Error Display::validate(uint32_t* outNumTypes, uint32_t* outNumRequests)
     if (error != Error::None && error != Error::HasChanges) {
         return error;
     }
+    mHasStateChanges = false;
 
     *outNumTypes = numTypes;
     *outNumRequests = numRequests;
@@ -620,6 +629,7 @@ Error Display::presentOrValidate(uint32_t* outNumTypes, uint32_t* outNumRequests
     if (error != Error::None && error != Error::HasChanges) {
         return error;
     }
+    mHasStateChanges = false;
 
     if (*state == 1) {
         *outPresentFence = new Fence(presentFenceFd);
@@ -635,6 +645,7 @@ Error Display::presentOrValidate(uint32_t* outNumTypes, uint32_t* outNumRequests
 void Display::discardCommands()
 {
     mComposer.resetCommands();
+    mHasStateChanges = true;
 }
 
 // For use by Device
@@ -710,13 +721,14 @@ Layer* Display::getLayerById(hwc2_layer_t id) const
 
 Layer::Layer(android::Hwc2::Composer& composer,
              const std::unordered_set<Capability>& capabilities,
-             hwc2_display_t displayId, hwc2_layer_t layerId)
+             Display& display, hwc2_layer_t layerId)
   : mComposer(composer),
     mCapabilities(capabilities),
-    mDisplayId(displayId),
+    mDisplay(display),
+    mDisplayId(display.getId()),
     mId(layerId)
 {
-    ALOGV("Created layer %" PRIu64 " on display %" PRIu64, layerId, displayId);
+    ALOGV("Created layer %" PRIu64 " on display %" PRIu64, layerId, mDisplayId);
 }
 
 Layer::~Layer()
@@ -746,6 +758,19 @@ Error Layer::setCursorPosition(int32_t x, int32_t y)
 Error Layer::setBuffer(uint32_t slot, const sp<GraphicBuffer>& buffer,
         const sp<Fence>& acquireFence)
 {
+    // A new buffer doesn't require validating the display again, unless it
+    // is a different kind of buffer
+    if (buffer != nullptr && (buffer->getWidth() != mBufferWidth ||
+            buffer->getHeight() != mBufferHeight ||
+            buffer->getPixelFormat() != mBufferFormat ||
+            buffer->getUsage() != mBufferUsage)) {
+        mBufferWidth = buffer->getWidth();
+        mBufferHeight = buffer->getHeight();
+        mBufferFormat = buffer->getPixelFormat();
+        mBufferUsage = buffer->getUsage();
+        mDisplay.mHasStateChanges = true;
+    }
+
     int32_t fenceFd = acquireFence->dup();
     auto intError = mComposer.setLayerBuffer(mDisplayId, mId, slot, buffer,
                                              fenceFd);
@@ -778,6 +803,7 @@ Error Layer::setSurfaceDamage(const Region& damage)
 
 Error Layer::setBlendMode(BlendMode mode)
 {
+    mDisplay.mHasStateChanges = true;
     auto intMode = static_cast<Hwc2::IComposerClient::BlendMode>(mode);
     auto intError = mComposer.setLayerBlendMode(mDisplayId, mId, intMode);
     return static_cast<Error>(intError);
@@ -785,6 +811,13 @@ Error Layer::setBlendMode(BlendMode mode)
 
 Error Layer::setColor(hwc_color_t color)
 {
+    if (mHasColor && color.r == mColor.r && color.g == mColor.g &&
+            color.b == mColor.b && color.a == mColor.a) {
+        return Error::None;
+    }
+    mColor = color;
+    mHasColor = true;
+    mDisplay.mHasStateChanges = true;
     Hwc2::IComposerClient::Color hwcColor{color.r, color.g, color.b, color.a};
     auto intError = mComposer.setLayerColor(mDisplayId, mId, hwcColor);
     return static_cast<Error>(intError);
@@ -792,6 +825,7 @@ Error Layer::setColor(hwc_color_t color)
 
 Error Layer::setCompositionType(Composition type)
 {
+    mDisplay.mHasStateChanges = true;
     auto intType = static_cast<Hwc2::IComposerClient::Composition>(type);
     auto intError = mComposer.setLayerCompositionType(
             mDisplayId, mId, intType);
@@ -804,6 +838,7 @@ Error Layer::setDataspace(android_dataspace_t dataspace)
         return Error::None;
     }
     mDataSpace = dataspace;
+    mDisplay.mHasStateChanges = true;
     auto intDataspace = static_cast<Hwc2::Dataspace>(dataspace);
     auto intError = mComposer.setLayerDataspace(mDisplayId, mId, intDataspace);
     return static_cast<Error>(intError);
@@ -811,6 +846,7 @@ Error Layer::setDataspace(android_dataspace_t dataspace)
 
 Error Layer::setDisplayFrame(const Rect& frame)
 {
+    mDisplay.mHasStateChanges = true;
     Hwc2::IComposerClient::Rect hwcRect{frame.left, frame.top,
         frame.right, frame.bottom};
     auto intError = mComposer.setLayerDisplayFrame(mDisplayId, mId, hwcRect);
@@ -819,6 +855,7 @@ Error Layer::setDisplayFrame(const Rect& frame)
 
 Error Layer::setPlaneAlpha(float alpha)
 {
+    mDisplay.mHasStateChanges = true;
     auto intError = mComposer.setLayerPlaneAlpha(mDisplayId, mId, alpha);
     return static_cast<Error>(intError);
 }
@@ -830,12 +867,18 @@ Error Layer::setSidebandStream(const native_handle_t* stream)
                 "device supports sideband streams");
         return Error::Unsupported;
     }
+    if (stream == mSidebandStream) {
+        return Error::None;
+    }
+    mSidebandStream = stream;
+    mDisplay.mHasStateChanges = true;
     auto intError = mComposer.setLayerSidebandStream(mDisplayId, mId, stream);
     return static_cast<Error>(intError);
 }
 
 Error Layer::setSourceCrop(const FloatRect& crop)
 {
+    mDisplay.mHasStateChanges = true;
     Hwc2::IComposerClient::FRect hwcRect{
         crop.left, crop.top, crop.right, crop.bottom};
     auto intError = mComposer.setLayerSourceCrop(mDisplayId, mId, hwcRect);
@@ -844,6 +887,12 @@ Error Layer::setSourceCrop(const FloatRect& crop)
 
 Error Layer::setTransform(Transform transform)
 {
+    if (mHasTransform && transform == mTransform) {
+        return Error::None;
+    }
+    mTransform = transform;
+    mHasTransform = true;
+    mDisplay.mHasStateChanges = true;
     auto intTransform = static_cast<Hwc2::Transform>(transform);
     auto intError = mComposer.setLayerTransform(mDisplayId, mId, intTransform);
     return static_cast<Error>(intError);
@@ -851,6 +900,13 @@ Error Layer::setTransform(Transform transform)
 
 Error Layer::setVisibleRegion(const Region& region)
 {
+    if (mHasVisibleRegion && region.hasSameRects(mVisibleRegion)) {
+        return Error::None;
+    }
+    mVisibleRegion = region;
+    mHasVisibleRegion = true;
+    mDisplay.mHasStateChanges = true;
+
     size_t rectCount = 0;
     auto rectArray = region.getArray(&rectCount);
 
@@ -866,12 +922,14 @@ Error Layer::setVisibleRegion(const Region& region)
 
 Error Layer::setZOrder(uint32_t z)
 {
+    mDisplay.mHasStateChanges = true;
     auto intError = mComposer.setLayerZOrder(mDisplayId, mId, z);
     return static_cast<Error>(intError);
 }
 
 Error Layer::setInfo(uint32_t type, uint32_t appId)
 {
+  mDisplay.mHasStateChanges = true;
   auto intError = mComposer.setLayerInfo(mDisplayId, mId, type, appId);
   return static_cast<Error>(intError);
 }
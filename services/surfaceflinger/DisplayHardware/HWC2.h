@@ -24,6 +24,8 @@
 #undef HWC2_USE_CPP11
 
 #include <ui/HdrCapabilities.h>
+#include <ui/PixelFormat.h>
+#include <ui/Region.h>
 #include <math/mat4.h>
 
 #include <utils/Log.h>
@@ -257,7 +259,15 @@ public:
     bool isConnected() const { return mIsConnected; }
     void setConnected(bool connected);  // For use by Device only
 
+    // Whether any state changed since the display was last validated. Layer
+    // buffers and surface damage don't count, as long as the buffers keep the
+    // same properties, so when this is false the display may be presented
+    // without validating it again.
+    bool hasStateChanges() const { return mHasStateChanges; }
+
 private:
+    friend class Layer;
+
     int32_t getAttribute(hwc2_config_t configId, Attribute attribute);
     void loadConfig(hwc2_config_t configId);
     void loadConfigs();
@@ -277,6 +287,7 @@ private:
     hwc2_display_t mId;
     bool mIsConnected;
     DisplayType mType;
+    bool mHasStateChanges;
     std::unordered_map<hwc2_layer_t, std::unique_ptr<Layer>> mLayers;
     // The ordering in this map matters, for getConfigs(), when it is
     // converted to a vector
@@ -289,7 +300,7 @@ class Layer
 public:
     Layer(android::Hwc2::Composer& composer,
           const std::unordered_set<Capability>& capabilities,
-          hwc2_display_t displayId, hwc2_layer_t layerId);
+          Display& display, hwc2_layer_t layerId);
     ~Layer();
 
     hwc2_layer_t getId() const { return mId; }
@@ -331,9 +342,24 @@ private:
     android::Hwc2::Composer& mComposer;
     const std::unordered_set<Capability>& mCapabilities;
 
+    Display& mDisplay;
     hwc2_display_t mDisplayId;
     hwc2_layer_t mId;
     android_dataspace mDataSpace = HAL_DATASPACE_UNKNOWN;
+
+    // State that is set on every frame, kept to only send changes to the
+    // HWC and keep the display validated
+    uint32_t mBufferWidth = 0;
+    uint32_t mBufferHeight = 0;
+    android::PixelFormat mBufferFormat = 0;
+    uint64_t mBufferUsage = 0;
+    android::Region mVisibleRegion;
+    bool mHasVisibleRegion = false;
+    hwc_color_t mColor = {0, 0, 0, 0};
+    bool mHasColor = false;
+    Transform mTransform = Transform::None;
+    bool mHasTransform = false;
+    const native_handle_t* mSidebandStream = nullptr;
     std::function<void(Layer*)> mLayerDestroyedListener;
 };
 
@@ -66,7 +66,8 @@ HWComposer::HWComposer(bool useVrComposer)
       mHwcDisplaySlots(),
       mCBContext(),
       mVSyncCounts(),
-      mRemainingHwcVirtualDisplays(0)
+      mRemainingHwcVirtualDisplays(0),
+      mSkipUnchangedValidate(true)
 {
     for (size_t i=0 ; i<HWC_NUM_PHYSICAL_DISPLAY_TYPES ; i++) {
         mLastHwVSync[i] = 0;
@@ -75,6 +76,10 @@ HWComposer::HWComposer(bool useVrComposer)
 
     mHwcDevice = std::make_unique<HWC2::Device>(useVrComposer);
     mRemainingHwcVirtualDisplays = mHwcDevice->getMaxVirtualDisplayCount();
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.hwc_skip_unchanged_validate", value, "1");
+    mSkipUnchangedValidate = atoi(value) != 0;
 }
 
 HWComposer::~HWComposer() {}
@@ -444,12 +449,25 @@ status_t HWComposer::prepare(DisplayDevice& displayDevice) {
 
     HWC2::Error error = HWC2::Error::None;
 
-    // First try to skip validate altogether if the HWC supports it.
+    // If nothing but layer buffers changed since the last validate, the
+    // composition types it picked still hold and validating again would only
+    // cost a round trip to the HWC. presentAndGetReleaseFences() presents.
     displayData.validateWasSkipped = false;
+    displayData.presentWithoutValidate = false;
+    if (mSkipUnchangedValidate && !displayData.presentWithoutValidateFailed &&
+            !hwcDisplay->hasStateChanges()) {
+        ALOGV("prepare: display %d is unchanged, skipping validate", displayId);
+        displayData.presentWithoutValidate = true;
+        displayData.skippedValidateCount++;
+        return NO_ERROR;
+    }
+
+    // Otherwise try to skip validate altogether if the HWC supports it.
     if (hasCapability(HWC2::Capability::SkipValidate) &&
             !displayData.hasClientComposition) {
         sp<android::Fence> outPresentFence;
         uint32_t state = UINT32_MAX;
+        displayData.presentOrValidateCount++;
         error = hwcDisplay->presentOrValidate(&numTypes, &numRequests, &outPresentFence , &state);
         if (error != HWC2::Error::None && error != HWC2::Error::HasChanges) {
             ALOGV("skipValidate: Failed to Present or Validate");
@@ -466,6 +484,7 @@ status_t HWComposer::prepare(DisplayDevice& displayDevice) {
         }
         // Present failed but Validate ran.
     } else {
+        displayData.validateCount++;
         error = hwcDisplay->validate(&numTypes, &numRequests);
     }
     ALOGV("SkipValidate failed, Falling back to SLOW validate/present");
@@ -615,7 +634,24 @@ status_t HWComposer::presentAndGetReleaseFences(int32_t displayId) {
         return NO_ERROR;
     }
 
+    displayData.presentCount++;
     auto error = hwcDisplay->present(&displayData.lastPresentFence);
+    if (error == HWC2::Error::NotValidated && displayData.presentWithoutValidate) {
+        // The HWC wants to validate after all. Present if it agrees with
+        // the composition types used for this frame; otherwise drop the
+        // frame, the next one is validated as usual.
+        ALOGW("presentAndGetReleaseFences: display %d needs to be validated "
+                "when unchanged, no longer skipping validate", displayId);
+        displayData.presentWithoutValidateFailed = true;
+        uint32_t numTypes = 0;
+        uint32_t numRequests = 0;
+        displayData.validateCount++;
+        error = hwcDisplay->validate(&numTypes, &numRequests);
+        if (error == HWC2::Error::None) {
+            displayData.presentCount++;
+            error = hwcDisplay->present(&displayData.lastPresentFence);
+        }
+    }
     if (error != HWC2::Error::None) {
         ALOGE("presentAndGetReleaseFences: failed for display %d: %s (%d)",
               displayId, to_string(error).c_str(), static_cast<int32_t>(error));
@@ -863,6 +899,22 @@ void HWComposer::dump(String8& result) const {
     // all the state going into the layers. This is probably better done in
     // Layer itself, but it's going to take a bit of work to get there.
     result.append(mHwcDevice->dump().c_str());
+
+    Mutex::Autolock _l(mDisplayLock);
+    result.append("HWC round trips:\n");
+    for (size_t displayId = 0; displayId < mDisplayData.size(); displayId++) {
+        const auto& displayData = mDisplayData[displayId];
+        if (displayData.hwcDisplay == nullptr) {
+            continue;
+        }
+        result.appendFormat("  display %zu: validate=%" PRIu64
+                " presentOrValidate=%" PRIu64 " present=%" PRIu64
+                " skippedValidate=%" PRIu64 "%s\n", displayId,
+                displayData.validateCount, displayData.presentOrValidateCount,
+                displayData.presentCount, displayData.skippedValidateCount,
+                displayData.presentWithoutValidateFailed ?
+                        " (HWC requires validate)" : "");
+    }
 }
 
 // ---------------------------------------------------------------------------
@@ -874,7 +926,15 @@ HWComposer::DisplayData::DisplayData()
     lastPresentFence(Fence::NO_FENCE),
     outbufHandle(nullptr),
     outbufAcquireFence(Fence::NO_FENCE),
-    vsyncEnabled(HWC2::Vsync::Disable) {
+    vsyncEnabled(HWC2::Vsync::Disable),
+    validateWasSkipped(false),
+    presentError(HWC2::Error::None),
+    presentWithoutValidate(false),
+    presentWithoutValidateFailed(false),
+    validateCount(0),
+    presentOrValidateCount(0),
+    presentCount(0),
+    skippedValidateCount(0) {
     ALOGV("Created new DisplayData");
 }
 
@@ -195,6 +195,18 @@ private:
 
         bool validateWasSkipped;
         HWC2::Error presentError;
+
+        // Set when prepare() found nothing to validate, so that the display
+        // is presented with the composition types of the previous frame
+        bool presentWithoutValidate;
+        // Set if the HWC refused such a present, which disables them
+        bool presentWithoutValidateFailed;
+
+        // Round trips to the HWC, for dumpsys
+        uint64_t validateCount;
+        uint64_t presentOrValidateCount;
+        uint64_t presentCount;
+        uint64_t skippedValidateCount;
     };
 
     std::unique_ptr<HWC2::Device>   mHwcDevice;
@@ -204,6 +216,10 @@ private:
     // protect mDisplayData from races between prepare and dump
     mutable Mutex mDisplayLock;
 
+    // Present displays whose state didn't change since they were last
+    // validated without validating them again
+    bool mSkipUnchangedValidate;
+
     cb_context*                     mCBContext;
     size_t                          mVSyncCounts[HWC_NUM_PHYSICAL_DISPLAY_TYPES];
     uint32_t                        mRemainingHwcVirtualDisplays;
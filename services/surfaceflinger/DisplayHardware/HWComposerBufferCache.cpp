@@ -16,38 +16,80 @@
 
 #include "HWComposerBufferCache.h"
 
+#include <stdlib.h>
+
+#include <cutils/properties.h>
 #include <gui/BufferQueue.h>
+#include <ui/GraphicBuffer.h>
 
 namespace android {
 
+HWComposerBufferCache::Stats& HWComposerBufferCache::Stats::operator+=(
+        const Stats& other)
+{
+    hits += other.hits;
+    misses += other.misses;
+    evictions += other.evictions;
+    return *this;
+}
+
+uint32_t HWComposerBufferCache::getSlotBudget()
+{
+    static const uint32_t budget = []() {
+        char value[PROPERTY_VALUE_MAX];
+        property_get("debug.sf.hwc_buffer_cache_slots", value, "0");
+        int slots = atoi(value);
+        if (slots <= 0 || slots > BufferQueue::NUM_BUFFER_SLOTS) {
+            slots = BufferQueue::NUM_BUFFER_SLOTS;
+        }
+        return static_cast<uint32_t>(slots);
+    }();
+    return budget;
+}
+
 HWComposerBufferCache::HWComposerBufferCache()
+  : mGeneration(0)
 {
-    mBuffers.reserve(BufferQueue::NUM_BUFFER_SLOTS);
+    mEntries.reserve(getSlotBudget());
 }
 
-void HWComposerBufferCache::getHwcBuffer(int slot,
-        const sp<GraphicBuffer>& buffer,
+void HWComposerBufferCache::getHwcBuffer(const sp<GraphicBuffer>& buffer,
         uint32_t* outSlot, sp<GraphicBuffer>* outBuffer)
 {
-    if (slot == BufferQueue::INVALID_BUFFER_SLOT || slot < 0) {
-        // default to slot 0
-        slot = 0;
+    if (buffer == nullptr) {
+        // nothing to cache, default to slot 0
+        *outSlot = 0;
+        *outBuffer = nullptr;
+        return;
     }
 
-    if (static_cast<size_t>(slot) >= mBuffers.size()) {
-        mBuffers.resize(slot + 1);
+    mGeneration++;
+    const uint64_t bufferId = buffer->getId();
+    size_t lruSlot = 0;
+    for (size_t slot = 0; slot < mEntries.size(); slot++) {
+        Entry& entry = mEntries[slot];
+        if (entry.bufferId == bufferId) {
+            // already cached in HWC, skip sending the buffer
+            entry.generation = mGeneration;
+            mStats.hits++;
+            *outSlot = slot;
+            *outBuffer = nullptr;
+            return;
+        }
+        if (entry.generation < mEntries[lruSlot].generation) {
+            lruSlot = slot;
+        }
     }
 
-    *outSlot = slot;
-
-    if (mBuffers[slot] == buffer) {
-        // already cached in HWC, skip sending the buffer
-        *outBuffer = nullptr;
+    mStats.misses++;
+    *outBuffer = buffer;
+    if (mEntries.size() < getSlotBudget()) {
+        *outSlot = mEntries.size();
+        mEntries.push_back({bufferId, mGeneration});
     } else {
-        *outBuffer = buffer;
-
-        // update cache
-        mBuffers[slot] = buffer;
+        mStats.evictions++;
+        *outSlot = lruSlot;
+        mEntries[lruSlot] = {bufferId, mGeneration};
     }
 }
 
@@ -37,22 +37,54 @@ class GraphicBuffer;
 //
 // To be able to find out whether a buffer is already in the HAL's cache, we
 // use HWComposerBufferCache to mirror the cache in SF.
+//
+// Buffers are identified by their GraphicBuffer id rather than by their
+// BufferQueue slot, so a buffer that HWC already holds is found again even
+// after it moved to another slot, and a slot reallocated with a new buffer
+// doesn't match the old one.  At most getSlotBudget() HWC cache slots are
+// used; when they are all taken the least recently used one is overwritten,
+// which is also what makes the HAL drop the buffer it held there.
 class HWComposerBufferCache {
 public:
+    struct Stats {
+        // buffers found in the HWC cache
+        uint64_t hits = 0;
+        // buffers that had to be sent to HWC
+        uint64_t misses = 0;
+        // misses that overwrote a slot holding another buffer
+        uint64_t evictions = 0;
+
+        Stats& operator+=(const Stats& other);
+    };
+
     HWComposerBufferCache();
 
-    // Given a buffer queue slot and buffer, return the HWC cache slot and
-    // buffer to be sent to HWC.
+    // Given a buffer, return the HWC cache slot and buffer to be sent to HWC.
     //
     // outBuffer is set to buffer when buffer is not in the HWC cache;
     // otherwise, outBuffer is set to nullptr.
-    void getHwcBuffer(int slot, const sp<GraphicBuffer>& buffer,
+    void getHwcBuffer(const sp<GraphicBuffer>& buffer,
             uint32_t* outSlot, sp<GraphicBuffer>* outBuffer);
 
+    const Stats& getStats() const { return mStats; }
+
+    // The number of HWC cache slots each cache uses, from
+    // debug.sf.hwc_buffer_cache_slots, between 1 and
+    // BufferQueue::NUM_BUFFER_SLOTS (the default).
+    static uint32_t getSlotBudget();
+
 private:
-    // a vector as we expect "slot" to be in the range of [0, 63] (that is,
-    // less than BufferQueue::NUM_BUFFER_SLOTS).
-    std::vector<sp<GraphicBuffer>> mBuffers;
+    struct Entry {
+        uint64_t bufferId;
+        // value of mGeneration when the entry was last used
+        uint64_t generation;
+    };
+
+    // Entries are indexed by HWC slot and only grow up to the slot budget,
+    // which is small enough for lookups to be a linear scan.
+    std::vector<Entry> mEntries;
+    uint64_t mGeneration;
+    Stats mStats;
 };
 
 // ---------------------------------------------------------------------------
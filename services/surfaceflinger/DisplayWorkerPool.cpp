@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <utils/String8.h>
+#include <utils/Trace.h>
+
+#include "DisplayWorkerPool.h"
+
+namespace android {
+
+DisplayWorkerPool::DisplayWorkerPool(size_t numThreads) :
+        mJobs(nullptr),
+        mNextJob(0),
+        mRunningJobs(0),
+        mExit(false) {
+    for (size_t i = 0; i < numThreads; i++) {
+        sp<Worker> worker = new Worker(this);
+        worker->run(String8::format("DisplayWorker%zu", i).string(),
+                PRIORITY_URGENT_DISPLAY);
+        mWorkers.push_back(worker);
+    }
+}
+
+DisplayWorkerPool::~DisplayWorkerPool() {
+    {
+        Mutex::Autolock lock(mMutex);
+        mExit = true;
+        mCond.broadcast();
+    }
+    for (auto& worker : mWorkers) {
+        worker->requestExitAndWait();
+    }
+}
+
+void DisplayWorkerPool::run(const std::vector<std::function<void()>>& jobs) {
+    Mutex::Autolock lock(mMutex);
+    mJobs = &jobs;
+    mNextJob = 0;
+    mCond.broadcast();
+
+    while (runNextJobLocked()) {
+    }
+    while (mRunningJobs > 0) {
+        mCond.wait(mMutex);
+    }
+    mJobs = nullptr;
+}
+
+bool DisplayWorkerPool::runNextJobLocked() {
+    if (mJobs == nullptr || mNextJob >= mJobs->size()) {
+        return false;
+    }
+    const std::function<void()>& job = (*mJobs)[mNextJob++];
+    mRunningJobs++;
+    mMutex.unlock();
+    {
+        ATRACE_NAME("displayJob");
+        job();
+    }
+    mMutex.lock();
+    if (--mRunningJobs == 0) {
+        mCond.broadcast();
+    }
+    return true;
+}
+
+bool DisplayWorkerPool::Worker::threadLoop() {
+    Mutex::Autolock lock(mPool->mMutex);
+    while (!mPool->mExit && !mPool->runNextJobLocked()) {
+        mPool->mCond.wait(mPool->mMutex);
+    }
+    return !mPool->mExit;
+}
+
+} // namespace android
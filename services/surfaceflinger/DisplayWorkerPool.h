@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DISPLAYWORKERPOOL_H
+#define ANDROID_DISPLAYWORKERPOOL_H
+
+#include <functional>
+#include <vector>
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/Thread.h>
+
+namespace android {
+
+/*
+ * A small pool of threads running the per-display parts of a frame that
+ * don't touch HWC or GL, so that secondary displays don't add to the
+ * composition time of the primary display.
+ */
+class DisplayWorkerPool : public virtual RefBase {
+public:
+    explicit DisplayWorkerPool(size_t numThreads);
+    virtual ~DisplayWorkerPool();
+
+    // Runs every job, on the worker threads and on the calling thread, and
+    // returns once they are all done. Jobs must not depend on each other.
+    void run(const std::vector<std::function<void()>>& jobs);
+
+private:
+    class Worker : public Thread {
+    public:
+        explicit Worker(DisplayWorkerPool* pool) : mPool(pool) {}
+        virtual bool threadLoop();
+    private:
+        DisplayWorkerPool* const mPool;
+    };
+
+    // Runs the next job that hasn't started. Called with mMutex held,
+    // returns false when there is none.
+    bool runNextJobLocked();
+
+    std::vector<sp<Worker>> mWorkers;
+
+    Mutex mMutex;
+    Condition mCond;
+    const std::vector<std::function<void()>>* mJobs;
+    size_t mNextJob;
+    size_t mRunningJobs;
+    bool mExit;
+};
+
+}
+
+#endif // ANDROID_DISPLAYWORKERPOOL_H
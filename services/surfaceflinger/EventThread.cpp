@@ -16,6 +16,7 @@
 
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 
+#include <inttypes.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -47,6 +48,9 @@ static void vsyncOffCallback(union sigval val) {
 EventThread::EventThread(const sp<VSyncSource>& src, SurfaceFlinger& flinger, bool interceptVSyncs)
     : mVSyncSource(src),
       mFlinger(flinger),
+      mVsyncCount(0),
+      mNextWakeupVsync(0),
+      mSkippedWakeups(0),
       mUseSoftwareVSync(false),
       mVsyncEnabled(false),
       mDebugVsyncEnabled(false),
@@ -103,17 +107,58 @@ sp<EventThread::Connection> EventThread::createEventConnection() const {
 status_t EventThread::registerDisplayEventConnection(
         const sp<EventThread::Connection>& connection) {
     Mutex::Autolock _l(mLock);
+    // Dead connections are only noticed on their way out of the vsync
+    // schedule, so drop the idle ones here rather than on every vsync.
+    for (size_t i = 0; i < mDisplayEventConnections.size();) {
+        if (mDisplayEventConnections[i].promote() == NULL) {
+            mDisplayEventConnections.removeAt(i);
+        } else {
+            i++;
+        }
+    }
     mDisplayEventConnections.add(connection);
     mCondition.broadcast();
     return NO_ERROR;
 }
 
 void EventThread::removeDisplayEventConnection(
-        const wp<EventThread::Connection>& connection) {
+        const sp<EventThread::Connection>& connection) {
     Mutex::Autolock _l(mLock);
+    connection->count = -1;
+    scheduleConnectionLocked(connection);
     mDisplayEventConnections.remove(connection);
 }
 
+void EventThread::scheduleConnectionLocked(const sp<EventThread::Connection>& connection) {
+    if (connection->isScheduled) {
+        mVsyncSchedule.erase(connection->scheduleEntry);
+        connection->isScheduled = false;
+    }
+    if (connection->count >= 1) {
+        connection->scheduleEntry = mVsyncSchedule.emplace(
+                computeNextVsyncLocked(*connection), connection);
+        connection->isScheduled = true;
+    }
+    updateNextWakeupLocked();
+}
+
+uint64_t EventThread::computeNextVsyncLocked(const EventThread::Connection& connection) const {
+    // the first vsync after the current one whose count is phase modulo rate
+    const uint64_t rate = connection.count;
+    const uint64_t next = mVsyncCount + 1;
+    return next + (connection.phase % rate + rate - next % rate) % rate;
+}
+
+void EventThread::updateNextWakeupLocked() {
+    if (!mOneShotConnections.empty() || mVsyncSchedule.empty()) {
+        // wake up on the next vsync, either to deliver it or to turn vsync
+        // off because nobody wants it anymore
+        mNextWakeupVsync = 0;
+    } else {
+        mNextWakeupVsync = mVsyncSchedule.begin()->first;
+    }
+}
+
 void EventThread::setVsyncRate(uint32_t count,
         const sp<EventThread::Connection>& connection) {
     if (int32_t(count) >= 0) { // server must protect against bad params
@@ -121,11 +166,36 @@ void EventThread::setVsyncRate(uint32_t count,
         const int32_t new_count = (count == 0) ? -1 : count;
         if (connection->count != new_count) {
             connection->count = new_count;
+            scheduleConnectionLocked(connection);
             mCondition.broadcast();
         }
     }
 }
 
+void EventThread::setVsyncPhase(uint32_t phase,
+        const sp<EventThread::Connection>& connection) {
+    Mutex::Autolock _l(mLock);
+    if (connection->phase != phase) {
+        connection->phase = phase;
+        if (connection->isScheduled) {
+            scheduleConnectionLocked(connection);
+        }
+    }
+}
+
+status_t EventThread::getVsyncTimeline(gui::VsyncTimeline* outTimeline) {
+    Mutex::Autolock _l(mLock);
+    if (mVsyncTimeline == NULL) {
+        auto timeline = std::make_unique<gui::VsyncTimeline>(gui::VsyncTimeline::Create);
+        status_t err = timeline->initCheck();
+        if (err != NO_ERROR) {
+            return err;
+        }
+        mVsyncTimeline = std::move(timeline);
+    }
+    return mVsyncTimeline->share(outTimeline);
+}
+
 void EventThread::requestNextVsync(
         const sp<EventThread::Connection>& connection) {
     Mutex::Autolock _l(mLock);
@@ -134,6 +204,11 @@ void EventThread::requestNextVsync(
 
     if (connection->count < 0) {
         connection->count = 0;
+        if (!connection->isOneShotQueued) {
+            mOneShotConnections.push_back(connection);
+            connection->isOneShotQueued = true;
+        }
+        updateNextWakeupLocked();
         mCondition.broadcast();
     }
 }
@@ -158,10 +233,20 @@ void EventThread::onScreenAcquired() {
 
 void EventThread::onVSyncEvent(nsecs_t timestamp) {
     Mutex::Autolock _l(mLock);
+    mVSyncEvent[0].vsync.count++;
+    mVsyncCount++;
+    if (mVsyncTimeline != NULL) {
+        mVsyncTimeline->publish(mVSyncEvent[0].vsync.count, timestamp,
+                mVSyncSource->getPeriod());
+    }
+    if (mVsyncCount < mNextWakeupVsync) {
+        // no connection is due to receive this one
+        mSkippedWakeups++;
+        return;
+    }
     mVSyncEvent[0].header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
     mVSyncEvent[0].header.id = 0;
     mVSyncEvent[0].header.timestamp = timestamp;
-    mVSyncEvent[0].vsync.count++;
     mCondition.broadcast();
 }
 
@@ -210,6 +295,43 @@ bool EventThread::threadLoop() {
     return true;
 }
 
+void EventThread::collectVsyncConnectionsLocked(
+        Vector< sp<EventThread::Connection> >* connections) {
+    for (const auto& weakConnection : mOneShotConnections) {
+        sp<Connection> connection(weakConnection.promote());
+        if (connection == NULL) {
+            // the connection has died, so clean-up!
+            mDisplayEventConnections.remove(weakConnection);
+            continue;
+        }
+        connection->isOneShotQueued = false;
+        // the connection may have switched to continuous events since
+        if (connection->count == 0) {
+            // fired this time around
+            connection->count = -1;
+            connections->add(connection);
+        }
+    }
+    mOneShotConnections.clear();
+
+    // Entries older than the current vsync were due on a vsync that came in
+    // while the thread was busy; deliver them late rather than not at all.
+    while (!mVsyncSchedule.empty() && mVsyncSchedule.begin()->first <= mVsyncCount) {
+        const wp<Connection> weakConnection(mVsyncSchedule.begin()->second);
+        mVsyncSchedule.erase(mVsyncSchedule.begin());
+        sp<Connection> connection(weakConnection.promote());
+        if (connection == NULL) {
+            mDisplayEventConnections.remove(weakConnection);
+            continue;
+        }
+        // continuous event, and time to report it
+        connection->isScheduled = false;
+        connections->add(connection);
+        scheduleConnectionLocked(connection);
+    }
+    updateNextWakeupLocked();
+}
+
 // This will return when (1) a vsync event has been received, and (2) there was
 // at least one connection interested in receiving it when we started waiting.
 Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
@@ -220,9 +342,9 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
 
     do {
         bool eventPending = false;
-        bool waitForVSync = false;
+        // we need vsync events if at least one connection is waiting for it
+        bool waitForVSync = !mOneShotConnections.empty() || !mVsyncSchedule.empty();
 
-        size_t vsyncCount = 0;
         nsecs_t timestamp = 0;
         for (int32_t i=0 ; i<DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES ; i++) {
             timestamp = mVSyncEvent[i].header.timestamp;
@@ -233,7 +355,6 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
                 }
                 *event = mVSyncEvent[i];
                 mVSyncEvent[i].header.timestamp = 0;
-                vsyncCount = mVSyncEvent[i].vsync.count;
                 break;
             }
         }
@@ -248,44 +369,25 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
             }
         }
 
-        // find out connections waiting for events
-        size_t count = mDisplayEventConnections.size();
-        for (size_t i=0 ; i<count ; i++) {
-            sp<Connection> connection(mDisplayEventConnections[i].promote());
-            if (connection != NULL) {
-                bool added = false;
-                if (connection->count >= 0) {
-                    // we need vsync events because at least
-                    // one connection is waiting for it
-                    waitForVSync = true;
-                    if (timestamp) {
-                        // we consume the event only if it's time
-                        // (ie: we received a vsync event)
-                        if (connection->count == 0) {
-                            // fired this time around
-                            connection->count = -1;
-                            signalConnections.add(connection);
-                            added = true;
-                        } else if (connection->count == 1 ||
-                                (vsyncCount % connection->count) == 0) {
-                            // continuous event, and time to report it
-                            signalConnections.add(connection);
-                            added = true;
-                        }
-                    }
-                }
-
-                if (eventPending && !timestamp && !added) {
-                    // we don't have a vsync event to process
-                    // (timestamp==0), but we have some pending
-                    // messages.
+        if (timestamp) {
+            // we consume the event only if it's time
+            // (ie: we received a vsync event)
+            collectVsyncConnectionsLocked(&signalConnections);
+        } else if (eventPending) {
+            // we don't have a vsync event to process
+            // (timestamp==0), but we have some pending
+            // messages for every connection.
+            size_t count = mDisplayEventConnections.size();
+            for (size_t i=0 ; i<count ; i++) {
+                sp<Connection> connection(mDisplayEventConnections[i].promote());
+                if (connection != NULL) {
                     signalConnections.add(connection);
+                } else {
+                    // we couldn't promote this reference, the connection has
+                    // died, so clean-up!
+                    mDisplayEventConnections.removeAt(i);
+                    --i; --count;
                 }
-            } else {
-                // we couldn't promote this reference, the connection has
-                // died, so clean-up!
-                mDisplayEventConnections.removeAt(i);
-                --i; --count;
             }
         }
 
@@ -318,10 +420,14 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
                 //
                 // We don't want to stall if there's a driver bug, so we
                 // use a (long) timeout when waiting for h/w vsync, and
-                // generate fake events when necessary.
+                // generate fake events when necessary. H/w vsync events
+                // nobody was due for don't wake us up, but still show that
+                // the driver is alive.
                 bool softwareSync = mUseSoftwareVSync;
                 nsecs_t timeout = softwareSync ? ms2ns(16) : ms2ns(1000);
-                if (mCondition.waitRelative(mLock, timeout) == TIMED_OUT) {
+                const uint64_t vsyncCount = mVsyncCount;
+                if (mCondition.waitRelative(mLock, timeout) == TIMED_OUT &&
+                        (softwareSync || mVsyncCount == vsyncCount)) {
                     if (!softwareSync) {
                         ALOGW("Timed out waiting for hw vsync; faking it");
                     }
@@ -331,6 +437,7 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
                     mVSyncEvent[0].header.id = DisplayDevice::DISPLAY_PRIMARY;
                     mVSyncEvent[0].header.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
                     mVSyncEvent[0].vsync.count++;
+                    mVsyncCount++;
                 }
             } else {
                 // Nobody is interested in vsync, so we just want to sleep.
@@ -375,14 +482,19 @@ void EventThread::dump(String8& result) const {
             mDebugVsyncEnabled?"enabled":"disabled");
     result.appendFormat("  soft-vsync: %s\n",
             mUseSoftwareVSync?"enabled":"disabled");
-    result.appendFormat("  numListeners=%zu,\n  events-delivered: %u\n",
-            mDisplayEventConnections.size(),
-            mVSyncEvent[DisplayDevice::DISPLAY_PRIMARY].vsync.count);
+    result.appendFormat("  vsync-timeline: %s\n",
+            mVsyncTimeline!=NULL?"enabled":"disabled");
+    result.appendFormat("  numListeners=%zu, continuous=%zu, one-shot=%zu,\n"
+            "  events-delivered: %u, skipped-wakeups: %" PRIu64 "\n",
+            mDisplayEventConnections.size(), mVsyncSchedule.size(),
+            mOneShotConnections.size(),
+            mVSyncEvent[DisplayDevice::DISPLAY_PRIMARY].vsync.count, mSkippedWakeups);
     for (size_t i=0 ; i<mDisplayEventConnections.size() ; i++) {
         sp<Connection> connection =
                 mDisplayEventConnections.itemAt(i).promote();
-        result.appendFormat("    %p: count=%d\n",
-                connection.get(), connection!=NULL ? connection->count : 0);
+        result.appendFormat("    %p: count=%d phase=%u\n",
+                connection.get(), connection!=NULL ? connection->count : 0,
+                connection!=NULL ? connection->phase : 0);
     }
 }
 
@@ -390,7 +502,8 @@ void EventThread::dump(String8& result) const {
 
 EventThread::Connection::Connection(
         const sp<EventThread>& eventThread)
-    : count(-1), mEventThread(eventThread), mChannel(gui::BitTube::DefaultSize)
+    : count(-1), phase(0), isScheduled(false), isOneShotQueued(false),
+      mEventThread(eventThread), mChannel(gui::BitTube::DefaultSize)
 {
 }
 
@@ -418,6 +531,15 @@ void EventThread::Connection::requestNextVsync() {
     mEventThread->requestNextVsync(this);
 }
 
+status_t EventThread::Connection::setVsyncPhase(uint32_t phase) {
+    mEventThread->setVsyncPhase(phase, this);
+    return NO_ERROR;
+}
+
+status_t EventThread::Connection::getVsyncTimeline(gui::VsyncTimeline* outTimeline) {
+    return mEventThread->getVsyncTimeline(outTimeline);
+}
+
 status_t EventThread::Connection::postEvent(
         const DisplayEventReceiver::Event& event) {
     ssize_t size = DisplayEventReceiver::sendEvents(&mChannel, &event, 1);
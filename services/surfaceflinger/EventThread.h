@@ -20,7 +20,12 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <map>
+#include <memory>
+#include <vector>
+
 #include <private/gui/BitTube.h>
+#include <private/gui/VsyncTimeline.h>
 #include <gui/DisplayEventReceiver.h>
 #include <gui/IDisplayEventConnection.h>
 
@@ -53,9 +58,17 @@ public:
     virtual void setVSyncEnabled(bool enable) = 0;
     virtual void setCallback(const sp<Callback>& callback) = 0;
     virtual void setPhaseOffset(nsecs_t phaseOffset) = 0;
+    // returns the vsync period, or 0 if it isn't known
+    virtual nsecs_t getPeriod() = 0;
 };
 
 class EventThread : public Thread, private VSyncSource::Callback {
+    class Connection;
+
+    // Continuous connections, keyed by the count of the next vsync event
+    // they receive
+    typedef std::multimap< uint64_t, wp<Connection> > VsyncSchedule;
+
     class Connection : public BnDisplayEventConnection {
     public:
         explicit Connection(const sp<EventThread>& eventThread);
@@ -66,12 +79,24 @@ class EventThread : public Thread, private VSyncSource::Callback {
         // count ==-1 : one-shot event that fired this round / disabled
         int32_t count;
 
+        // continuous events go out on the vsyncs whose count modulo the
+        // rate is phase (modulo the rate)
+        uint32_t phase;
+
+        // where the connection is in EventThread's schedule, protected by
+        // EventThread::mLock
+        bool isScheduled;
+        VsyncSchedule::iterator scheduleEntry;
+        bool isOneShotQueued;
+
     private:
         virtual ~Connection();
         virtual void onFirstRef();
         status_t stealReceiveChannel(gui::BitTube* outChannel) override;
         status_t setVsyncRate(uint32_t count) override;
         void requestNextVsync() override;    // asynchronous
+        status_t setVsyncPhase(uint32_t phase) override;
+        status_t getVsyncTimeline(gui::VsyncTimeline* outTimeline) override;
         sp<EventThread> const mEventThread;
         gui::BitTube mChannel;
     };
@@ -85,6 +110,8 @@ public:
 
     void setVsyncRate(uint32_t count, const sp<Connection>& connection);
     void requestNextVsync(const sp<Connection>& connection);
+    void setVsyncPhase(uint32_t phase, const sp<Connection>& connection);
+    status_t getVsyncTimeline(gui::VsyncTimeline* outTimeline);
 
     // called before the screen is turned off from main thread
     void onScreenReleased();
@@ -109,7 +136,19 @@ private:
 
     virtual void onVSyncEvent(nsecs_t timestamp);
 
-    void removeDisplayEventConnection(const wp<Connection>& connection);
+    void removeDisplayEventConnection(const sp<Connection>& connection);
+
+    // scheduleConnectionLocked (re)inserts connection in mVsyncSchedule
+    // according to its rate and phase, or takes it out if it isn't
+    // continuous anymore
+    void scheduleConnectionLocked(const sp<Connection>& connection);
+    uint64_t computeNextVsyncLocked(const Connection& connection) const;
+    void updateNextWakeupLocked();
+
+    // collectVsyncConnectionsLocked pops the connections due to receive the
+    // current vsync event off the schedule
+    void collectVsyncConnectionsLocked(Vector< sp<Connection> >* connections);
+
     void enableVSyncLocked();
     void disableVSyncLocked();
     void sendVsyncHintOnLocked();
@@ -126,6 +165,20 @@ private:
     SortedVector< wp<Connection> > mDisplayEventConnections;
     Vector< DisplayEventReceiver::Event > mPendingEvents;
     DisplayEventReceiver::Event mVSyncEvent[DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES];
+
+    // Vsync events are only delivered to the connections in mVsyncSchedule
+    // and mOneShotConnections, and the thread isn't woken up by vsync events
+    // before mNextWakeupVsync, when nobody is due. mVsyncCount is the
+    // 64-bit version of mVSyncEvent[0].vsync.count.
+    VsyncSchedule mVsyncSchedule;
+    std::vector< wp<Connection> > mOneShotConnections;
+    uint64_t mVsyncCount;
+    uint64_t mNextWakeupVsync;
+    uint64_t mSkippedWakeups;
+
+    // Created when the first client asks for it, then updated on every
+    // vsync event, including the skipped ones.
+    std::unique_ptr<gui::VsyncTimeline> mVsyncTimeline;
     bool mUseSoftwareVSync;
     bool mVsyncEnabled;
 
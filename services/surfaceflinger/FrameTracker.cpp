@@ -65,6 +65,16 @@ void FrameTracker::setActualPresentFence(
     mNumFences++;
 }
 
+void FrameTracker::setQueueTime(nsecs_t queueTime) {
+    Mutex::Autolock lock(mMutex);
+    mFrameRecords[mOffset].queueTime = queueTime;
+}
+
+void FrameTracker::setLatchTime(nsecs_t latchTime) {
+    Mutex::Autolock lock(mMutex);
+    mFrameRecords[mOffset].latchTime = latchTime;
+}
+
 void FrameTracker::setDisplayRefreshPeriod(nsecs_t displayPeriod) {
     Mutex::Autolock lock(mMutex);
     mDisplayPeriod = displayPeriod;
@@ -73,14 +83,22 @@ void FrameTracker::setDisplayRefreshPeriod(nsecs_t displayPeriod) {
 void FrameTracker::advanceFrame() {
     Mutex::Autolock lock(mMutex);
 
+    // Pick up the fences that signaled since the last frame, so that the
+    // histograms get every frame even if nobody calls dumpStats.
+    processFencesLocked();
+
     // Update the statistic to include the frame we just finished.
     updateStatsLocked(mOffset);
+    updateHistogramsLocked(mOffset);
 
     // Advance to the next frame.
     mOffset = (mOffset+1) % NUM_FRAME_RECORDS;
     mFrameRecords[mOffset].desiredPresentTime = INT64_MAX;
     mFrameRecords[mOffset].frameReadyTime = INT64_MAX;
     mFrameRecords[mOffset].actualPresentTime = INT64_MAX;
+    mFrameRecords[mOffset].queueTime = 0;
+    mFrameRecords[mOffset].latchTime = 0;
+    mFrameRecords[mOffset].histogramsUpdated = false;
 
     if (mFrameRecords[mOffset].frameReadyFence != NULL) {
         // We're clobbering an unsignaled fence, so we need to decrement the
@@ -103,6 +121,9 @@ void FrameTracker::clearStats() {
         mFrameRecords[i].desiredPresentTime = 0;
         mFrameRecords[i].frameReadyTime = 0;
         mFrameRecords[i].actualPresentTime = 0;
+        mFrameRecords[i].queueTime = 0;
+        mFrameRecords[i].latchTime = 0;
+        mFrameRecords[i].histogramsUpdated = false;
         mFrameRecords[i].frameReadyFence.reset();
         mFrameRecords[i].actualPresentFence.reset();
     }
@@ -110,6 +131,9 @@ void FrameTracker::clearStats() {
     mFrameRecords[mOffset].desiredPresentTime = INT64_MAX;
     mFrameRecords[mOffset].frameReadyTime = INT64_MAX;
     mFrameRecords[mOffset].actualPresentTime = INT64_MAX;
+    mQueueToLatch.clear();
+    mLatchToPresent.clear();
+    mPresentJitter.clear();
 }
 
 void FrameTracker::getStats(FrameStats* outStats) const {
@@ -175,6 +199,7 @@ void FrameTracker::processFencesLocked() const {
 
         if (updated) {
             updateStatsLocked(idx);
+            updateHistogramsLocked(idx);
         }
     }
 }
@@ -210,6 +235,30 @@ void FrameTracker::updateStatsLocked(size_t newFrameIdx) const {
     }
 }
 
+void FrameTracker::updateHistogramsLocked(size_t frameIdx) const {
+    FrameRecord& record = const_cast<FrameRecord&>(mFrameRecords[frameIdx]);
+    if (record.histogramsUpdated || !isFrameValidLocked(frameIdx)) {
+        return;
+    }
+    record.histogramsUpdated = true;
+
+    if (record.latchTime > 0) {
+        if (record.queueTime > 0) {
+            mQueueToLatch.record(record.latchTime - record.queueTime);
+        }
+        mLatchToPresent.record(record.actualPresentTime - record.latchTime);
+    }
+
+    size_t prevFrameIdx = (frameIdx+NUM_FRAME_RECORDS-1) % NUM_FRAME_RECORDS;
+    if (mDisplayPeriod > 0 && isFrameValidLocked(prevFrameIdx)) {
+        nsecs_t duration = record.actualPresentTime -
+                mFrameRecords[prevFrameIdx].actualPresentTime;
+        nsecs_t numPeriods = (duration + mDisplayPeriod/2) / mDisplayPeriod;
+        nsecs_t jitter = duration - numPeriods * mDisplayPeriod;
+        mPresentJitter.record(jitter < 0 ? -jitter : jitter);
+    }
+}
+
 void FrameTracker::resetFrameCountersLocked() {
     for (int i = 0; i < NUM_FRAME_BUCKETS; i++) {
         mNumFrames[i] = 0;
@@ -245,4 +294,13 @@ void FrameTracker::dumpStats(String8& result) const {
     result.append("\n");
 }
 
+void FrameTracker::dumpHistograms(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    processFencesLocked();
+
+    mQueueToLatch.encode(result);
+    mLatchToPresent.encode(result);
+    mPresentJitter.encode(result);
+}
+
 } // namespace android
@@ -19,6 +19,8 @@
 
 #include <ui/FenceTime.h>
 
+#include "LatencyHistogram.h"
+
 #include <stddef.h>
 
 #include <utils/Mutex.h>
@@ -71,6 +73,14 @@ public:
     // at which the current frame became visible to the user.
     void setActualPresentFence(std::shared_ptr<FenceTime>&& fence);
 
+    // setQueueTime sets the time at which the producer queued the current
+    // frame.
+    void setQueueTime(nsecs_t queueTime);
+
+    // setLatchTime sets the time at which SurfaceFlinger latched the current
+    // frame for composition.
+    void setLatchTime(nsecs_t latchTime);
+
     // setDisplayRefreshPeriod sets the display refresh period in nanoseconds.
     // This is used to compute frame presentation duration statistics relative
     // to this period.
@@ -79,7 +89,7 @@ public:
     // advanceFrame advances the frame tracker to the next frame.
     void advanceFrame();
 
-    // clearStats clears the tracked frame stats.
+    // clearStats clears the tracked frame stats and latency histograms.
     void clearStats();
 
     // getStats gets the tracked frame stats.
@@ -92,15 +102,26 @@ public:
     // dumpStats dump appends the current frame display time history to the result string.
     void dumpStats(String8& result) const;
 
+    // dumpHistograms appends the queue to latch, latch to present and present
+    // jitter histograms to the result string, in the binary form described in
+    // LatencyHistogram.cpp.
+    void dumpHistograms(String8& result) const;
+
 private:
     struct FrameRecord {
         FrameRecord() :
             desiredPresentTime(0),
             frameReadyTime(0),
-            actualPresentTime(0) {}
+            actualPresentTime(0),
+            queueTime(0),
+            latchTime(0),
+            histogramsUpdated(false) {}
         nsecs_t desiredPresentTime;
         nsecs_t frameReadyTime;
         nsecs_t actualPresentTime;
+        nsecs_t queueTime;
+        nsecs_t latchTime;
+        bool histogramsUpdated;
         std::shared_ptr<FenceTime> frameReadyFence;
         std::shared_ptr<FenceTime> actualPresentFence;
     };
@@ -118,6 +139,10 @@ private:
     // about the frame times.
     void updateStatsLocked(size_t newFrameIdx) const;
 
+    // updateHistogramsLocked adds the given frame to the latency histograms
+    // once its present time is known.
+    void updateHistogramsLocked(size_t frameIdx) const;
+
     // resetFrameCounteresLocked sets all elements of the mNumFrames array to
     // 0.
     void resetFrameCountersLocked();
@@ -152,6 +177,17 @@ private:
     // all frames with duration greater than 2^(NUM_FRAME_BUCKETS-1).
     int32_t mNumFrames[NUM_FRAME_BUCKETS];
 
+    // Unlike mNumFrames, the latency histograms are never reset by
+    // logAndResetStats so they can be collected over a whole test run.
+    // mQueueToLatch tracks the time from queueBuffer to the frame being
+    // latched, mLatchToPresent the time from latching to the present fence
+    // signaling, and mPresentJitter how far apart from a multiple of the
+    // refresh period consecutive present fences signaled. They are mutable
+    // because they are updated as fences signal, from the const dump paths.
+    mutable LatencyHistogram mQueueToLatch;
+    mutable LatencyHistogram mLatchToPresent;
+    mutable LatencyHistogram mPresentJitter;
+
     // mDisplayPeriod is the display refresh period of the display for which
     // this FrameTracker is gathering information.
     nsecs_t mDisplayPeriod;
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <utils/String8.h>
+
+#include "LatencyHistogram.h"
+
+namespace android {
+
+LatencyHistogram::LatencyHistogram() {
+    clear();
+}
+
+void LatencyHistogram::appendVarint(String8& result, uint64_t value) {
+    char bytes[10];
+    size_t size = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value != 0) {
+            byte |= 0x80;
+        }
+        bytes[size++] = static_cast<char>(byte);
+    } while (value != 0);
+    result.append(bytes, size);
+}
+
+size_t LatencyHistogram::getBucketIndex(uint64_t us) {
+    if (us < NUM_SUB_BUCKETS) {
+        return us;
+    }
+    const int magnitude = 63 - __builtin_clzll(us);
+    const int shift = magnitude - SUB_BUCKET_BITS;
+    const size_t index = (shift + 1) * NUM_SUB_BUCKETS +
+            ((us >> shift) - NUM_SUB_BUCKETS);
+    return index < NUM_BUCKETS ? index : NUM_BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::getBucketStart(size_t index) {
+    if (index < NUM_SUB_BUCKETS) {
+        return index;
+    }
+    const int shift = index / NUM_SUB_BUCKETS - 1;
+    return static_cast<uint64_t>(NUM_SUB_BUCKETS + index % NUM_SUB_BUCKETS) << shift;
+}
+
+void LatencyHistogram::record(nsecs_t duration) {
+    if (duration < 0) {
+        duration = 0;
+    }
+    mBuckets[getBucketIndex(static_cast<uint64_t>(duration) / 1000)]++;
+    mCount++;
+    if (duration > mMax) {
+        mMax = duration;
+    }
+}
+
+void LatencyHistogram::clear() {
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mMax = 0;
+}
+
+// The histogram is encoded as a sequence of varints:
+//
+//     count, max (us), number of non-empty buckets,
+//     then for each non-empty bucket in increasing order:
+//         index - index of the previous non-empty bucket (or 0), count
+//
+// Bucket indices map to durations as described in LatencyHistogram.h.
+void LatencyHistogram::encode(String8& result) const {
+    size_t numNonEmpty = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        if (mBuckets[i] != 0) {
+            numNonEmpty++;
+        }
+    }
+
+    appendVarint(result, mCount);
+    appendVarint(result, static_cast<uint64_t>(mMax) / 1000);
+    appendVarint(result, numNonEmpty);
+    size_t previous = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        if (mBuckets[i] != 0) {
+            appendVarint(result, i - previous);
+            appendVarint(result, mBuckets[i]);
+            previous = i;
+        }
+    }
+}
+
+LatencyHistogramDump::LatencyHistogramDump() :
+    mNumEntries(0) {
+}
+
+String8& LatencyHistogramDump::addEntry(const String8& name) {
+    LatencyHistogram::appendVarint(mEntries, name.size());
+    mEntries.append(name.string(), name.size());
+    mNumEntries++;
+    return mEntries;
+}
+
+// The dump is encoded as:
+//
+//     "SFLH", then as varints: version (1), LatencyHistogram::SUB_BUCKET_BITS,
+//     refresh period (ns), number of entries,
+//     then for each entry: name length, name, and the histograms appended by
+//     the caller, each encoded as above
+void LatencyHistogramDump::write(nsecs_t refreshPeriod, String8& result) const {
+    result.append("SFLH", 4);
+    LatencyHistogram::appendVarint(result, 1);
+    LatencyHistogram::appendVarint(result, LatencyHistogram::SUB_BUCKET_BITS);
+    LatencyHistogram::appendVarint(result, static_cast<uint64_t>(refreshPeriod));
+    LatencyHistogram::appendVarint(result, mNumEntries);
+    result.append(mEntries.string(), mEntries.size());
+}
+
+} // namespace android
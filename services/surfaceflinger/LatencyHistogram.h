@@ -0,0 +1,92 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_LATENCYHISTOGRAM_H
+#define ANDROID_LATENCYHISTOGRAM_H
+
+#include <stdint.h>
+
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+// LatencyHistogram counts durations in log-linear buckets, in the manner of
+// an HDR histogram: each power of two microseconds is split into
+// NUM_SUB_BUCKETS linear buckets, so the relative error of a bucket is at
+// most 1/NUM_SUB_BUCKETS over the whole range. Recording a value is constant
+// time and the memory used doesn't depend on the number of values recorded.
+//
+// Durations below 1us go to bucket 0, durations above the range go to the
+// last bucket.
+//
+// This class is *NOT* thread-safe.
+class LatencyHistogram {
+public:
+    enum {
+        SUB_BUCKET_BITS = 3,
+        NUM_SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+        // Up to 2^32us (more than an hour)
+        NUM_BUCKETS = (32 - SUB_BUCKET_BITS + 1) * NUM_SUB_BUCKETS,
+    };
+
+    LatencyHistogram();
+
+    void record(nsecs_t duration);
+    void clear();
+
+    // encode appends the histogram to result in the compact binary form
+    // described in LatencyHistogram.cpp
+    void encode(String8& result) const;
+
+    // getBucketIndex and getBucketStart convert between microseconds and
+    // bucket indices
+    static size_t getBucketIndex(uint64_t us);
+    static uint64_t getBucketStart(size_t index);
+
+    // appendVarint appends value to result as an unsigned LEB128 varint, the
+    // integer encoding used by encode
+    static void appendVarint(String8& result, uint64_t value);
+
+private:
+    uint32_t mBuckets[NUM_BUCKETS];
+    uint64_t mCount;
+    nsecs_t mMax;
+};
+
+// LatencyHistogramDump builds the output of
+// "dumpsys SurfaceFlinger --latency-histograms", a list of named entries each
+// holding the histograms of one layer, in the form described in
+// LatencyHistogram.cpp.
+class LatencyHistogramDump {
+public:
+    LatencyHistogramDump();
+
+    // addEntry starts a new entry and returns the string the histograms of
+    // the entry must be encoded to
+    String8& addEntry(const String8& name);
+
+    // write appends the dump header and all the entries to result
+    void write(nsecs_t refreshPeriod, String8& result) const;
+
+private:
+    size_t mNumEntries;
+    String8 mEntries;
+};
+
+}
+
+#endif // ANDROID_LATENCYHISTOGRAM_H
@@ -67,6 +67,7 @@ int32_t Layer::sSequence = 1;
 Layer::Layer(SurfaceFlinger* flinger, const sp<Client>& client,
         const String8& name, uint32_t w, uint32_t h, uint32_t flags)
     :   contentDirty(false),
+        snapshotIndex(0),
         sequence(uint32_t(android_atomic_inc(&sSequence))),
         mFlinger(flinger),
         mTextureName(-1U),
@@ -171,7 +172,9 @@ void Layer::onFirstRef() {
     // Creates a custom BufferQueue for SurfaceFlingerConsumer to use
     sp<IGraphicBufferProducer> producer;
     sp<IGraphicBufferConsumer> consumer;
-    BufferQueue::createBufferQueue(&producer, &consumer, true);
+    // SurfaceFlingerConsumer acquires and releases buffers under its own
+    // mutex, so its releases don't need to lock the BufferQueue
+    BufferQueue::createBufferQueue(&producer, &consumer, true, true);
 
     mSurfaceFlingerConsumer = new SurfaceFlingerConsumer(consumer, mTextureName, this);
     mSurfaceFlingerConsumer->setConsumerUsageBits(getEffectiveUsage(0));
@@ -937,8 +940,7 @@ void Layer::setPerFrameData(const sp<const DisplayDevice>& displayDevice) {
 
     uint32_t hwcSlot = 0;
     sp<GraphicBuffer> hwcBuffer;
-    hwcInfo.bufferCache.getHwcBuffer(mActiveBufferSlot, mActiveBuffer,
-            &hwcSlot, &hwcBuffer);
+    hwcInfo.bufferCache.getHwcBuffer(mActiveBuffer, &hwcSlot, &hwcBuffer);
 
     auto acquireFence = mSurfaceFlingerConsumer->getCurrentFence();
     error = hwcLayer->setBuffer(hwcSlot, hwcBuffer, acquireFence);
@@ -2076,6 +2078,16 @@ bool Layer::onPostComposition(const std::shared_ptr<FenceTime>& glDoneFence,
         Mutex::Autolock lock(mFrameEventHistoryMutex);
         mFrameEventHistory.addPostComposition(mCurrentFrameNumber,
                 glDoneFence, presentFence, compositorTiming);
+
+        const FrameEvents* frame = mFrameEventHistory.getFrame(mCurrentFrameNumber);
+        if (frame != nullptr) {
+            if (FrameEvents::isValidTimestamp(frame->postedTime)) {
+                mFrameTracker.setQueueTime(frame->postedTime);
+            }
+            if (FrameEvents::isValidTimestamp(frame->latchTime)) {
+                mFrameTracker.setLatchTime(frame->latchTime);
+            }
+        }
     }
 
     // Update mFrameTracker.
@@ -2172,6 +2184,36 @@ bool Layer::allTransactionsSignaled() {
     return !matchingFramesFound || allTransactionsApplied;
 }
 
+Region Layer::computeDamagedRegion(const Region& bounds) const
+{
+    // The surface damage is in buffer coordinates, only use it when the
+    // buffer maps onto the layer pixel for pixel
+    const State& s(getDrawingState());
+    const Transform& tr(getTransform());
+    if (!mCurrentCrop.isEmpty() || (mCurrentTransform != 0) ||
+            (mActiveBuffer->getWidth() != s.active.w) ||
+            (mActiveBuffer->getHeight() != s.active.h) ||
+            !tr.preserveRects() || (tr.getType() >= Transform::SCALE)) {
+        return bounds;
+    }
+
+    // The damage is relative to the previous frame, which we may have
+    // dropped
+    const Region& damage(mSurfaceFlingerConsumer->getSurfaceDamage());
+    if ((mCurrentFrameNumber != mPreviousFrameNumber + 1) ||
+            (damage.isRect() && damage.getBounds() == Rect::INVALID_RECT)) {
+        return bounds;
+    }
+
+    // Grow each rectangle by a pixel, filtering by the display projection
+    // can blend pixels into their neighbors
+    Region damaged;
+    for (const Rect& rect : damage) {
+        damaged.orSelf(Rect(rect.left - 1, rect.top - 1, rect.right + 1, rect.bottom + 1));
+    }
+    return damaged.intersect(bounds);
+}
+
 Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
 {
     ATRACE_CALL();
@@ -2318,10 +2360,12 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
 
     mRefreshPending = true;
     mFrameLatencyNeeded = true;
+    bool geometryChanged = false;
     if (oldActiveBuffer == NULL) {
          // the first time we receive a buffer, we need to trigger a
          // geometry invalidation.
         recomputeVisibleRegions = true;
+        geometryChanged = true;
      }
 
     setDataSpace(mSurfaceFlingerConsumer->getCurrentDataSpace());
@@ -2337,6 +2381,7 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
         mCurrentTransform = transform;
         mCurrentScalingMode = scalingMode;
         recomputeVisibleRegions = true;
+        geometryChanged = true;
     }
 
     if (oldActiveBuffer != NULL) {
@@ -2345,12 +2390,14 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
         if (bufWidth != uint32_t(oldActiveBuffer->width) ||
             bufHeight != uint32_t(oldActiveBuffer->height)) {
             recomputeVisibleRegions = true;
+            geometryChanged = true;
         }
     }
 
     mCurrentOpacity = getOpacityForFormat(mActiveBuffer->format);
     if (oldOpacity != isOpaque(s)) {
         recomputeVisibleRegions = true;
+        geometryChanged = true;
     }
 
     // Remove any sync points corresponding to the buffer which was just
@@ -2375,8 +2422,10 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
         }
     }
 
-    // FIXME: postedRegion should be dirty & bounds
     Region dirtyRegion(Rect(s.active.w, s.active.h));
+    if (!geometryChanged && !mFlinger->mForceFullDamage) {
+        dirtyRegion = computeDamagedRegion(dirtyRegion);
+    }
 
     // transform the dirty region to window-manager space
     outDirtyRegion = (getTransform().transform(dirtyRegion));
@@ -2528,12 +2577,23 @@ void Layer::miniDump(String8& result, int32_t hwcId) const {
     result.append("- - - - - - - - - - - - - - - - - - - - ");
     result.append("- - - - - - - - - - - - - - - - - - - -\n");
 }
+
+void Layer::addHwcBufferCacheStats(int32_t hwcId,
+        HWComposerBufferCache::Stats* outStats) const {
+    if (mHwcLayers.count(hwcId) != 0) {
+        *outStats += mHwcLayers.at(hwcId).bufferCache.getStats();
+    }
+}
 #endif
 
 void Layer::dumpFrameStats(String8& result) const {
     mFrameTracker.dumpStats(result);
 }
 
+void Layer::dumpFrameHistograms(String8& result) const {
+    mFrameTracker.dumpHistograms(result);
+}
+
 void Layer::clearFrameStats() {
     mFrameTracker.clearStats();
 }
@@ -81,6 +81,37 @@ public:
     Region visibleNonTransparentRegion;
     Region surfaceDamageRegion;
 
+    // Inputs and layer-local results of the last visible region pass. Used
+    // by SurfaceFlinger::computeVisibleRegions to skip the region math for
+    // layers whose geometry and coverage did not change since that pass.
+    struct VisibleRegionCache {
+        bool valid = false;
+        // bumped each time the layer's own footprint has to be recomputed
+        uint32_t geometryGeneration = 0;
+
+        bool visible = false;
+        bool translucent = false;
+        bool fullAlpha = false;
+        Rect bounds;
+        Transform transform;
+        Region activeTransparentRegion;
+
+        // derived from the inputs above, independent of other layers
+        Region footprint;
+        Region opaqueRegion;
+        Region transparentRegion;
+
+        // coverage by the layers above when visibleRegion was last computed
+        Region aboveOpaqueLayers;
+        Region aboveCoveredLayers;
+    };
+    VisibleRegionCache visibleRegionCache;
+
+    // Index of this layer in SurfaceFlinger's LayerSnapshot of the frame
+    // being composed. Only meaningful while the layer is in the drawing
+    // state.
+    size_t snapshotIndex;
+
     // Layer serial number.  This gives layers an explicit ordering, so we
     // have a stable sort order when their layer stack and Z-order are
     // the same.
@@ -167,6 +198,7 @@ public:
     virtual ~Layer();
 
     void setPrimaryDisplayOnly() { mPrimaryDisplayOnly = true; }
+    bool isPrimaryDisplayOnly() const { return mPrimaryDisplayOnly; }
 
     // the this layer's size and format
     status_t setBuffers(uint32_t w, uint32_t h, PixelFormat format, uint32_t flags);
@@ -485,8 +517,13 @@ public:
 #ifdef USE_HWC2
     static void miniDumpHeader(String8& result);
     void miniDump(String8& result, int32_t hwcId) const;
+    // adds the stats of this layer's HWC buffer cache on display hwcId to
+    // outStats
+    void addHwcBufferCacheStats(int32_t hwcId,
+            HWComposerBufferCache::Stats* outStats) const;
 #endif
     void dumpFrameStats(String8& result) const;
+    void dumpFrameHistograms(String8& result) const;
     void dumpFrameEvents(String8& result);
     void clearFrameStats();
     void logFrameStats();
@@ -579,6 +616,9 @@ private:
     Rect computeInitialCrop(const sp<const DisplayDevice>& hw) const;
     bool isCropped() const;
     static bool getOpacityForFormat(uint32_t format);
+    // Returns the part of bounds, in layer space, that the producer damaged
+    // in the buffer just latched
+    Region computeDamagedRegion(const Region& bounds) const;
 
     // drawing
     void clearWithOpenGL(const sp<const DisplayDevice>& hw,
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "LayerSnapshot.h"
+
+#include "Layer.h"
+
+namespace android {
+
+LayerSnapshot::LayerSnapshot()
+    : mHasGeometry(false) {
+}
+
+void LayerSnapshot::clear(bool withGeometry) {
+    // clear() keeps the capacity, so that a frame with as many layers as
+    // the previous one doesn't allocate
+    mLayers.clear();
+    mLayerStacks.clear();
+    mFlags.clear();
+    mAlphas.clear();
+    mDataSpaces.clear();
+    mTransforms.clear();
+    mScreenBounds.clear();
+    mHasGeometry = withGeometry;
+}
+
+void LayerSnapshot::add(Layer* layer) {
+    const Layer::State& s(layer->getDrawingState());
+
+    layer->snapshotIndex = mLayers.size();
+    mLayers.push_back(layer);
+    mLayerStacks.push_back(layer->getLayerStack());
+
+    const bool visible = layer->isVisible();
+    uint8_t flags = 0;
+    if (visible) {
+        flags |= VISIBLE;
+    }
+    if (layer->isOpaque(s)) {
+        flags |= OPAQUE;
+    }
+    if (layer->isPrimaryDisplayOnly()) {
+        flags |= PRIMARY_DISPLAY_ONLY;
+    }
+    mFlags.push_back(flags);
+#ifdef USE_HWC2
+    mAlphas.push_back(s.alpha);
+#else
+    mAlphas.push_back(s.alpha / 255.0f);
+#endif
+    mDataSpaces.push_back(layer->getDataSpace());
+
+    if (mHasGeometry) {
+        // invisible layers have no footprint, don't bother
+        mTransforms.push_back(visible ? layer->getTransform() : Transform());
+        mScreenBounds.push_back(visible ? layer->computeScreenBounds() : Rect());
+    }
+}
+
+} // namespace android
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_LAYERSNAPSHOT_H
+#define ANDROID_LAYERSNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+#include <system/graphics.h>
+#include <ui/Rect.h>
+
+#include "Transform.h"
+
+namespace android {
+
+class Layer;
+
+// LayerSnapshot copies the drawing state that composition reads for every
+// layer into one array per field, in Z order, once per frame. The passes
+// over the layers then read a few compact arrays instead of chasing each
+// layer's state, and its parents for the transform and bounds, through the
+// heap once per display. The snapshot isn't modified while it's read, so
+// it's also safe to read from the display worker threads.
+//
+// Layers find their entry through Layer::snapshotIndex, which add() sets.
+//
+// This class is *NOT* thread-safe.
+class LayerSnapshot {
+public:
+    LayerSnapshot();
+
+    // Empties the snapshot before the layers are added again. The
+    // transform and screen bounds of the layers are only computed with
+    // withGeometry, as they are only needed when the visible regions are
+    // recomputed.
+    void clear(bool withGeometry);
+
+    // Appends layer, which must be next in Z order
+    void add(Layer* layer);
+
+    size_t size() const { return mLayers.size(); }
+    bool hasGeometry() const { return mHasGeometry; }
+
+    Layer* getLayer(size_t i) const { return mLayers[i]; }
+    bool belongsToDisplay(size_t i, uint32_t layerStack, bool isPrimaryDisplay) const {
+        return mLayerStacks[i] == layerStack &&
+                (!(mFlags[i] & PRIMARY_DISPLAY_ONLY) || isPrimaryDisplay);
+    }
+    bool isVisible(size_t i) const { return mFlags[i] & VISIBLE; }
+    bool isOpaque(size_t i) const { return mFlags[i] & OPAQUE; }
+    // alpha of the layer's own drawing state, not including its parents'
+    float getAlpha(size_t i) const { return mAlphas[i]; }
+    android_dataspace getDataSpace(size_t i) const { return mDataSpaces[i]; }
+    // only valid if hasGeometry()
+    const Transform& getTransform(size_t i) const { return mTransforms[i]; }
+    const Rect& getScreenBounds(size_t i) const { return mScreenBounds[i]; }
+
+private:
+    enum : uint8_t {
+        VISIBLE              = 0x01,
+        OPAQUE               = 0x02,
+        PRIMARY_DISPLAY_ONLY = 0x04,
+    };
+
+    std::vector<Layer*> mLayers;
+    std::vector<uint32_t> mLayerStacks;
+    std::vector<uint8_t> mFlags;
+    std::vector<float> mAlphas;
+    std::vector<android_dataspace> mDataSpaces;
+    // only filled in when mHasGeometry
+    std::vector<Transform> mTransforms;
+    std::vector<Rect> mScreenBounds;
+    bool mHasGeometry;
+};
+
+}
+
+#endif // ANDROID_LAYERSNAPSHOT_H
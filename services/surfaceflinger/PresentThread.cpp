@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <string.h>
+
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include "PresentThread.h"
+
+namespace android {
+
+PresentThread::PresentThread() :
+        mBusy(false) {
+}
+
+void PresentThread::queueFrame(std::function<void()> frame) {
+    Mutex::Autolock lock(mMutex);
+    while (mFrame || mBusy) {
+        mCond.wait(mMutex);
+    }
+    mFrame = std::move(frame);
+    mCond.broadcast();
+}
+
+void PresentThread::waitForIdle() {
+    Mutex::Autolock lock(mMutex);
+    while (mFrame || mBusy) {
+        mCond.wait(mMutex);
+    }
+}
+
+bool PresentThread::threadLoop() {
+    std::function<void()> frame;
+    {
+        Mutex::Autolock lock(mMutex);
+        while (!mFrame) {
+            status_t err = mCond.wait(mMutex);
+            if (err != NO_ERROR) {
+                ALOGE("error waiting for a frame: %s (%d)", strerror(-err), err);
+                return false;
+            }
+        }
+        frame = std::move(mFrame);
+        mFrame = nullptr;
+        mBusy = true;
+    }
+
+    {
+        ATRACE_NAME("presentFrame");
+        frame();
+    }
+
+    Mutex::Autolock lock(mMutex);
+    mBusy = false;
+    mCond.broadcast();
+    return true;
+}
+
+} // namespace android
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_PRESENTTHREAD_H
+#define ANDROID_PRESENTTHREAD_H
+
+#include <functional>
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+
+namespace android {
+
+/*
+ * Runs the HWC present of a frame so that the main thread can go back to its
+ * message queue while HWC blocks. Release fences are still handed out on the
+ * main thread. At most one frame is in flight: queueFrame() waits for the
+ * previous one.
+ */
+class PresentThread : public Thread {
+public:
+    PresentThread();
+    virtual ~PresentThread() {}
+
+    // Runs frame on this thread once the previous frame is done.
+    void queueFrame(std::function<void()> frame);
+
+    // Blocks until the last queued frame is done.
+    void waitForIdle();
+
+    virtual bool threadLoop();
+
+private:
+    Mutex mMutex;
+    Condition mCond;
+    std::function<void()> mFrame;
+    bool mBusy;
+};
+
+}
+
+#endif // ANDROID_PRESENTTHREAD_H
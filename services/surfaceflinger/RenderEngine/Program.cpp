@@ -15,6 +15,9 @@
  */
 
 #include <stdint.h>
+#include <string.h>
+
+#include <GLES2/gl2ext.h>
 
 #include <log/log.h>
 #include <utils/String8.h>
@@ -26,7 +29,7 @@
 namespace android {
 
 Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const char* fragment)
-        : mInitialized(false) {
+        : mInitialized(false), mUniformsSet(false) {
     GLuint vertexId = buildShader(vertex, GL_VERTEX_SHADER);
     GLuint fragmentId = buildShader(fragment, GL_FRAGMENT_SHADER);
     GLuint programId = glCreateProgram();
@@ -53,29 +56,55 @@ Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const c
         glDeleteShader(fragmentId);
         glDeleteProgram(programId);
     } else {
-        mProgram = programId;
-        mVertexShader = vertexId;
-        mFragmentShader = fragmentId;
-        mInitialized = true;
-
-        mColorMatrixLoc = glGetUniformLocation(programId, "colorMatrix");
-        mProjectionMatrixLoc = glGetUniformLocation(programId, "projection");
-        mTextureMatrixLoc = glGetUniformLocation(programId, "texture");
-        mSamplerLoc = glGetUniformLocation(programId, "sampler");
-        mColorLoc = glGetUniformLocation(programId, "color");
-        mAlphaPlaneLoc = glGetUniformLocation(programId, "alphaPlane");
-
-        // set-up the default values for our uniforms
-        glUseProgram(programId);
-        const GLfloat m[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
-        glUniformMatrix4fv(mProjectionMatrixLoc, 1, GL_FALSE, m);
-        glEnableVertexAttribArray(0);
+        initialize(programId, vertexId, fragmentId);
+    }
+}
+
+Program::Program(const ProgramCache::Key& /*needs*/, GLenum binaryFormat, const void* binary,
+        GLsizei length)
+        : mInitialized(false), mUniformsSet(false) {
+    GLuint programId = glCreateProgram();
+    glProgramBinaryOES(programId, binaryFormat, binary, length);
+
+    // attribute locations were bound when the binary was first linked
+    GLint status;
+    glGetProgramiv(programId, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        ALOGW("Program binary (format 0x%x, %d bytes) rejected by the driver",
+                binaryFormat, length);
+        glDeleteProgram(programId);
+    } else {
+        initialize(programId, 0, 0);
     }
 }
 
 Program::~Program() {
 }
 
+void Program::initialize(GLuint programId, GLuint vertexId, GLuint fragmentId) {
+    mProgram = programId;
+    mVertexShader = vertexId;
+    mFragmentShader = fragmentId;
+    mInitialized = true;
+    mUniformsSet = false;
+
+    mColorMatrixLoc = glGetUniformLocation(programId, "colorMatrix");
+    mProjectionMatrixLoc = glGetUniformLocation(programId, "projection");
+    mTextureMatrixLoc = glGetUniformLocation(programId, "texture");
+    mSamplerLoc = glGetUniformLocation(programId, "sampler");
+    mColorLoc = glGetUniformLocation(programId, "color");
+    mAlphaPlaneLoc = glGetUniformLocation(programId, "alphaPlane");
+
+    // set-up the default values for our uniforms
+    glUseProgram(programId);
+    const GLfloat m[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+    glUniformMatrix4fv(mProjectionMatrixLoc, 1, GL_FALSE, m);
+    if (mSamplerLoc >= 0) {
+        glUniform1i(mSamplerLoc, 0);
+    }
+    glEnableVertexAttribArray(0);
+}
+
 bool Program::isValid() const {
     return mInitialized;
 }
@@ -84,6 +113,30 @@ void Program::use() {
     glUseProgram(mProgram);
 }
 
+bool Program::getBinary(GLenum* outFormat, std::vector<uint8_t>* outBinary) const {
+    if (!mInitialized) {
+        return false;
+    }
+    // drop errors left by earlier calls, so that they aren't taken for a
+    // failure to read the binary below
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    GLint length = 0;
+    glGetProgramiv(mProgram, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) {
+        return false;
+    }
+    outBinary->resize(static_cast<size_t>(length));
+    GLsizei written = 0;
+    glGetProgramBinaryOES(mProgram, length, &written, outFormat, outBinary->data());
+    if (glGetError() != GL_NO_ERROR || written <= 0) {
+        outBinary->clear();
+        return false;
+    }
+    outBinary->resize(static_cast<size_t>(written));
+    return true;
+}
+
 GLuint Program::getAttrib(const char* name) const {
     // TODO: maybe use a local cache
     return glGetAttribLocation(mProgram, name);
@@ -124,25 +177,33 @@ String8& Program::dumpShader(String8& result, GLenum /*type*/) {
 }
 
 void Program::setUniforms(const Description& desc) {
-
-    // TODO: we should have a mechanism here to not always reset uniforms that
-    // didn't change for this program.
-
-    if (mSamplerLoc >= 0) {
-        glUniform1i(mSamplerLoc, 0);
-        glUniformMatrix4fv(mTextureMatrixLoc, 1, GL_FALSE, desc.mTexture.getMatrix().asArray());
+    // Uniforms are part of the program object, so only the ones that
+    // changed since this program was last used need to be uploaded.
+    // The sampler is always bound to unit 0, see initialize().
+    const bool force = !mUniformsSet;
+    if (mTextureMatrixLoc >= 0 &&
+            (force || mTextureMatrix != desc.mTexture.getMatrix())) {
+        mTextureMatrix = desc.mTexture.getMatrix();
+        glUniformMatrix4fv(mTextureMatrixLoc, 1, GL_FALSE, mTextureMatrix.asArray());
     }
-    if (mAlphaPlaneLoc >= 0) {
-        glUniform1f(mAlphaPlaneLoc, desc.mPlaneAlpha);
+    if (mAlphaPlaneLoc >= 0 && (force || mAlphaPlane != desc.mPlaneAlpha)) {
+        mAlphaPlane = desc.mPlaneAlpha;
+        glUniform1f(mAlphaPlaneLoc, mAlphaPlane);
     }
-    if (mColorLoc >= 0) {
-        glUniform4fv(mColorLoc, 1, desc.mColor);
+    if (mColorLoc >= 0 && (force || memcmp(mColor, desc.mColor, sizeof(mColor)) != 0)) {
+        memcpy(mColor, desc.mColor, sizeof(mColor));
+        glUniform4fv(mColorLoc, 1, mColor);
     }
-    if (mColorMatrixLoc >= 0) {
-        glUniformMatrix4fv(mColorMatrixLoc, 1, GL_FALSE, desc.mColorMatrix.asArray());
+    if (mColorMatrixLoc >= 0 && (force || mColorMatrix != desc.mColorMatrix)) {
+        mColorMatrix = desc.mColorMatrix;
+        glUniformMatrix4fv(mColorMatrixLoc, 1, GL_FALSE, mColorMatrix.asArray());
     }
     // these uniforms are always present
-    glUniformMatrix4fv(mProjectionMatrixLoc, 1, GL_FALSE, desc.mProjectionMatrix.asArray());
+    if (force || mProjectionMatrix != desc.mProjectionMatrix) {
+        mProjectionMatrix = desc.mProjectionMatrix;
+        glUniformMatrix4fv(mProjectionMatrixLoc, 1, GL_FALSE, mProjectionMatrix.asArray());
+    }
+    mUniformsSet = true;
 }
 
 } /* namespace android */
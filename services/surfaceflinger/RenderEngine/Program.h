@@ -19,6 +19,8 @@
 
 #include <stdint.h>
 
+#include <vector>
+
 #include <GLES2/gl2.h>
 
 #include "Description.h"
@@ -37,6 +39,11 @@ public:
     enum { position=0, texCoords=1 };
 
     Program(const ProgramCache::Key& needs, const char* vertex, const char* fragment);
+    // Creates the program from a binary returned by getBinary(), possibly
+    // by an earlier instance of surfaceflinger. The program is invalid if
+    // the driver rejects the binary.
+    Program(const ProgramCache::Key& needs, GLenum binaryFormat, const void* binary,
+            GLsizei length);
     ~Program();
 
     /* whether this object is usable */
@@ -54,8 +61,11 @@ public:
     /* set-up uniforms from the description */
     void setUniforms(const Description& desc);
 
+    /* retrieves the linked program binary, requires GL_OES_get_program_binary */
+    bool getBinary(GLenum* outFormat, std::vector<uint8_t>* outBinary) const;
 
 private:
+    void initialize(GLuint programId, GLuint vertexId, GLuint fragmentId);
     GLuint buildShader(const char* source, GLenum type);
     String8& dumpShader(String8& result, GLenum type);
 
@@ -84,6 +94,14 @@ private:
 
     /* location of the color uniform */
     GLint mColorLoc;
+
+    /* values last uploaded by setUniforms(), valid once mUniformsSet */
+    bool mUniformsSet;
+    mat4 mProjectionMatrix;
+    mat4 mColorMatrix;
+    mat4 mTextureMatrix;
+    GLclampf mAlphaPlane;
+    GLclampf mColor[4];
 };
 
 
@@ -14,14 +14,28 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
+#include <android-base/file.h>
+#include <cutils/properties.h>
 #include <utils/String8.h>
 
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "ProgramCache.h"
 #include "Program.h"
 #include "Description.h"
+#include "GLExtensions.h"
 
 namespace android {
 // -----------------------------------------------------------------------------------------------
@@ -75,15 +89,66 @@ Formatter& dedent(Formatter& f) {
 
 // -----------------------------------------------------------------------------------------------
 
+/*
+ * Layout of the program cache file: a CacheHeader, the driver fingerprint,
+ * then CacheHeader::count entries, each a CacheEntryHeader followed by
+ * CacheEntryHeader::length bytes of program binary. Entries with no binary
+ * only list a key to compile during primeCache().
+ */
+static const char* const PROGRAM_CACHE_PATH = "/data/misc/surfaceflinger/program_cache.bin";
+static const uint32_t PROGRAM_CACHE_MAGIC = 0x53465043; // 'SFPC'
+static const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t fingerprintLength;
+    uint32_t count;
+};
+
+struct CacheEntryHeader {
+    uint64_t sourceHash;
+    uint32_t key;
+    uint32_t binaryFormat;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+template <typename T>
+static bool readFromCache(const std::string& data, size_t& offset, T* out) {
+    if (data.size() - offset < sizeof(T)) {
+        return false;
+    }
+    memcpy(out, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+template <typename T>
+static void appendToCache(std::string& data, const T& value) {
+    data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// -----------------------------------------------------------------------------------------------
+
 ANDROID_SINGLETON_STATIC_INSTANCE(ProgramCache)
 
-ProgramCache::ProgramCache() {
-    // Until surfaceflinger has a dependable blob cache on the filesystem,
-    // generate shaders on initialization so as to avoid jank.
+ProgramCache::ProgramCache()
+    : mProgramBinarySupported(
+            GLExtensions::getInstance().hasExtension("GL_OES_get_program_binary")),
+      mCacheDirty(false),
+      mSaveEnabled(false),
+      mCurrentProgram(nullptr),
+      mWritePending(false),
+      mStopWriting(false) {
+    // /data may not be available yet, so restore what we can from the
+    // program cache and generate the remaining shaders on initialization
+    // so as to avoid jank.
     primeCache();
 }
 
 ProgramCache::~ProgramCache() {
+    finishSaves();
 }
 
 void ProgramCache::primeCache() {
@@ -94,6 +159,19 @@ void ProgramCache::primeCache() {
     // leaving off the experimental color matrix mask options.
 
     nsecs_t timeBefore = systemTime();
+
+    // Also warm up every program a previous instance ended up using, which
+    // includes the color matrix and wide gamut ones.
+    Vector<Key> keysToCompile;
+    const size_t restoredCount = loadCache(keysToCompile);
+    for (size_t i = 0; i < keysToCompile.size(); i++) {
+        const Key& shaderKey(keysToCompile[i]);
+        if (mCache.indexOfKey(shaderKey) < 0) {
+            mCache.add(shaderKey, generateProgram(shaderKey));
+            shaderCount++;
+        }
+    }
+
     for (uint32_t keyVal = 0; keyVal <= keyMask; keyVal++) {
         Key shaderKey;
         shaderKey.set(keyMask, keyVal);
@@ -112,7 +190,170 @@ void ProgramCache::primeCache() {
     }
     nsecs_t timeAfter = systemTime();
     float compileTimeMs = static_cast<float>(timeAfter - timeBefore) / 1.0E6;
-    ALOGD("shader cache generated - %u shaders in %f ms\n", shaderCount, compileTimeMs);
+    ALOGD("shader cache generated - %u shaders (%zu restored) in %f ms\n",
+            shaderCount, restoredCount, compileTimeMs);
+
+    if (shaderCount > 0) {
+        mCacheDirty = true;
+    }
+}
+
+String8 ProgramCache::getDriverFingerprint() {
+    const GLExtensions& extensions(GLExtensions::getInstance());
+    char buildFingerprint[PROPERTY_VALUE_MAX];
+    property_get("ro.build.fingerprint", buildFingerprint, "");
+    return String8::format("%s;%s;%s;%s", extensions.getVendor(), extensions.getRenderer(),
+            extensions.getVersion(), buildFingerprint);
+}
+
+uint64_t ProgramCache::hashSources(const Key& needs) {
+    std::string sources(generateVertexShader(needs).string());
+    sources.append(generateFragmentShader(needs).string());
+    return std::hash<std::string>()(sources);
+}
+
+size_t ProgramCache::loadCache(Vector<Key>& outKeysToCompile) {
+    std::string data;
+    if (!base::ReadFileToString(PROGRAM_CACHE_PATH, &data)) {
+        return 0;
+    }
+
+    size_t offset = 0;
+    CacheHeader header;
+    if (!readFromCache(data, offset, &header) || header.magic != PROGRAM_CACHE_MAGIC ||
+            header.version != PROGRAM_CACHE_VERSION ||
+            header.fingerprintLength > data.size() - offset) {
+        ALOGW("Ignoring malformed program cache %s", PROGRAM_CACHE_PATH);
+        return 0;
+    }
+
+    // binaries are only usable with the driver that produced them, but the
+    // keys are still worth warming up
+    const String8 fingerprint(getDriverFingerprint());
+    const bool sameDriver = mProgramBinarySupported &&
+            data.compare(offset, header.fingerprintLength, fingerprint.string()) == 0;
+    offset += header.fingerprintLength;
+
+    size_t restoredCount = 0;
+    for (uint32_t i = 0; i < header.count; i++) {
+        CacheEntryHeader entry;
+        if (!readFromCache(data, offset, &entry) || entry.length > data.size() - offset) {
+            ALOGW("Program cache %s is truncated", PROGRAM_CACHE_PATH);
+            break;
+        }
+        Key key;
+        key.mKey = entry.key;
+        if (mCache.indexOfKey(key) < 0) {
+            Program* program = nullptr;
+            if (sameDriver && entry.length > 0 && entry.sourceHash == hashSources(key)) {
+                program = new Program(key, entry.binaryFormat, data.data() + offset,
+                        static_cast<GLsizei>(entry.length));
+                if (!program->isValid()) {
+                    delete program;
+                    program = nullptr;
+                }
+            }
+            if (program != nullptr) {
+                mCache.add(key, program);
+                restoredCount++;
+            } else {
+                outKeysToCompile.add(key);
+            }
+        }
+        offset += entry.length;
+    }
+    return restoredCount;
+}
+
+void ProgramCache::saveCache() {
+    mSaveEnabled = true;
+    if (!mCacheDirty) {
+        return;
+    }
+
+    const String8 fingerprint(getDriverFingerprint());
+    CacheHeader header;
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.fingerprintLength = static_cast<uint32_t>(fingerprint.length());
+    header.count = static_cast<uint32_t>(mCache.size());
+
+    std::string data;
+    appendToCache(data, header);
+    data.append(fingerprint.string(), fingerprint.length());
+
+    std::vector<uint8_t> binary;
+    for (size_t i = 0; i < mCache.size(); i++) {
+        const Key& key(mCache.keyAt(i));
+        CacheEntryHeader entry;
+        entry.sourceHash = hashSources(key);
+        entry.key = key.mKey;
+        entry.binaryFormat = 0;
+        entry.reserved = 0;
+        binary.clear();
+        if (!mProgramBinarySupported ||
+                !mCache.valueAt(i)->getBinary(&entry.binaryFormat, &binary)) {
+            // keep the key so that it still gets warmed up
+            binary.clear();
+        }
+        entry.length = static_cast<uint32_t>(binary.size());
+        appendToCache(data, entry);
+        data.append(reinterpret_cast<const char*>(binary.data()), binary.size());
+    }
+
+    // the binaries had to be read with the context current, but the file is
+    // written by a worker so that the caller doesn't wait for storage
+    mCacheDirty = false;
+    std::lock_guard<std::mutex> lock(mWriteMutex);
+    if (mStopWriting) {
+        return;
+    }
+    mPendingWrite = std::move(data);
+    mWritePending = true;
+    if (!mWriteThread.joinable()) {
+        mWriteThread = std::thread(&ProgramCache::writeThreadLoop, this);
+    }
+    mWriteCondition.notify_one();
+}
+
+void ProgramCache::finishSaves() {
+    {
+        std::lock_guard<std::mutex> lock(mWriteMutex);
+        mStopWriting = true;
+    }
+    mWriteCondition.notify_one();
+    if (mWriteThread.joinable()) {
+        mWriteThread.join();
+    }
+}
+
+void ProgramCache::writeThreadLoop() {
+    std::unique_lock<std::mutex> lock(mWriteMutex);
+    while (true) {
+        mWriteCondition.wait(lock, [this]() { return mWritePending || mStopWriting; });
+        // the pending cache is still written when stopping
+        if (!mWritePending) {
+            return;
+        }
+        std::string data(std::move(mPendingWrite));
+        mPendingWrite.clear();
+        mWritePending = false;
+
+        lock.unlock();
+        writeCacheFile(data);
+        lock.lock();
+    }
+}
+
+void ProgramCache::writeCacheFile(const std::string& data) {
+    // write to a temporary file first so that a crash can't leave a
+    // truncated cache behind
+    const std::string tmpPath = std::string(PROGRAM_CACHE_PATH) + ".tmp";
+    if (!base::WriteStringToFile(data, tmpPath) ||
+            rename(tmpPath.c_str(), PROGRAM_CACHE_PATH) != 0) {
+        ALOGW("Failed to write program cache %s: %s", PROGRAM_CACHE_PATH, strerror(errno));
+        unlink(tmpPath.c_str());
+    }
 }
 
 ProgramCache::Key ProgramCache::computeKey(const Description& description) {
@@ -284,13 +525,22 @@ void ProgramCache::useProgram(const Description& description) {
         mCache.add(needs, program);
         time += systemTime();
 
+        // generating a program binds it
+        mCurrentProgram = nullptr;
+
+        // saved by a later saveCache(), not in the middle of this frame
+        mCacheDirty = true;
+
         //ALOGD(">>> generated new program: needs=%08X, time=%u ms (%d programs)",
         //        needs.mNeeds, uint32_t(ns2ms(time)), mCache.size());
     }
 
     // here we have a suitable program for this description
     if (program->isValid()) {
-        program->use();
+        if (program != mCurrentProgram) {
+            program->use();
+            mCurrentProgram = program;
+        }
         program->setUniforms(description);
     }
 }
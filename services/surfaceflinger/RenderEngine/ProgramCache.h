@@ -19,6 +19,11 @@
 
 #include <GLES2/gl2.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
 #include <utils/Singleton.h>
 #include <utils/KeyedVector.h>
 #include <utils/TypeHelpers.h>
@@ -118,9 +123,31 @@ public:
     // if none can be found.
     void useProgram(const Description& description);
 
+    // Writes the keys and binaries of all cached programs to persistent
+    // storage so the next primeCache() can restore them instead of compiling
+    // them. The binaries are read here, the file is written by a worker
+    // thread. Must be called with the GL context current.
+    void saveCache();
+
+    // Waits for the cache handed to the worker thread by saveCache() to be
+    // written, then stops the thread. Later saves are dropped.
+    void finishSaves();
+
+    // true once saveCache() was called and programs were generated since,
+    // the caller should call saveCache() again when it's idle
+    bool needsSave() const { return mSaveEnabled && mCacheDirty; }
+
 private:
     // Generate shaders to populate the cache
     void primeCache();
+    // Restores the programs saved by saveCache(). Keys whose binary could
+    // not be restored (e.g. after a driver update) are added to
+    // outKeysToCompile. Returns the number of programs restored.
+    size_t loadCache(Vector<Key>& outKeysToCompile);
+    // identifies the GL driver and system build the binaries were made by
+    static String8 getDriverFingerprint();
+    // hash of the shader sources of a Key, to detect generator changes
+    static uint64_t hashSources(const Key& needs);
     // compute a cache Key from a Description
     static Key computeKey(const Description& description);
     // generates a program from the Key
@@ -129,10 +156,35 @@ private:
     static String8 generateVertexShader(const Key& needs);
     // generates the fragment shader from the Key
     static String8 generateFragmentShader(const Key& needs);
+    // runs on mWriteThread, writes the caches handed over by saveCache()
+    void writeThreadLoop();
+    // writes a serialized cache made by saveCache()
+    static void writeCacheFile(const std::string& data);
 
     // Key/Value map used for caching Programs. Currently the cache
     // is never shrunk.
     DefaultKeyedVector<Key, Program*> mCache;
+
+    // whether the driver can give back program binaries
+    bool mProgramBinarySupported;
+    // programs were added since the last saveCache()
+    bool mCacheDirty;
+    // saveCache() was called, storage is available to save new programs
+    bool mSaveEnabled;
+    // program bound by the last useProgram()
+    Program* mCurrentProgram;
+
+    // Worker writing the cache file, started by the first saveCache().
+    // mWriteMutex guards the fields below it.
+    std::thread mWriteThread;
+    std::mutex mWriteMutex;
+    std::condition_variable mWriteCondition;
+    // latest cache not written yet, a newer save replaces it since every
+    // save holds all the programs
+    std::string mPendingWrite;
+    bool mWritePending;
+    // set by finishSaves()
+    bool mStopWriting;
 };
 
 
@@ -453,6 +453,20 @@ void RenderEngine::primeCache() const {
     ProgramCache::getInstance();
 }
 
+void RenderEngine::saveProgramCache() const {
+    ProgramCache::getInstance().saveCache();
+}
+
+bool RenderEngine::needsProgramCacheSave() const {
+    return ProgramCache::getInstance().needsSave();
+}
+
+void RenderEngine::finishProgramCacheSaves() const {
+    if (ProgramCache::hasInstance()) {
+        ProgramCache::getInstance().finishSaves();
+    }
+}
+
 // ---------------------------------------------------------------------------
 }; // namespace android
 // ---------------------------------------------------------------------------
@@ -67,6 +67,9 @@ public:
     static EGLConfig chooseEglConfig(EGLDisplay display, int format, bool logConfig);
 
     void primeCache() const;
+    void saveProgramCache() const;
+    bool needsProgramCacheSave() const;
+    void finishProgramCacheSaves() const;
 
     // dump the extension strings. always call the base class.
     virtual void dump(String8& result);
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ScreenshotImageCache.h"
+
+#include <ui/GraphicBuffer.h>
+
+namespace android {
+
+ScreenshotImageCache::ScreenshotImageCache()
+    : mDisplay(EGL_NO_DISPLAY),
+      mHits(0),
+      mMisses(0)
+{
+}
+
+ScreenshotImageCache::~ScreenshotImageCache()
+{
+    for (const Entry& entry : mEntries) {
+        eglDestroyImageKHR(mDisplay, entry.image);
+    }
+}
+
+EGLImageKHR ScreenshotImageCache::getImage(EGLDisplay display,
+        ANativeWindowBuffer* buffer, nsecs_t now)
+{
+    mDisplay = display;
+    const uint64_t bufferId = GraphicBuffer::from(buffer)->getId();
+    for (Entry& entry : mEntries) {
+        if (entry.bufferId == bufferId) {
+            entry.lastUsed = now;
+            mHits.fetch_add(1, std::memory_order_relaxed);
+            return entry.image;
+        }
+    }
+    mMisses.fetch_add(1, std::memory_order_relaxed);
+
+    EGLImageKHR image = eglCreateImageKHR(display, EGL_NO_CONTEXT,
+            EGL_NATIVE_BUFFER_ANDROID, buffer, NULL);
+    if (image == EGL_NO_IMAGE_KHR) {
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    if (mEntries.size() < MAX_IMAGES) {
+        mEntries.push_back({bufferId, image, now});
+        return image;
+    }
+
+    auto lru = mEntries.begin();
+    for (auto entry = mEntries.begin(); entry != mEntries.end(); ++entry) {
+        if (entry->lastUsed < lru->lastUsed) {
+            lru = entry;
+        }
+    }
+    eglDestroyImageKHR(display, lru->image);
+    *lru = {bufferId, image, now};
+    return image;
+}
+
+void ScreenshotImageCache::releaseIdle(nsecs_t now)
+{
+    for (auto entry = mEntries.begin(); entry != mEntries.end();) {
+        if (now - entry->lastUsed >= IDLE_TIMEOUT) {
+            eglDestroyImageKHR(mDisplay, entry->image);
+            entry = mEntries.erase(entry);
+        } else {
+            ++entry;
+        }
+    }
+}
+
+} // namespace android
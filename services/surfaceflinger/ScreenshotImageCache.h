@@ -0,0 +1,82 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_SCREENSHOTIMAGECACHE_H
+#define ANDROID_SF_SCREENSHOTIMAGECACHE_H
+
+#include <stdint.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <utils/Timers.h>
+
+#include <atomic>
+#include <vector>
+
+struct ANativeWindowBuffer;
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+// ScreenshotImageCache keeps the EGLImages of the last few buffers screen
+// captures were rendered into. Clients that take screenshots repeatedly, such
+// as ScreenshotClient, keep reusing the buffers of a single BufferQueue, so
+// the images, and the driver's import of the buffers behind them, can be
+// reused too instead of being created for every capture.
+//
+// Buffers are identified by their GraphicBuffer id. An image holds on to its
+// buffer, so images that weren't used for IDLE_TIMEOUT should be released
+// with releaseIdle().
+//
+// This class is *NOT* thread-safe, it is used on the main thread only. The
+// hit and miss counts may be read from any thread, e.g. by dumpsys.
+class ScreenshotImageCache {
+public:
+    enum { MAX_IMAGES = 3 };
+    static constexpr nsecs_t IDLE_TIMEOUT = ms2ns(1000);
+
+    ScreenshotImageCache();
+    ~ScreenshotImageCache();
+
+    // Returns the image of buffer, creating it if needed, or
+    // EGL_NO_IMAGE_KHR on failure. The image belongs to the cache.
+    EGLImageKHR getImage(EGLDisplay display, ANativeWindowBuffer* buffer, nsecs_t now);
+
+    // Destroys the images not used since now - IDLE_TIMEOUT
+    void releaseIdle(nsecs_t now);
+
+    bool isEmpty() const { return mEntries.empty(); }
+    size_t getHitCount() const { return mHits.load(std::memory_order_relaxed); }
+    size_t getMissCount() const { return mMisses.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry {
+        uint64_t bufferId;
+        EGLImageKHR image;
+        nsecs_t lastUsed;
+    };
+
+    EGLDisplay mDisplay;
+    std::vector<Entry> mEntries;
+    std::atomic<size_t> mHits;
+    std::atomic<size_t> mMisses;
+};
+
+// ---------------------------------------------------------------------------
+} // namespace android
+
+#endif // ANDROID_SF_SCREENSHOTIMAGECACHE_H
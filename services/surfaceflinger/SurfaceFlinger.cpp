@@ -70,6 +70,8 @@
 #include "DisplayDevice.h"
 #include "DispSync.h"
 #include "EventControlThread.h"
+#include "PresentThread.h"
+#include "DisplayWorkerPool.h"
 #include "EventThread.h"
 #include "Layer.h"
 #include "LayerVector.h"
@@ -153,6 +155,17 @@ bool SurfaceFlinger::useVrFlinger;
 int64_t SurfaceFlinger::maxFrameBufferAcquiredBuffers;
 bool SurfaceFlinger::hasWideColorDisplay;
 
+// debug.sf.dispsync_model selects the vsync model of the primary display,
+// "average" (the default) or "kalman"
+static DispSync::Model getPrimaryDispSyncModel() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.dispsync_model", value, "average");
+    if (strcmp(value, "kalman") == 0) {
+        return DispSync::Model::KALMAN;
+    }
+    return DispSync::Model::AVERAGE;
+}
+
 SurfaceFlinger::SurfaceFlinger()
     :   BnSurfaceComposer(),
         mTransactionFlags(0),
@@ -178,7 +191,7 @@ SurfaceFlinger::SurfaceFlinger()
         mBootFinished(false),
         mForceFullDamage(false),
         mInterceptor(this),
-        mPrimaryDispSync("PrimaryDispSync"),
+        mPrimaryDispSync("PrimaryDispSync", getPrimaryDispSyncModel()),
         mPrimaryHWVsyncEnabled(false),
         mHWVsyncAvailable(false),
         mHasColorMatrix(false),
@@ -250,6 +263,14 @@ SurfaceFlinger::SurfaceFlinger()
     mPropagateBackpressure = !atoi(value);
     ALOGI_IF(!mPropagateBackpressure, "Disabling backpressure propagation");
 
+    property_get("debug.sf.disable_incremental_visible_regions", value, "0");
+    mUseIncrementalVisibleRegions = !atoi(value);
+    ALOGI_IF(!mUseIncrementalVisibleRegions, "Disabling incremental visible regions");
+
+    property_get("debug.sf.enable_partial_client_composition", value, "0");
+    mPartialClientComposition = atoi(value);
+    ALOGI_IF(mPartialClientComposition, "Enabling partial client composition");
+
     property_get("debug.sf.enable_hwc_vds", value, "0");
     mUseHwcVirtualDisplays = atoi(value);
     ALOGI_IF(!mUseHwcVirtualDisplays, "Enabling HWC virtual displays");
@@ -275,6 +296,9 @@ void SurfaceFlinger::onFirstRef()
 
 SurfaceFlinger::~SurfaceFlinger()
 {
+    if (mRenderEngine) {
+        mRenderEngine->finishProgramCacheSaves();
+    }
     EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
     eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
     eglTerminate(display);
@@ -420,6 +444,8 @@ void SurfaceFlinger::bootFinished()
 
     sp<LambdaMessage> readProperties = new LambdaMessage([&]() {
         readPersistentProperties();
+        // /data is mounted by now, persist the shaders generated so far
+        mRenderEngine->saveProgramCache();
     });
     postMessageAsync(readProperties);
 }
@@ -485,6 +511,10 @@ public:
         mCallback = callback;
     }
 
+    virtual nsecs_t getPeriod() {
+        return mDispSync->getPeriod();
+    }
+
     virtual void setPhaseOffset(nsecs_t phaseOffset) {
         Mutex::Autolock lock(mVsyncMutex);
 
@@ -576,6 +606,7 @@ public:
 
     virtual void setVSyncEnabled(bool) {}
     virtual void setPhaseOffset(nsecs_t) {}
+    virtual nsecs_t getPeriod() { return 0; }
 
 private:
     std::mutex mCallbackMutex; // Protects the following
@@ -657,6 +688,21 @@ void SurfaceFlinger::init() {
     mEventControlThread->run("EventControl", PRIORITY_URGENT_DISPLAY);
     android_set_rt_ioprio(mEventControlThread->getTid(), 1);
 
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.enable_present_thread", value, "0");
+    if (atoi(value)) {
+        ALOGI("Presenting frames on a separate thread");
+        mPresentThread = new PresentThread();
+        mPresentThread->run("PresentThread", PRIORITY_URGENT_DISPLAY);
+    }
+
+    property_get("debug.sf.display_worker_threads", value, "0");
+    int displayWorkerThreads = atoi(value);
+    if (displayWorkerThreads > 0) {
+        ALOGI("Computing the layer stacks of displays on %d threads", displayWorkerThreads);
+        mDisplayWorkerPool = new DisplayWorkerPool(displayWorkerThreads);
+    }
+
     // initialize our drawing state
     mDrawingState = mCurrentState;
 
@@ -888,6 +934,7 @@ int SurfaceFlinger::getActiveConfig(const sp<IBinder>& display) {
 }
 
 void SurfaceFlinger::setActiveConfigInternal(const sp<DisplayDevice>& hw, int mode) {
+    waitForPresent();
     ALOGD("Set active config mode=%d, type=%d flinger=%p", mode, hw->getDisplayType(),
           this);
     int32_t type = hw->getDisplayType();
@@ -1232,7 +1279,8 @@ void SurfaceFlinger::resyncWithRateLimit() {
     // No explicit locking is needed here since EventThread holds a lock while calling this method
     static nsecs_t sLastResyncAttempted = 0;
     const nsecs_t now = systemTime();
-    if (now - sLastResyncAttempted > kIgnoreDelay) {
+    if (now - sLastResyncAttempted > kIgnoreDelay &&
+            !mPrimaryDispSync.hasConfidentModel(now)) {
         resyncToHardwareVsync(false);
     }
     sLastResyncAttempted = now;
@@ -1400,6 +1448,8 @@ void SurfaceFlinger::updateVrFlinger() {
         return;
     }
 
+    waitForPresent();
+
     if (vrFlingerRequestsDisplay && !mHwc->getComposer()->isRemote()) {
         ALOGE("Vr flinger is only supported for remote hardware composer"
               " service connections. Ignoring request to transition to vr"
@@ -1490,6 +1540,12 @@ void SurfaceFlinger::onMessageReceived(int32_t what) {
 }
 
 bool SurfaceFlinger::handleMessageTransaction() {
+    {
+        Mutex::Autolock _l(mStateLock);
+        // we're handling the transaction already, no need to signal it
+        android_atomic_or(applyQueuedTransactionsLocked(), &mTransactionFlags);
+    }
+
     uint32_t transactionFlags = peekTransactionFlags();
     if (transactionFlags) {
         handleTransaction(transactionFlags);
@@ -1508,13 +1564,88 @@ void SurfaceFlinger::handleMessageRefresh() {
 
     mRefreshPending = false;
 
+    waitForPresent();
+
     nsecs_t refreshStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
 
     preComposition(refreshStartTime);
+    updateLayerSnapshot();
     rebuildLayerStacks();
     setUpHWComposer();
     doDebugFlashRegions();
     doComposition();
+
+    if (mPresentThread != nullptr) {
+        // Present can block until the previous frame is on screen; let the
+        // main thread handle transactions in the meantime. The present
+        // thread only gets the HWC display ids, everything else it needs
+        // was handed to HWC by setUpHWComposer() and doComposition(). The
+        // frame is finished by the first waitForPresent() on the main thread.
+        mPresentPending = true;
+        mPendingRefreshStartTime = refreshStartTime;
+        mDebugInSwapBuffers = systemTime();
+        mPresentedDisplays = capturePresentedDisplays();
+        mPresentedAnimComposition = mAnimCompositionPending;
+        mAnimCompositionPending = false;
+        std::vector<int32_t> hwcIds(getPresentedHwcIds(mPresentedDisplays));
+        mPresentThread->queueFrame([this, hwcIds]() {
+            const nsecs_t now = systemTime();
+            presentDisplays(hwcIds);
+            mPresentDuration = systemTime() - now;
+            postMessageAsync(new LambdaMessage([this]() { waitForPresent(); }));
+        });
+        runPendingCaptures();
+        scheduleProgramCacheSave();
+        return;
+    }
+
+    postFramebuffer();
+    finishFrame(refreshStartTime);
+    runPendingCaptures();
+    scheduleProgramCacheSave();
+}
+
+void SurfaceFlinger::scheduleProgramCacheSave() {
+    if (mProgramCacheSavePending || !mRenderEngine->needsProgramCacheSave()) {
+        return;
+    }
+    // programs tend to be generated in bursts (e.g. when an app starts), a
+    // single save after the burst covers them all
+    static constexpr nsecs_t PROGRAM_CACHE_SAVE_DELAY = s2ns(5);
+    mProgramCacheSavePending = true;
+    postMessageAsync(new LambdaMessage([this]() {
+        mProgramCacheSavePending = false;
+        mRenderEngine->saveProgramCache();
+    }), PROGRAM_CACHE_SAVE_DELAY);
+}
+
+void SurfaceFlinger::waitForPresent() {
+    if (!mPresentPending) {
+        return;
+    }
+    ATRACE_CALL();
+    mPresentThread->waitForIdle();
+    mPresentPending = false;
+
+    distributeReleaseFences(mPresentedDisplays);
+    mPresentedDisplays.clear();
+    mLastSwapBufferTime = mPresentDuration;
+    mDebugInSwapBuffers = 0;
+
+    // postComposition() reports whether this frame, not the transactions
+    // committed since, was part of an animation
+    bool animCompositionPending = mAnimCompositionPending;
+    mAnimCompositionPending = mPresentedAnimComposition;
+    finishFrame(mPendingRefreshStartTime);
+    mAnimCompositionPending = animCompositionPending;
+
+    if (mCursorUpdatePending) {
+        mCursorUpdatePending = false;
+        updateCursorAsync();
+    }
+}
+
+void SurfaceFlinger::finishFrame(nsecs_t refreshStartTime) {
     postComposition(refreshStartTime);
 
     mPreviousPresentFence = mHwc->getPresentFence(HWC_DISPLAY_PRIMARY);
@@ -1527,6 +1658,12 @@ void SurfaceFlinger::handleMessageRefresh() {
     }
 
     mLayersWithQueuedFrames.clear();
+
+    // |mStateLock| not needed as we are on the main thread
+    uint32_t flipCount = getDefaultDisplayDeviceLocked()->getPageFlipCount();
+    if (flipCount % LOG_FRAME_STATS_PERIOD == 0) {
+        logFrameStats();
+    }
 }
 
 void SurfaceFlinger::doDebugFlashRegions()
@@ -1751,6 +1888,14 @@ void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
     mLastSwapTime = currentTime;
 }
 
+void SurfaceFlinger::updateLayerSnapshot() {
+    ATRACE_CALL();
+    mLayerSnapshot.clear(mVisibleRegionsDirty);
+    mDrawingState.traverseInZOrder([&](Layer* layer) {
+        mLayerSnapshot.add(layer);
+    });
+}
+
 void SurfaceFlinger::rebuildLayerStacks() {
     ATRACE_CALL();
     ALOGV("rebuildLayerStacks");
@@ -1761,65 +1906,105 @@ void SurfaceFlinger::rebuildLayerStacks() {
         mVisibleRegionsDirty = false;
         invalidateHwcGeometry();
 
+        // Visible regions are computed per layer stack: they are stored in
+        // the layers, so displays showing the same layer stack are done one
+        // after the other, while other layer stacks may be done in parallel
+        // on mDisplayWorkerPool. HWC layers are only touched afterwards, on
+        // this thread.
+        std::vector<VisibleLayers> visibleLayers(mDisplays.size());
+        std::vector<std::vector<size_t>> layerStackDisplays;
+        std::vector<uint32_t> layerStacks;
+        for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
+            const sp<DisplayDevice>& displayDevice(mDisplays[dpy]);
+            if (!displayDevice->isDisplayOn()) {
+                continue;
+            }
+            const uint32_t layerStack = displayDevice->getLayerStack();
+            auto found = std::find(layerStacks.begin(), layerStacks.end(), layerStack);
+            if (found == layerStacks.end()) {
+                layerStacks.push_back(layerStack);
+                layerStackDisplays.emplace_back();
+                found = layerStacks.end() - 1;
+            }
+            layerStackDisplays[found - layerStacks.begin()].push_back(dpy);
+        }
+
+        std::vector<std::function<void()>> jobs;
+        for (const auto& displays : layerStackDisplays) {
+            jobs.emplace_back([this, &displays, &visibleLayers]() {
+                for (size_t dpy : displays) {
+                    computeVisibleLayers(mDisplays[dpy], visibleLayers[dpy]);
+                }
+            });
+        }
+        if (mDisplayWorkerPool != nullptr && jobs.size() > 1) {
+            mDisplayWorkerPool->run(jobs);
+        } else {
+            for (const auto& job : jobs) {
+                job();
+            }
+        }
+
         for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
-            Region opaqueRegion;
-            Region dirtyRegion;
-            Vector<sp<Layer>> layersSortedByZ;
-            Vector<sp<Layer>> layersNeedingFences;
             const sp<DisplayDevice>& displayDevice(mDisplays[dpy]);
             const Transform& tr(displayDevice->getTransform());
             const Rect bounds(displayDevice->getBounds());
-            if (displayDevice->isDisplayOn()) {
-                computeVisibleRegions(displayDevice, dirtyRegion, opaqueRegion);
-
-                mDrawingState.traverseInZOrder([&](Layer* layer) {
-                    bool hwcLayerDestroyed = false;
-                    if (layer->belongsToDisplay(displayDevice->getLayerStack(),
-                                displayDevice->isPrimary())) {
-                        Region drawRegion(tr.transform(
-                                layer->visibleNonTransparentRegion));
-                        drawRegion.andSelf(bounds);
-                        if (!drawRegion.isEmpty()) {
-                            layersSortedByZ.add(layer);
-                        } else {
-                            // Clear out the HWC layer if this layer was
-                            // previously visible, but no longer is
-                            hwcLayerDestroyed = layer->hasHwcLayer(
-                                    displayDevice->getHwcDisplayId());
-                            layer->destroyHwcLayer(
-                                    displayDevice->getHwcDisplayId());
-                        }
-                    } else {
-                        // WM changes displayDevice->layerStack upon sleep/awake.
-                        // Here we make sure we delete the HWC layers even if
-                        // WM changed their layer stack.
-                        hwcLayerDestroyed = layer->hasHwcLayer(displayDevice->getHwcDisplayId());
-                        layer->destroyHwcLayer(displayDevice->getHwcDisplayId());
-                    }
-
-                    // If a layer is not going to get a release fence because
-                    // it is invisible, but it is also going to release its
-                    // old buffer, add it to the list of layers needing
-                    // fences.
-                    if (hwcLayerDestroyed) {
-                        auto found = std::find(mLayersWithQueuedFrames.cbegin(),
-                                mLayersWithQueuedFrames.cend(), layer);
-                        if (found != mLayersWithQueuedFrames.cend()) {
-                            layersNeedingFences.add(layer);
-                        }
+            const VisibleLayers& visible(visibleLayers[dpy]);
+            Vector<sp<Layer>> layersNeedingFences;
+            const auto hwcId = displayDevice->getHwcDisplayId();
+            for (const auto& layer : visible.hiddenLayers) {
+                // Clear out the HWC layer if this layer was previously
+                // visible, but no longer is
+                bool hwcLayerDestroyed = layer->hasHwcLayer(hwcId);
+                layer->destroyHwcLayer(hwcId);
+
+                // If a layer is not going to get a release fence because
+                // it is invisible, but it is also going to release its
+                // old buffer, add it to the list of layers needing
+                // fences.
+                if (hwcLayerDestroyed) {
+                    auto found = std::find(mLayersWithQueuedFrames.cbegin(),
+                            mLayersWithQueuedFrames.cend(), layer);
+                    if (found != mLayersWithQueuedFrames.cend()) {
+                        layersNeedingFences.add(layer);
                     }
-                });
+                }
             }
-            displayDevice->setVisibleLayersSortedByZ(layersSortedByZ);
+            displayDevice->setVisibleLayersSortedByZ(visible.layersSortedByZ);
             displayDevice->setLayersNeedingFences(layersNeedingFences);
             displayDevice->undefinedRegion.set(bounds);
             displayDevice->undefinedRegion.subtractSelf(
-                    tr.transform(opaqueRegion));
-            displayDevice->dirtyRegion.orSelf(dirtyRegion);
+                    tr.transform(visible.opaqueRegion));
+            displayDevice->dirtyRegion.orSelf(visible.dirtyRegion);
         }
     }
 }
 
+void SurfaceFlinger::computeVisibleLayers(const sp<const DisplayDevice>& displayDevice,
+        VisibleLayers& outVisibleLayers) {
+    const Transform& tr(displayDevice->getTransform());
+    const Rect bounds(displayDevice->getBounds());
+    computeVisibleRegions(displayDevice, outVisibleLayers.dirtyRegion,
+            outVisibleLayers.opaqueRegion);
+
+    mDrawingState.traverseInZOrder([&](Layer* layer) {
+        if (layer->belongsToDisplay(displayDevice->getLayerStack(),
+                    displayDevice->isPrimary())) {
+            Region drawRegion(tr.transform(
+                    layer->visibleNonTransparentRegion));
+            drawRegion.andSelf(bounds);
+            if (!drawRegion.isEmpty()) {
+                outVisibleLayers.layersSortedByZ.add(layer);
+                return;
+            }
+        }
+        // Either the layer isn't visible on this display, or WM changed
+        // displayDevice->layerStack upon sleep/awake. Either way its HWC
+        // layer for this display is deleted.
+        outVisibleLayers.hiddenLayers.push_back(layer);
+    });
+}
+
 mat4 SurfaceFlinger::computeSaturationMatrix() const {
     if (mSaturation == 1.0f) {
         return mat4();
@@ -1966,10 +2151,12 @@ void SurfaceFlinger::setUpHWComposer() {
             android_dataspace newDataSpace = HAL_DATASPACE_V0_SRGB;
 
             for (auto& layer : displayDevice->getVisibleLayersSortedByZ()) {
-                newDataSpace = bestTargetDataSpace(layer->getDataSpace(), newDataSpace);
+                const android_dataspace dataSpace =
+                        mLayerSnapshot.getDataSpace(layer->snapshotIndex);
+                newDataSpace = bestTargetDataSpace(dataSpace, newDataSpace);
                 ALOGV("layer: %s, dataspace: %s (%#x), newDataSpace: %s (%#x)",
-                      layer->getName().string(), dataspaceDetails(layer->getDataSpace()).c_str(),
-                      layer->getDataSpace(), dataspaceDetails(newDataSpace).c_str(), newDataSpace);
+                      layer->getName().string(), dataspaceDetails(dataSpace).c_str(),
+                      dataSpace, dataspaceDetails(newDataSpace).c_str(), newDataSpace);
             }
             newColorMode = pickColorMode(newDataSpace);
 
@@ -2010,7 +2197,6 @@ void SurfaceFlinger::doComposition() {
             hw->swapRegion.clear();
         }
     }
-    postFramebuffer();
 }
 
 void SurfaceFlinger::postFramebuffer()
@@ -2021,18 +2207,60 @@ void SurfaceFlinger::postFramebuffer()
     const nsecs_t now = systemTime();
     mDebugInSwapBuffers = now;
 
+    std::vector<PresentedDisplay> displays(capturePresentedDisplays());
+    presentDisplays(getPresentedHwcIds(displays));
+    distributeReleaseFences(displays);
+
+    mLastSwapBufferTime = systemTime() - now;
+    mDebugInSwapBuffers = 0;
+}
+
+std::vector<SurfaceFlinger::PresentedDisplay> SurfaceFlinger::capturePresentedDisplays() const
+{
+    std::vector<PresentedDisplay> displays;
     for (size_t displayId = 0; displayId < mDisplays.size(); ++displayId) {
-        auto& displayDevice = mDisplays[displayId];
+        const sp<DisplayDevice>& displayDevice = mDisplays[displayId];
         if (!displayDevice->isDisplayOn()) {
             continue;
         }
-        const auto hwcId = displayDevice->getHwcDisplayId();
-        if (hwcId >= 0) {
-            mHwc->presentAndGetReleaseFences(hwcId);
+        PresentedDisplay display;
+        display.displayDevice = displayDevice;
+        display.hwcId = displayDevice->getHwcDisplayId();
+        // Vector copies share their storage until either side changes
+        display.visibleLayers = displayDevice->getVisibleLayersSortedByZ();
+        display.layersNeedingFences = displayDevice->getLayersNeedingFences();
+        displays.push_back(std::move(display));
+    }
+    return displays;
+}
+
+std::vector<int32_t> SurfaceFlinger::getPresentedHwcIds(
+        const std::vector<PresentedDisplay>& displays)
+{
+    std::vector<int32_t> hwcIds;
+    for (const auto& display : displays) {
+        if (display.hwcId >= 0) {
+            hwcIds.push_back(display.hwcId);
         }
+    }
+    return hwcIds;
+}
+
+void SurfaceFlinger::presentDisplays(const std::vector<int32_t>& hwcIds)
+{
+    for (int32_t hwcId : hwcIds) {
+        mHwc->presentAndGetReleaseFences(hwcId);
+    }
+}
+
+void SurfaceFlinger::distributeReleaseFences(const std::vector<PresentedDisplay>& displays)
+{
+    for (const auto& display : displays) {
+        const sp<DisplayDevice>& displayDevice = display.displayDevice;
+        const auto hwcId = display.hwcId;
         displayDevice->onSwapBuffersCompleted();
         displayDevice->makeCurrent(mEGLDisplay, mEGLContext);
-        for (auto& layer : displayDevice->getVisibleLayersSortedByZ()) {
+        for (auto& layer : display.visibleLayers) {
             // The layer buffer from the previous frame (if any) is released
             // by HWC only when the release fence from this frame (if any) is
             // signaled.  Always get the release fence from HWC first.
@@ -2055,9 +2283,9 @@ void SurfaceFlinger::postFramebuffer()
         // We've got a list of layers needing fences, that are disjoint with
         // displayDevice->getVisibleLayersSortedByZ.  The best we can do is to
         // supply them with the present fence.
-        if (!displayDevice->getLayersNeedingFences().isEmpty()) {
+        if (!display.layersNeedingFences.isEmpty()) {
             sp<Fence> presentFence = mHwc->getPresentFence(hwcId);
-            for (auto& layer : displayDevice->getLayersNeedingFences()) {
+            for (auto& layer : display.layersNeedingFences) {
                 layer->onLayerDisplayed(presentFence);
             }
         }
@@ -2066,15 +2294,6 @@ void SurfaceFlinger::postFramebuffer()
             mHwc->clearReleaseFences(hwcId);
         }
     }
-
-    mLastSwapBufferTime = systemTime() - now;
-    mDebugInSwapBuffers = 0;
-
-    // |mStateLock| not needed as we are on the main thread
-    uint32_t flipCount = getDefaultDisplayDeviceLocked()->getPageFlipCount();
-    if (flipCount % LOG_FRAME_STATS_PERIOD == 0) {
-        logFrameStats();
-    }
 }
 
 void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
@@ -2134,6 +2353,9 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
      */
 
     if (transactionFlags & eDisplayTransactionNeeded) {
+        // displays may be destroyed or reconfigured
+        waitForPresent();
+
         // here we take advantage of Vector's copy-on-write semantics to
         // improve performance by skipping the transaction entirely when
         // know that the lists are identical
@@ -2389,6 +2611,12 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
 
 void SurfaceFlinger::updateCursorAsync()
 {
+    // Cursor positions go through the same HWC command stream as present,
+    // so they are set once the frame being presented is done.
+    if (mPresentPending) {
+        mCursorUpdatePending = true;
+        return;
+    }
     for (size_t displayId = 0; displayId < mDisplays.size(); ++displayId) {
         auto& displayDevice = mDisplays[displayId];
         if (displayDevice->getHwcDisplayId() < 0) {
@@ -2404,6 +2632,10 @@ void SurfaceFlinger::updateCursorAsync()
 void SurfaceFlinger::commitTransaction()
 {
     if (!mLayersPendingRemoval.isEmpty()) {
+        // removing the layers destroys their HWC layers, which the frame
+        // being presented still uses
+        waitForPresent();
+
         // Notify removed layers now that they can't be drawn from
         for (const auto& l : mLayersPendingRemoval) {
             recordBufferingStats(l->getName().string(),
@@ -2418,9 +2650,12 @@ void SurfaceFlinger::commitTransaction()
     mAnimCompositionPending = mAnimTransactionPending;
 
     mDrawingState = mCurrentState;
-    mDrawingState.traverseInZOrder([](Layer* layer) {
+    // commitChildList commits the whole subtree, and walking the tree
+    // while its child lists are being replaced isn't safe
+    for (const auto& layer : mDrawingState.layersSortedByZ) {
         layer->commitChildList();
-    });
+    }
+    mDrawingState.updateTraversalCache();
     mTransactionPending = false;
     mAnimTransactionPending = false;
     mTransactionCV.broadcast();
@@ -2435,21 +2670,118 @@ void SurfaceFlinger::computeVisibleRegions(const sp<const DisplayDevice>& displa
     Region aboveOpaqueLayers;
     Region aboveCoveredLayers;
     Region dirty;
+    int32_t recomputedLayers = 0;
 
     outDirtyRegion.clear();
 
-    mDrawingState.traverseInReverseZOrder([&](Layer* layer) {
+    mDrawingState.traverseLayerStackInReverseZOrder(displayDevice->getLayerStack(),
+            [&](Layer* layer) {
+        const size_t i = layer->snapshotIndex;
+        ALOG_ASSERT(mLayerSnapshot.getLayer(i) == layer, "%s isn't in the layer snapshot",
+                layer->getName().string());
+
+        // only consider the layers on the given layer stack
+        if (!mLayerSnapshot.belongsToDisplay(i, displayDevice->getLayerStack(),
+                    displayDevice->isPrimary()))
+            return;
+
         // start with the whole surface at its current location
         const Layer::State& s(layer->getDrawingState());
+        Layer::VisibleRegionCache& cache(layer->visibleRegionCache);
+
+        // gather everything the layer's own footprint depends on
+        const bool layerVisible = mLayerSnapshot.isVisible(i);
+        const bool translucent = !mLayerSnapshot.isOpaque(i);
+        const bool fullAlpha = mLayerSnapshot.getAlpha(i) == 1.0f;
+        const Rect& bounds(mLayerSnapshot.getScreenBounds(i));
+        const Transform& tr(mLayerSnapshot.getTransform(i));
+
+        const bool geometryChanged = !mUseIncrementalVisibleRegions ||
+                !cache.valid ||
+                cache.visible != layerVisible ||
+                cache.translucent != translucent ||
+                cache.fullAlpha != fullAlpha ||
+                cache.bounds != bounds ||
+                cache.transform != tr ||
+                !cache.activeTransparentRegion.isTriviallyEqual(s.activeTransparentRegion);
+
+        if (geometryChanged) {
+            /*
+             * opaqueRegion: area of a surface that is fully opaque.
+             */
+            Region opaqueRegion;
 
-        // only consider the layers on the given layer stack
-        if (!layer->belongsToDisplay(displayDevice->getLayerStack(), displayDevice->isPrimary()))
+            /*
+             * footprint: the whole surface at its current location, before
+             * removing what is hidden by the layers above it.
+             */
+            Region footprint;
+
+            /*
+             * transparentRegion: area of a surface that is hinted to be completely
+             * transparent. This is only used to tell when the layer has no visible
+             * non-transparent regions and can be removed from the layer list. It
+             * does not affect the visibleRegion of this layer or any layers
+             * beneath it. The hint may not be correct if apps don't respect the
+             * SurfaceView restrictions (which, sadly, some don't).
+             */
+            Region transparentRegion;
+
+            // handle hidden surfaces by setting the visible region to empty
+            if (CC_LIKELY(layerVisible)) {
+                footprint.set(bounds);
+                if (!footprint.isEmpty()) {
+                    // Remove the transparent area from the visible region
+                    if (translucent) {
+                        if (tr.preserveRects()) {
+                            // transform the transparent region
+                            transparentRegion = tr.transform(s.activeTransparentRegion);
+                        } else {
+                            // transformation too complex, can't do the
+                            // transparent region optimization.
+                            transparentRegion.clear();
+                        }
+                    }
+
+                    // compute the opaque region
+                    const int32_t layerOrientation = tr.getOrientation();
+                    if (fullAlpha && !translucent &&
+                            ((layerOrientation & Transform::ROT_INVALID) == false)) {
+                        // the opaque region is the layer's footprint
+                        opaqueRegion = footprint;
+                    }
+                }
+            }
+
+            cache.valid = mUseIncrementalVisibleRegions;
+            cache.geometryGeneration++;
+            cache.visible = layerVisible;
+            cache.translucent = translucent;
+            cache.fullAlpha = fullAlpha;
+            cache.bounds = bounds;
+            cache.transform = tr;
+            cache.activeTransparentRegion = s.activeTransparentRegion;
+            cache.footprint = footprint;
+            cache.opaqueRegion = opaqueRegion;
+            cache.transparentRegion = transparentRegion;
+        } else if (!layer->contentDirty &&
+                cache.aboveOpaqueLayers.hasSameRects(aboveOpaqueLayers) &&
+                cache.aboveCoveredLayers.hasSameRects(aboveCoveredLayers)) {
+            // Neither this layer nor anything covering it changed, so the
+            // visible and covered regions stored in the layer are still
+            // valid. The exposed region computed below would be empty, which
+            // leaves the visible part that is covered by translucent layers.
+            outDirtyRegion.orSelf(layer->visibleRegion.intersect(layer->coveredRegion));
+            aboveCoveredLayers.orSelf(cache.footprint);
+            aboveOpaqueLayers.orSelf(cache.opaqueRegion);
             return;
+        }
 
-        /*
-         * opaqueRegion: area of a surface that is fully opaque.
-         */
-        Region opaqueRegion;
+        recomputedLayers++;
+        if (mUseIncrementalVisibleRegions) {
+            cache.aboveOpaqueLayers = aboveOpaqueLayers;
+            cache.aboveCoveredLayers = aboveCoveredLayers;
+        }
 
         /*
          * visibleRegion: area of a surface that is visible on screen
@@ -2457,7 +2789,7 @@ void SurfaceFlinger::computeVisibleRegions(const sp<const DisplayDevice>& displa
          * footprint minus the opaque regions above it.
          * Areas covered by a translucent surface are considered visible.
          */
-        Region visibleRegion;
+        Region visibleRegion(cache.footprint);
 
         /*
          * coveredRegion: area of a surface that is covered by all
@@ -2465,46 +2797,6 @@ void SurfaceFlinger::computeVisibleRegions(const sp<const DisplayDevice>& displa
          */
         Region coveredRegion;
 
-        /*
-         * transparentRegion: area of a surface that is hinted to be completely
-         * transparent. This is only used to tell when the layer has no visible
-         * non-transparent regions and can be removed from the layer list. It
-         * does not affect the visibleRegion of this layer or any layers
-         * beneath it. The hint may not be correct if apps don't respect the
-         * SurfaceView restrictions (which, sadly, some don't).
-         */
-        Region transparentRegion;
-
-
-        // handle hidden surfaces by setting the visible region to empty
-        if (CC_LIKELY(layer->isVisible())) {
-            const bool translucent = !layer->isOpaque(s);
-            Rect bounds(layer->computeScreenBounds());
-            visibleRegion.set(bounds);
-            Transform tr = layer->getTransform();
-            if (!visibleRegion.isEmpty()) {
-                // Remove the transparent area from the visible region
-                if (translucent) {
-                    if (tr.preserveRects()) {
-                        // transform the transparent region
-                        transparentRegion = tr.transform(s.activeTransparentRegion);
-                    } else {
-                        // transformation too complex, can't do the
-                        // transparent region optimization.
-                        transparentRegion.clear();
-                    }
-                }
-
-                // compute the opaque region
-                const int32_t layerOrientation = tr.getOrientation();
-                if (s.alpha == 1.0f && !translucent &&
-                        ((layerOrientation & Transform::ROT_INVALID) == false)) {
-                    // the opaque region is the layer's footprint
-                    opaqueRegion = visibleRegion;
-                }
-            }
-        }
-
         // Clip the covered region to the visible region
         coveredRegion = aboveCoveredLayers.intersect(visibleRegion);
 
@@ -2546,15 +2838,16 @@ void SurfaceFlinger::computeVisibleRegions(const sp<const DisplayDevice>& displa
         outDirtyRegion.orSelf(dirty);
 
         // Update aboveOpaqueLayers for next (lower) layer
-        aboveOpaqueLayers.orSelf(opaqueRegion);
+        aboveOpaqueLayers.orSelf(cache.opaqueRegion);
 
         // Store the visible region in screen space
         layer->setVisibleRegion(visibleRegion);
         layer->setCoveredRegion(coveredRegion);
         layer->setVisibleNonTransparentRegion(
-                visibleRegion.subtract(transparentRegion));
+                visibleRegion.subtract(cache.transparentRegion));
     });
 
+    ATRACE_INT("VisibleRegionsRecomputed", recomputedLayers);
     outOpaqueRegion = aboveOpaqueLayers;
 }
 
@@ -2586,11 +2879,12 @@ bool SurfaceFlinger::handlePageFlip()
     // 3.) Layer 1 is latched.
     // Display is now waiting on Layer 1's frame, which is behind layer 0's
     // second frame. But layer 0's second frame could be waiting on display.
+    std::vector<sp<Layer>> layersWithQueuedFrames;
     mDrawingState.traverseInZOrder([&](Layer* layer) {
         if (layer->hasQueuedFrame()) {
             frameQueued = true;
             if (layer->shouldPresentNow(mPrimaryDispSync)) {
-                mLayersWithQueuedFrames.push_back(layer);
+                layersWithQueuedFrames.push_back(layer);
             } else {
                 layer->useEmptyDamage();
             }
@@ -2599,6 +2893,20 @@ bool SurfaceFlinger::handlePageFlip()
         }
     });
 
+    if (layersWithQueuedFrames.empty()) {
+        // Nothing to latch, so the frame being presented (if any) can keep
+        // its mLayersWithQueuedFrames.
+        if (frameQueued) {
+            signalLayerUpdate();
+        }
+        return false;
+    }
+
+    // Latching releases the previous buffers, which must have received their
+    // release fences from the last present.
+    waitForPresent();
+    mLayersWithQueuedFrames = std::move(layersWithQueuedFrames);
+
     for (auto& layer : mLayersWithQueuedFrames) {
         const Region dirty(layer->latchBuffer(visibleRegions, latchTime));
         layer->useSurfaceDamage();
@@ -2613,12 +2921,12 @@ bool SurfaceFlinger::handlePageFlip()
     // If we will need to wake up at some time in the future to deal with a
     // queued frame that shouldn't be displayed during this vsync period, wake
     // up during the next vsync period to check again.
-    if (frameQueued && (mLayersWithQueuedFrames.empty() || !newDataLatched)) {
+    if (!newDataLatched) {
         signalLayerUpdate();
     }
 
     // Only continue with the refresh if there is actually new work to do
-    return !mLayersWithQueuedFrames.empty() && newDataLatched;
+    return newDataLatched;
 }
 
 void SurfaceFlinger::invalidateHwcGeometry()
@@ -2661,6 +2969,11 @@ void SurfaceFlinger::doDisplayComposition(
             // This is needed because PARTIAL_UPDATES only takes one
             // rectangle instead of a region (see DisplayDevice::flip())
             dirtyRegion.set(displayDevice->swapRegion.bounds());
+        } else if (mPartialClientComposition) {
+            // we need to redraw what changed since the back buffer was
+            // last drawn, which may be the whole screen
+            dirtyRegion.set(computeClientRepaintRect(displayDevice, dirtyRegion));
+            displayDevice->swapRegion = dirtyRegion;
         } else {
             // we need to redraw everything (the whole screen)
             dirtyRegion.set(displayDevice->bounds());
@@ -2677,6 +2990,39 @@ void SurfaceFlinger::doDisplayComposition(
     displayDevice->swapBuffers(getHwComposer());
 }
 
+Rect SurfaceFlinger::computeClientRepaintRect(
+        const sp<const DisplayDevice>& displayDevice, const Region& dirty)
+{
+    const auto hwcId = displayDevice->getHwcDisplayId();
+    if (hwcId >= 0) {
+        // Where the client target holds a cleared hole or a client layer
+        // depends on how each layer was composed, so a back buffer drawn
+        // with a different composition can't be patched up
+        std::vector<uint64_t> signature;
+        for (auto& layer : displayDevice->getVisibleLayersSortedByZ()) {
+            const uint64_t sequence = static_cast<uint32_t>(layer->sequence);
+            const uint64_t type = static_cast<uint32_t>(layer->getCompositionType(hwcId));
+            signature.push_back((sequence << 32) | (type << 1) |
+                    (layer->getClearClientTarget(hwcId) ? 1 : 0));
+        }
+        displayDevice->setCompositionSignature(std::move(signature));
+
+        if (!mHwc->hasClientComposition(hwcId)) {
+            // nothing is drawn into the client target this frame, remember
+            // what changed for the next frame that is
+            displayDevice->addDamage(dirty);
+            return displayDevice->getBounds();
+        }
+    }
+
+    // the buffer age can only be queried on the current surface
+    if (!displayDevice->makeCurrent(mEGLDisplay, mEGLContext)) {
+        // doComposeSurfaces will bail out, and the frame won't be swapped
+        return displayDevice->getBounds();
+    }
+    return displayDevice->getRepaintRect(dirty);
+}
+
 bool SurfaceFlinger::doComposeSurfaces(
         const sp<const DisplayDevice>& displayDevice, const Region& dirty)
 {
@@ -2714,6 +3060,18 @@ bool SurfaceFlinger::doComposeSurfaces(
             return false;
         }
 
+        // With partial client composition, the back buffer outside of the
+        // dirty region is already up to date and mustn't be touched
+        Rect repaint(displayDevice->getBounds());
+        if (mPartialClientComposition) {
+            repaint.intersect(dirty.getBounds(), &repaint);
+            if (repaint != displayDevice->getBounds()) {
+                const uint32_t height = displayDevice->getHeight();
+                mRenderEngine->setScissor(repaint.left, height - repaint.bottom,
+                        repaint.getWidth(), repaint.getHeight());
+            }
+        }
+
         // Never touch the framebuffer if we don't have any framebuffer layers
         const bool hasDeviceComposition = mHwc->hasDeviceComposition(hwcId);
         if (hasDeviceComposition) {
@@ -2750,7 +3108,8 @@ bool SurfaceFlinger::doComposeSurfaces(
             // scissor on the main display. It should never be needed
             // anyways (though in theory it could since the API allows it).
             const Rect& bounds(displayDevice->getBounds());
-            const Rect& scissor(displayDevice->getScissor());
+            Rect scissor(displayDevice->getScissor());
+            scissor.intersect(repaint, &scissor);
             if (scissor != bounds) {
                 // scissor doesn't match the screen's dimensions, so we
                 // need to clear everything outside of it and enable
@@ -2785,9 +3144,10 @@ bool SurfaceFlinger::doComposeSurfaces(
                     case HWC2::Composition::Device:
                     case HWC2::Composition::Sideband:
                     case HWC2::Composition::SolidColor: {
-                        const Layer::State& state(layer->getDrawingState());
+                        const size_t i = layer->snapshotIndex;
                         if (layer->getClearClientTarget(hwcId) && !firstLayer &&
-                                layer->isOpaque(state) && (state.alpha == 1.0f)
+                                mLayerSnapshot.isOpaque(i) &&
+                                (mLayerSnapshot.getAlpha(i) == 1.0f)
                                 && hasClientComposition) {
                             // never clear the very first layer since we're
                             // guaranteed the FB is already cleared
@@ -2842,6 +3202,10 @@ status_t SurfaceFlinger::addClientLayer(const sp<Client>& client,
     // add this layer to the current state list
     {
         Mutex::Autolock _l(mStateLock);
+        // layers are ordered by z then age, apply the z changes sent earlier
+        if (uint32_t flags = applyQueuedTransactionsLocked()) {
+            setTransactionFlags(flags);
+        }
         if (mNumLayers >= MAX_LAYERS) {
             ALOGE("AddClientLayer failed, mNumLayers (%zu) >= MAX_LAYERS (%zu)", mNumLayers,
                   MAX_LAYERS);
@@ -2930,12 +3294,33 @@ uint32_t SurfaceFlinger::setTransactionFlags(uint32_t flags) {
     return old;
 }
 
+// Returns the Client behind a transaction's ISurfaceComposerClient, or null
+// if it isn't one of ours
+static sp<Client> asLocalClient(const sp<ISurfaceComposerClient>& c) {
+    if (c != NULL) {
+        sp<IBinder> binder = IInterface::asBinder(c);
+        if (binder != NULL &&
+                binder->queryLocalInterface(ISurfaceComposerClient::descriptor) != NULL) {
+            return static_cast<Client*>(c.get());
+        }
+    }
+    return nullptr;
+}
+
 void SurfaceFlinger::setTransactionState(
         const Vector<ComposerState>& state,
         const Vector<DisplayState>& displays,
         uint32_t flags)
 {
     ATRACE_CALL();
+
+    // Asynchronous layer updates don't need mStateLock: they are merged and
+    // applied by the main thread at the next vsync.
+    if (flags == 0 && displays.isEmpty() && !mInterceptor.isEnabled() &&
+            queueTransaction(state)) {
+        return;
+    }
+
     Mutex::Autolock _l(mStateLock);
     uint32_t transactionFlags = 0;
 
@@ -2955,6 +3340,13 @@ void SurfaceFlinger::setTransactionState(
         }
     }
 
+    // queued transactions were sent before this one
+    transactionFlags |= applyQueuedTransactionsLocked();
+    {
+        Mutex::Autolock _l(mQueuedTransactionLock);
+        mTransactionStats.applied++;
+    }
+
     size_t count = displays.size();
     for (size_t i=0 ; i<count ; i++) {
         const DisplayState& s(displays[i]);
@@ -2971,14 +3363,9 @@ void SurfaceFlinger::setTransactionState(
         //
         // NOTE: it would be better to use RTTI as we could directly check
         // that we have a Client*. however, RTTI is disabled in Android.
-        if (s.client != NULL) {
-            sp<IBinder> binder = IInterface::asBinder(s.client);
-            if (binder != NULL) {
-                if (binder->queryLocalInterface(ISurfaceComposerClient::descriptor) != NULL) {
-                    sp<Client> client( static_cast<Client *>(s.client.get()) );
-                    transactionFlags |= setClientStateLocked(client, s.state);
-                }
-            }
+        sp<Client> client(asLocalClient(s.client));
+        if (client != nullptr) {
+            transactionFlags |= setClientStateLocked(client, s.state);
         }
     }
 
@@ -3020,6 +3407,77 @@ void SurfaceFlinger::setTransactionState(
     }
 }
 
+// Layer states that depend on the state of other layers when applied
+static const uint32_t kUnqueueableLayerStates = layer_state_t::eDeferTransaction |
+        layer_state_t::eReparentChildren | layer_state_t::eDetachChildren;
+// Layer states that move the layer in the layer list. To keep the order in
+// which layers get moved, they are only merged into the last queued state.
+static const uint32_t kReorderingLayerStates = layer_state_t::eLayerChanged |
+        layer_state_t::eRelativeLayerChanged | layer_state_t::eLayerStackChanged;
+
+bool SurfaceFlinger::queueTransaction(const Vector<ComposerState>& state) {
+    for (size_t i = 0; i < state.size(); i++) {
+        if (state[i].state.what & kUnqueueableLayerStates) {
+            return false;
+        }
+    }
+
+    Mutex::Autolock _l(mQueuedTransactionLock);
+    const bool wasEmpty = mQueuedLayerStates.empty();
+    for (size_t i = 0; i < state.size(); i++) {
+        const ComposerState& s(state[i]);
+        sp<Client> client(asLocalClient(s.client));
+        if (client == nullptr) {
+            continue;
+        }
+        mTransactionStats.queuedStates++;
+
+        auto index = mQueuedLayerStateIndex.find(s.state.surface.get());
+        if (index != mQueuedLayerStateIndex.end()) {
+            QueuedLayerState& queued(mQueuedLayerStates[index->second]);
+            const bool isLast = index->second + 1 == mQueuedLayerStates.size();
+            const uint32_t resizeFlags = (queued.state.what ^ s.state.what) &
+                    layer_state_t::eGeometryAppliesWithResize;
+            if (queued.client == client && resizeFlags == 0 &&
+                    (isLast || !(s.state.what & kReorderingLayerStates))) {
+                queued.state.merge(s.state);
+                mTransactionStats.coalescedStates++;
+                continue;
+            }
+        }
+        mQueuedLayerStateIndex[s.state.surface.get()] = mQueuedLayerStates.size();
+        mQueuedLayerStates.push_back({client, s.state});
+    }
+    mTransactionStats.queued++;
+
+    // everything queued until the main thread runs is applied at once, so
+    // it only needs to be woken up once
+    if (wasEmpty && !mQueuedLayerStates.empty()) {
+        signalTransaction();
+    }
+    return true;
+}
+
+uint32_t SurfaceFlinger::applyQueuedTransactionsLocked() {
+    std::vector<QueuedLayerState> queued;
+    {
+        Mutex::Autolock _l(mQueuedTransactionLock);
+        if (mQueuedLayerStates.empty()) {
+            return 0;
+        }
+        queued.swap(mQueuedLayerStates);
+        mQueuedLayerStateIndex.clear();
+        mTransactionStats.flushes++;
+    }
+
+    ATRACE_INT("QueuedLayerStates", static_cast<int32_t>(queued.size()));
+    uint32_t transactionFlags = 0;
+    for (const auto& s : queued) {
+        transactionFlags |= setClientStateLocked(s.client, s.state);
+    }
+    return transactionFlags;
+}
+
 uint32_t SurfaceFlinger::setDisplayStateLocked(const DisplayState& s)
 {
     ssize_t dpyIdx = mCurrentState.displays.indexOfKey(s.token);
@@ -3383,6 +3841,7 @@ void SurfaceFlinger::setPowerModeInternal(const sp<DisplayDevice>& hw,
              int mode, bool stateLockHeld) {
     ALOGD("Set power mode=%d, type=%d flinger=%p", mode, hw->getDisplayType(),
             this);
+    waitForPresent();
     int32_t type = hw->getDisplayType();
     int currentMode = hw->getPowerMode();
 
@@ -3543,6 +4002,13 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
                 dumpAll = false;
             }
 
+            if ((index < numArgs) &&
+                    (args[index] == String16("--latency-histograms"))) {
+                index++;
+                dumpLatencyHistogramsLocked(args, index, result);
+                dumpAll = false;
+            }
+
             if ((index < numArgs) &&
                     (args[index] == String16("--dispsync"))) {
                 index++;
@@ -3633,6 +4099,33 @@ void SurfaceFlinger::clearStatsLocked(const Vector<String16>& args, size_t& inde
     mAnimFrameTracker.clearStats();
 }
 
+// Dumps the latency histograms of the window animations and of every layer,
+// or of the layers with the given name, in the compact binary form described
+// in LatencyHistogram.cpp, meant to be collected from many devices.
+void SurfaceFlinger::dumpLatencyHistogramsLocked(const Vector<String16>& args,
+        size_t& index, String8& result) const
+{
+    String8 name;
+    if (index < args.size()) {
+        name = String8(args[index]);
+        index++;
+    }
+
+    LatencyHistogramDump dump;
+    if (name.isEmpty()) {
+        mAnimFrameTracker.dumpHistograms(dump.addEntry(String8("<win-anim>")));
+    }
+    mCurrentState.traverseInZOrder([&](Layer* layer) {
+        if (name.isEmpty() || name == layer->getName()) {
+            layer->dumpFrameHistograms(dump.addEntry(layer->getName()));
+        }
+    });
+
+    const auto& activeConfig = mHwc->getActiveConfig(HWC_DISPLAY_PRIMARY);
+    const nsecs_t period = activeConfig->getVsyncPeriod();
+    dump.write(period, result);
+}
+
 // This should only be called from the main thread.  Otherwise it would need
 // the lock and should use mCurrentState rather than mDrawingState.
 void SurfaceFlinger::logFrameStats() {
@@ -3739,6 +4232,16 @@ void SurfaceFlinger::dumpBufferingStats(String8& result) const {
     result.append("\n");
 }
 
+void SurfaceFlinger::dumpTransactionStats(String8& result) const {
+    Mutex::Autolock _l(mQueuedTransactionLock);
+    const TransactionStats& stats(mTransactionStats);
+    result.append("Transaction stats:\n");
+    result.appendFormat("  applied on arrival: %" PRIu64 ", queued: %" PRIu64
+            ", queue flushes: %" PRIu64 "\n", stats.applied, stats.queued, stats.flushes);
+    result.appendFormat("  queued layer states: %" PRIu64 ", coalesced: %" PRIu64 "\n",
+            stats.queuedStates, stats.coalescedStates);
+}
+
 void SurfaceFlinger::dumpWideColorInfo(String8& result) const {
     result.appendFormat("hasWideColorDisplay: %d\n", hasWideColorDisplay);
     result.appendFormat("forceNativeColorMode: %d\n", mForceNativeColorMode);
@@ -3823,6 +4326,9 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
 
     dumpBufferingStats(result);
 
+    dumpTransactionStats(result);
+    result.append("\n");
+
     /*
      * Dump the visible layer list
      */
@@ -3909,12 +4415,21 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
 
         result.appendFormat("Display %d HWC layers:\n", hwcId);
         Layer::miniDumpHeader(result);
+        HWComposerBufferCache::Stats bufferCacheStats;
         mCurrentState.traverseInZOrder([&](Layer* layer) {
             layer->miniDump(result, hwcId);
+            layer->addHwcBufferCacheStats(hwcId, &bufferCacheStats);
         });
+        result.appendFormat("HWC buffer cache (current layers, %u slots per layer): "
+                "%" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions\n",
+                HWComposerBufferCache::getSlotBudget(), bufferCacheStats.hits,
+                bufferCacheStats.misses, bufferCacheStats.evictions);
         result.append("\n");
     }
 
+    result.appendFormat("Screenshot image cache: %zu hits, %zu misses\n\n",
+            mScreenshotImageCache.getHitCount(), mScreenshotImageCache.getMissCount());
+
     /*
      * Dump HWComposer state
      */
@@ -4394,55 +4909,72 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
         return result;
     }
 
-    // This mutex protects syncFd and captureResult for communication of the return values from the
-    // main thread back to this Binder thread
+    // This mutex protects syncFd, sync and captureResult for communication of the return values
+    // from the main thread back to this Binder thread
     std::mutex captureMutex;
     std::condition_variable captureCondition;
     std::unique_lock<std::mutex> captureLock(captureMutex);
     int syncFd = -1;
+    EGLSyncKHR sync = EGL_NO_SYNC_KHR;
     std::optional<status_t> captureResult;
 
-    sp<LambdaMessage> message = new LambdaMessage([&]() {
-        // If there is a refresh pending, bug out early and tell the binder thread to try again
-        // after the refresh.
-        if (mRefreshPending) {
-            ATRACE_NAME("Skipping screenshot for now");
-            std::unique_lock<std::mutex> captureLock(captureMutex);
-            captureResult = std::make_optional<status_t>(EAGAIN);
-            captureCondition.notify_one();
-            return;
-        }
-
+    sp<LambdaMessage> capture = new LambdaMessage([&]() {
         status_t result = NO_ERROR;
         int fd = -1;
+        EGLSyncKHR s = EGL_NO_SYNC_KHR;
         {
             Mutex::Autolock _l(mStateLock);
             sp<const DisplayDevice> device(getDisplayDeviceLocked(display));
             result = captureScreenImplLocked(device, buffer, sourceCrop, reqWidth, reqHeight,
                                              minLayerZ, maxLayerZ, useIdentityTransform,
-                                             rotationFlags, isLocalScreenshot, &fd);
+                                             rotationFlags, isLocalScreenshot, &fd, &s);
         }
 
         {
             std::unique_lock<std::mutex> captureLock(captureMutex);
             syncFd = fd;
+            sync = s;
             captureResult = std::make_optional<status_t>(result);
             captureCondition.notify_one();
         }
     });
 
-    result = postMessageAsync(message);
-    if (result == NO_ERROR) {
-        captureCondition.wait(captureLock, [&]() { return captureResult; });
-        while (*captureResult == EAGAIN) {
-            captureResult.reset();
-            result = postMessageAsync(message);
-            if (result != NO_ERROR) {
-                return result;
-            }
-            captureCondition.wait(captureLock, [&]() { return captureResult; });
+    // Captures are run by the main thread right after the next refresh, so
+    // that they never delay one. If there's no refresh pending, the message
+    // runs them right away.
+    {
+        Mutex::Autolock _l(mCaptureLock);
+        mPendingCaptures.push_back(capture);
+    }
+    result = postMessageAsync(new LambdaMessage([this]() {
+        if (!mRefreshPending) {
+            runPendingCaptures();
+        }
+    }));
+    if (result != NO_ERROR) {
+        Mutex::Autolock _l(mCaptureLock);
+        auto pending = std::find(mPendingCaptures.begin(), mPendingCaptures.end(), capture);
+        if (pending != mPendingCaptures.end()) {
+            mPendingCaptures.erase(pending);
+            return result;
         }
-        result = *captureResult;
+        // the main thread already took it
+    }
+    captureCondition.wait(captureLock, [&]() { return captureResult; });
+    result = *captureResult;
+
+    if (sync != EGL_NO_SYNC_KHR) {
+        // Without native fences the rendering must be waited for here, the
+        // main thread doesn't
+        EGLint waitResult = eglClientWaitSyncKHR(mEGLDisplay, sync, 0, 2000000000 /*2 sec*/);
+        EGLint eglErr = eglGetError();
+        if (waitResult == EGL_TIMEOUT_EXPIRED_KHR) {
+            ALOGW("captureScreen: fence wait timed out");
+        } else {
+            ALOGW_IF(eglErr != EGL_SUCCESS,
+                    "captureScreen: error waiting on EGL fence: %#x", eglErr);
+        }
+        eglDestroySyncKHR(mEGLDisplay, sync);
     }
 
     if (result == NO_ERROR) {
@@ -4453,6 +4985,34 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
     return result;
 }
 
+void SurfaceFlinger::runPendingCaptures() {
+    std::vector<sp<LambdaMessage>> captures;
+    {
+        Mutex::Autolock _l(mCaptureLock);
+        captures.swap(mPendingCaptures);
+    }
+    if (captures.empty()) {
+        return;
+    }
+    ATRACE_CALL();
+    for (const auto& capture : captures) {
+        capture->handler();
+    }
+    scheduleScreenshotImageCleanup();
+}
+
+void SurfaceFlinger::scheduleScreenshotImageCleanup() {
+    if (mScreenshotImageCleanupPending || mScreenshotImageCache.isEmpty()) {
+        return;
+    }
+    mScreenshotImageCleanupPending = true;
+    postMessageAsync(new LambdaMessage([this]() {
+        mScreenshotImageCleanupPending = false;
+        mScreenshotImageCache.releaseIdle(systemTime(SYSTEM_TIME_MONOTONIC));
+        scheduleScreenshotImageCleanup();
+    }), ScreenshotImageCache::IDLE_TIMEOUT);
+}
+
 
 void SurfaceFlinger::renderScreenImplLocked(
         const sp<const DisplayDevice>& hw,
@@ -4530,33 +5090,14 @@ void SurfaceFlinger::renderScreenImplLocked(
     hw->setViewportAndProjection();
 }
 
-// A simple RAII class that holds an EGLImage and destroys it either:
-//   a) When the destroy() method is called
-//   b) When the object goes out of scope
-class ImageHolder {
-public:
-    ImageHolder(EGLDisplay display, EGLImageKHR image) : mDisplay(display), mImage(image) {}
-    ~ImageHolder() { destroy(); }
-
-    void destroy() {
-        if (mImage != EGL_NO_IMAGE_KHR) {
-            eglDestroyImageKHR(mDisplay, mImage);
-            mImage = EGL_NO_IMAGE_KHR;
-        }
-    }
-
-private:
-    const EGLDisplay mDisplay;
-    EGLImageKHR mImage;
-};
-
 status_t SurfaceFlinger::captureScreenImplLocked(const sp<const DisplayDevice>& hw,
                                                  ANativeWindowBuffer* buffer, Rect sourceCrop,
                                                  uint32_t reqWidth, uint32_t reqHeight,
                                                  int32_t minLayerZ, int32_t maxLayerZ,
                                                  bool useIdentityTransform,
                                                  Transform::orientation_flags rotation,
-                                                 bool isLocalScreenshot, int* outSyncFd) {
+                                                 bool isLocalScreenshot, int* outSyncFd,
+                                                 EGLSyncKHR* outSync) {
     ATRACE_CALL();
 
     bool secureLayerIsVisible = false;
@@ -4578,17 +5119,14 @@ status_t SurfaceFlinger::captureScreenImplLocked(const sp<const DisplayDevice>&
     }
 
     int syncFd = -1;
-    // create an EGLImage from the buffer so we can later
+    // get an EGLImage of the buffer so we can later
     // turn it into a texture
-    EGLImageKHR image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
-            EGL_NATIVE_BUFFER_ANDROID, buffer, NULL);
+    EGLImageKHR image = mScreenshotImageCache.getImage(mEGLDisplay, buffer,
+            systemTime(SYSTEM_TIME_MONOTONIC));
     if (image == EGL_NO_IMAGE_KHR) {
         return BAD_VALUE;
     }
 
-    // This will automatically destroy the image if we return before calling its destroy method
-    ImageHolder imageHolder(mEGLDisplay, image);
-
     // this binds the given EGLImage as a framebuffer for the
     // duration of this scope.
     RenderEngine::BindImageAsFramebuffer imageBond(getRenderEngine(), image);
@@ -4606,8 +5144,8 @@ status_t SurfaceFlinger::captureScreenImplLocked(const sp<const DisplayDevice>&
         useIdentityTransform, rotation);
 
     // Attempt to create a sync khr object that can produce a sync point. If that
-    // isn't available, create a non-dupable sync object in the fallback path and
-    // wait on it directly.
+    // isn't available, create a non-dupable sync object in the fallback path for
+    // the caller to wait on.
     EGLSyncKHR sync = EGL_NO_SYNC_KHR;
     if (!DEBUG_SCREENSHOTS) {
        sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
@@ -4623,25 +5161,16 @@ status_t SurfaceFlinger::captureScreenImplLocked(const sp<const DisplayDevice>&
             syncFd = -1;
         }
         eglDestroySyncKHR(mEGLDisplay, sync);
+        sync = EGL_NO_SYNC_KHR;
     } else {
-        // fallback path
+        // fallback path, the caller waits on the sync object
         sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_FENCE_KHR, NULL);
-        if (sync != EGL_NO_SYNC_KHR) {
-            EGLint result = eglClientWaitSyncKHR(mEGLDisplay, sync,
-                EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 2000000000 /*2 sec*/);
-            EGLint eglErr = eglGetError();
-            if (result == EGL_TIMEOUT_EXPIRED_KHR) {
-                ALOGW("captureScreen: fence wait timed out");
-            } else {
-                ALOGW_IF(eglErr != EGL_SUCCESS,
-                        "captureScreen: error waiting on EGL fence: %#x", eglErr);
-            }
-            eglDestroySyncKHR(mEGLDisplay, sync);
-        } else {
-            ALOGW("captureScreen: error creating EGL fence: %#x", eglGetError());
-        }
+        getRenderEngine().flush();
+        ALOGW_IF(sync == EGL_NO_SYNC_KHR,
+                "captureScreen: error creating EGL fence: %#x", eglGetError());
     }
     *outSyncFd = syncFd;
+    *outSync = sync;
 
     if (DEBUG_SCREENSHOTS) {
         uint32_t* pixels = new uint32_t[reqWidth*reqHeight];
@@ -4651,9 +5180,6 @@ status_t SurfaceFlinger::captureScreenImplLocked(const sp<const DisplayDevice>&
         delete [] pixels;
     }
 
-    // destroy our image
-    imageHolder.destroy();
-
     return NO_ERROR;
 }
 
@@ -4690,13 +5216,65 @@ void SurfaceFlinger::checkScreenshot(size_t w, size_t s, size_t h, void const* v
 // ---------------------------------------------------------------------------
 
 void SurfaceFlinger::State::traverseInZOrder(const LayerVector::Visitor& visitor) const {
+    if (mTraversalCacheValid) {
+        for (Layer* layer : mTraversalCache) {
+            visitor(layer);
+        }
+        return;
+    }
     layersSortedByZ.traverseInZOrder(stateSet, visitor);
 }
 
 void SurfaceFlinger::State::traverseInReverseZOrder(const LayerVector::Visitor& visitor) const {
+    if (mTraversalCacheValid) {
+        for (auto i = mTraversalCache.rbegin(); i != mTraversalCache.rend(); ++i) {
+            visitor(*i);
+        }
+        return;
+    }
     layersSortedByZ.traverseInReverseZOrder(stateSet, visitor);
 }
 
+void SurfaceFlinger::State::traverseLayerStackInReverseZOrder(uint32_t layerStack,
+        const LayerVector::Visitor& visitor) const {
+    if (!mTraversalCacheValid || !mLayerStacksContiguous) {
+        traverseInReverseZOrder(visitor);
+        return;
+    }
+    const auto range = mLayerStackRanges.find(layerStack);
+    if (range == mLayerStackRanges.end()) {
+        return;
+    }
+    for (size_t i = range->second.second; i > range->second.first; i--) {
+        visitor(mTraversalCache[i - 1]);
+    }
+}
+
+void SurfaceFlinger::State::updateTraversalCache() {
+    mTraversalCache.clear();
+    layersSortedByZ.traverseInZOrder(stateSet, [this](Layer* layer) {
+        mTraversalCache.push_back(layer);
+    });
+
+    // Root layers are sorted by layer stack, but a layer can be drawn
+    // relative to a layer of another stack
+    mLayerStackRanges.clear();
+    mLayerStacksContiguous = true;
+    for (size_t i = 0; i < mTraversalCache.size(); i++) {
+        const uint32_t layerStack = mTraversalCache[i]->getLayerStack();
+        auto range = mLayerStackRanges.find(layerStack);
+        if (range == mLayerStackRanges.end()) {
+            mLayerStackRanges.emplace(layerStack, std::make_pair(i, i + 1));
+        } else if (range->second.second == i) {
+            range->second.second = i + 1;
+        } else {
+            mLayerStacksContiguous = false;
+            break;
+        }
+    }
+    mTraversalCacheValid = true;
+}
+
 }; // namespace android
 
 
@@ -55,6 +55,8 @@
 #include "DisplayDevice.h"
 #include "DispSync.h"
 #include "FrameTracker.h"
+#include "LayerSnapshot.h"
+#include "ScreenshotImageCache.h"
 #include "LayerVector.h"
 #include "MessageQueue.h"
 #include "SurfaceInterceptor.h"
@@ -74,7 +76,9 @@
 #include <queue>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace android {
 
@@ -88,6 +92,8 @@ class LayerDim;
 class Surface;
 class RenderEngine;
 class EventControlThread;
+class PresentThread;
+class DisplayWorkerPool;
 class VSyncSource;
 class InjectVSyncSource;
 
@@ -258,6 +264,7 @@ private:
             // always uses the Drawing StateSet.
             layersSortedByZ = other.layersSortedByZ;
             displays = other.displays;
+            mTraversalCacheValid = false;
             return *this;
         }
 
@@ -267,6 +274,26 @@ private:
 
         void traverseInZOrder(const LayerVector::Visitor& visitor) const;
         void traverseInReverseZOrder(const LayerVector::Visitor& visitor) const;
+
+        // Like traverseInReverseZOrder, but may skip the layers that are not
+        // on layerStack. The visitor still has to check.
+        void traverseLayerStackInReverseZOrder(uint32_t layerStack,
+                const LayerVector::Visitor& visitor) const;
+
+        // Flattens the layer tree in Z order, so that the traversals above
+        // walk an array instead of rebuilding and re-sorting the child and
+        // relative lists of every layer. The tree must not change until the
+        // state is assigned again, which drops the cache; this holds for
+        // mDrawingState between two commitTransaction() calls.
+        void updateTraversalCache();
+
+    private:
+        std::vector<Layer*> mTraversalCache;
+        // [begin, end) of each layer stack in mTraversalCache, only used
+        // when every layer stack is contiguous
+        std::unordered_map<uint32_t, std::pair<size_t, size_t>> mLayerStackRanges;
+        bool mLayerStacksContiguous = false;
+        bool mTraversalCacheValid = false;
     };
 
     /* ------------------------------------------------------------------------
@@ -400,6 +427,15 @@ private:
     void commitTransaction();
     uint32_t setClientStateLocked(const sp<Client>& client, const layer_state_t& s);
     uint32_t setDisplayStateLocked(const DisplayState& s);
+#ifdef USE_HWC2
+    // Queues the layer states of an asynchronous transaction for the main
+    // thread, merged with the states already queued for the same layers.
+    // Returns false if the transaction has to be applied right away.
+    bool queueTransaction(const Vector<ComposerState>& state);
+    // Applies the queued layer states and returns the transaction flags
+    // they need
+    uint32_t applyQueuedTransactionsLocked();
+#endif
 
     /* ------------------------------------------------------------------------
      * Layer management
@@ -462,7 +498,12 @@ private:
                                      uint32_t reqWidth, uint32_t reqHeight, int32_t minLayerZ,
                                      int32_t maxLayerZ, bool useIdentityTransform,
                                      Transform::orientation_flags rotation, bool isLocalScreenshot,
-                                     int* outSyncFd);
+                                     int* outSyncFd, EGLSyncKHR* outSync);
+
+    // Runs the screen captures queued by captureScreen, on the main thread
+    void runPendingCaptures();
+    // Releases the screenshot images that have been idle for a while
+    void scheduleScreenshotImageCleanup();
 #else
     status_t captureScreenImplLocked(
             const sp<const DisplayDevice>& hw,
@@ -562,6 +603,23 @@ private:
             nsecs_t vsyncPhase, nsecs_t vsyncInterval,
             nsecs_t compositeToPresentLatency);
     void rebuildLayerStacks();
+#ifdef USE_HWC2
+    // Fills mLayerSnapshot from the drawing state, once per frame before
+    // rebuildLayerStacks()
+    void updateLayerSnapshot();
+    // What rebuildLayerStacks() computes for one display
+    struct VisibleLayers {
+        Region opaqueRegion;
+        Region dirtyRegion;
+        Vector<sp<Layer>> layersSortedByZ;
+        // Layers that must not have an HWC layer on the display
+        std::vector<Layer*> hiddenLayers;
+    };
+    // Computes the visible regions and layers of displayDevice. Doesn't
+    // touch HWC, so it may run on mDisplayWorkerPool.
+    void computeVisibleLayers(const sp<const DisplayDevice>& displayDevice,
+            VisibleLayers& outVisibleLayers);
+#endif
 
     // Given a dataSpace, returns the appropriate color_mode to use
     // to display that dataSpace.
@@ -574,12 +632,47 @@ private:
     void doComposition();
     void doDebugFlashRegions();
     void doDisplayComposition(const sp<const DisplayDevice>& displayDevice, const Region& dirtyRegion);
+#ifdef USE_HWC2
+    // Returns the part of the client target doDisplayComposition must redraw
+    // for dirty to be up to date, with partial client composition
+    Rect computeClientRepaintRect(const sp<const DisplayDevice>& displayDevice,
+            const Region& dirty);
+#endif
 
     // compose surfaces for display hw. this fails if using GL and the surface
     // has been destroyed and is no longer valid.
     bool doComposeSurfaces(const sp<const DisplayDevice>& displayDevice, const Region& dirty);
 
     void postFramebuffer();
+#ifdef USE_HWC2
+    // What distributing the release fences of a display needs from a frame,
+    // captured when the frame is presented. The layer lists are the ones the
+    // frame was composed with, even if the display is recomposed meanwhile.
+    struct PresentedDisplay {
+        sp<DisplayDevice> displayDevice;
+        int32_t hwcId;
+        Vector< sp<Layer> > visibleLayers;
+        Vector< sp<Layer> > layersNeedingFences;
+    };
+    std::vector<PresentedDisplay> capturePresentedDisplays() const;
+    static std::vector<int32_t> getPresentedHwcIds(
+            const std::vector<PresentedDisplay>& displays);
+    // HWC present of the given displays. This is all mPresentThread does, so
+    // it must not touch anything but HWC.
+    void presentDisplays(const std::vector<int32_t>& hwcIds);
+    // Hands the release fences of the last present to the layers and
+    // display surfaces. Main thread only.
+    void distributeReleaseFences(const std::vector<PresentedDisplay>& displays);
+    // Post-present bookkeeping of the frame started at refreshStartTime
+    void finishFrame(nsecs_t refreshStartTime);
+    // Waits for the frame handed to mPresentThread, if any, and finishes
+    // it. Must be called on the main thread before anything that needs the
+    // release fences of that frame or changes the HWC state it presents.
+    void waitForPresent();
+    // Saves the shader programs generated at runtime from a later message,
+    // instead of during the frame that generated them
+    void scheduleProgramCacheSave();
+#endif
     void drawWormhole(const sp<const DisplayDevice>& displayDevice, const Region& region) const;
 
     /* ------------------------------------------------------------------------
@@ -604,6 +697,8 @@ private:
     void listLayersLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     void dumpStatsLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     void clearStatsLocked(const Vector<String16>& args, size_t& index, String8& result);
+    void dumpLatencyHistogramsLocked(const Vector<String16>& args, size_t& index,
+            String8& result) const;
     void dumpAllLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     bool startDdmConnection();
     void appendSfConfigString(String8& result) const;
@@ -621,6 +716,9 @@ private:
             std::vector<OccupancyTracker::Segment>&& history);
     void dumpBufferingStats(String8& result) const;
     void dumpWideColorInfo(String8& result) const;
+#ifdef USE_HWC2
+    void dumpTransactionStats(String8& result) const;
+#endif
 
     bool isLayerTripleBufferingDisabled() const {
         return this->mLayerTripleBufferingDisabled;
@@ -653,6 +751,26 @@ private:
     SortedVector< sp<Layer> > mLayersPendingRemoval;
     SortedVector< wp<IBinder> > mGraphicBufferProducerList;
 
+#ifdef USE_HWC2
+    // Layer states of asynchronous transactions waiting for the main thread.
+    // When mStateLock is needed too, it must be taken first.
+    struct QueuedLayerState {
+        sp<Client> client;
+        layer_state_t state;
+    };
+    mutable Mutex mQueuedTransactionLock;
+    std::vector<QueuedLayerState> mQueuedLayerStates;
+    // index of the last state queued for each surface
+    std::unordered_map<IBinder*, size_t> mQueuedLayerStateIndex;
+    struct TransactionStats {
+        uint64_t applied = 0;           // transactions applied on arrival
+        uint64_t queued = 0;            // transactions queued for the main thread
+        uint64_t queuedStates = 0;      // layer states in queued transactions
+        uint64_t coalescedStates = 0;   // ... merged into an already queued state
+        uint64_t flushes = 0;           // times the queued states were applied
+    } mTransactionStats;
+#endif
+
     // protected by mStateLock (but we could use another lock)
     bool mLayersRemoved;
     bool mLayersAdded;
@@ -730,6 +848,37 @@ private:
     bool mForceFullDamage;
 #ifdef USE_HWC2
     bool mPropagateBackpressure = true;
+    // Only recompute visible regions of layers whose geometry or coverage
+    // changed; see Layer::VisibleRegionCache.
+    bool mUseIncrementalVisibleRegions = true;
+    // Only redraw the part of the client target that changed since its
+    // back buffer was last drawn, see DisplayDevice::getRepaintRect. Off
+    // unless debug.sf.enable_partial_client_composition is set.
+    bool mPartialClientComposition = false;
+    // When set, HWC present and release fences are done on this thread
+    // while the main thread returns to its message queue.
+    sp<PresentThread> mPresentThread;
+    bool mPresentPending = false;
+    nsecs_t mPendingRefreshStartTime = 0;
+#ifdef USE_HWC2
+    // The frame handed to mPresentThread, finished by waitForPresent()
+    std::vector<PresentedDisplay> mPresentedDisplays;
+    bool mPresentedAnimComposition = false;
+    bool mCursorUpdatePending = false;
+    // Written by mPresentThread, read once waitForPresent() has waited for it
+    nsecs_t mPresentDuration = 0;
+#endif
+    // When set, the visible layers of displays showing different layer
+    // stacks are computed in parallel on these threads.
+    sp<DisplayWorkerPool> mDisplayWorkerPool;
+    // Read by computeVisibleRegions, setUpHWComposer and doComposeSurfaces
+    LayerSnapshot mLayerSnapshot;
+    // Screen captures waiting for the main thread, see captureScreen
+    Mutex mCaptureLock;
+    std::vector<sp<LambdaMessage>> mPendingCaptures;
+    ScreenshotImageCache mScreenshotImageCache;
+    bool mScreenshotImageCleanupPending = false;
+    bool mProgramCacheSavePending = false;
 #endif
     SurfaceInterceptor mInterceptor;
     bool mUseHwcVirtualDisplays = false;
@@ -435,6 +435,10 @@ public:
         mCallback = callback;
     }
 
+    virtual nsecs_t getPeriod() {
+        return mDispSync->getPeriod();
+    }
+
     virtual void setPhaseOffset(nsecs_t phaseOffset) {
         Mutex::Autolock lock(mVsyncMutex);
 
@@ -524,6 +528,7 @@ public:
 
     virtual void setVSyncEnabled(bool) {}
     virtual void setPhaseOffset(nsecs_t) {}
+    virtual nsecs_t getPeriod() { return 0; }
 
 private:
     std::mutex mCallbackMutex; // Protects the following
@@ -1953,9 +1958,12 @@ void SurfaceFlinger::commitTransaction()
     mAnimCompositionPending = mAnimTransactionPending;
 
     mDrawingState = mCurrentState;
-    mDrawingState.traverseInZOrder([](Layer* layer) {
+    // commitChildList commits the whole subtree, and walking the tree
+    // while its child lists are being replaced isn't safe
+    for (const auto& layer : mDrawingState.layersSortedByZ) {
         layer->commitChildList();
-    });
+    }
+    mDrawingState.updateTraversalCache();
     mTransactionPending = false;
     mAnimTransactionPending = false;
     mTransactionCV.broadcast();
@@ -3042,6 +3050,13 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
                 dumpAll = false;
             }
 
+            if ((index < numArgs) &&
+                    (args[index] == String16("--latency-histograms"))) {
+                index++;
+                dumpLatencyHistogramsLocked(args, index, result);
+                dumpAll = false;
+            }
+
             if ((index < numArgs) &&
                     (args[index] == String16("--dispsync"))) {
                 index++;
@@ -3126,6 +3141,33 @@ void SurfaceFlinger::clearStatsLocked(const Vector<String16>& args, size_t& inde
     mAnimFrameTracker.clearStats();
 }
 
+// Dumps the latency histograms of the window animations and of every layer,
+// or of the layers with the given name, in the compact binary form described
+// in LatencyHistogram.cpp, meant to be collected from many devices.
+void SurfaceFlinger::dumpLatencyHistogramsLocked(const Vector<String16>& args,
+        size_t& index, String8& result) const
+{
+    String8 name;
+    if (index < args.size()) {
+        name = String8(args[index]);
+        index++;
+    }
+
+    LatencyHistogramDump dump;
+    if (name.isEmpty()) {
+        mAnimFrameTracker.dumpHistograms(dump.addEntry(String8("<win-anim>")));
+    }
+    mCurrentState.traverseInZOrder([&](Layer* layer) {
+        if (name.isEmpty() || name == layer->getName()) {
+            layer->dumpFrameHistograms(dump.addEntry(layer->getName()));
+        }
+    });
+
+    const nsecs_t period =
+            getHwComposer().getRefreshPeriod(HWC_DISPLAY_PRIMARY);
+    dump.write(period, result);
+}
+
 // This should only be called from the main thread.  Otherwise it would need
 // the lock and should use mCurrentState rather than mDrawingState.
 void SurfaceFlinger::logFrameStats() {
@@ -4117,13 +4159,65 @@ void SurfaceFlinger::checkScreenshot(size_t w, size_t s, size_t h, void const* v
 // ---------------------------------------------------------------------------
 
 void SurfaceFlinger::State::traverseInZOrder(const LayerVector::Visitor& visitor) const {
+    if (mTraversalCacheValid) {
+        for (Layer* layer : mTraversalCache) {
+            visitor(layer);
+        }
+        return;
+    }
     layersSortedByZ.traverseInZOrder(stateSet, visitor);
 }
 
 void SurfaceFlinger::State::traverseInReverseZOrder(const LayerVector::Visitor& visitor) const {
+    if (mTraversalCacheValid) {
+        for (auto i = mTraversalCache.rbegin(); i != mTraversalCache.rend(); ++i) {
+            visitor(*i);
+        }
+        return;
+    }
     layersSortedByZ.traverseInReverseZOrder(stateSet, visitor);
 }
 
+void SurfaceFlinger::State::traverseLayerStackInReverseZOrder(uint32_t layerStack,
+        const LayerVector::Visitor& visitor) const {
+    if (!mTraversalCacheValid || !mLayerStacksContiguous) {
+        traverseInReverseZOrder(visitor);
+        return;
+    }
+    const auto range = mLayerStackRanges.find(layerStack);
+    if (range == mLayerStackRanges.end()) {
+        return;
+    }
+    for (size_t i = range->second.second; i > range->second.first; i--) {
+        visitor(mTraversalCache[i - 1]);
+    }
+}
+
+void SurfaceFlinger::State::updateTraversalCache() {
+    mTraversalCache.clear();
+    layersSortedByZ.traverseInZOrder(stateSet, [this](Layer* layer) {
+        mTraversalCache.push_back(layer);
+    });
+
+    // Root layers are sorted by layer stack, but a layer can be drawn
+    // relative to a layer of another stack
+    mLayerStackRanges.clear();
+    mLayerStacksContiguous = true;
+    for (size_t i = 0; i < mTraversalCache.size(); i++) {
+        const uint32_t layerStack = mTraversalCache[i]->getLayerStack();
+        auto range = mLayerStackRanges.find(layerStack);
+        if (range == mLayerStackRanges.end()) {
+            mLayerStackRanges.emplace(layerStack, std::make_pair(i, i + 1));
+        } else if (range->second.second == i) {
+            range->second.second = i + 1;
+        } else {
+            mLayerStacksContiguous = false;
+            break;
+        }
+    }
+    mTraversalCacheValid = true;
+}
+
 }; // namespace android
 
 
@@ -21,21 +21,45 @@
 #include "SurfaceFlinger.h"
 #include "SurfaceInterceptor.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <deque>
 #include <fstream>
 
 #include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <cutils/properties.h>
 #include <log/log.h>
 #include <utils/Trace.h>
+#include <zlib.h>
 
 namespace android {
 
 // ----------------------------------------------------------------------------
 
+// The writer thread wakes up this often, or as soon as this many increments
+// are waiting, to turn the increments into a chunk
+constexpr auto WRITER_FLUSH_INTERVAL = std::chrono::milliseconds(500);
+constexpr int WRITER_FLUSH_INCREMENTS = 1024;
+
 SurfaceInterceptor::SurfaceInterceptor(SurfaceFlinger* flinger)
     :   mFlinger(flinger)
 {
 }
 
+SurfaceInterceptor::~SurfaceInterceptor() {
+    {
+        std::lock_guard<std::mutex> protoGuard(mTraceMutex);
+        mWriterExit = true;
+        mWriterCondition.notify_one();
+    }
+    joinWriter();
+}
+
 void SurfaceInterceptor::enable(const SortedVector<sp<Layer>>& layers,
         const DefaultKeyedVector< wp<IBinder>, DisplayDeviceState>& displays)
 {
@@ -43,10 +67,24 @@ void SurfaceInterceptor::enable(const SortedVector<sp<Layer>>& layers,
         return;
     }
     ATRACE_CALL();
+    // The previous capture may still be writing its output
+    joinWriter();
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.interceptor_stream", value, "0");
+    mStreaming = atoi(value) != 0;
+    property_get("debug.sf.interceptor_compress", value, "0");
+    mCompress = atoi(value) != 0;
+    property_get("debug.sf.interceptor_ring_kb", value, "0");
+    mRingBufferSize = static_cast<size_t>(std::max(atoi(value), 0)) * 1024;
+
     mEnabled = true;
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     saveExistingDisplaysLocked(displays);
     saveExistingSurfacesLocked(layers);
+    if (mStreaming || mRingBufferSize > 0) {
+        startWriterLocked();
+    }
 }
 
 void SurfaceInterceptor::disable() {
@@ -56,6 +94,12 @@ void SurfaceInterceptor::disable() {
     ATRACE_CALL();
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     mEnabled = false;
+    if (mWriterThread.joinable()) {
+        // The writer thread writes what's left and exits
+        mWriterExit = true;
+        mWriterCondition.notify_one();
+        return;
+    }
     status_t err(writeProtoFileLocked());
     ALOGE_IF(err == PERMISSION_DENIED, "Could not save the proto file! Permission denied");
     ALOGE_IF(err == NOT_ENOUGH_DATA, "Could not save the proto file! There are missing fields");
@@ -129,11 +173,9 @@ status_t SurfaceInterceptor::writeProtoFileLocked() {
     ATRACE_CALL();
     std::string output;
 
-    if (!mTrace.IsInitialized()) {
-        return NOT_ENOUGH_DATA;
-    }
-    if (!mTrace.SerializeToString(&output)) {
-        return PERMISSION_DENIED;
+    status_t err = encodeChunk(&mTrace, &output);
+    if (err != NO_ERROR) {
+        return err;
     }
     if (!android::base::WriteStringToFile(output, mOutputFileName, true)) {
         return PERMISSION_DENIED;
@@ -142,6 +184,109 @@ status_t SurfaceInterceptor::writeProtoFileLocked() {
     return NO_ERROR;
 }
 
+status_t SurfaceInterceptor::encodeChunk(Trace* chunk, std::string* output) const {
+    if (!chunk->IsInitialized()) {
+        return NOT_ENOUGH_DATA;
+    }
+    std::string serialized;
+    if (!chunk->SerializeToString(mCompress ? &serialized : output)) {
+        return PERMISSION_DENIED;
+    }
+    if (!mCompress) {
+        return NO_ERROR;
+    }
+
+    // Each chunk is a complete gzip member
+    z_stream stream {};
+    if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NO_MEMORY;
+    }
+    output->resize(deflateBound(&stream, serialized.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(&serialized[0]);
+    stream.avail_in = serialized.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&(*output)[0]);
+    stream.avail_out = output->size();
+    int result = deflate(&stream, Z_FINISH);
+    output->resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END ? NO_ERROR : UNKNOWN_ERROR;
+}
+
+void SurfaceInterceptor::startWriterLocked() {
+    mWriterExit = false;
+    mWriterThread = std::thread(&SurfaceInterceptor::writerMain, this);
+}
+
+void SurfaceInterceptor::joinWriter() {
+    if (mWriterThread.joinable()) {
+        mWriterThread.join();
+    }
+}
+
+void SurfaceInterceptor::writerMain() {
+    android::base::unique_fd fd;
+    if (mStreaming) {
+        fd.reset(open(mOutputFileName.c_str(),
+                O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, DEFFILEMODE));
+        ALOGE_IF(fd < 0, "Could not open %s: %s", mOutputFileName.c_str(), strerror(errno));
+    }
+
+    // In ring buffer mode, the first chunk holds the initial snapshot of the
+    // layers and displays and is always kept
+    std::string snapshot;
+    std::deque<std::string> ring;
+    size_t ringSize = 0;
+    bool isFirstChunk = true;
+
+    std::unique_lock<std::mutex> lock(mTraceMutex);
+    while (true) {
+        mWriterCondition.wait_for(lock, WRITER_FLUSH_INTERVAL, [this]() {
+            return mWriterExit || mTrace.increment_size() >= WRITER_FLUSH_INCREMENTS;
+        });
+        const bool exit = mWriterExit;
+        Trace chunk;
+        chunk.Swap(&mTrace);
+        lock.unlock();
+
+        if (chunk.increment_size() > 0) {
+            ATRACE_NAME("SurfaceInterceptor::writeChunk");
+            std::string output;
+            status_t err = encodeChunk(&chunk, &output);
+            ALOGE_IF(err != NO_ERROR, "Could not encode %d increments (%d)",
+                    chunk.increment_size(), err);
+            if (err == NO_ERROR && mStreaming && fd >= 0) {
+                ALOGE_IF(!android::base::WriteFully(fd, output.data(), output.size()),
+                        "Could not write to %s: %s", mOutputFileName.c_str(), strerror(errno));
+            } else if (err == NO_ERROR && isFirstChunk) {
+                snapshot = std::move(output);
+            } else if (err == NO_ERROR) {
+                ringSize += output.size();
+                ring.push_back(std::move(output));
+                while (ringSize > mRingBufferSize && ring.size() > 1) {
+                    ringSize -= ring.front().size();
+                    ring.pop_front();
+                }
+            }
+            isFirstChunk = false;
+        }
+
+        if (exit) {
+            break;
+        }
+        lock.lock();
+    }
+
+    if (!mStreaming) {
+        std::string output(std::move(snapshot));
+        for (const auto& chunk : ring) {
+            output += chunk;
+        }
+        ALOGE_IF(!android::base::WriteStringToFile(output, mOutputFileName, true),
+                "Could not save the proto file! Permission denied");
+    }
+}
+
 const sp<const Layer> SurfaceInterceptor::getLayer(const wp<const IBinder>& weakHandle) {
     const sp<const IBinder>& handle(weakHandle.promote());
     const auto layerHandle(static_cast<const Layer::Handle*>(handle.get()));
@@ -159,6 +304,10 @@ int32_t SurfaceInterceptor::getLayerId(const sp<const Layer>& layer) {
 }
 
 Increment* SurfaceInterceptor::createTraceIncrementLocked() {
+    // Wake up the writer thread early, if there is one
+    if (mTrace.increment_size() >= WRITER_FLUSH_INCREMENTS) {
+        mWriterCondition.notify_one();
+    }
     Increment* increment(mTrace.add_increment());
     increment->set_time_stamp(systemTime());
     return increment;
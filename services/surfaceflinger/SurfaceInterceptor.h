@@ -19,7 +19,10 @@
 
 #include <frameworks/native/cmds/surfacereplayer/proto/src/trace.pb.h>
 
+#include <condition_variable>
 #include <mutex>
+#include <string>
+#include <thread>
 
 #include <utils/SortedVector.h>
 #include <utils/Vector.h>
@@ -37,10 +40,25 @@ constexpr auto DEFAULT_FILENAME = "/data/SurfaceTrace.dat";
 /*
  * SurfaceInterceptor intercepts and stores incoming streams of window
  * properties on SurfaceFlinger.
+ *
+ * By default the whole trace is kept in memory and written when the
+ * interceptor is disabled. The following properties, read when it is enabled,
+ * select other modes:
+ *
+ *   debug.sf.interceptor_stream    stream the trace to the file while capturing
+ *   debug.sf.interceptor_ring_kb   keep only the last N KiB of the trace in
+ *                                  memory, for always-on capture
+ *   debug.sf.interceptor_compress  gzip the output
+ *
+ * In streaming and ring buffer modes, the increments are handed to a writer
+ * thread in chunks. Each chunk is a serialized Trace and compressed chunks
+ * are independent gzip members, so the file is always a valid Trace (once
+ * decompressed) and disable() doesn't wait for the file to be written.
  */
 class SurfaceInterceptor {
 public:
     SurfaceInterceptor(SurfaceFlinger* const flinger);
+    ~SurfaceInterceptor();
     // Both vectors are used to capture the current state of SF as the initial snapshot in the trace
     void enable(const SortedVector<sp<Layer>>& layers,
             const DefaultKeyedVector< wp<IBinder>, DisplayDeviceState>& displays);
@@ -75,6 +93,12 @@ private:
     void addInitialDisplayStateLocked(Increment* increment, const DisplayDeviceState& display);
 
     status_t writeProtoFileLocked();
+
+    // The writer thread used in streaming and ring buffer modes
+    void startWriterLocked();
+    void joinWriter();
+    void writerMain();
+    status_t encodeChunk(Trace* chunk, std::string* output) const;
     const sp<const Layer> getLayer(const wp<const IBinder>& weakHandle);
     const std::string getLayerName(const sp<const Layer>& layer);
     int32_t getLayerId(const sp<const Layer>& layer);
@@ -132,6 +156,16 @@ private:
     std::mutex mTraceMutex {};
     Trace mTrace {};
     SurfaceFlinger* const mFlinger;
+
+    // Output options, read from the properties when enabling
+    bool mStreaming {false};
+    bool mCompress {false};
+    size_t mRingBufferSize {0};
+
+    // Protected by mTraceMutex
+    std::thread mWriterThread {};
+    std::condition_variable mWriterCondition {};
+    bool mWriterExit {false};
 };
 
 }
@@ -54,6 +54,12 @@ bool Transform::absIsOne(float f) {
     return isZero(fabs(f) - 1.0f);
 }
 
+bool Transform::operator == (const Transform& other) const {
+    return mMatrix[0] == other.mMatrix[0] &&
+            mMatrix[1] == other.mMatrix[1] &&
+            mMatrix[2] == other.mMatrix[2];
+}
+
 Transform Transform::operator * (const Transform& rhs) const
 {
     if (CC_LIKELY(mType == IDENTITY))
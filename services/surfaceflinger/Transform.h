@@ -81,6 +81,10 @@ public:
             Rect    transform(const Rect& bounds,
                     bool roundOutwards = false) const;
             Transform operator * (const Transform& rhs) const;
+            bool operator == (const Transform& other) const;
+            bool operator != (const Transform& other) const {
+                return !operator == (other);
+            }
             // assumes the last row is < 0 , 0 , 1 >
             vec2 transform(const vec2& v) const;
             vec3 transform(const vec3& v) const;
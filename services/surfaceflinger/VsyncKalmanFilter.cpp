@@ -0,0 +1,145 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include "VsyncKalmanFilter.h"
+
+namespace android {
+
+// Standard deviation of the timestamps of hardware vsync events and of
+// present fences around the actual vsync
+static const double kHwVsyncNoise = 50000.0;
+static const double kPresentFenceNoise = 200000.0;
+
+// Standard deviation of the drift of the phase and of the period, per period
+static const double kPhaseNoise = 2000.0;
+static const double kPeriodNoise = 10.0;
+
+// Relative standard deviation of the period a model starts with
+static const double kInitialPeriodUncertainty = 0.01;
+
+// Samples further than this many standard deviations from the prediction
+// are outliers, once the model has this many samples
+static const double kOutlierThreshold = 4.0;
+static const size_t kMinSamplesForOutlierRejection = 4;
+
+// The model is wrong after this many outliers in a row
+static const size_t kMaxConsecutiveRejectedSamples = 8;
+
+VsyncKalmanFilter::VsyncKalmanFilter() {
+    reset(0);
+}
+
+void VsyncKalmanFilter::reset(nsecs_t period) {
+    mNumSamples = 0;
+    mNumRejectedSamples = 0;
+    mNumConsecutiveRejectedSamples = 0;
+    mReferenceTime = 0;
+    mOffset = 0;
+    mPeriod = period;
+    mCovariance[0][0] = kHwVsyncNoise * kHwVsyncNoise;
+    mCovariance[0][1] = mCovariance[1][0] = 0;
+    mCovariance[1][1] = (period * kInitialPeriodUncertainty) *
+            (period * kInitialPeriodUncertainty);
+}
+
+int64_t VsyncKalmanFilter::getPeriodsSinceReference(nsecs_t timestamp) const {
+    return llround((timestamp - mReferenceTime - mOffset) / mPeriod);
+}
+
+bool VsyncKalmanFilter::addSample(nsecs_t timestamp, SampleType type) {
+    if (mPeriod <= 0) {
+        return false;
+    }
+    if (mNumSamples == 0) {
+        mReferenceTime = timestamp;
+        mOffset = 0;
+        mNumSamples++;
+        return true;
+    }
+
+    const int64_t n = getPeriodsSinceReference(timestamp);
+    if (n < 0) {
+        // Older than the last modeled event
+        return false;
+    }
+
+    // Predict the state at the nth event after the last one
+    const double& p00 = mCovariance[0][0];
+    const double& p01 = mCovariance[0][1];
+    const double& p11 = mCovariance[1][1];
+    const double offset = mOffset + n * mPeriod;
+    const double c00 = p00 + 2 * n * p01 + n * n * p11 + n * kPhaseNoise * kPhaseNoise;
+    const double c01 = p01 + n * p11;
+    const double c11 = p11 + n * kPeriodNoise * kPeriodNoise;
+
+    const double noise = (type == HW_VSYNC) ? kHwVsyncNoise : kPresentFenceNoise;
+    const double innovation = (timestamp - mReferenceTime) - offset;
+    const double innovationVariance = c00 + noise * noise;
+    if (mNumSamples >= kMinSamplesForOutlierRejection &&
+            innovation * innovation >
+                    kOutlierThreshold * kOutlierThreshold * innovationVariance) {
+        mNumRejectedSamples++;
+        mNumConsecutiveRejectedSamples++;
+        return false;
+    }
+
+    // Correct it with the sample
+    const double gainOffset = c00 / innovationVariance;
+    const double gainPeriod = c01 / innovationVariance;
+    mOffset = offset + gainOffset * innovation;
+    mPeriod += gainPeriod * innovation;
+    mCovariance[0][0] = (1 - gainOffset) * c00;
+    mCovariance[0][1] = mCovariance[1][0] = (1 - gainOffset) * c01;
+    mCovariance[1][1] = c11 - gainPeriod * c01;
+
+    // Move the reference to this event
+    const nsecs_t shift = static_cast<nsecs_t>(mOffset);
+    mReferenceTime += shift;
+    mOffset -= shift;
+
+    mNumSamples++;
+    mNumConsecutiveRejectedSamples = 0;
+    return true;
+}
+
+bool VsyncKalmanFilter::needsReset() const {
+    return mNumConsecutiveRejectedSamples >= kMaxConsecutiveRejectedSamples;
+}
+
+nsecs_t VsyncKalmanFilter::getReferenceTime() const {
+    return mReferenceTime + llround(mOffset);
+}
+
+nsecs_t VsyncKalmanFilter::getPeriod() const {
+    return llround(mPeriod);
+}
+
+nsecs_t VsyncKalmanFilter::getPredictionError(nsecs_t when) const {
+    if (mNumSamples == 0 || mPeriod <= 0) {
+        return -1;
+    }
+    double n = floor((when - mReferenceTime - mOffset) / mPeriod) + 1;
+    if (n < 0) {
+        n = 0;
+    }
+    const double variance = mCovariance[0][0] + 2 * n * mCovariance[0][1] +
+            n * n * mCovariance[1][1] + n * kPhaseNoise * kPhaseNoise;
+    return llround(sqrt(variance));
+}
+
+} // namespace android
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VSYNCKALMANFILTER_H
+#define ANDROID_VSYNCKALMANFILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+// VsyncKalmanFilter tracks the period and phase of a vsync signal from the
+// timestamps of some of its events, which need not be consecutive. The state
+// is the time of the last event and the period; the timestamps of hardware
+// vsync events and of present fences are noisy measurements of the former.
+// Between two measurements, both are allowed to drift a little per elapsed
+// period, so the model follows slow changes of the display clock.
+//
+// Samples whose distance to the prediction is unlikely given the current
+// uncertainty are rejected as outliers, e.g. a present fence that signaled
+// late. If too many are rejected in a row, the model is considered wrong and
+// needsReset() returns true.
+//
+// This class is *NOT* thread-safe.
+class VsyncKalmanFilter {
+public:
+    enum SampleType {
+        HW_VSYNC,
+        PRESENT_FENCE,
+    };
+
+    VsyncKalmanFilter();
+
+    // reset forgets all samples. The next sample starts a new model with
+    // the given period.
+    void reset(nsecs_t period);
+
+    // addSample updates the model with the timestamp of a vsync event.
+    // Returns false if the sample was rejected as an outlier.
+    bool addSample(nsecs_t timestamp, SampleType type);
+
+    size_t getNumSamples() const { return mNumSamples; }
+    size_t getNumRejectedSamples() const { return mNumRejectedSamples; }
+    bool needsReset() const;
+
+    // The time of the last modeled vsync event and the period.
+    nsecs_t getReferenceTime() const;
+    nsecs_t getPeriod() const;
+
+    // getPredictionError returns the standard deviation of the predicted
+    // time of the first vsync event after when, or -1 without a model.
+    nsecs_t getPredictionError(nsecs_t when) const;
+
+private:
+    // Number of periods between the last modeled event and the one nearest
+    // to timestamp
+    int64_t getPeriodsSinceReference(nsecs_t timestamp) const;
+
+    size_t mNumSamples;
+    size_t mNumRejectedSamples;
+    size_t mNumConsecutiveRejectedSamples;
+
+    // The state: the time of the last event is mReferenceTime + mOffset,
+    // where mOffset stays small to keep the precision of the doubles.
+    nsecs_t mReferenceTime;
+    double mOffset;
+    double mPeriod;
+
+    // The covariance of (mOffset, mPeriod)
+    double mCovariance[2][2];
+};
+
+}
+
+#endif // ANDROID_VSYNCKALMANFILTER_H
@@ -0,0 +1,23 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := dispsync_replay
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    dispsync_replay.cpp \
+    ../../DispSync.cpp \
+    ../../VsyncKalmanFilter.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../..
+
+LOCAL_SHARED_LIBRARIES := \
+    libbfqio \
+    libcutils \
+    liblog \
+    libui \
+    libutils
+
+LOCAL_CFLAGS := -Wall -Werror -Wunused -Wunreachable-code
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays vsync and present fence timestamps into both DispSync models and
+ * compares how well they predict the vsync events, and how often they need
+ * hardware vsync events to do it.
+ *
+ * The trace has one event per line, "vsync <timestamp>",
+ * "present <timestamp>" or "request <timestamp>", in nanoseconds and in
+ * order; lines starting with '#' are ignored. Every vsync event is used to
+ * measure the prediction error, and is fed to the model as a hardware vsync
+ * event while it asks for them, the way SurfaceFlinger turns them on and
+ * off. Present fences are always fed to the model.
+ *
+ * A request event is an app asking for the next vsync event. Like
+ * SurfaceFlinger::resyncWithRateLimit, the first request after 500ms
+ * without any turns hardware vsync on, unless the model is confident it
+ * doesn't need it.
+ *
+ * For each model, "resyncs" counts the resyncs asked for by present fences,
+ * "requests" the ones started by requests, and "skipped" the ones a
+ * confident model saved.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <ui/FenceTime.h>
+
+#include "DispSync.h"
+
+using namespace android;
+
+namespace {
+
+// Requests closer than this to the previous one don't resync, see
+// SurfaceFlinger::resyncWithRateLimit
+const nsecs_t kResyncIgnoreDelay = ms2ns(500);
+
+struct Event {
+    enum Type {
+        VSYNC,
+        PRESENT,
+        REQUEST,
+    };
+    Type type;
+    nsecs_t timestamp;
+};
+
+struct Result {
+    size_t numPredictions = 0;
+    double sqErrorSum = 0;
+    nsecs_t maxError = 0;
+    size_t numHwVsyncs = 0;
+    size_t numResyncs = 0;
+    size_t numRequestResyncs = 0;
+    size_t numSkippedResyncs = 0;
+};
+
+bool readTrace(const char* path, std::vector<Event>* events) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char line[256];
+    size_t lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        lineNumber++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        char type[16];
+        int64_t timestamp;
+        if (sscanf(line, "%15s %" SCNd64, type, &timestamp) != 2) {
+            type[0] = '\0';
+        }
+        if (strcmp(type, "vsync") == 0) {
+            events->push_back({Event::VSYNC, timestamp});
+        } else if (strcmp(type, "present") == 0) {
+            events->push_back({Event::PRESENT, timestamp});
+        } else if (strcmp(type, "request") == 0) {
+            events->push_back({Event::REQUEST, timestamp});
+        } else {
+            fprintf(stderr, "%s:%zu: expected \"vsync|present|request <timestamp>\"\n",
+                    path, lineNumber);
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// A panel whose period drifts by up to 100ppm over a minute, with 30us of
+// jitter on vsync events. An app animates for 2s, then idles for 1s. While
+// it animates, it requests every vsync event and a frame is presented on it;
+// 1% of the present fences signal 2ms late.
+void synthesizeTrace(nsecs_t period, double seconds, std::vector<Event>* events) {
+    std::mt19937 random(0);
+    std::normal_distribution<double> vsyncJitter(0, 30000);
+    std::normal_distribution<double> presentJitter(0, 100000);
+    std::uniform_real_distribution<double> late(0, 1);
+
+    double time = seconds2ns(1);
+    while (time < seconds2ns(1 + seconds)) {
+        const double drift = 100e-6 * sin(2 * M_PI * time / seconds2ns(60));
+        time += period * (1 + drift);
+        const bool animating = fmod(time / seconds2ns(1), 3.0) < 2.0;
+        if (animating) {
+            events->push_back({Event::REQUEST, static_cast<nsecs_t>(time - period / 2)});
+        }
+        events->push_back({Event::VSYNC, static_cast<nsecs_t>(time + vsyncJitter(random))});
+        if (animating) {
+            nsecs_t present = static_cast<nsecs_t>(time + presentJitter(random));
+            if (late(random) < 0.01) {
+                present += ms2ns(2);
+            }
+            events->push_back({Event::PRESENT, present});
+        }
+    }
+}
+
+Result replay(DispSync::Model model, nsecs_t period, const std::vector<Event>& events) {
+    Result result;
+    DispSync dispSync("replay", model);
+    dispSync.reset();
+    dispSync.setPeriod(period);
+    dispSync.beginResync();
+    bool hwVsyncEnabled = true;
+    bool hasModel = false;
+    nsecs_t lastRequest = 0;
+
+    for (const auto& event : events) {
+        if (event.type == Event::REQUEST) {
+            if (event.timestamp - lastRequest > kResyncIgnoreDelay && !hwVsyncEnabled) {
+                if (dispSync.hasConfidentModel(event.timestamp)) {
+                    result.numSkippedResyncs++;
+                } else {
+                    dispSync.beginResync();
+                    hwVsyncEnabled = true;
+                    result.numRequestResyncs++;
+                }
+            }
+            lastRequest = event.timestamp;
+        } else if (event.type == Event::VSYNC) {
+            if (hasModel) {
+                nsecs_t predicted = dispSync.computeNextVsync(event.timestamp - period / 2);
+                nsecs_t error = llabs(predicted - event.timestamp);
+                result.numPredictions++;
+                result.sqErrorSum += double(error) * error;
+                result.maxError = std::max(result.maxError, error);
+            }
+            if (hwVsyncEnabled) {
+                result.numHwVsyncs++;
+                hwVsyncEnabled = dispSync.addResyncSample(event.timestamp);
+                if (!hwVsyncEnabled) {
+                    dispSync.endResync();
+                }
+                hasModel = true;
+            }
+        } else {
+            auto fenceTime = std::make_shared<FenceTime>(event.timestamp);
+            if (dispSync.addPresentFence(fenceTime) && !hwVsyncEnabled) {
+                dispSync.beginResync();
+                hwVsyncEnabled = true;
+                result.numResyncs++;
+            }
+        }
+    }
+    return result;
+}
+
+void printResult(const char* name, const Result& result, size_t numVsyncs) {
+    printf("%-8s %10.1f %10.1f %12zu (%5.1f%%) %8zu %9zu %8zu\n", name,
+            result.numPredictions > 0 ?
+                    sqrt(result.sqErrorSum / result.numPredictions) / 1000 : 0,
+            result.maxError / 1000.0, result.numHwVsyncs,
+            numVsyncs > 0 ? 100.0 * result.numHwVsyncs / numVsyncs : 0,
+            result.numResyncs, result.numRequestResyncs, result.numSkippedResyncs);
+}
+
+void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-p period_ns] [-s seconds | trace]\n"
+            "  -p  nominal vsync period (default 16666667)\n"
+            "  -s  replay a synthetic trace of that many seconds\n", name);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    nsecs_t period = 16666667;
+    double syntheticSeconds = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:s:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                period = strtoll(optarg, nullptr, 10);
+                break;
+            case 's':
+                syntheticSeconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<Event> events;
+    if (syntheticSeconds > 0) {
+        synthesizeTrace(period, syntheticSeconds, &events);
+    } else if (optind < argc) {
+        if (!readTrace(argv[optind], &events)) {
+            return 1;
+        }
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t numVsyncs = 0;
+    size_t numPresents = 0;
+    for (const auto& event : events) {
+        numVsyncs += event.type == Event::VSYNC ? 1 : 0;
+        numPresents += event.type == Event::PRESENT ? 1 : 0;
+    }
+
+    printf("%zu vsync events, %zu present fences, %zu requests\n", numVsyncs, numPresents,
+            events.size() - numVsyncs - numPresents);
+    printf("%-8s %10s %10s %21s %8s %9s %8s\n", "model", "rms (us)", "max (us)",
+            "hw vsync events", "resyncs", "requests", "skipped");
+    printResult("average", replay(DispSync::Model::AVERAGE, period, events), numVsyncs);
+    printResult("kalman", replay(DispSync::Model::KALMAN, period, events), numVsyncs);
+    return 0;
+}
@@ -0,0 +1,33 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := SkipValidate_benchmark
+LOCAL_MODULE_TAGS := tests
+
+# Builds the HWC2 wrapper of SurfaceFlinger in, since libsurfaceflinger
+# doesn't export it
+LOCAL_SRC_FILES := \
+    SkipValidate_benchmark.cpp \
+    ../../DisplayHardware/ComposerHal.cpp \
+    ../../DisplayHardware/HWC2.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../DisplayHardware
+
+LOCAL_SHARED_LIBRARIES := \
+    android.frameworks.vr.composer@1.0 \
+    android.hardware.graphics.composer@2.1 \
+    libcutils \
+    libgui \
+    libhidlbase \
+    libhidltransport \
+    libhwbinder \
+    liblog \
+    libsync \
+    libui \
+    libutils
+
+LOCAL_STATIC_LIBRARIES := libhwcomposer-command-buffer
+
+LOCAL_CFLAGS += -DUSE_HWC2 -Wall -Werror -Wunused -Wunreachable-code
+
+include $(BUILD_NATIVE_BENCHMARK)
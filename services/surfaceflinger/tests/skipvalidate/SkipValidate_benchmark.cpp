@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <ui/Fence.h>
+#include <ui/FloatRect.h>
+#include <ui/GraphicBuffer.h>
+#include <ui/Region.h>
+#include <utils/String8.h>
+
+#include <vector>
+
+#include "HWC2.h"
+
+using namespace android;
+
+// Composes a static UI with one updating video layer on the primary display
+// of vr_hwc, the software composer of the "vr" composer service, which has
+// to be running.
+//
+// The time reported is the cost of the HWC round trips of one frame, and the
+// label reports how many there are per frame. Arg(0) validates every frame;
+// Arg(1) only validates when HWC2::Display::hasStateChanges(), as HWComposer
+// does.
+
+namespace {
+
+constexpr uint32_t kNumStaticLayers = 6;
+constexpr uint32_t kLayerSize = 64;
+
+class PrimaryDisplayCallback : public HWC2::ComposerCallback {
+public:
+    void onHotplugReceived(int32_t /* sequenceId */, hwc2_display_t display,
+            HWC2::Connection connection, bool primaryDisplay) override {
+        if (primaryDisplay && connection == HWC2::Connection::Connected) {
+            mPrimaryDisplay = display;
+        }
+    }
+    void onRefreshReceived(int32_t /* sequenceId */,
+            hwc2_display_t /* display */) override {}
+    void onVsyncReceived(int32_t /* sequenceId */, hwc2_display_t /* display */,
+            int64_t /* timestamp */) override {}
+
+    hwc2_display_t mPrimaryDisplay = 0;
+};
+
+sp<GraphicBuffer> allocateBuffer() {
+    return new GraphicBuffer(kLayerSize, kLayerSize, PIXEL_FORMAT_RGBA_8888,
+            GraphicBuffer::USAGE_HW_COMPOSER | GraphicBuffer::USAGE_SW_WRITE_OFTEN,
+            "SkipValidate_benchmark");
+}
+
+struct StaticUiFixture {
+    HWC2::Device device{true /* useVrComposer */};
+    PrimaryDisplayCallback callback;
+    HWC2::Display* display = nullptr;
+    std::vector<HWC2::Layer*> staticLayers;
+    HWC2::Layer* videoLayer = nullptr;
+    sp<GraphicBuffer> staticBuffer = allocateBuffer();
+    sp<GraphicBuffer> videoBuffers[2] = { allocateBuffer(), allocateBuffer() };
+    uint64_t frameNumber = 0;
+
+    StaticUiFixture() {
+        device.registerCallback(&callback, 0);
+        display = device.getDisplayById(callback.mPrimaryDisplay);
+        for (uint32_t z = 0; z <= kNumStaticLayers; z++) {
+            HWC2::Layer* layer = nullptr;
+            if (display->createLayer(&layer) != HWC2::Error::None) {
+                continue;
+            }
+            const Rect frame(z * 8, z * 8, z * 8 + kLayerSize, z * 8 + kLayerSize);
+            (void)layer->setCompositionType(HWC2::Composition::Device);
+            (void)layer->setBlendMode(HWC2::BlendMode::Premultiplied);
+            (void)layer->setDisplayFrame(frame);
+            (void)layer->setSourceCrop(FloatRect(0, 0, kLayerSize, kLayerSize));
+            (void)layer->setPlaneAlpha(1.0f);
+            (void)layer->setZOrder(z);
+            if (z < kNumStaticLayers) {
+                staticLayers.push_back(layer);
+            } else {
+                videoLayer = layer;
+            }
+        }
+    }
+
+    // Sends what SurfaceFlinger sends on every frame, then presents.
+    // Returns the number of round trips to the HWC.
+    int frame(bool skipUnchangedValidate) {
+        const Region visible(Rect(kLayerSize, kLayerSize));
+        const Region noDamage;
+        for (auto layer : staticLayers) {
+            (void)layer->setVisibleRegion(visible);
+            (void)layer->setSurfaceDamage(noDamage);
+            (void)layer->setBuffer(0, staticBuffer, Fence::NO_FENCE);
+        }
+        const uint32_t slot = frameNumber++ % 2;
+        (void)videoLayer->setVisibleRegion(visible);
+        (void)videoLayer->setSurfaceDamage(Region(Rect(kLayerSize, kLayerSize)));
+        (void)videoLayer->setBuffer(slot, videoBuffers[slot], Fence::NO_FENCE);
+
+        int roundTrips = 1;
+        if (!skipUnchangedValidate || display->hasStateChanges()) {
+            uint32_t numTypes = 0;
+            uint32_t numRequests = 0;
+            auto error = display->validate(&numTypes, &numRequests);
+            if (error == HWC2::Error::HasChanges) {
+                (void)display->acceptChanges();
+            }
+            roundTrips++;
+        }
+        sp<Fence> presentFence;
+        (void)display->present(&presentFence);
+        return roundTrips;
+    }
+};
+
+} // namespace
+
+static void BM_StaticUiWithVideo(benchmark::State& state) {
+    StaticUiFixture fixture;
+    const bool skipUnchangedValidate = state.range(0) != 0;
+    // The first frame is always validated
+    fixture.frame(skipUnchangedValidate);
+
+    int64_t frames = 0;
+    int64_t roundTrips = 0;
+    while (state.KeepRunning()) {
+        roundTrips += fixture.frame(skipUnchangedValidate);
+        frames++;
+    }
+    if (frames > 0) {
+        state.SetLabel(String8::format("%.2f round trips/frame",
+                static_cast<double>(roundTrips) / frames).string());
+    }
+}
+BENCHMARK(BM_StaticUiWithVideo)->Arg(0)->Arg(1);
+
+BENCHMARK_MAIN();
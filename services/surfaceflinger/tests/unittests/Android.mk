@@ -0,0 +1,26 @@
+# Build the unit tests of the SurfaceFlinger classes that don't need a
+# running SurfaceFlinger.
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+
+LOCAL_MODULE := libsurfaceflinger_unittest
+LOCAL_COMPATIBILITY_SUITE := device-tests
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    LatencyHistogram_test.cpp \
+    VsyncKalmanFilter_test.cpp \
+    ../../LatencyHistogram.cpp \
+    ../../VsyncKalmanFilter.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../..
+
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    liblog \
+    libutils
+
+LOCAL_CFLAGS += -Wall -Werror -Wunused -Wunreachable-code
+
+include $(BUILD_NATIVE_TEST)
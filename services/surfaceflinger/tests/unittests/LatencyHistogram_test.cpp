@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LatencyHistogramTest"
+
+#include <gtest/gtest.h>
+
+#include <utils/String8.h>
+
+#include "LatencyHistogram.h"
+
+namespace android {
+
+class LatencyHistogramTest : public testing::Test {
+protected:
+    // Reads the varints of an encoded histogram or dump back, starting at
+    // mOffset.
+    struct Reader {
+        explicit Reader(const String8& data) : mData(data), mOffset(0) {}
+
+        uint64_t readVarint() {
+            uint64_t value = 0;
+            for (int shift = 0; mOffset < mData.size(); shift += 7) {
+                const uint8_t byte = static_cast<uint8_t>(mData.string()[mOffset++]);
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            return value;
+        }
+
+        String8 readBytes(size_t size) {
+            String8 bytes(mData.string() + mOffset, size);
+            mOffset += size;
+            return bytes;
+        }
+
+        bool atEnd() const { return mOffset == mData.size(); }
+
+        const String8& mData;
+        size_t mOffset;
+    };
+
+    static String8 varint(uint64_t value) {
+        String8 result;
+        LatencyHistogram::appendVarint(result, value);
+        return result;
+    }
+
+    static void expectBytes(const String8& actual, std::initializer_list<uint8_t> expected) {
+        ASSERT_EQ(expected.size(), actual.size());
+        size_t i = 0;
+        for (uint8_t byte : expected) {
+            EXPECT_EQ(byte, static_cast<uint8_t>(actual.string()[i])) << "at byte " << i;
+            i++;
+        }
+    }
+};
+
+TEST_F(LatencyHistogramTest, BucketIndex_BelowSubBucketCount_IsLinear) {
+    for (uint64_t us = 0; us < LatencyHistogram::NUM_SUB_BUCKETS; us++) {
+        EXPECT_EQ(us, LatencyHistogram::getBucketIndex(us));
+        EXPECT_EQ(us, LatencyHistogram::getBucketStart(us));
+    }
+}
+
+TEST_F(LatencyHistogramTest, BucketIndex_EachPowerOfTwo_HasEightSubBuckets) {
+    ASSERT_EQ(8, LatencyHistogram::NUM_SUB_BUCKETS);
+    for (int magnitude = LatencyHistogram::SUB_BUCKET_BITS; magnitude < 31; magnitude++) {
+        const uint64_t start = 1ULL << magnitude;
+        EXPECT_EQ(LatencyHistogram::getBucketIndex(start) + LatencyHistogram::NUM_SUB_BUCKETS,
+                LatencyHistogram::getBucketIndex(start * 2)) << "at 2^" << magnitude;
+        EXPECT_EQ(start, LatencyHistogram::getBucketStart(
+                LatencyHistogram::getBucketIndex(start)));
+    }
+}
+
+TEST_F(LatencyHistogramTest, BucketIndex_BucketBoundaries_MapToTheirBucket) {
+    for (size_t i = 0; i + 1 < LatencyHistogram::NUM_BUCKETS; i++) {
+        const uint64_t start = LatencyHistogram::getBucketStart(i);
+        const uint64_t end = LatencyHistogram::getBucketStart(i + 1);
+        ASSERT_LT(start, end) << "at bucket " << i;
+        EXPECT_EQ(i, LatencyHistogram::getBucketIndex(start));
+        EXPECT_EQ(i, LatencyHistogram::getBucketIndex(end - 1));
+        EXPECT_EQ(i + 1, LatencyHistogram::getBucketIndex(end));
+    }
+}
+
+TEST_F(LatencyHistogramTest, BucketWidth_IsAtMostAnEighthOfItsStart) {
+    for (size_t i = LatencyHistogram::NUM_SUB_BUCKETS; i < LatencyHistogram::NUM_BUCKETS; i++) {
+        const uint64_t start = LatencyHistogram::getBucketStart(i);
+        const uint64_t width = LatencyHistogram::getBucketStart(i + 1) - start;
+        EXPECT_LE(width * LatencyHistogram::NUM_SUB_BUCKETS, start) << "at bucket " << i;
+    }
+}
+
+TEST_F(LatencyHistogramTest, BucketIndex_AboveRange_ClampsToLastBucket) {
+    const size_t last = LatencyHistogram::NUM_BUCKETS - 1;
+    EXPECT_EQ(last, LatencyHistogram::getBucketIndex(1ULL << 32));
+    EXPECT_EQ(last, LatencyHistogram::getBucketIndex(1ULL << 50));
+    EXPECT_EQ(last, LatencyHistogram::getBucketIndex(UINT64_MAX));
+}
+
+TEST_F(LatencyHistogramTest, AppendVarint_EncodesLEB128) {
+    expectBytes(varint(0), {0x00});
+    expectBytes(varint(1), {0x01});
+    expectBytes(varint(127), {0x7f});
+    expectBytes(varint(128), {0x80, 0x01});
+    expectBytes(varint(300), {0xac, 0x02});
+    expectBytes(varint(UINT64_MAX),
+            {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01});
+}
+
+TEST_F(LatencyHistogramTest, Encode_Empty_WritesZeroCounts) {
+    LatencyHistogram histogram;
+    String8 result;
+    histogram.encode(result);
+    expectBytes(result, {0x00, 0x00, 0x00});
+}
+
+TEST_F(LatencyHistogramTest, Encode_WritesDeltaIndicesOfNonEmptyBuckets) {
+    LatencyHistogram histogram;
+    histogram.record(1000);     // 1us, bucket 1
+    histogram.record(20000);    // 20us, bucket 16 + (20 >> 1) - 8 = 18
+    histogram.record(20999);    // still 20us
+    String8 result;
+    histogram.encode(result);
+    // count, max (us), non-empty buckets, then (index delta, count) pairs
+    expectBytes(result, {0x03, 0x14, 0x02, 0x01, 0x01, 0x11, 0x02});
+}
+
+TEST_F(LatencyHistogramTest, Record_OutOfRange_ClampsToFirstAndLastBucket) {
+    const nsecs_t huge = static_cast<nsecs_t>(1ULL << 40) * 1000;
+    LatencyHistogram histogram;
+    histogram.record(-1);
+    histogram.record(999);
+    histogram.record(huge);
+    String8 result;
+    histogram.encode(result);
+
+    Reader reader(result);
+    EXPECT_EQ(3u, reader.readVarint());
+    EXPECT_EQ(1ULL << 40, reader.readVarint());
+    ASSERT_EQ(2u, reader.readVarint());
+    EXPECT_EQ(0u, reader.readVarint());
+    EXPECT_EQ(2u, reader.readVarint());
+    EXPECT_EQ(LatencyHistogram::NUM_BUCKETS - 1u, reader.readVarint());
+    EXPECT_EQ(1u, reader.readVarint());
+    EXPECT_TRUE(reader.atEnd());
+}
+
+TEST_F(LatencyHistogramTest, Clear_ResetsCounts) {
+    LatencyHistogram histogram;
+    histogram.record(5000);
+    histogram.clear();
+    String8 result;
+    histogram.encode(result);
+    expectBytes(result, {0x00, 0x00, 0x00});
+}
+
+TEST_F(LatencyHistogramTest, DumpWrite_WritesHeaderAndEntries) {
+    LatencyHistogram histogram;
+    histogram.record(1000);
+
+    LatencyHistogramDump dump;
+    histogram.encode(dump.addEntry(String8("a")));
+    dump.addEntry(String8("bc"));
+    String8 result;
+    dump.write(16666667, result);
+
+    Reader reader(result);
+    EXPECT_EQ(String8("SFLH"), reader.readBytes(4));
+    EXPECT_EQ(1u, reader.readVarint());
+    EXPECT_EQ(static_cast<uint64_t>(LatencyHistogram::SUB_BUCKET_BITS), reader.readVarint());
+    EXPECT_EQ(16666667u, reader.readVarint());
+    ASSERT_EQ(2u, reader.readVarint());
+
+    ASSERT_EQ(1u, reader.readVarint());
+    EXPECT_EQ(String8("a"), reader.readBytes(1));
+    EXPECT_EQ(1u, reader.readVarint());     // count
+    EXPECT_EQ(1u, reader.readVarint());     // max
+    ASSERT_EQ(1u, reader.readVarint());     // non-empty buckets
+    EXPECT_EQ(1u, reader.readVarint());
+    EXPECT_EQ(1u, reader.readVarint());
+
+    ASSERT_EQ(2u, reader.readVarint());
+    EXPECT_EQ(String8("bc"), reader.readBytes(2));
+    EXPECT_TRUE(reader.atEnd());
+}
+
+} // namespace android
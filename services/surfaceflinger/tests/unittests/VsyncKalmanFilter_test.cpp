@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "VsyncKalmanFilterTest"
+
+#include <gtest/gtest.h>
+
+#include "VsyncKalmanFilter.h"
+
+namespace android {
+
+// The period of the simulated display, 60Hz.
+static const nsecs_t PERIOD = 16666667;
+
+// An arbitrary time for the first vsync event.
+static const nsecs_t START_TIME = 1000000000;
+
+class VsyncKalmanFilterTest : public testing::Test {
+protected:
+    // Adds the hardware vsync events count periods apart, starting at
+    // START_TIME + first * period. Every other event is shifted by +/- jitter.
+    void addVsyncs(nsecs_t period, size_t first, size_t count, nsecs_t jitter = 0) {
+        for (size_t i = first; i < first + count; i++) {
+            const nsecs_t noise = (i % 2 == 0) ? jitter : -jitter;
+            EXPECT_TRUE(mFilter.addSample(START_TIME + i * period + noise,
+                    VsyncKalmanFilter::HW_VSYNC)) << "at sample " << i;
+        }
+    }
+
+    VsyncKalmanFilter mFilter;
+};
+
+TEST_F(VsyncKalmanFilterTest, AddSample_WithoutPeriod_IsRejected) {
+    EXPECT_FALSE(mFilter.addSample(START_TIME, VsyncKalmanFilter::HW_VSYNC));
+    EXPECT_EQ(0u, mFilter.getNumSamples());
+    EXPECT_EQ(-1, mFilter.getPredictionError(START_TIME));
+}
+
+TEST_F(VsyncKalmanFilterTest, CleanPeriod_Converges) {
+    // start from a period that is off by 0.5%
+    mFilter.reset(PERIOD + PERIOD / 200);
+    addVsyncs(PERIOD, 0, 120);
+
+    EXPECT_NEAR(PERIOD, mFilter.getPeriod(), 100);
+    EXPECT_NEAR(START_TIME + 119 * PERIOD, mFilter.getReferenceTime(), 10000);
+    EXPECT_EQ(0u, mFilter.getNumRejectedSamples());
+    EXPECT_FALSE(mFilter.needsReset());
+
+    // the uncertainty of the next vsync event is well below the noise of a
+    // single sample
+    const nsecs_t error = mFilter.getPredictionError(START_TIME + 119 * PERIOD);
+    EXPECT_GE(error, 0);
+    EXPECT_LT(error, 50000);
+}
+
+TEST_F(VsyncKalmanFilterTest, JitteryPeriod_Converges) {
+    mFilter.reset(PERIOD);
+    addVsyncs(PERIOD, 0, 240, 40000);
+
+    EXPECT_NEAR(PERIOD, mFilter.getPeriod(), 1000);
+    EXPECT_NEAR(START_TIME + 239 * PERIOD, mFilter.getReferenceTime(), 40000);
+}
+
+TEST_F(VsyncKalmanFilterTest, SkippedEvents_StillConverge) {
+    mFilter.reset(PERIOD);
+    // only every third vsync event is seen, as with present fences
+    for (size_t i = 0; i < 120; i++) {
+        EXPECT_TRUE(mFilter.addSample(START_TIME + 3 * i * PERIOD,
+                VsyncKalmanFilter::PRESENT_FENCE));
+    }
+    EXPECT_NEAR(PERIOD, mFilter.getPeriod(), 100);
+}
+
+TEST_F(VsyncKalmanFilterTest, LateSample_IsRejectedAsOutlier) {
+    mFilter.reset(PERIOD);
+    addVsyncs(PERIOD, 0, 60);
+    const nsecs_t period = mFilter.getPeriod();
+    const nsecs_t referenceTime = mFilter.getReferenceTime();
+
+    // a present fence signaling 3ms late
+    EXPECT_FALSE(mFilter.addSample(START_TIME + 60 * PERIOD + 3000000,
+            VsyncKalmanFilter::PRESENT_FENCE));
+    EXPECT_EQ(1u, mFilter.getNumRejectedSamples());
+    EXPECT_EQ(period, mFilter.getPeriod());
+    EXPECT_EQ(referenceTime, mFilter.getReferenceTime());
+
+    // and the model carries on with the next good sample
+    addVsyncs(PERIOD, 61, 1);
+    EXPECT_FALSE(mFilter.needsReset());
+}
+
+TEST_F(VsyncKalmanFilterTest, FirstSamples_AreNeverRejected) {
+    mFilter.reset(PERIOD);
+    addVsyncs(PERIOD, 0, 2);
+    EXPECT_TRUE(mFilter.addSample(START_TIME + 2 * PERIOD + 3000000,
+            VsyncKalmanFilter::HW_VSYNC));
+    EXPECT_EQ(0u, mFilter.getNumRejectedSamples());
+}
+
+TEST_F(VsyncKalmanFilterTest, ManyOutliersInARow_NeedReset) {
+    mFilter.reset(PERIOD);
+    addVsyncs(PERIOD, 0, 60);
+
+    // the display switched to a 3ms later phase
+    for (size_t i = 60; i < 67; i++) {
+        EXPECT_FALSE(mFilter.addSample(START_TIME + i * PERIOD + 3000000,
+                VsyncKalmanFilter::HW_VSYNC));
+        EXPECT_FALSE(mFilter.needsReset());
+    }
+    EXPECT_FALSE(mFilter.addSample(START_TIME + 67 * PERIOD + 3000000,
+            VsyncKalmanFilter::HW_VSYNC));
+    EXPECT_TRUE(mFilter.needsReset());
+
+    mFilter.reset(PERIOD);
+    EXPECT_FALSE(mFilter.needsReset());
+    EXPECT_EQ(0u, mFilter.getNumSamples());
+}
+
+TEST_F(VsyncKalmanFilterTest, PredictionError_GrowsWithoutSamples) {
+    mFilter.reset(PERIOD);
+    addVsyncs(PERIOD, 0, 60);
+    const nsecs_t lastVsync = START_TIME + 59 * PERIOD;
+
+    const nsecs_t soon = mFilter.getPredictionError(lastVsync + PERIOD / 2);
+    const nsecs_t later = mFilter.getPredictionError(lastVsync + 600 * PERIOD);
+    EXPECT_GT(later, soon);
+}
+
+} // namespace android
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+
 #include <android/looper.h>
 #include <gui/DisplayEventReceiver.h>
 #include <utils/Looper.h>
@@ -47,16 +49,20 @@ int receiver(int /*fd*/, int /*events*/, void* data)
     return 1;
 }
 
-int main(int /*argc*/, char** /*argv*/)
+// usage: test-vsync-events [rate [phase]]
+int main(int argc, char** argv)
 {
     DisplayEventReceiver myDisplayEvent;
+    uint32_t rate = argc > 1 ? atoi(argv[1]) : 1;
+    uint32_t phase = argc > 2 ? atoi(argv[2]) : 0;
 
 
     sp<Looper> loop = new Looper(false);
     loop->addFd(myDisplayEvent.getFd(), 0, ALOOPER_EVENT_INPUT, receiver,
             &myDisplayEvent);
 
-    myDisplayEvent.setVsyncRate(1);
+    myDisplayEvent.setVsyncPhase(phase);
+    myDisplayEvent.setVsyncRate(rate);
 
     do {
         //printf("about to poll...\n");